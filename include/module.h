@@ -24,6 +24,10 @@
 // Comment out the following line for a TTGO ESP LoRa v1 module w/o OLED
 #define OLED_ENABLE
 
+// Uncomment the following line to record radio and pump events in the
+// binary trace ring (see lib/trace) instead of formatting them with ESP_LOG
+// #define TRACE_ENABLE
+
 // Pin mappings on TTGO ESP32 LoRa OLED v1 module
 
 
@@ -1,10 +1,13 @@
 #include <stdio.h>
 
+#include <esp_attr.h>
+
 #include "medtronic.h"
 #include "4b6b.h"
 #include "commands.h"
 #include "crc.h"
 #include "rfm95.h"
+#include "trace.h"
 
 #define CARELINK_DEVICE		0xA7
 
@@ -12,6 +15,7 @@
 #define FRAGMENT_LENGTH		(PAYLOAD_LENGTH + 1) // seq# + payload
 #define DONE_BIT		(1 << 7)
 #define NUM_FRAGMENTS		16
+#define ALL_FRAGMENTS		((1 << NUM_FRAGMENTS) - 1)
 
 #define NO_RESPONSE		-1
 #define DECODING_FAILURE	-2
@@ -45,9 +49,33 @@ static void log_error(command_t cmd, int n) {
 	ESP_LOGE(TAG, "command %02X: %s", cmd, msg);
 }
 
-static uint8_t pump_id[3];
+// Sizes of the buffers allocated from a session's arena.
+#define SHORT_BUF_SIZE		11	// 7-byte short packet encodes to 11 bytes
+#define LONG_BUF_SIZE		107	// 71-byte long packet encodes to 107 bytes
+#define RX_BUF_SIZE		150
+#define RESPONSE_BUF_SIZE	100
+#define PAGE_BUF_SIZE		1024
+
+_Static_assert(PUMP_SESSION_ARENA_SIZE == SHORT_BUF_SIZE + LONG_BUF_SIZE + RX_BUF_SIZE + RESPONSE_BUF_SIZE + PAGE_BUF_SIZE,
+	       "PUMP_SESSION_ARENA_SIZE does not match buffer sizes");
+
+// The pump keeps its radio on for a while after each exchange,
+// so there is no need to probe it or wake it up again within that window.
+#define DEFAULT_AWAKE_DURATION	60	// seconds
+#define KEEP_ALIVE_MARGIN	15	// seconds
+
+// Receive timeouts for each kind of command packet are derived
+// from the observed response times, as for TCP retransmissions:
+// timeout = srtt + 4 * rttvar, clamped to [min_timeout, max_timeout].
+// DEFAULT_TIMEOUT is used until the first response is seen.
+#define DEFAULT_TIMEOUT		500	// milliseconds
+#define DEFAULT_MIN_TIMEOUT	40	// milliseconds
+#define DEFAULT_MAX_TIMEOUT	1000	// milliseconds
+
+// Use the session's estimate instead of a fixed receive timeout.
+#define ADAPTIVE_TIMEOUT	(-1)
 
-void pump_set_id(const char *id) {
+static void parse_pump_id(const char *id, uint8_t *pump_id) {
 	uint32_t n = 0;
 	int i = 0;
 	for (;;) {
@@ -70,10 +98,71 @@ void pump_set_id(const char *id) {
 	pump_id[2] = n;
 }
 
-static void encode_pump_id(uint8_t *dst) {
-	dst[0] = pump_id[0];
-	dst[1] = pump_id[1];
-	dst[2] = pump_id[2];
+// The state of the last pump heard from, kept in RTC memory so that
+// it survives deep sleep. Since monotonic_ms() starts over at boot,
+// the time of the last response is by the system clock instead.
+typedef struct {
+	uint8_t pump_id[3];
+	int model;
+	bool heard;
+	int64_t last_heard;	// realtime_ms() of the last response
+} awake_window_t;
+
+static RTC_DATA_ATTR awake_window_t saved_window;
+
+void pump_save_awake_window(pump_session_t *s) {
+	awake_window_t *w = &saved_window;
+	memcpy(w->pump_id, s->pump_id, sizeof(w->pump_id));
+	w->model = s->model;
+	w->heard = s->heard;
+	w->last_heard = realtime_ms() - (monotonic_ms() - s->last_heard);
+}
+
+static void restore_awake_window(pump_session_t *s) {
+	awake_window_t *w = &saved_window;
+	if (memcmp(w->pump_id, s->pump_id, sizeof(w->pump_id)) != 0) {
+		return;
+	}
+	s->model = w->model;
+	s->family = w->model % 100;
+	int64_t elapsed = realtime_ms() - w->last_heard;
+	// Don't trust the window if the clock has been set back.
+	if (!w->heard || elapsed < 0) {
+		return;
+	}
+	s->last_heard = monotonic_ms() - elapsed;
+	s->heard = true;
+}
+
+int pump_session_init(pump_session_t *s, const char *id, uint8_t *arena, int len) {
+	if (len < PUMP_SESSION_ARENA_SIZE) {
+		ESP_LOGE(TAG, "pump session arena is %d bytes instead of %d", len, PUMP_SESSION_ARENA_SIZE);
+		return -1;
+	}
+	memset(s, 0, sizeof(*s));
+	parse_pump_id(id, s->pump_id);
+	s->awake_duration = DEFAULT_AWAKE_DURATION * 1000;
+	s->min_timeout = DEFAULT_MIN_TIMEOUT;
+	s->max_timeout = DEFAULT_MAX_TIMEOUT;
+	uint8_t *p = arena;
+	s->short_buf = p;
+	p += SHORT_BUF_SIZE;
+	s->long_buf = p;
+	p += LONG_BUF_SIZE;
+	s->rx_buf = p;
+	p += RX_BUF_SIZE;
+	s->response_buf = p;
+	p += RESPONSE_BUF_SIZE;
+	s->page_buf = p;
+	s->download.page_num = -1;
+	restore_awake_window(s);
+	return 0;
+}
+
+static void encode_pump_id(pump_session_t *s, uint8_t *dst) {
+	dst[0] = s->pump_id[0];
+	dst[1] = s->pump_id[1];
+	dst[2] = s->pump_id[2];
 }
 
 typedef struct {
@@ -84,19 +173,19 @@ typedef struct {
 	uint8_t crc;
 } short_packet_t;
 
-static short_packet_t short_packet;
-
-// 7-byte short packet encodes to 11 bytes.
-static uint8_t short_buf[11];
+static void encode_short_packet_into(pump_session_t *s, command_t cmd, uint8_t *dst) {
+	short_packet_t pkt;
+	pkt.device_type = CARELINK_DEVICE;
+	encode_pump_id(s, pkt.pump_id);
+	pkt.command = cmd;
+	pkt.length = 0;
+	uint8_t *p = (uint8_t *)&pkt;
+	pkt.crc = crc8(p, sizeof(pkt)-1);
+	encode_4b6b(p, dst, sizeof(pkt));
+}
 
-static void encode_short_packet(command_t cmd) {
-	short_packet.device_type = CARELINK_DEVICE;
-	encode_pump_id(short_packet.pump_id);
-	short_packet.command = cmd;
-	short_packet.length = 0;
-	uint8_t *p = (uint8_t *)&short_packet;
-	short_packet.crc = crc8(p, sizeof(short_packet)-1);
-	encode_4b6b(p, short_buf, sizeof(short_packet));
+static void encode_short_packet(pump_session_t *s, command_t cmd) {
+	encode_short_packet_into(s, cmd, s->short_buf);
 }
 
 typedef struct {
@@ -108,84 +197,258 @@ typedef struct {
 	uint8_t crc;
 } long_packet_t;
 
-static long_packet_t long_packet;
+static void encode_long_packet(pump_session_t *s, command_t cmd, uint8_t *params, int len) {
+	long_packet_t pkt;
+	pkt.device_type = CARELINK_DEVICE;
+	encode_pump_id(s, pkt.pump_id);
+	pkt.command = cmd;
+	pkt.length = len;
+	memcpy(pkt.params, params, len);
+	memset(&pkt.params[len], 0, sizeof(pkt.params) - len);
+	uint8_t *p = (uint8_t *)&pkt;
+	pkt.crc = crc8(p, sizeof(pkt)-1);
+	encode_4b6b(p, s->long_buf, sizeof(pkt));
+}
+
+static void pump_heard(pump_session_t *s) {
+	s->last_heard = monotonic_ms();
+	s->heard = true;
+	pump_save_awake_window(s);
+}
+
+void pump_set_awake_duration(pump_session_t *s, int seconds) {
+	s->awake_duration = seconds * 1000;
+}
+
+int pump_awake_remaining(pump_session_t *s) {
+	if (!s->heard) {
+		return 0;
+	}
+	int64_t remaining = s->last_heard + s->awake_duration - monotonic_ms();
+	return remaining > 0 ? remaining / 1000 : 0;
+}
 
-// 71-byte long packet encodes to 107 bytes.
-static uint8_t long_buf[107];
+bool pump_is_awake(pump_session_t *s) {
+	return pump_awake_remaining(s) > 0;
+}
 
-static void encode_long_packet(command_t cmd, uint8_t *params, int len) {
-	long_packet.device_type = CARELINK_DEVICE;
-	encode_pump_id(long_packet.pump_id);
-	long_packet.command = cmd;
-	long_packet.length = len;
-	memcpy(long_packet.params, params, len);
-	memset(&long_packet.params[len], 0, sizeof(long_packet.params) - len);
-	uint8_t *p = (uint8_t *)&long_packet;
-	long_packet.crc = crc8(p, sizeof(long_packet)-1);
-	encode_4b6b(p, long_buf, sizeof(long_packet));
+void pump_set_timeout_limits(pump_session_t *s, int min_ms, int max_ms) {
+	s->min_timeout = min_ms;
+	s->max_timeout = max_ms;
+	for (int i = 0; i < s->num_rtt; i++) {
+		s->rtt[i].timeout = 0;
+	}
 }
 
-static uint8_t rx_buf[150], response_buf[100];
+const pump_rtt_t *pump_rtt_stats(pump_session_t *s, int *count) {
+	*count = s->num_rtt;
+	return s->rtt;
+}
 
-static int valid_response(command_t cmd, command_t resp, int n) {
+static int clamp_timeout(pump_session_t *s, int t) {
+	if (t < s->min_timeout) {
+		return s->min_timeout;
+	}
+	if (t > s->max_timeout) {
+		return s->max_timeout;
+	}
+	return t;
+}
+
+static pump_rtt_t *rtt_entry(pump_session_t *s, command_t cmd, bool long_packet) {
+	for (int i = 0; i < s->num_rtt; i++) {
+		pump_rtt_t *e = &s->rtt[i];
+		if (e->command == cmd && e->long_packet == long_packet) {
+			return e;
+		}
+	}
+	if (s->num_rtt == MAX_RTT_ENTRIES) {
+		return 0;
+	}
+	pump_rtt_t *e = &s->rtt[s->num_rtt++];
+	memset(e, 0, sizeof(*e));
+	e->command = cmd;
+	e->long_packet = long_packet;
+	return e;
+}
+
+static int rtt_timeout(pump_session_t *s, pump_rtt_t *e) {
+	if (e == 0) {
+		return clamp_timeout(s, DEFAULT_TIMEOUT);
+	}
+	if (e->timeout == 0) {
+		int t = e->samples == 0 ? DEFAULT_TIMEOUT : (e->srtt >> 3) + e->rttvar;
+		e->timeout = clamp_timeout(s, t);
+	}
+	return e->timeout;
+}
+
+static void rtt_sample(pump_session_t *s, pump_rtt_t *e, int ms) {
+	if (e->samples == 0) {
+		e->srtt = ms << 3;
+		e->rttvar = ms << 1;
+	} else {
+		int delta = ms - (e->srtt >> 3);
+		e->srtt += delta;
+		if (delta < 0) {
+			delta = -delta;
+		}
+		e->rttvar += delta - (e->rttvar >> 2);
+	}
+	e->samples++;
+	e->timeout = clamp_timeout(s, (e->srtt >> 3) + e->rttvar);
+}
+
+// A missing response may just mean the timeout is too short,
+// so back off exponentially, as TCP does.  Until the pump has
+// answered at least once, it is more likely to be asleep or out of
+// range, so don't wait longer than DEFAULT_TIMEOUT.
+static void rtt_backoff(pump_session_t *s, pump_rtt_t *e) {
+	e->no_response++;
+	int t = clamp_timeout(s, 2 * rtt_timeout(s, e));
+	if (e->samples == 0 && t > DEFAULT_TIMEOUT) {
+		t = clamp_timeout(s, DEFAULT_TIMEOUT);
+	}
+	e->timeout = t;
+}
+
+static int valid_response(pump_session_t *s, command_t cmd, command_t resp, int n) {
 	if (n < 6) {
 		return 0;
 	}
-	short_packet_t *p = (short_packet_t *)response_buf;
+	short_packet_t *p = (short_packet_t *)s->response_buf;
 	if (p->device_type != CARELINK_DEVICE) {
 		return 0;
 	}
-	if (memcmp(p->pump_id, pump_id, sizeof(pump_id)) != 0) {
+	if (memcmp(p->pump_id, s->pump_id, sizeof(s->pump_id)) != 0) {
 		return 0;
 	}
 	return p->command == cmd || p->command == resp;
 }
 
-static uint8_t *perform(command_t cmd, uint8_t *pkt, int pkt_len, int tries, int rx_timeout, command_t exp_resp, int *result_lenp) {
-	if (pkt_len == sizeof(long_buf)) {
+static uint8_t *perform(pump_session_t *s, command_t cmd, uint8_t *pkt, int pkt_len, int tries, int rx_timeout, command_t exp_resp, int *result_lenp) {
+	bool long_packet = pkt == s->long_buf;
+	if (long_packet) {
 		// Don't attempt state-changing commands more than once.
 		tries = 1;
 	}
+	pump_rtt_t *e = 0;
+	if (rx_timeout == ADAPTIVE_TIMEOUT) {
+		e = rtt_entry(s, cmd, long_packet);
+	}
 	int err = 0;
 	for (int t = 0; t < tries; t++) {
+		int timeout = e ? rtt_timeout(s, e) : rx_timeout;
 		transmit(pkt, pkt_len);
-		int n = receive(rx_buf, sizeof(rx_buf), rx_timeout);
+		int64_t start = monotonic_ms();
+		int n = receive(s->rx_buf, RX_BUF_SIZE, timeout);
 		if (n == 0) {
 			err = NO_RESPONSE;
+			if (e) {
+				rtt_backoff(s, e);
+			}
 			continue;
 		}
-		n = decode_4b6b(rx_buf, response_buf, n);
+		// Only time responses to the first try, since a response
+		// after a retry may have been sent for an earlier one (Karn's algorithm).
+		// Corrupted responses still show how long the pump took to answer.
+		if (e && t == 0) {
+			rtt_sample(s, e, monotonic_ms() - start);
+		}
+		n = decode_4b6b(s->rx_buf, s->response_buf, n);
 		if (n == -1) {
 			err = DECODING_FAILURE;
+			if (e) {
+				e->bad_response++;
+			}
 			continue;
 		}
-		uint8_t c = crc8(response_buf, n-1);
-		if (c != response_buf[n-1]) {
+		uint8_t c = crc8(s->response_buf, n-1);
+		if (c != s->response_buf[n-1]) {
 			err = CRC_FAILURE;
+			if (e) {
+				e->bad_response++;
+			}
 			continue;
 		}
 		n--; // discard CRC byte
-		if (!valid_response(cmd, exp_resp, n)) {
+		if (!valid_response(s, cmd, exp_resp, n)) {
 			err = INVALID_RESPONSE;
 			break;
 		};
 		if (t != 0) {
-			ESP_LOGE(TAG, "command %02X required %d tries", cmd, t+1);
+			TRACE(TRACE_PUMP_RETRIES, cmd, t+1);
 		}
+		pump_heard(s);
 		*result_lenp = n - 5;
-		return &response_buf[5];
+		return &s->response_buf[5];
+	}
+	if (err == NO_RESPONSE) {
+		// Don't rely on the awake window if the pump has stopped answering.
+		s->heard = false;
+		pump_save_awake_window(s);
 	}
 	*result_lenp = err ? err : NO_RESPONSE;
 	return 0;
 }
 
+// ID of the monitor acknowledging MySentry broadcasts.
+static const uint8_t mysentry_id[3] = { 0x00, 0x08, 0x00 };
+
+#define MYSENTRY_ACK_LENGTH	9
+
+static void mysentry_ack(pump_session_t *s, uint8_t seq) {
+	uint8_t pkt[5 + MYSENTRY_ACK_LENGTH + 1] = {
+		MYSENTRY_DEVICE, s->pump_id[0], s->pump_id[1], s->pump_id[2], MYSENTRY_ACK,
+		seq, mysentry_id[0], mysentry_id[1], mysentry_id[2], 0, MYSENTRY_STATUS,
+	};
+	int n = sizeof(pkt) - 1;
+	pkt[n] = crc8(pkt, n);
+	n = encode_4b6b(pkt, s->long_buf, sizeof(pkt));
+	transmit(s->long_buf, n);
+}
+
+bool pump_listen(pump_session_t *s, int timeout) {
+	int64_t deadline = monotonic_ms() + timeout;
+	for (;;) {
+		int remaining = deadline - monotonic_ms();
+		if (remaining <= 0) {
+			return false;
+		}
+		int n = receive(s->rx_buf, RX_BUF_SIZE, remaining);
+		if (n == 0) {
+			return false;
+		}
+		n = decode_4b6b(s->rx_buf, s->response_buf, n);
+		if (n < 2 || crc8(s->response_buf, n - 1) != s->response_buf[n - 1]) {
+			continue;
+		}
+		mysentry_status_t m;
+		if (mysentry_decode_status(s, s->response_buf, n - 1, &m) != 0) {
+			continue;
+		}
+		// The pump repeats a broadcast until it is acknowledged.
+		mysentry_ack(s, m.seq);
+		s->broadcast = m;
+		s->broadcast_time = monotonic_ms();
+		s->have_broadcast = true;
+		return true;
+	}
+}
+
+const mysentry_status_t *pump_broadcast_status(pump_session_t *s, int max_age) {
+	if (!s->have_broadcast || monotonic_ms() - s->broadcast_time > max_age) {
+		return 0;
+	}
+	return &s->broadcast;
+}
+
 #define DEFAULT_TRIES	3
-#define DEFAULT_TIMEOUT	500 // milliseconds
 #define MAX_NAKS	10
 
-uint8_t *short_command(command_t cmd, int *lenp) {
-	encode_short_packet(cmd);
-	uint8_t *data = perform(cmd, short_buf, sizeof(short_buf), DEFAULT_TRIES, DEFAULT_TIMEOUT, cmd, lenp);
+uint8_t *short_command(pump_session_t *s, command_t cmd, int *lenp) {
+	encode_short_packet(s, cmd);
+	uint8_t *data = perform(s, cmd, s->short_buf, SHORT_BUF_SIZE, DEFAULT_TRIES, ADAPTIVE_TIMEOUT, cmd, lenp);
 	int n = *lenp;
 	if (n < 0) {
 		log_error(cmd, n);
@@ -194,9 +457,48 @@ uint8_t *short_command(command_t cmd, int *lenp) {
 	return data;
 }
 
-static uint8_t *acknowledge(command_t cmd, int *lenp) {
-	encode_short_packet(CMD_ACK);
-	uint8_t *data = perform(CMD_ACK, short_buf, sizeof(short_buf), 1, DEFAULT_TIMEOUT, cmd, lenp);
+// Responses to a batch of commands are saved in the page buffer.
+#define BATCH_SLOT_SIZE		RESPONSE_BUF_SIZE
+
+_Static_assert(MAX_BATCH_COMMANDS * BATCH_SLOT_SIZE <= PAGE_BUF_SIZE,
+	       "page buffer is too small for MAX_BATCH_COMMANDS responses");
+
+int short_commands(pump_session_t *s, const command_t *cmds, int count, uint8_t **data, int *lens) {
+	assert(count <= MAX_BATCH_COMMANDS);
+	// Encode every packet first, so that only the radio exchange
+	// and the CRC check happen while the pump is waiting.
+	uint8_t pkts[MAX_BATCH_COMMANDS][SHORT_BUF_SIZE];
+	for (int i = 0; i < count; i++) {
+		encode_short_packet_into(s, cmds[i], pkts[i]);
+		data[i] = 0;
+		lens[i] = NO_RESPONSE;
+	}
+	// This overwrites any partially downloaded history page.
+	s->download.page_num = -1;
+	int answered = 0;
+	for (int i = 0; i < count; i++) {
+		int n;
+		uint8_t *r = perform(s, cmds[i], pkts[i], SHORT_BUF_SIZE, DEFAULT_TRIES, ADAPTIVE_TIMEOUT, cmds[i], &n);
+		lens[i] = n;
+		if (r == 0) {
+			log_error(cmds[i], n);
+			if (n == NO_RESPONSE) {
+				// The pump has stopped answering.
+				break;
+			}
+			continue;
+		}
+		// The next response overwrites the session's response buffer.
+		data[i] = &s->page_buf[i * BATCH_SLOT_SIZE];
+		memcpy(data[i], r, n);
+		answered++;
+	}
+	return answered;
+}
+
+static uint8_t *acknowledge(pump_session_t *s, command_t cmd, int *lenp) {
+	encode_short_packet(s, CMD_ACK);
+	uint8_t *data = perform(s, CMD_ACK, s->short_buf, SHORT_BUF_SIZE, 1, ADAPTIVE_TIMEOUT, cmd, lenp);
 	int n = *lenp;
 	if (n < 0) {
 		log_error(cmd, n);
@@ -205,18 +507,13 @@ static uint8_t *acknowledge(command_t cmd, int *lenp) {
 	return data;
 }
 
-typedef struct {
-	uint8_t data[HISTORY_PAGE_SIZE];
-	uint8_t crc[2];
-} history_page_t;
-
-static uint8_t page_buf[1024];
-
-uint8_t *extended_response(command_t cmd, int *lenp) {
+uint8_t *extended_response(pump_session_t *s, command_t cmd, int *lenp) {
 	int n;
 	int expected = 1;
-	uint8_t *p = page_buf;
-	uint8_t *data = short_command(cmd, &n);
+	uint8_t *p = s->page_buf;
+	// This overwrites any partially downloaded history page.
+	s->download.page_num = -1;
+	uint8_t *data = short_command(s, cmd, &n);
 	while (data != 0 && n == FRAGMENT_LENGTH) {
 		uint8_t seq_num = data[0] & ~DONE_BIT;
 		if (seq_num != expected) {
@@ -227,10 +524,10 @@ uint8_t *extended_response(command_t cmd, int *lenp) {
 		p += PAYLOAD_LENGTH;
 		if (data[0] & DONE_BIT) {
 			*lenp = seq_num * PAYLOAD_LENGTH;
-			return page_buf;
+			return s->page_buf;
 		}
 		// Acknowledge this fragment and receive the next.
-		data = acknowledge(cmd, &n);
+		data = acknowledge(s, cmd, &n);
 		expected++;
 	}
 	if (n < 0) {
@@ -244,116 +541,210 @@ uint8_t *extended_response(command_t cmd, int *lenp) {
 	return 0;
 }
 
-uint8_t *check_page_crc(int page_num, int *lenp) {
-	uint16_t data_crc = two_byte_be_int(&page_buf[1022]);
-	uint16_t calc_crc = crc16(page_buf, 1022);
-	if (calc_crc != data_crc) {
+#define HISTORY_CRC_OFFSET	HISTORY_PAGE_SIZE
+#define MAX_PAGE_REQUESTS	3
+
+static void start_download(pump_session_t *s, command_t cmd, int page_num) {
+	page_download_t *d = &s->download;
+	d->command = cmd;
+	d->page_num = page_num;
+	d->received = 0;
+	d->crc_fragments = 0;
+	d->crc = CRC16_INIT;
+}
+
+// Store a fragment and extend the running CRC over any fragments
+// that are now contiguous with the ones already included.
+static void store_fragment(pump_session_t *s, int seq_num, uint8_t *payload) {
+	page_download_t *d = &s->download;
+	int bit = 1 << (seq_num - 1);
+	if (d->received & bit) {
+		return;
+	}
+	memcpy(&s->page_buf[(seq_num - 1) * PAYLOAD_LENGTH], payload, PAYLOAD_LENGTH);
+	d->received |= bit;
+	while (d->crc_fragments < NUM_FRAGMENTS && (d->received & (1 << d->crc_fragments))) {
+		int offset = d->crc_fragments * PAYLOAD_LENGTH;
+		int len = PAYLOAD_LENGTH;
+		if (offset + len > HISTORY_CRC_OFFSET) {
+			len = HISTORY_CRC_OFFSET - offset;
+		}
+		d->crc = crc16_update(d->crc, &s->page_buf[offset], len);
+		d->crc_fragments++;
+	}
+}
+
+static uint8_t *check_page_crc(pump_session_t *s, int page_num, int *lenp) {
+	page_download_t *d = &s->download;
+	// A bad page can't be repaired by re-requesting fragments, so start over next time.
+	d->page_num = -1;
+	uint16_t data_crc = two_byte_be_int(&s->page_buf[HISTORY_CRC_OFFSET]);
+	if (d->crc != data_crc) {
 		*lenp = -1;
-		ESP_LOGE(TAG, "history page %d: computed CRC %04X but received %04X", page_num, calc_crc, data_crc);
+		ESP_LOGE(TAG, "history page %d: computed CRC %04X but received %04X", page_num, d->crc, data_crc);
 		return 0;
 	}
 	*lenp = HISTORY_PAGE_SIZE;
-	return page_buf;
+	return s->page_buf;
 }
 
-uint8_t *handle_no_response(command_t cmd, int page_num, int expected, int *lenp) {
+static uint8_t *handle_no_response(pump_session_t *s, command_t cmd, int page_num, int *lenp) {
 	for (int count = 0; count < MAX_NAKS; count++) {
-		encode_short_packet(CMD_NAK);
+		encode_short_packet(s, CMD_NAK);
 		int n;
-		uint8_t *data = perform(CMD_NAK, short_buf, sizeof(short_buf), 1, DEFAULT_TIMEOUT, cmd, &n);
+		uint8_t *data = perform(s, CMD_NAK, s->short_buf, SHORT_BUF_SIZE, 1, ADAPTIVE_TIMEOUT, cmd, &n);
 		if (n < 0) {
-			if (n == NO_RESPONSE) {
+			if (n == NO_RESPONSE || n == DECODING_FAILURE || n == CRC_FAILURE) {
 				continue;
 			}
-			*lenp = -1;
-			log_error(cmd, n);
+			*lenp = n;
 			return 0;
 		}
 		uint8_t seq_num = data[0] & ~DONE_BIT;
-		ESP_LOGI(TAG, "history page %d: received fragment %d after %d NAK(s)", page_num, seq_num, count + 1);
+		TRACE(TRACE_PUMP_NAK, page_num, seq_num, count + 1);
+		*lenp = n;
 		return data;
 	}
-	*lenp = -1;
-	ESP_LOGE(TAG, "history page %d: lost fragment %d", page_num, expected);
+	*lenp = NO_RESPONSE;
 	return 0;
 }
 
-uint8_t *download_page(command_t cmd, int page_num, int *lenp) {
-	uint8_t pg = page_num;
+// Request the page and store the fragments that have not already been received.
+// Stop as soon as all the fragments have been received.
+// Return 0 if the request should be repeated to get the missing fragments.
+static int request_page(pump_session_t *s, command_t cmd, int page_num) {
+	page_download_t *d = &s->download;
+	// Glucose pages are numbered with 4 bytes, history pages with 1.
+	uint8_t pg[4];
+	int pg_len;
+	if (cmd == CMD_GLUCOSE_PAGE) {
+		pg[0] = page_num >> 24;
+		pg[1] = page_num >> 16;
+		pg[2] = page_num >> 8;
+		pg[3] = page_num;
+		pg_len = 4;
+	} else {
+		pg[0] = page_num;
+		pg_len = 1;
+	}
 	int n;
-	uint8_t *data = long_command(cmd, &pg, 1, &n);
+	uint8_t *data = long_command(s, cmd, pg, pg_len, &n);
 	if (n < 0) {
-		*lenp = n;
-		log_error(cmd, n);
-		return 0;
+		return n;
 	}
-	uint8_t *p = page_buf;
-	int expected = 1;
 	while (data != 0 && n == FRAGMENT_LENGTH) {
 		uint8_t seq_num = data[0] & ~DONE_BIT;
-		if (seq_num > expected) {
-			// Missed fragment.
-			*lenp = -1;
-			ESP_LOGE(TAG, "history page %d: received fragment %d instead of %d", page_num, seq_num, expected);
-			return 0;
+		if (seq_num < 1 || seq_num > NUM_FRAGMENTS) {
+			ESP_LOGE(TAG, "history page %d: received fragment %d", page_num, seq_num);
+			return -1;
 		}
-		if (seq_num == expected) {
-			memcpy(p, data + 1, PAYLOAD_LENGTH);
-			p += PAYLOAD_LENGTH;
-			expected++;
+		store_fragment(s, seq_num, data + 1);
+		if (d->received == ALL_FRAGMENTS) {
+			return 0;
 		}
 		if (seq_num == NUM_FRAGMENTS) {
 			if (!(data[0] & DONE_BIT)) {
-				*lenp = -1;
 				ESP_LOGE(TAG, "history page %d: missing done bit", page_num);
-				return 0;
+				return -1;
 			}
-			return check_page_crc(page_num, lenp);
+			// Some earlier fragment was skipped.
+			return 0;
 		}
 		// Acknowledge this fragment and receive the next.
-		data = acknowledge(cmd, &n);
-		if (n < 0) {
-			if (n != NO_RESPONSE) {
-				break;
+		data = acknowledge(s, cmd, &n);
+		if (n == NO_RESPONSE || n == DECODING_FAILURE || n == CRC_FAILURE) {
+			data = handle_no_response(s, cmd, page_num, &n);
+			if (n == NO_RESPONSE) {
+				// Lost fragment.
+				return 0;
 			}
-			data = handle_no_response(cmd, page_num, expected, &n);
 		}
+	}
+	if (n < 0) {
+		return n;
+	}
+	ESP_LOGE(TAG, "history page %d: received %d-byte response", page_num, n);
+	print_bytes("response", data, n);
+	return -1;
+}
+
+static int num_missing(uint16_t received) {
+	int count = 0;
+	for (int i = 0; i < NUM_FRAGMENTS; i++) {
+		if (!(received & (1 << i))) {
+			count++;
+		}
+	}
+	return count;
+}
 
+uint8_t *download_page(pump_session_t *s, command_t cmd, int page_num, int *lenp) {
+	page_download_t *d = &s->download;
+	if (d->command != cmd || d->page_num != page_num) {
+		start_download(s, cmd, page_num);
+	} else {
+		ESP_LOGI(TAG, "history page %d: resuming with %d fragments missing", page_num, num_missing(d->received));
+	}
+	int n = 0;
+	for (int r = 0; r < MAX_PAGE_REQUESTS; r++) {
+		if (r != 0) {
+			ESP_LOGI(TAG, "history page %d: re-requesting for %d missing fragments", page_num, num_missing(d->received));
+		}
+		n = request_page(s, cmd, page_num);
+		if (d->received == ALL_FRAGMENTS) {
+			return check_page_crc(s, page_num, lenp);
+		}
+		if (n < 0) {
+			break;
+		}
 	}
+	// Keep the fragments received so far; the next call for this page will resume.
 	if (n < 0) {
 		log_error(cmd, n);
 	} else {
-		ESP_LOGE(TAG, "history page %d: received %d-byte response", page_num, n);
-		print_bytes("response", data, n);
+		ESP_LOGE(TAG, "history page %d: %d fragments missing", page_num, num_missing(d->received));
 		n = -1;
 	}
 	*lenp = n;
 	return 0;
 }
 
-bool pump_wakeup(void) {
-	int m = pump_get_model();
+bool pump_wakeup(pump_session_t *s) {
+	if (pump_is_awake(s)) {
+		return true;
+	}
+	int m = pump_get_model(s);
 	if (m != -1) {
 		return true;
 	}
-	encode_short_packet(CMD_WAKEUP);
+	encode_short_packet(s, CMD_WAKEUP);
 	int n;
-	perform(CMD_WAKEUP, short_buf, sizeof(short_buf), 100, 10, CMD_ACK, &n);
-	uint8_t *data = perform(CMD_WAKEUP, short_buf, sizeof(short_buf), 1, 10000, CMD_ACK, &n);
+	perform(s, CMD_WAKEUP, s->short_buf, SHORT_BUF_SIZE, 100, 10, CMD_ACK, &n);
+	uint8_t *data = perform(s, CMD_WAKEUP, s->short_buf, SHORT_BUF_SIZE, 1, 10000, CMD_ACK, &n);
 	return data != 0;
 }
 
-uint8_t *long_command(command_t cmd, uint8_t *params, int params_len, int *lenp) {
-	encode_short_packet(cmd);
-	uint8_t *data = perform(cmd, short_buf, sizeof(short_buf), DEFAULT_TRIES, DEFAULT_TIMEOUT, CMD_ACK, lenp);
+bool pump_keep_alive(pump_session_t *s) {
+	if (!pump_is_awake(s)) {
+		return false;
+	}
+	if (pump_awake_remaining(s) > KEEP_ALIVE_MARGIN) {
+		return true;
+	}
+	return pump_get_model(s) != -1;
+}
+
+uint8_t *long_command(pump_session_t *s, command_t cmd, uint8_t *params, int params_len, int *lenp) {
+	encode_short_packet(s, cmd);
+	uint8_t *data = perform(s, cmd, s->short_buf, SHORT_BUF_SIZE, DEFAULT_TRIES, ADAPTIVE_TIMEOUT, CMD_ACK, lenp);
 	int n = *lenp;
 	if (n < 0) {
 		log_error(cmd, n);
 		ESP_LOGE(TAG, "command %02X was not performed", cmd);
 		return 0;
 	}
-	encode_long_packet(cmd, params, params_len);
-	data = perform(cmd, long_buf, sizeof(long_buf), 1, DEFAULT_TIMEOUT, CMD_ACK, lenp);
+	encode_long_packet(s, cmd, params, params_len);
+	data = perform(s, cmd, s->long_buf, LONG_BUF_SIZE, 1, ADAPTIVE_TIMEOUT, CMD_ACK, lenp);
 	if (!data) {
 		log_error(cmd, n);
 		return 0;
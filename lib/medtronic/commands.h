@@ -27,18 +27,53 @@ typedef enum {
 	CMD_SETTINGS_512	= 0x91,
 	CMD_BASAL_RATES		= 0x92,
 	CMD_TEMP_BASAL		= 0x98,
+	CMD_GLUCOSE_PAGE	= 0x9A,
 	CMD_TARGETS		= 0x9F,
 	CMD_SETTINGS		= 0xC0,
+	CMD_GLUCOSE_PAGES	= 0xCD,
 	CMD_STATUS		= 0xCE,
 } command_t;
 
-uint8_t *short_command(command_t cmd, int *len);
+// MySentry packets have the same layout as CareLink packets:
+// device type, pump ID, message type, and body.
+#define MYSENTRY_DEVICE		0xA2
 
-uint8_t *long_command(command_t cmd, uint8_t *params, int params_len, int *len);
+typedef enum {
+	MYSENTRY_STATUS		= 0x04,
+	MYSENTRY_ACK		= 0x06,
+} mysentry_message_t;
+
+uint8_t *short_command(pump_session_t *s, command_t cmd, int *len);
+
+// Perform a batch of short commands back to back, without decoding
+// the responses in between, to keep the exchange with the pump short.
+// data[i] and lens[i] are set as by short_command for each command;
+// the responses remain valid until the next command in the session.
+// The batch stops early if the pump stops responding.
+// Return the number of commands that were answered.
+#define MAX_BATCH_COMMANDS	8
+
+int short_commands(pump_session_t *s, const command_t *cmds, int count, uint8_t **data, int *lens);
+
+uint8_t *long_command(pump_session_t *s, command_t cmd, uint8_t *params, int params_len, int *len);
+
+uint8_t *extended_response(pump_session_t *s, command_t cmd, int *len);
 
-uint8_t *extended_response(command_t cmd, int *len);
+uint8_t *download_page(pump_session_t *s, command_t cmd, int page_num, int *len);
 
-uint8_t *download_page(command_t cmd, int page_num, int *len);
+// These always read the pump's configuration over the radio;
+// the pump_get_* versions in config.c use the session's cache.
+int pump_read_basal_rates(pump_session_t *s, basal_rate_t *r, int len);
+int pump_read_carb_ratios(pump_session_t *s, carb_ratio_t *r, int len);
+int pump_read_sensitivities(pump_session_t *s, sensitivity_t *r, int len);
+int pump_read_settings(pump_session_t *s, settings_t *r);
+int pump_read_targets(pump_session_t *s, target_t *r, int len);
+
+// Return the settings in the session's cache, or 0 if they are not cached.
+const settings_t *pump_cached_settings(pump_session_t *s);
+
+// Save settings read from the pump in the session's cache, if it has one.
+void pump_cache_settings(pump_session_t *s, const settings_t *r);
 
 static inline int two_byte_be_int(uint8_t *p) {
 	return (p[0] << 8) | p[1];
@@ -62,4 +97,16 @@ static inline time_t half_hours(int n) {
 
 void print_bytes(const char *msg, const uint8_t *data, int len);
 
+// Return milliseconds since an arbitrary starting point.
+// Unlike time(), this is not affected by setting the clock,
+// but it starts over after deep sleep.
+int64_t monotonic_ms(void);
+
+// Return milliseconds by the system clock, which keeps running
+// through deep sleep.
+int64_t realtime_ms(void);
+
+// Record the session's awake window and model in RTC memory.
+void pump_save_awake_window(pump_session_t *s);
+
 #endif // _COMMANDS_H
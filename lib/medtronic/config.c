@@ -0,0 +1,140 @@
+#include "medtronic.h"
+#include "commands.h"
+#include "pump_history.h"
+
+// Increment this when the layout of pump_config_t changes,
+// so that a cache saved by an older version is discarded.
+#define CONFIG_VERSION	2
+
+#define BIT(item)	(1 << (item))
+
+static bool config_valid(pump_config_t *c, config_item_t item) {
+	return c != 0 && (c->valid & BIT(item));
+}
+
+static void config_fetched(pump_config_t *c, config_item_t item) {
+	c->valid |= BIT(item);
+	// Any change recorded after the newest history record seen so far
+	// was made after this read.
+	c->fetched[item] = c->history_time;
+	pump_config_save(c);
+}
+
+void pump_config_attach(pump_session_t *s, pump_config_t *c) {
+	s->config = c;
+	if (pump_config_load(c) == 0 && c->version == CONFIG_VERSION &&
+	    memcmp(c->pump_id, s->pump_id, sizeof(c->pump_id)) == 0) {
+		return;
+	}
+	memset(c, 0, sizeof(*c));
+	c->version = CONFIG_VERSION;
+	memcpy(c->pump_id, s->pump_id, sizeof(c->pump_id));
+}
+
+void pump_config_invalidate(pump_session_t *s) {
+	pump_config_t *c = s->config;
+	if (c == 0 || c->valid == 0) {
+		return;
+	}
+	c->valid = 0;
+	pump_config_save(c);
+}
+
+// Define a getter that answers from the cache if possible,
+// and otherwise reads the entire schedule into the cache.
+#define DEFINE_CACHED_SCHEDULE(type, item, array, max)					\
+	int pump_get_##array(pump_session_t *s, type##_t *r, int len) {			\
+		pump_config_t *c = s->config;						\
+		if (c == 0) {								\
+			return pump_read_##array(s, r, len);				\
+		}									\
+		if (!config_valid(c, item)) {						\
+			int n = pump_read_##array(s, c->array, max);			\
+			if (n == 0) {							\
+				return 0;						\
+			}								\
+			c->num_##array = n;						\
+			config_fetched(c, item);					\
+		}									\
+		int n = c->num_##array < len ? c->num_##array : len;			\
+		memcpy(r, c->array, n * sizeof(type##_t));				\
+		return n;								\
+	}
+
+DEFINE_CACHED_SCHEDULE(basal_rate, CONFIG_BASAL_RATES, basal_rates, MAX_BASAL_RATES)
+DEFINE_CACHED_SCHEDULE(carb_ratio, CONFIG_CARB_RATIOS, carb_ratios, MAX_CARB_RATIOS)
+DEFINE_CACHED_SCHEDULE(sensitivity, CONFIG_SENSITIVITIES, sensitivities, MAX_SENSITIVITIES)
+DEFINE_CACHED_SCHEDULE(target, CONFIG_TARGETS, targets, MAX_TARGETS)
+
+int pump_get_settings(pump_session_t *s, settings_t *r) {
+	pump_config_t *c = s->config;
+	if (c == 0) {
+		return pump_read_settings(s, r);
+	}
+	if (!config_valid(c, CONFIG_SETTINGS)) {
+		if (pump_read_settings(s, &c->settings) != 0) {
+			return -1;
+		}
+		config_fetched(c, CONFIG_SETTINGS);
+	}
+	*r = c->settings;
+	return 0;
+}
+
+const settings_t *pump_cached_settings(pump_session_t *s) {
+	pump_config_t *c = s->config;
+	return config_valid(c, CONFIG_SETTINGS) ? &c->settings : 0;
+}
+
+void pump_cache_settings(pump_session_t *s, const settings_t *r) {
+	pump_config_t *c = s->config;
+	if (c == 0) {
+		return;
+	}
+	c->settings = *r;
+	config_fetched(c, CONFIG_SETTINGS);
+}
+
+// Return the configuration items affected by a history record.
+static int changed_items(history_record_type_t type) {
+	switch (type) {
+	case ChangeBasalPattern:
+	case BasalProfileAfter:
+		return BIT(CONFIG_BASAL_RATES);
+	case ChangeBolusWizardSetup:
+		return BIT(CONFIG_CARB_RATIOS) | BIT(CONFIG_SENSITIVITIES) | BIT(CONFIG_TARGETS);
+	case MaxBasal:
+	case MaxBolus:
+	case ChangeTempBasalType:
+		return BIT(CONFIG_SETTINGS);
+	default:
+		return 0;
+	}
+}
+
+bool pump_config_history(pump_session_t *s, history_record_t *r) {
+	pump_config_t *c = s->config;
+	if (c == 0) {
+		return false;
+	}
+	// This is saved with the next change to the cache. If it is lost,
+	// an older history_time only makes invalidation more eager.
+	if (r->time > c->history_time) {
+		c->history_time = r->time;
+	}
+	int items = changed_items(r->type) & c->valid;
+	int stale = 0;
+	for (int i = 0; i < NUM_CONFIG_ITEMS; i++) {
+		// Changes no newer than the history seen when the item was read
+		// are already reflected in it.
+		if ((items & BIT(i)) && r->time > c->fetched[i]) {
+			stale |= BIT(i);
+		}
+	}
+	if (stale == 0) {
+		return false;
+	}
+	c->valid &= ~stale;
+	pump_config_save(c);
+	return true;
+}
@@ -0,0 +1,45 @@
+#include <nvs.h>
+
+#include "medtronic.h"
+#include "commands.h"
+
+#define STORAGE_NAMESPACE	"medtronic"
+#define CONFIG_KEY		"config"
+
+int pump_config_load(pump_config_t *c) {
+	nvs_handle handle;
+	esp_err_t err = nvs_open(STORAGE_NAMESPACE, NVS_READONLY, &handle);
+	if (err != ESP_OK) {
+		ESP_LOGI(TAG, "pump_config_load: nvs_open: %s", esp_err_to_name(err));
+		return -1;
+	}
+	size_t size = sizeof(*c);
+	err = nvs_get_blob(handle, CONFIG_KEY, c, &size);
+	nvs_close(handle);
+	if (err != ESP_OK) {
+		ESP_LOGI(TAG, "pump_config_load: nvs_get_blob: %s", esp_err_to_name(err));
+		return -1;
+	}
+	if (size != sizeof(*c)) {
+		ESP_LOGI(TAG, "pump_config_load: found %d bytes instead of %d", (int)size, (int)sizeof(*c));
+		return -1;
+	}
+	return 0;
+}
+
+void pump_config_save(const pump_config_t *c) {
+	nvs_handle handle;
+	esp_err_t err = nvs_open(STORAGE_NAMESPACE, NVS_READWRITE, &handle);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "pump_config_save: nvs_open: %s", esp_err_to_name(err));
+		return;
+	}
+	err = nvs_set_blob(handle, CONFIG_KEY, c, sizeof(*c));
+	if (err == ESP_OK) {
+		err = nvs_commit(handle);
+	}
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "pump_config_save: %s", esp_err_to_name(err));
+	}
+	nvs_close(handle);
+}
@@ -84,12 +84,16 @@ static const uint16_t crc16_lookup[256] = {
 	0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0,
 };
 
-uint16_t crc16(const uint8_t *buf, size_t len)
+uint16_t crc16_update(uint16_t res, const uint8_t *buf, size_t len)
 {
-	uint16_t res = 0xFFFF;
 	int i;
 
 	for (i = 0; i < len; ++i)
 		res = (res << 8) ^ crc16_lookup[(res >> 8) ^ buf[i]];
 	return res;
 }
+
+uint16_t crc16(const uint8_t *buf, size_t len)
+{
+	return crc16_update(CRC16_INIT, buf, len);
+}
@@ -12,4 +12,11 @@ uint8_t crc8(const uint8_t *buf, size_t len);
 
 uint16_t crc16(const uint8_t *buf, size_t len);
 
+// Incremental CRC-16: start with CRC16_INIT and feed successive
+// pieces of the data to crc16_update.
+
+#define CRC16_INIT	0xFFFF
+
+uint16_t crc16_update(uint16_t crc, const uint8_t *buf, size_t len);
+
 #endif /* _CRC_H */
@@ -0,0 +1,125 @@
+#include "medtronic.h"
+#include "commands.h"
+#include "glucose_history.h"
+
+#define UNKNOWN		0
+
+// Lengths of the record types below GlucoseValue, including the type byte.
+static const uint8_t record_length[GlucoseValue] = {
+	[GlucoseNull]           = 1,
+	[GlucoseDataEnd]        = 1,
+	[GlucoseWeakSignal]     = 1,
+	[GlucoseCal]            = 2,
+	[GlucosePacket]         = 2,
+	[GlucoseError]          = 2,
+	[GlucoseDataLow]        = 2,
+	[GlucoseDataHigh]       = 2,
+	[GlucoseTimestamp]      = 5,
+	[GlucoseBatteryChange]  = 5,
+	[GlucoseSensorStatus]   = 5,
+	[GlucoseDateTimeChange] = 5,
+	[GlucoseSensorSync]     = 5,
+	[GlucoseCalBGForGH]     = 6,
+	[GlucoseCalFactor]      = 7,
+	[Glucose10]             = 8,
+	[Glucose13]             = 1,
+};
+
+static int glucose_record_length(uint8_t type) {
+	return type >= GlucoseValue ? 1 : record_length[type];
+}
+
+// Records that take up a 5-minute sensor interval.
+static bool is_reading(uint8_t type) {
+	switch (type) {
+	case GlucoseWeakSignal:
+	case GlucoseError:
+	case GlucoseDataLow:
+	case GlucoseDataHigh:
+		return true;
+	default:
+		return type >= GlucoseValue;
+	}
+}
+
+// Decode a 4-byte timestamp from a glucose history record.
+static time_t decode_glucose_time(uint8_t *data) {
+	struct tm tm = {
+		.tm_min = data[1] & 0x3F,
+		.tm_hour = data[0] & 0x1F,
+		.tm_mday = data[2] & 0x1F,
+		// The 4-bit month value is encoded in the high 2 bits of the first 2 bytes.
+		.tm_mon = (((data[0]>>6)<<2) | (data[1]>>6)) - 1,
+		.tm_year = (data[3]&0x7F) + 100,
+	};
+	return make_local_time(&tm);
+}
+
+// Apply fn to the readings in page[start:end], newest first,
+// given the time of the timestamp before them and how many there are.
+static int decode_readings(uint8_t *page, int start, int end, time_t t, int count, glucose_record_fn_t decode_fn) {
+	glucose_record_t rec;
+	for (int i = end - 1; i >= start; i -= glucose_record_length(page[i])) {
+		uint8_t type = page[i];
+		if (!is_reading(type)) {
+			continue;
+		}
+		rec.time = t + count * 5 * 60;
+		count--;
+		switch (type) {
+		case GlucoseDataLow:
+			rec.type = type;
+			rec.glucose = GLUCOSE_LOW;
+			break;
+		case GlucoseDataHigh:
+			rec.type = type;
+			rec.glucose = GLUCOSE_HIGH;
+			break;
+		default:
+			if (type < GlucoseValue) {
+				continue;
+			}
+			rec.type = GlucoseValue;
+			rec.glucose = 2 * type;
+			break;
+		}
+		if (decode_fn(&rec) != 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void pump_decode_glucose(uint8_t *page, int len, glucose_record_fn_t decode_fn) {
+	// Readings after the most recent timestamp seen so far
+	// (in page order) are in page[i+1:end].
+	int end = len;
+	int count = 0;
+	int i = len - 1;
+	while (i >= 0) {
+		uint8_t type = page[i];
+		int n = glucose_record_length(type);
+		if (n == UNKNOWN) {
+			ESP_LOGE(TAG, "unknown glucose record type %02X", type);
+			print_bytes("glucose data", page, i + 1);
+			return;
+		}
+		if (n > i + 1) {
+			ESP_LOGE(TAG, "glucose record type %02X would require %d bytes", type, n);
+			print_bytes("glucose data", page, i + 1);
+			return;
+		}
+		int start = i + 1 - n;
+		if (type == GlucoseTimestamp) {
+			time_t t = decode_glucose_time(&page[start]);
+			if (decode_readings(page, i + 1, end, t, count, decode_fn) != 0) {
+				return;
+			}
+			end = start;
+			count = 0;
+		} else if (is_reading(type)) {
+			count++;
+		}
+		i = start - 1;
+	}
+}
@@ -0,0 +1,51 @@
+#ifndef _GLUCOSE_HISTORY_H
+#define _GLUCOSE_HISTORY_H
+
+// Glucose history pages from sensor-enabled pumps.
+// These definitions track github.com/ecc1/medtronic/glucoserecord.go
+//
+// Records are stored oldest first, but can only be decoded from the end
+// of the page, since each record's type is in its last byte.
+// Only timestamp records carry a time; the readings that follow
+// a SensorTimestamp are 5 minutes apart.
+typedef enum PACKED {
+	GlucoseNull             = 0x00,
+	GlucoseDataEnd          = 0x01,
+	GlucoseWeakSignal       = 0x02,
+	GlucoseCal              = 0x03,
+	GlucosePacket           = 0x04,
+	GlucoseError            = 0x05,
+	GlucoseDataLow          = 0x06,
+	GlucoseDataHigh         = 0x07,
+	GlucoseTimestamp        = 0x08,
+	GlucoseBatteryChange    = 0x0A,
+	GlucoseSensorStatus     = 0x0B,
+	GlucoseDateTimeChange   = 0x0C,
+	GlucoseSensorSync       = 0x0D,
+	GlucoseCalBGForGH       = 0x0E,
+	GlucoseCalFactor        = 0x0F,
+	Glucose10               = 0x10,
+	Glucose13               = 0x13,
+	// Types from here up are readings of twice the type value.
+	GlucoseValue            = 0x14,
+} glucose_record_type_t;
+
+// Readings below and above the sensor's range.
+#define GLUCOSE_LOW	40	// mg/dL
+#define GLUCOSE_HIGH	400	// mg/dL
+
+typedef struct {
+	glucose_record_type_t type;	// GlucoseValue, GlucoseDataLow, or GlucoseDataHigh
+	time_t time;
+	glucose_t glucose;	// mg/dL
+} glucose_record_t;
+
+// Signature of function to be applied to glucose readings during decoding.
+typedef int (*glucose_record_fn_t)(glucose_record_t *);
+
+// Decode the given glucose page and apply f to each sensor glucose reading,
+// newest first. Readings older than the first timestamp in the page are skipped.
+// If f returns a non-zero value, the decoding loop terminates.
+void pump_decode_glucose(uint8_t *page, int len, glucose_record_fn_t decode_fn);
+
+#endif // _GLUCOSE_HISTORY_H
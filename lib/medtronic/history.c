@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 
 #include "medtronic.h"
 #include "commands.h"
@@ -14,320 +15,305 @@ time_t pump_decode_time(uint8_t *data) {
 		// The 4-bit month value is encoded in the high 2 bits of the first 2 bytes.
 		.tm_mon = (((data[0]>>6)<<2) | (data[1]>>6)) - 1,
 		.tm_year = (data[4]&0x7F) + 100,
-		.tm_isdst = -1,
 	};
-	return mktime(&tm);
+	return make_local_time(&tm);
 }
 
-#define UNKNOWN_RECORD_ERR	(-1)
-#define RECORD_SIZE_ERR		(-2)
-
-#define REQUIRE_BYTES(n)					\
-	do {							\
-		r->length = (n);				\
-		if (r->length > len) return RECORD_SIZE_ERR;	\
-	} while (0)
-
-// Return 1 for insulin-related records, 0 for records to skip, negative values for errors.
-// Insulin-related records:
+// Record lengths for the three pump generations:
+// x22 and older, x23 through x50, and x51 and newer.
+// VARIABLE means the length is in data[1].
+// Record types that are not listed are unknown.
+//
+// The decoder, if any, fills in the fields of an insulin-related
+// or configuration-change record (see config.c):
 //   BasalProfileStart (x23 and newer models only)
 //   TempBasalRate and TempBasalDuration
 //   SuspendPump and ResumePump
 //   Bolus (normal and square wave)
 //   Rewind and Prime
 //   Alarm and ClearAlarm
-static int decode_history_record(uint8_t *data, int len, int family, history_record_t *r) {
-	memset(r, 0, sizeof(history_record_t));
-	r->type = data[0];
-	switch (r->type) {
-	case Bolus:
-		if (family <= 22) {
-			REQUIRE_BYTES(9);
-			r->time = pump_decode_time(&data[4]);
-			r->insulin = int_to_insulin(data[2], family);
-			r->duration = half_hours(data[3]);
-		} else {
-			REQUIRE_BYTES(13);
-			r->time = pump_decode_time(&data[8]);
-			r->insulin = int_to_insulin(two_byte_be_int(&data[3]), family);
-			r->duration = half_hours(data[7]);
-		}
-		return 1;
-	case Prime:
-		REQUIRE_BYTES(10);
-		r->time = pump_decode_time(&data[5]);
-		return 1;
-	case Alarm:
-		REQUIRE_BYTES(9);
+//   ChangeBasalPattern and BasalProfileAfter
+//   ChangeBolusWizardSetup
+//   MaxBasal, MaxBolus, and ChangeTempBasalType
+// or the details of a bolus wizard, BG, meal, or daily total record
+// (see pump_history.h):
+//   BolusWizard and BolusWizard512
+//   UnabsorbedInsulin and UnabsorbedInsulin512 (which have no timestamp)
+//   BGReceived and BGReceived512
+//   MealMarker
+//   DailyTotal515, DailyTotal522, and DailyTotal523
+// Other records are skipped.
+//
+// The layouts of the wizard and unabsorbed insulin records
+// follow github.com/openaps/decocare/decocare/history.py
+
+#define HISTORY_RECORDS \
+	RECORD(Bolus,                  9,        13,       13,       decode_bolus)               \
+	RECORD(Prime,                  10,       10,       10,       decode_prime)               \
+	RECORD(Alarm,                  9,        9,        9,        decode_alarm)               \
+	RECORD(DailyTotal,             7,        10,       10,       0)                          \
+	RECORD(BasalProfileBefore,     152,      152,      152,      0)                          \
+	RECORD(BasalProfileAfter,      152,      152,      152,      decode_timestamp)           \
+	RECORD(BGCapture,              7,        7,        7,        0)                          \
+	RECORD(SensorAlarm,            8,        8,        8,        0)                          \
+	RECORD(ClearAlarm,             7,        7,        7,        decode_timestamp)           \
+	RECORD(ChangeBasalPattern,     7,        7,        7,        decode_timestamp)           \
+	RECORD(TempBasalDuration,      7,        7,        7,        decode_temp_basal_duration) \
+	RECORD(ChangeTime,             7,        7,        7,        0)                          \
+	RECORD(NewTime,                7,        7,        7,        0)                          \
+	RECORD(LowBattery,             7,        7,        7,        0)                          \
+	RECORD(BatteryChange,          7,        7,        7,        0)                          \
+	RECORD(SetAutoOff,             7,        7,        7,        0)                          \
+	RECORD(PrepareInsulinChange,   7,        7,        7,        0)                          \
+	RECORD(SuspendPump,            7,        7,        7,        decode_timestamp)           \
+	RECORD(ResumePump,             7,        7,        7,        decode_timestamp)           \
+	RECORD(SelfTest,               7,        7,        7,        0)                          \
+	RECORD(Rewind,                 7,        7,        7,        decode_timestamp)           \
+	RECORD(ClearSettings,          7,        7,        7,        0)                          \
+	RECORD(EnableChildBlock,       7,        7,        7,        0)                          \
+	RECORD(MaxBolus,               7,        7,        7,        decode_timestamp)           \
+	RECORD(EnableRemote,           21,       21,       21,       0)                          \
+	RECORD(MaxBasal,               7,        7,        7,        decode_timestamp)           \
+	RECORD(EnableBolusWizard,      7,        7,        7,        0)                          \
+	RECORD(Unknown2E,              107,      107,      107,      0)                          \
+	RECORD(BolusWizard512,         19,       19,       19,       decode_bolus_wizard_512)    \
+	RECORD(UnabsorbedInsulin512,   VARIABLE, VARIABLE, VARIABLE, decode_unabsorbed_insulin)  \
+	RECORD(ChangeBGReminder,       7,        7,        7,        0)                          \
+	RECORD(SetAlarmClockTime,      7,        7,        7,        0)                          \
+	RECORD(TempBasalRate,          8,        8,        8,        decode_temp_basal_rate)     \
+	RECORD(LowReservoir,           7,        7,        7,        0)                          \
+	RECORD(AlarmClock,             7,        7,        7,        0)                          \
+	RECORD(ChangeMeterID,          21,       21,       21,       0)                          \
+	RECORD(BGReceived512,          10,       10,       10,       decode_bg_received)         \
+	RECORD(ConfirmInsulinChange,   7,        7,        7,        0)                          \
+	RECORD(SensorStatus,           7,        7,        7,        0)                          \
+	RECORD(EnableMeter,            21,       21,       21,       0)                          \
+	RECORD(BGReceived,             10,       10,       10,       decode_bg_received)         \
+	RECORD(MealMarker,             9,        9,        9,        decode_meal_marker)         \
+	RECORD(ExerciseMarker,         8,        8,        8,        0)                          \
+	RECORD(InsulinMarker,          8,        8,        8,        0)                          \
+	RECORD(OtherMarker,            7,        7,        7,        0)                          \
+	RECORD(EnableSensorAutoCal,    7,        7,        7,        0)                          \
+	RECORD(ChangeBolusWizardSetup, 39,       39,       39,       decode_timestamp)           \
+	RECORD(SensorSetup,            37,       37,       41,       0)                          \
+	RECORD(Sensor51,               7,        7,        7,        0)                          \
+	RECORD(Sensor52,               7,        7,        7,        0)                          \
+	RECORD(ChangeSensorAlarm,      8,        8,        8,        0)                          \
+	RECORD(Sensor54,               64,       64,       64,       0)                          \
+	RECORD(Sensor55,               55,       55,       55,       0)                          \
+	RECORD(ChangeSensorAlert,      12,       12,       12,       0)                          \
+	RECORD(ChangeBolusStep,        7,        7,        7,        0)                          \
+	RECORD(BolusWizardSetup,       124,      144,      144,      0)                          \
+	RECORD(BolusWizard,            20,       22,       22,       decode_bolus_wizard)        \
+	RECORD(UnabsorbedInsulin,      VARIABLE, VARIABLE, VARIABLE, decode_unabsorbed_insulin)  \
+	RECORD(SaveSettings,           7,        7,        7,        0)                          \
+	RECORD(EnableVariableBolus,    7,        7,        7,        0)                          \
+	RECORD(ChangeEasyBolus,        7,        7,        7,        0)                          \
+	RECORD(EnableBGReminder,       7,        7,        7,        0)                          \
+	RECORD(EnableAlarmClock,       7,        7,        7,        0)                          \
+	RECORD(ChangeTempBasalType,    7,        7,        7,        decode_timestamp)           \
+	RECORD(ChangeAlarmType,        7,        7,        7,        0)                          \
+	RECORD(ChangeTimeFormat,       7,        7,        7,        0)                          \
+	RECORD(ChangeReservoirWarning, 7,        7,        7,        0)                          \
+	RECORD(EnableBolusReminder,    7,        7,        7,        0)                          \
+	RECORD(SetBolusReminderTime,   9,        9,        9,        0)                          \
+	RECORD(DeleteBolusReminderTime,9,        9,        9,        0)                          \
+	RECORD(BolusReminder,          9,        9,        9,        0)                          \
+	RECORD(DeleteAlarmClockTime,   7,        7,        7,        0)                          \
+	RECORD(DailyTotal515,          38,       38,       38,       decode_daily_total)         \
+	RECORD(DailyTotal522,          44,       44,       44,       decode_daily_total)         \
+	RECORD(DailyTotal523,          52,       52,       52,       decode_daily_total)         \
+	RECORD(ChangeCarbUnits,        7,        7,        7,        0)                          \
+	RECORD(BasalProfileStart,      10,       10,       10,       decode_basal_profile_start) \
+	RECORD(ConnectOtherDevices,    7,        7,        7,        0)                          \
+	RECORD(ChangeOtherDevice,      37,       37,       37,       0)                          \
+	RECORD(ChangeMarriage,         12,       12,       12,       0)                          \
+	RECORD(DeleteOtherDevice,      12,       12,       12,       0)                          \
+	RECORD(EnableCaptureEvent,     7,        7,        7,        0)                         
+
+#define UNKNOWN		0
+#define VARIABLE	0xFF
+
+// A decoder returns 1 if the record should be passed to the caller, 0 if not.
+typedef int (*record_decoder_t)(uint8_t *data, int family, history_record_t *r);
+
+typedef struct {
+	uint8_t length;
+	record_decoder_t decode;
+} record_info_t;
+
+static int decode_timestamp(uint8_t *data, int family, history_record_t *r) {
+	r->time = pump_decode_time(&data[2]);
+	return 1;
+}
+
+static int decode_bolus(uint8_t *data, int family, history_record_t *r) {
+	if (family <= 22) {
 		r->time = pump_decode_time(&data[4]);
-		// Use insulin field to store alarm code.
-		r->insulin = data[1];
-		return 1;
-	case DailyTotal:
-		REQUIRE_BYTES(family <= 22 ? 7 : 10);
-		return 0;
-	case BasalProfileBefore:
-		REQUIRE_BYTES(152);
-		return 0;
-	case BasalProfileAfter:
-		REQUIRE_BYTES(152);
-		return 0;
-	case BGCapture:
-		REQUIRE_BYTES(7);
-		return 0;
-	case SensorAlarm:
-		REQUIRE_BYTES(8);
-		return 0;
-	case ClearAlarm:
-		REQUIRE_BYTES(7);
-		r->time = pump_decode_time(&data[2]);
-		return 1;
-	case ChangeBasalPattern:
-		REQUIRE_BYTES(7);
-		return 0;
-	case TempBasalDuration:
-		REQUIRE_BYTES(7);
-		r->time = pump_decode_time(&data[2]);
-		r->duration = half_hours(data[1]);
-		return 1;
-	case ChangeTime:
-		REQUIRE_BYTES(7);
-		return 0;
-	case NewTime:
-		REQUIRE_BYTES(7);
-		return 0;
-	case LowBattery:
-		REQUIRE_BYTES(7);
-		return 0;
-	case BatteryChange:
-		REQUIRE_BYTES(7);
-		return 0;
-	case SetAutoOff:
-		REQUIRE_BYTES(7);
-		return 0;
-	case PrepareInsulinChange:
-		REQUIRE_BYTES(7);
-		return 0;
-	case SuspendPump:
-		REQUIRE_BYTES(7);
-		r->time = pump_decode_time(&data[2]);
-		return 1;
-	case ResumePump:
-		REQUIRE_BYTES(7);
-		r->time = pump_decode_time(&data[2]);
-		return 1;
-	case SelfTest:
-		REQUIRE_BYTES(7);
-		return 0;
-	case Rewind:
-		REQUIRE_BYTES(7);
-		r->time = pump_decode_time(&data[2]);
+		r->insulin = int_to_insulin(data[2], family);
+		r->duration = half_hours(data[3]);
+	} else {
+		r->time = pump_decode_time(&data[8]);
+		r->insulin = int_to_insulin(two_byte_be_int(&data[3]), family);
+		r->duration = half_hours(data[7]);
+	}
+	return 1;
+}
+
+static int decode_prime(uint8_t *data, int family, history_record_t *r) {
+	r->time = pump_decode_time(&data[5]);
+	return 1;
+}
+
+static int decode_alarm(uint8_t *data, int family, history_record_t *r) {
+	r->time = pump_decode_time(&data[4]);
+	// Use insulin field to store alarm code.
+	r->insulin = data[1];
+	return 1;
+}
+
+static int decode_temp_basal_duration(uint8_t *data, int family, history_record_t *r) {
+	r->time = pump_decode_time(&data[2]);
+	r->duration = half_hours(data[1]);
+	return 1;
+}
+
+static int decode_temp_basal_rate(uint8_t *data, int family, history_record_t *r) {
+	r->time = pump_decode_time(&data[2]);
+	switch (data[7] >> 3) { // temp basal type
+	case ABSOLUTE:
+		r->insulin = int_to_insulin(((data[7] & 0x7) << 8) | data[1], 23);
 		return 1;
-	case ClearSettings:
-		REQUIRE_BYTES(7);
-		return 0;
-	case EnableChildBlock:
-		REQUIRE_BYTES(7);
-		return 0;
-	case MaxBolus:
-		REQUIRE_BYTES(7);
-		return 0;
-	case EnableRemote:
-		REQUIRE_BYTES(21);
-		return 0;
-	case MaxBasal:
-		REQUIRE_BYTES(7);
-		return 0;
-	case EnableBolusWizard:
-		REQUIRE_BYTES(7);
-		return 0;
-	case Unknown2E:
-		REQUIRE_BYTES(107);
-		return 0;
-	case BolusWizard512:
-		REQUIRE_BYTES(19);
-		return 0;
-	case UnabsorbedInsulin512:
-		REQUIRE_BYTES(data[1]);
-		return 0;
-	case ChangeBGReminder:
-		REQUIRE_BYTES(7);
-		return 0;
-	case SetAlarmClockTime:
-		REQUIRE_BYTES(7);
-		return 0;
-	case TempBasalRate:
-		REQUIRE_BYTES(8);
-		r->time = pump_decode_time(&data[2]);
-		switch (data[7] >> 3) { // temp basal type
-		case ABSOLUTE:
-			r->insulin = int_to_insulin(((data[7] & 0x7) << 8) | data[1], 23);
+	default:
+		if (data[1] == 0) {
+			r->insulin = 0;
 			return 1;
-		default:
-			if (data[1] == 0) {
-				r->insulin = 0;
-				return 1;
-			}
-			char ts[TIME_STRING_SIZE];
-			ESP_LOGE(TAG, "%3d percent temp basal in pump history at %s",
-				 data[1], time_string(r->time, ts));
-			return 0;
 		}
-	case LowReservoir:
-		REQUIRE_BYTES(7);
-		return 0;
-	case AlarmClock:
-		REQUIRE_BYTES(7);
-		return 0;
-	case ChangeMeterID:
-		REQUIRE_BYTES(21);
-		return 0;
-	case BGReceived512:
-		REQUIRE_BYTES(10);
-		return 0;
-	case ConfirmInsulinChange:
-		REQUIRE_BYTES(7);
-		return 0;
-	case SensorStatus:
-		REQUIRE_BYTES(7);
-		return 0;
-	case EnableMeter:
-		REQUIRE_BYTES(21);
-		return 0;
-	case BGReceived:
-		REQUIRE_BYTES(10);
-		return 0;
-	case MealMarker:
-		REQUIRE_BYTES(9);
-		return 0;
-	case ExerciseMarker:
-		REQUIRE_BYTES(8);
-		return 0;
-	case InsulinMarker:
-		REQUIRE_BYTES(8);
-		return 0;
-	case OtherMarker:
-		REQUIRE_BYTES(7);
-		return 0;
-	case EnableSensorAutoCal:
-		REQUIRE_BYTES(7);
-		return 0;
-	case ChangeBolusWizardSetup:
-		REQUIRE_BYTES(39);
-		return 0;
-	case SensorSetup:
-		REQUIRE_BYTES(family >= 51 ? 41 : 37);
-		return 0;
-	case Sensor51:
-		REQUIRE_BYTES(7);
+		char ts[TIME_STRING_SIZE];
+		ESP_LOGE(TAG, "%3d percent temp basal in pump history at %s",
+			 data[1], time_string(r->time, ts));
 		return 0;
-	case Sensor52:
-		REQUIRE_BYTES(7);
-		return 0;
-	case ChangeSensorAlarm:
-		REQUIRE_BYTES(8);
-		return 0;
-	case Sensor54:
-		REQUIRE_BYTES(64);
-		return 0;
-	case Sensor55:
-		REQUIRE_BYTES(55);
-		return 0;
-	case ChangeSensorAlert:
-		REQUIRE_BYTES(12);
-		return 0;
-	case ChangeBolusStep:
-		REQUIRE_BYTES(7);
-		return 0;
-	case BolusWizardSetup:
-		REQUIRE_BYTES(family <= 22 ? 124 : 144);
-		return 0;
-	case BolusWizard:
-		REQUIRE_BYTES(family <= 22 ? 20 : 22);
-		return 0;
-	case UnabsorbedInsulin:
-		REQUIRE_BYTES(data[1]);
-		return 0;
-	case SaveSettings:
-		REQUIRE_BYTES(7);
-		return 0;
-	case EnableVariableBolus:
-		REQUIRE_BYTES(7);
-		return 0;
-	case ChangeEasyBolus:
-		REQUIRE_BYTES(7);
-		return 0;
-	case EnableBGReminder:
-		REQUIRE_BYTES(7);
-		return 0;
-	case EnableAlarmClock:
-		REQUIRE_BYTES(7);
-		return 0;
-	case ChangeTempBasalType:
-		REQUIRE_BYTES(7);
-		return 0;
-	case ChangeAlarmType:
-		REQUIRE_BYTES(7);
-		return 0;
-	case ChangeTimeFormat:
-		REQUIRE_BYTES(7);
-		return 0;
-	case ChangeReservoirWarning:
-		REQUIRE_BYTES(7);
-		return 0;
-	case EnableBolusReminder:
-		REQUIRE_BYTES(7);
-		return 0;
-	case SetBolusReminderTime:
-		REQUIRE_BYTES(9);
-		return 0;
-	case DeleteBolusReminderTime:
-		REQUIRE_BYTES(9);
-		return 0;
-	case BolusReminder:
-		REQUIRE_BYTES(9);
-		return 0;
-	case DeleteAlarmClockTime:
-		REQUIRE_BYTES(7);
-		return 0;
-	case DailyTotal515:
-		REQUIRE_BYTES(38);
-		return 0;
-	case DailyTotal522:
-		REQUIRE_BYTES(44);
-		return 0;
-	case DailyTotal523:
-		REQUIRE_BYTES(52);
-		return 0;
-	case ChangeCarbUnits:
-		REQUIRE_BYTES(7);
-		return 0;
-	case BasalProfileStart:
-		REQUIRE_BYTES(10);
-		r->time = pump_decode_time(&data[2]);
-		// data[7] = starting half-hour
-		r->insulin = int_to_insulin(two_byte_le_int(&data[8]), 23);
-		return 1;
-	case ConnectOtherDevices:
-		REQUIRE_BYTES(7);
-		return 0;
-	case ChangeOtherDevice:
-		REQUIRE_BYTES(37);
-		return 0;
-	case ChangeMarriage:
-		REQUIRE_BYTES(12);
-		return 0;
-	case DeleteOtherDevice:
-		REQUIRE_BYTES(12);
-		return 0;
-	case EnableCaptureEvent:
-		REQUIRE_BYTES(7);
-		return 0;
-	default:
-		return UNKNOWN_RECORD_ERR;
 	}
 }
 
+static int decode_basal_profile_start(uint8_t *data, int family, history_record_t *r) {
+	r->time = pump_decode_time(&data[2]);
+	// data[7] = starting half-hour
+	r->insulin = int_to_insulin(two_byte_le_int(&data[8]), 23);
+	return 1;
+}
+
+static int decode_bolus_wizard(uint8_t *data, int family, history_record_t *r) {
+	bolus_wizard_t *w = &r->info.bolus_wizard;
+	r->time = pump_decode_time(&data[2]);
+	if (family <= 22) {
+		w->glucose = (data[8] & 0x0F) << 8 | data[1];
+		w->carbs = data[7];
+		w->carb_ratio = 10 * data[9];
+		w->sensitivity = data[10];
+		w->target_low = data[11];
+		w->correction = int_to_insulin(data[14] + (data[12] & 0x0F), family);
+		w->food = int_to_insulin(data[13], family);
+		w->unabsorbed = int_to_insulin(data[16], family);
+		w->estimate = int_to_insulin(data[18], family);
+		w->target_high = data[19];
+	} else {
+		w->glucose = (data[8] & 0x03) << 8 | data[1];
+		w->carbs = (data[8] & 0x0C) << 6 | data[7];
+		w->carb_ratio = (data[9] & 0x07) << 8 | data[10];
+		w->sensitivity = data[11];
+		w->target_low = data[12];
+		w->correction = int_to_insulin((data[16] & 0x38) << 5 | data[13], family);
+		w->food = int_to_insulin(two_byte_be_int(&data[14]), family);
+		w->unabsorbed = int_to_insulin(two_byte_be_int(&data[17]), family);
+		w->estimate = int_to_insulin(two_byte_be_int(&data[19]), family);
+		w->target_high = data[21];
+	}
+	r->insulin = w->estimate;
+	return 1;
+}
+
+// The 512 record has the x22 layout without the high target.
+static int decode_bolus_wizard_512(uint8_t *data, int family, history_record_t *r) {
+	bolus_wizard_t *w = &r->info.bolus_wizard;
+	r->time = pump_decode_time(&data[2]);
+	w->glucose = (data[8] & 0x0F) << 8 | data[1];
+	w->carbs = data[7];
+	w->carb_ratio = 10 * data[9];
+	w->sensitivity = data[10];
+	w->target_low = data[11];
+	w->target_high = data[11];
+	w->correction = int_to_insulin(data[14] + (data[12] & 0x0F), 22);
+	w->food = int_to_insulin(data[13], 22);
+	w->unabsorbed = int_to_insulin(data[16], 22);
+	w->estimate = int_to_insulin(data[18], 22);
+	r->insulin = w->estimate;
+	return 1;
+}
+
+// Each entry is 3 bytes: amount, and age in minutes (10 bits).
+static int decode_unabsorbed_insulin(uint8_t *data, int family, history_record_t *r) {
+	unabsorbed_insulin_t *u = &r->info.unabsorbed_insulin;
+	for (int i = 2; i + 3 <= r->length && u->count < MAX_UNABSORBED; i += 3) {
+		u->bolus[u->count].amount = int_to_insulin(data[i], 23);
+		u->bolus[u->count].age = (data[i+2] & 0x30) << 4 | data[i+1];
+		u->count++;
+	}
+	return 1;
+}
+
+// The low 3 bits of the glucose value are in the high bits of the hour.
+static int decode_bg_received(uint8_t *data, int family, history_record_t *r) {
+	bg_received_t *bg = &r->info.bg_received;
+	r->time = pump_decode_time(&data[2]);
+	bg->glucose = data[1] << 3 | data[4] >> 5;
+	memcpy(bg->meter, &data[7], sizeof(bg->meter));
+	return 1;
+}
+
+static int decode_meal_marker(uint8_t *data, int family, history_record_t *r) {
+	meal_marker_t *m = &r->info.meal_marker;
+	r->time = pump_decode_time(&data[2]);
+	m->carbs = (data[7] & 1) << 8 | data[8];
+	m->units = (data[7] >> 1) & 0x3;
+	return 1;
+}
+
+// Daily totals are stamped with a 2-byte date;
+// the record time is the start of that day.
+static int decode_daily_total(uint8_t *data, int family, history_record_t *r) {
+	struct tm tm = {
+		.tm_mday = data[1] & 0x1F,
+		.tm_mon = ((data[1] >> 5) << 1 | data[2] >> 7) - 1,
+		.tm_year = (data[2] & 0x7F) + 100,
+	};
+	r->time = make_local_time(&tm);
+	r->insulin = int_to_insulin(two_byte_be_int(&data[3]), 23);
+	return 1;
+}
+
+#define RECORD(type, x22, x23, x51, fn)	[type] = { x22, fn },
+static const record_info_t x22_records[256] = { HISTORY_RECORDS };
+#undef RECORD
+
+#define RECORD(type, x22, x23, x51, fn)	[type] = { x23, fn },
+static const record_info_t x23_records[256] = { HISTORY_RECORDS };
+#undef RECORD
+
+#define RECORD(type, x22, x23, x51, fn)	[type] = { x51, fn },
+static const record_info_t x51_records[256] = { HISTORY_RECORDS };
+#undef RECORD
+
+static const record_info_t *record_table(int family) {
+	if (family <= 22) {
+		return x22_records;
+	}
+	if (family < 51) {
+		return x23_records;
+	}
+	return x51_records;
+}
+
 static bool all_zero(uint8_t *data, int len) {
 	for (int i = 0; i < len; i++) {
 		if (data[i] != 0) {
@@ -346,33 +332,43 @@ void print_bytes(const char *msg, const uint8_t *data, int len) {
 }
 
 void pump_decode_history(uint8_t *page, int len, int family, history_record_fn_t decode_fn) {
+	const record_info_t *table = record_table(family);
 	uint8_t *data = page;
 	history_record_t rec;
 	while (len > 0) {
 		if (all_zero(data, len)) {
 			return;
 		}
-		int e = decode_history_record(data, len, family, &rec);
-		switch (e) {
-		case UNKNOWN_RECORD_ERR:
-			ESP_LOGE(TAG, "unknown history record type %02X", rec.type);
-			print_bytes("history data", data, len);
-			return;
-		case RECORD_SIZE_ERR:
-			ESP_LOGE(TAG, "history record type %02X would require %d bytes", rec.type, rec.length);
+		const record_info_t *info = &table[data[0]];
+		int n = info->length;
+		if (n == UNKNOWN) {
+			ESP_LOGE(TAG, "unknown history record type %02X", data[0]);
 			print_bytes("history data", data, len);
 			return;
-		default:
-			if (e < 0) {
-				ESP_LOGE(TAG, "history record type %02X: unknown error %d", rec.type, e);
+		}
+		if (n == VARIABLE) {
+			// The length includes the type and length bytes.
+			if (len < 2 || data[1] < 2) {
+				ESP_LOGE(TAG, "history record type %02X has invalid length", data[0]);
+				print_bytes("history data", data, len);
 				return;
 			}
-			break;
+			n = data[1];
 		}
-		if (e == 1 && decode_fn(&rec) != 0) {
+		if (n > len) {
+			ESP_LOGE(TAG, "history record type %02X would require %d bytes", data[0], n);
+			print_bytes("history data", data, len);
 			return;
 		}
-		data += rec.length;
-		len -= rec.length;
+		if (info->decode != 0) {
+			memset(&rec, 0, sizeof(rec));
+			rec.type = data[0];
+			rec.length = n;
+			if (info->decode(data, family, &rec) && decode_fn(&rec) != 0) {
+				return;
+			}
+		}
+		data += n;
+		len -= n;
 	}
 }
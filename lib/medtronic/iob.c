@@ -0,0 +1,246 @@
+#include <string.h>
+
+#include "iob.h"
+
+// Parameters of the bilinear activity curve for a 3-hour DIA.
+#define DEFAULT_DIA	3	// hours
+#define PEAK_MINUTES	75
+#define END_MINUTES	180
+
+static void compute_curve(iob_state_t *e) {
+	double scale = (double)DEFAULT_DIA / e->dia;
+	for (int k = 0; k <= IOB_BUCKETS; k++) {
+		double minutes = scale * k * IOB_BUCKET_SECONDS / 60;
+		double f;
+		if (minutes < PEAK_MINUTES) {
+			double x = minutes / 5 + 1;
+			f = 1 - 0.001852 * x * x + 0.001852 * x;
+		} else if (minutes < END_MINUTES) {
+			double x = (minutes - PEAK_MINUTES) / 5;
+			f = 0.001323 * x * x - 0.054233 * x + 0.55556;
+		} else {
+			f = 0;
+		}
+		if (f < 0) {
+			f = 0;
+		}
+		e->curve[k] = f * IOB_CURVE_ONE + 0.5;
+	}
+}
+
+// Fraction of a dose remaining after the given number of seconds,
+// in units of 1/IOB_CURVE_ONE.
+static int remaining(const iob_state_t *e, time_t age) {
+	if (age <= 0) {
+		return IOB_CURVE_ONE;
+	}
+	time_t k = age / IOB_BUCKET_SECONDS;
+	if (k >= IOB_BUCKETS) {
+		return 0;
+	}
+	int f = age % IOB_BUCKET_SECONDS;
+	int a = e->curve[k], b = e->curve[k + 1];
+	return a + (b - a) * f / IOB_BUCKET_SECONDS;
+}
+
+void iob_set_config(iob_state_t *e, const settings_t *settings, const basal_rate_t *rates, int len) {
+	int dia = settings->dia;
+	if (dia < MIN_DIA) {
+		dia = MIN_DIA;
+	} else if (dia > MAX_DIA) {
+		dia = MAX_DIA;
+	}
+	if (dia != e->dia) {
+		e->dia = dia;
+		compute_curve(e);
+	}
+	if (len > MAX_BASAL_RATES) {
+		len = MAX_BASAL_RATES;
+	}
+	memcpy(e->basal_rates, rates, len * sizeof(basal_rate_t));
+	basal_rate_index(&e->schedule, rates, len);
+}
+
+void iob_init(iob_state_t *e, const settings_t *settings, const basal_rate_t *rates, int len) {
+	memset(e, 0, sizeof(*e));
+	iob_set_config(e, settings, rates, len);
+}
+
+static time_t earlier(time_t a, time_t b) {
+	return a < b ? a : b;
+}
+
+// Called for each interval with a constant net basal rate (milliUnits/hour)
+// that lies within one bucket.
+typedef void (*segment_fn_t)(iob_state_t *e, time_t from, time_t to, insulin_t rate, void *arg);
+
+static void split_by_bucket(iob_state_t *e, time_t from, time_t to, insulin_t rate, segment_fn_t f, void *arg) {
+	while (from < to) {
+		time_t end = earlier(to, (from / IOB_BUCKET_SECONDS + 1) * IOB_BUCKET_SECONDS);
+		f(e, from, end, rate, arg);
+		from = end;
+	}
+}
+
+// Apply f to the net basal delivery from the given time until to,
+// assuming no further records. The state is not changed.
+static void for_each_segment(iob_state_t *e, time_t from, time_t to, segment_fn_t f, void *arg) {
+	// Insulin delivered longer ago than the maximum DIA doesn't matter.
+	time_t horizon = to - IOB_BUCKETS * IOB_BUCKET_SECONDS;
+	if (from < horizon) {
+		from = horizon;
+	}
+	while (from < to) {
+		time_t end = to;
+		insulin_t scheduled = 0;
+		if (from < e->profile_end) {
+			scheduled = e->profile_rate;
+			end = earlier(end, e->profile_end);
+		} else if (e->schedule.len != 0) {
+			int i = schedule_lookup(&e->schedule, from);
+			if (i >= 0) {
+				scheduled = e->basal_rates[i].rate;
+				end = earlier(end, next_change(&e->schedule, from));
+			} else {
+				end = earlier(end, from + e->schedule.start[0] - since_midnight(from));
+			}
+		}
+		insulin_t rate = 0;
+		if (!e->suspended) {
+			if (from < e->temp_end && e->temp_rate_time == e->temp_start) {
+				rate = e->temp_rate;
+				end = earlier(end, e->temp_end);
+			} else {
+				rate = scheduled;
+			}
+			if (from < e->extended_end) {
+				rate += e->extended_rate;
+				end = earlier(end, e->extended_end);
+			}
+		}
+		split_by_bucket(e, from, end, rate - scheduled, f, arg);
+		from = end;
+	}
+}
+
+// Net insulin delivered in the interval, in microUnits.
+static int64_t delivered(time_t from, time_t to, insulin_t rate) {
+	return (int64_t)rate * (to - from) * 1000 / 3600;
+}
+
+static void add_to_bucket(iob_state_t *e, time_t from, time_t to, insulin_t rate, void *arg) {
+	int64_t b = from / IOB_BUCKET_SECONDS;
+	if (b > e->newest_bucket) {
+		int64_t first = b - IOB_BUCKETS + 1;
+		if (first <= e->newest_bucket) {
+			first = e->newest_bucket + 1;
+		}
+		for (int64_t i = first; i <= b; i++) {
+			e->basal[i % IOB_BUCKETS] = 0;
+		}
+		e->newest_bucket = b;
+	} else if (b <= e->newest_bucket - IOB_BUCKETS) {
+		return;
+	}
+	e->basal[b % IOB_BUCKETS] += delivered(from, to, rate);
+}
+
+static void advance(iob_state_t *e, time_t t) {
+	if (t <= e->time) {
+		return;
+	}
+	for_each_segment(e, e->time, t, add_to_bucket, 0);
+	e->time = t;
+}
+
+void iob_record(iob_state_t *e, const history_record_t *r) {
+	if (e->time == 0) {
+		e->time = r->time;
+		e->newest_bucket = r->time / IOB_BUCKET_SECONDS;
+	}
+	if (r->time < e->time) {
+		return;
+	}
+	advance(e, r->time);
+	switch (r->type) {
+	case Bolus:
+		if (r->duration == 0) {
+			e->bolus[e->next_bolus] = (iob_bolus_t){ .time = r->time, .amount = r->insulin };
+			e->next_bolus = (e->next_bolus + 1) % MAX_IOB_BOLUSES;
+		} else {
+			e->extended_rate = (int64_t)r->insulin * 3600 / r->duration;
+			e->extended_end = r->time + r->duration;
+		}
+		break;
+	case TempBasalRate:
+		e->temp_rate = r->insulin;
+		e->temp_rate_time = r->time;
+		break;
+	case TempBasalDuration:
+		// A duration of 0 cancels the temp basal.
+		// The rate records of percent temp basals are not decoded,
+		// so a duration without a rate at the same time leaves
+		// the scheduled rate in effect rather than the previous temp rate.
+		e->temp_start = r->time;
+		e->temp_end = r->time + r->duration;
+		break;
+	case SuspendPump:
+		e->suspended = true;
+		break;
+	case ResumePump:
+		e->suspended = false;
+		break;
+	case BasalProfileStart:
+		// The pump's record of the scheduled rate takes precedence
+		// over the schedule until the next scheduled change.
+		if (e->schedule.len == 0) {
+			break;
+		}
+		e->profile_rate = r->insulin;
+		e->profile_end = next_change(&e->schedule, r->time);
+		break;
+	default:
+		break;
+	}
+}
+
+// Add the IOB at time *arg of a segment that has not been added to a bucket yet.
+typedef struct {
+	time_t t;
+	int64_t sum;
+} pending_t;
+
+static void add_pending(iob_state_t *e, time_t from, time_t to, insulin_t rate, void *arg) {
+	pending_t *p = arg;
+	time_t mid = from + (to - from) / 2;
+	p->sum += delivered(from, to, rate) * remaining(e, p->t - mid);
+}
+
+insulin_t iob_at(iob_state_t *e, time_t t) {
+	if (e->time == 0) {
+		return 0;
+	}
+	time_t dia = e->dia * 3600;
+	int64_t sum = 0;
+	for (int i = 0; i < MAX_IOB_BOLUSES; i++) {
+		iob_bolus_t *b = &e->bolus[i];
+		if (b->amount == 0 || t - b->time >= dia) {
+			continue;
+		}
+		sum += (int64_t)b->amount * 1000 * remaining(e, t - b->time);
+	}
+	for (int i = 0; i < IOB_BUCKETS; i++) {
+		int64_t b = e->newest_bucket - i;
+		int32_t amount = e->basal[b % IOB_BUCKETS];
+		if (amount == 0) {
+			continue;
+		}
+		time_t mid = b * IOB_BUCKET_SECONDS + IOB_BUCKET_SECONDS / 2;
+		sum += (int64_t)amount * remaining(e, t - mid);
+	}
+	pending_t p = { .t = t };
+	for_each_segment(e, e->time, t, add_pending, &p);
+	sum += p.sum;
+	int64_t scale = (int64_t)IOB_CURVE_ONE * 1000;
+	return (sum + (sum >= 0 ? scale / 2 : -scale / 2)) / scale;
+}
@@ -0,0 +1,76 @@
+#ifndef _IOB_H
+#define _IOB_H
+
+#include "medtronic.h"
+#include "pump_history.h"
+
+// Insulin on board, computed from pump history records.
+//
+// Boluses are tracked individually. Basal insulin is tracked as the
+// difference between the delivered and scheduled rates, accumulated
+// in 5-minute buckets, so temp basals and suspends contribute positive
+// or negative IOB and the scheduled basal contributes none.
+//
+// The remaining fraction of a dose is taken from a fixed-point table,
+// computed when the duration of insulin action changes, using the
+// bilinear activity curve from OpenAPS (peak at 75 minutes for a
+// 3-hour DIA, scaled for other durations).
+
+#define MIN_DIA			2	// hours
+#define MAX_DIA			8	// hours
+
+#define IOB_BUCKET_SECONDS	(5 * 60)
+#define IOB_BUCKETS		(MAX_DIA * 3600 / IOB_BUCKET_SECONDS)
+#define MAX_IOB_BOLUSES		32
+
+// Fraction of a dose remaining, in units of 1/IOB_CURVE_ONE.
+#define IOB_CURVE_ONE		(1 << 15)
+
+typedef struct {
+	time_t time;
+	insulin_t amount;
+} iob_bolus_t;
+
+typedef struct {
+	int dia;	// hours
+	uint16_t curve[IOB_BUCKETS + 1];	// remaining fraction after each 5-minute step
+
+	basal_rate_t basal_rates[MAX_BASAL_RATES];
+	schedule_index_t schedule;
+
+	time_t time;	// delivery is accounted for up to this time; 0 before the first record
+
+	iob_bolus_t bolus[MAX_IOB_BOLUSES];
+	int next_bolus;
+
+	// Net basal insulin delivered in each bucket, in microUnits.
+	int32_t basal[IOB_BUCKETS];
+	int64_t newest_bucket;
+
+	insulin_t temp_rate;	// milliUnits/hour
+	time_t temp_rate_time;	// time of the TempBasalRate record
+	time_t temp_start;	// time of the TempBasalDuration record
+	time_t temp_end;
+	insulin_t extended_rate;	// milliUnits/hour, for square-wave boluses
+	time_t extended_end;
+	insulin_t profile_rate;	// from BasalProfileStart, until the next scheduled change
+	time_t profile_end;
+	bool suspended;
+} iob_state_t;
+
+// Start with no insulin on board.
+void iob_init(iob_state_t *e, const settings_t *settings, const basal_rate_t *rates, int len);
+
+// Apply new settings or a new basal schedule, keeping the doses recorded so far.
+void iob_set_config(iob_state_t *e, const settings_t *settings, const basal_rate_t *rates, int len);
+
+// Account for a history record. Records must be given in chronological
+// order, each one once; records older than the last one are ignored.
+// The work done is independent of the amount of history already seen.
+void iob_record(iob_state_t *e, const history_record_t *r);
+
+// Return the insulin on board at time t, which must not be earlier than
+// the last record. Delivery is assumed to continue as last recorded.
+insulin_t iob_at(iob_state_t *e, time_t t);
+
+#endif // _IOB_H
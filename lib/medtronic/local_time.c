@@ -0,0 +1,200 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "medtronic.h"
+
+// Converting local times with mktime() and localtime() is slow,
+// because they consult the time zone rules every time. Instead, the UTC
+// offsets in effect during a year are found once with localtime() and
+// cached, and local times are converted by arithmetic on days since the epoch.
+// Times that fall in a transition (skipped or repeated by a DST change)
+// and out-of-range fields are still handled by mktime(), so the results
+// are always the same.
+
+#define SECONDS_PER_DAY		(24 * 60 * 60)
+
+// Intervals with a constant UTC offset within a year.
+#define MAX_INTERVALS		8
+
+typedef struct {
+	int year;		// local year covered, or 0 if unused
+	int num_intervals;	// 0 if the offsets could not be determined
+	time_t start[MAX_INTERVALS + 1];	// UTC; start[num_intervals] is the end
+	int offset[MAX_INTERVALS];	// seconds east of UTC
+} zone_year_t;
+
+#define NUM_ZONE_YEARS		2
+
+static zone_year_t zone_years[NUM_ZONE_YEARS];
+static int next_zone_year;
+
+#define MAX_TZ_LEN		64
+
+static char zone_name[MAX_TZ_LEN];
+
+// The interval of UTC times that fall on the same local day
+// as the last argument to since_midnight(), with the same UTC offset.
+static struct {
+	time_t start;
+	time_t end;
+	time_t midnight;
+} day_cache;
+
+// Days since 1970-01-01 of a date in the proleptic Gregorian calendar
+// (month is 1 to 12). See http://howardhinnant.github.io/date_algorithms.html
+static time_t days_from_civil(int y, int m, int d) {
+	y -= m <= 2;
+	int era = (y >= 0 ? y : y - 399) / 400;
+	int yoe = y - era * 400;
+	int doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+	int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return (time_t)era * 146097 + doe - 719468;
+}
+
+static int is_leap_year(int y) {
+	return y % 4 == 0 && (y % 100 != 0 || y % 400 == 0);
+}
+
+static int days_in_month(int m, int y) {
+	static const uint8_t days[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+	return days[m - 1] + (m == 2 && is_leap_year(y));
+}
+
+// Seconds since the epoch of a local date and time, as if it were UTC.
+static time_t civil_seconds(const struct tm *tm) {
+	time_t days = days_from_civil(tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday);
+	return days * SECONDS_PER_DAY + tm->tm_hour * 3600 + tm->tm_min * 60 + tm->tm_sec;
+}
+
+static int utc_offset_at(time_t t) {
+	struct tm tm;
+	localtime_r(&t, &tm);
+	return civil_seconds(&tm) - t;
+}
+
+// Find the first second in (lo, hi] with an offset different from lo.
+static time_t find_transition(time_t lo, time_t hi, int offset) {
+	while (hi - lo > 1) {
+		time_t mid = lo + (hi - lo) / 2;
+		if (utc_offset_at(mid) == offset) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	return hi;
+}
+
+// Record the offsets in effect from a day before to a day after the year,
+// so that every local time in the year is covered.
+static void build_zone_year(zone_year_t *z, int year) {
+	time_t t = (days_from_civil(year, 1, 1) - 1) * SECONDS_PER_DAY;
+	time_t end = (days_from_civil(year + 1, 1, 1) + 1) * SECONDS_PER_DAY;
+	z->year = year;
+	z->num_intervals = 1;
+	z->start[0] = t;
+	z->offset[0] = utc_offset_at(t);
+	while (t < end) {
+		// No time zone changes its offset more than once in a day.
+		time_t next = t + SECONDS_PER_DAY;
+		if (next > end) {
+			next = end;
+		}
+		int n = z->num_intervals - 1;
+		int offset = utc_offset_at(next);
+		if (offset != z->offset[n]) {
+			if (n + 1 == MAX_INTERVALS) {
+				z->num_intervals = 0;
+				return;
+			}
+			z->start[n + 1] = find_transition(t, next, z->offset[n]);
+			z->offset[n + 1] = offset;
+			z->num_intervals++;
+		}
+		t = next;
+	}
+	z->start[z->num_intervals] = end;
+}
+
+// The cache is discarded if the TZ environment variable changes.
+static void check_zone_name(void) {
+	const char *tz = getenv("TZ");
+	if (tz == 0) {
+		tz = "";
+	}
+	if (strncmp(tz, zone_name, sizeof(zone_name)) == 0) {
+		return;
+	}
+	strncpy(zone_name, tz, sizeof(zone_name));
+	memset(zone_years, 0, sizeof(zone_years));
+	memset(&day_cache, 0, sizeof(day_cache));
+	tzset();
+}
+
+static zone_year_t *zone_year(int year) {
+	check_zone_name();
+	for (int i = 0; i < NUM_ZONE_YEARS; i++) {
+		if (zone_years[i].year == year) {
+			return &zone_years[i];
+		}
+	}
+	zone_year_t *z = &zone_years[next_zone_year];
+	next_zone_year = (next_zone_year + 1) % NUM_ZONE_YEARS;
+	build_zone_year(z, year);
+	return z;
+}
+
+static time_t slow_local_time(const struct tm *tm) {
+	struct tm t = *tm;
+	t.tm_isdst = -1;
+	return mktime(&t);
+}
+
+time_t make_local_time(const struct tm *tm) {
+	int year = tm->tm_year + 1900;
+	if (tm->tm_mon < 0 || tm->tm_mon > 11 ||
+	    tm->tm_mday < 1 || tm->tm_mday > days_in_month(tm->tm_mon + 1, year) ||
+	    tm->tm_hour < 0 || tm->tm_hour > 23 ||
+	    tm->tm_min < 0 || tm->tm_min > 59 ||
+	    tm->tm_sec < 0 || tm->tm_sec > 59) {
+		return slow_local_time(tm);
+	}
+	zone_year_t *z = zone_year(year);
+	time_t local = civil_seconds(tm);
+	int matches = 0;
+	time_t t = -1;
+	for (int i = 0; i < z->num_intervals; i++) {
+		int offset = z->offset[i];
+		if (z->start[i] + offset <= local && local < z->start[i + 1] + offset) {
+			matches++;
+			t = local - offset;
+		}
+	}
+	if (matches != 1) {
+		return slow_local_time(tm);
+	}
+	return t;
+}
+
+time_of_day_t since_midnight(time_t t) {
+	check_zone_name();
+	if (day_cache.start <= t && t < day_cache.end) {
+		return t - day_cache.midnight;
+	}
+	struct tm tm;
+	localtime_r(&t, &tm);
+	time_of_day_t d = tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec;
+	time_t midnight = t - d;
+	day_cache.start = day_cache.end = 0;
+	zone_year_t *z = zone_year(tm.tm_year + 1900);
+	for (int i = 0; i < z->num_intervals; i++) {
+		if (z->start[i] <= t && t < z->start[i + 1]) {
+			time_t end = midnight + SECONDS_PER_DAY;
+			day_cache.start = midnight > z->start[i] ? midnight : z->start[i];
+			day_cache.end = end < z->start[i + 1] ? end : z->start[i + 1];
+			day_cache.midnight = midnight;
+			break;
+		}
+	}
+	return d;
+}
@@ -48,6 +48,43 @@ typedef struct {
 } status_t;
 #define STATUS_NORMAL	0x03
 
+// Status broadcast by x23 and newer pumps to a paired MySentry monitor.
+typedef struct {
+	uint8_t seq;
+	time_t clock;
+	insulin_t reservoir;
+	int reservoir_minutes;	// until the reservoir is empty
+	int battery_percent;
+	insulin_t iob;
+	glucose_t glucose;	// mg/dL, or 0 if there is no sensor reading
+	glucose_t prev_glucose;
+	time_t glucose_time;
+	int sensor_age;		// hours
+	int sensor_remaining;	// hours
+} mysentry_status_t;
+
+// Fields of a pump_snapshot_t, to select which ones pump_get_snapshot reads.
+typedef enum {
+	SNAPSHOT_CLOCK = 1 << 0,
+	SNAPSHOT_BATTERY = 1 << 1,
+	SNAPSHOT_RESERVOIR = 1 << 2,
+	SNAPSHOT_STATUS = 1 << 3,
+	SNAPSHOT_TEMP_BASAL = 1 << 4,
+	SNAPSHOT_SETTINGS = 1 << 5,
+	SNAPSHOT_ALL = (1 << 6) - 1,
+} snapshot_field_t;
+
+// The pump state read by pump_get_snapshot.
+typedef struct {
+	time_t clock;
+	int battery;		// milliVolts
+	insulin_t reservoir;
+	status_t status;
+	insulin_t temp_basal;
+	int temp_basal_minutes;
+	settings_t settings;
+} pump_snapshot_t;
+
 typedef struct {
 	time_of_day_t start;
 	insulin_t rate;
@@ -72,28 +109,177 @@ typedef struct {
 	glucose_t high;
 } target_t;
 
-void pump_set_id(const char *id);
-
-int pump_get_basal_rates(basal_rate_t *r, int len);
-int pump_get_battery(void);
-int pump_get_carb_ratios(carb_ratio_t *r, int len);
-carb_units_t pump_get_carb_units(void);
-time_t pump_get_clock(void);
-int pump_get_family(void);
-glucose_units_t pump_get_glucose_units(void);
-uint8_t *pump_get_history_page(int page_num);
-int pump_get_model(void);
-insulin_t pump_get_reservoir(void);
-int pump_get_sensitivities(sensitivity_t *r, int len);
-int pump_get_settings(settings_t *r);
-int pump_get_status(status_t *r);
-int pump_get_targets(target_t *r, int len);
-insulin_t pump_get_temp_basal(int *minutes);
-bool pump_wakeup(void);
-int pump_set_temp_basal(int duration_mins, insulin_t rate);
+// Maximum number of entries in each pump schedule.
+#define MAX_BASAL_RATES		48
+#define MAX_CARB_RATIOS		8
+#define MAX_SENSITIVITIES	8
+#define MAX_TARGETS		8
+
+typedef enum {
+	CONFIG_BASAL_RATES,
+	CONFIG_CARB_RATIOS,
+	CONFIG_SENSITIVITIES,
+	CONFIG_TARGETS,
+	CONFIG_SETTINGS,
+	NUM_CONFIG_ITEMS,
+} config_item_t;
+
+// Cached copy of the pump's configuration.
+// An item is valid if its bit (1 << config_item_t) is set,
+// and is only invalidated by a history record that changes it.
+typedef struct {
+	uint16_t version;
+	uint8_t pump_id[3];
+	uint8_t valid;
+	// Times are by the pump's clock, so that they can be compared with
+	// history records regardless of the device's clock.
+	time_t history_time;			// newest history record seen
+	time_t fetched[NUM_CONFIG_ITEMS];	// history_time when each item was read
+	int num_basal_rates;
+	basal_rate_t basal_rates[MAX_BASAL_RATES];
+	int num_carb_ratios;
+	carb_ratio_t carb_ratios[MAX_CARB_RATIOS];
+	int num_sensitivities;
+	sensitivity_t sensitivities[MAX_SENSITIVITIES];
+	int num_targets;
+	target_t targets[MAX_TARGETS];
+	settings_t settings;
+} pump_config_t;
+
+// Response time statistics for one kind of command packet,
+// used to set receive timeouts (see RFC 6298).
+typedef struct {
+	uint8_t command;
+	bool long_packet;
+	int samples;
+	int srtt;		// smoothed response time, in 1/8 milliseconds
+	int rttvar;		// smoothed mean deviation, in 1/4 milliseconds
+	int timeout;		// current receive timeout, in milliseconds
+	int no_response;	// count of tries with no response
+	int bad_response;	// count of tries with corrupted responses
+} pump_rtt_t;
+
+#define MAX_RTT_ENTRIES	24
+
+// Fragments of a history page received so far, so that a failed
+// download can be resumed without discarding them.
+typedef struct {
+	uint8_t command;
+	int page_num;		// -1 if there is no download in progress
+	uint16_t received;	// bit i is set if fragment i+1 has been received
+	int crc_fragments;	// number of leading fragments included in crc
+	uint16_t crc;		// running CRC-16 of those fragments
+} page_download_t;
+
+// A pump session holds the pump ID, what is known about the pump's state,
+// and the buffers used to encode commands and decode responses.
+// The buffers are allocated from an arena supplied by the caller,
+// so independent sessions do not share any state.
+// Data returned by a command points into the session's buffers
+// and remains valid until the next command in the same session.
+typedef struct {
+	uint8_t pump_id[3];
+	int model;		// 0 until the model has been read
+	int family;		// 0 until the model has been read
+	int awake_duration;	// milliseconds
+	int64_t last_heard;	// monotonic_ms() of the last response
+	bool heard;
+	uint8_t *short_buf;
+	uint8_t *long_buf;
+	uint8_t *rx_buf;
+	uint8_t *response_buf;
+	uint8_t *page_buf;
+	pump_config_t *config;	// optional
+	int min_timeout;	// milliseconds
+	int max_timeout;	// milliseconds
+	int num_rtt;
+	pump_rtt_t rtt[MAX_RTT_ENTRIES];
+	page_download_t download;
+	bool have_broadcast;
+	int64_t broadcast_time;	// monotonic_ms() when the broadcast was received
+	mysentry_status_t broadcast;
+} pump_session_t;
+
+#define PUMP_SESSION_ARENA_SIZE	(11 + 107 + 150 + 100 + 1024)
+
+// Initialize a session for the pump with the given (hex) ID.
+// Return -1 if the arena is smaller than PUMP_SESSION_ARENA_SIZE.
+int pump_session_init(pump_session_t *s, const char *id, uint8_t *arena, int len);
+
+// Set the limits for receive timeouts derived from observed response times.
+// Setting both to the same value disables adaptive timeouts.
+void pump_set_timeout_limits(pump_session_t *s, int min_ms, int max_ms);
+
+// Return the response time statistics collected by the session.
+const pump_rtt_t *pump_rtt_stats(pump_session_t *s, int *count);
+
+// Attach a configuration cache to the session, restoring it from flash.
+// The basal rate, carb ratio, sensitivity, target, and settings
+// getters are then answered from the cache when possible.
+void pump_config_attach(pump_session_t *s, pump_config_t *c);
+
+// Invalidate all cached configuration items.
+void pump_config_invalidate(pump_session_t *s);
+
+// Persistent storage for the configuration cache (NVS on the ESP32).
+// pump_config_load returns 0 on success.
+int pump_config_load(pump_config_t *c);
+void pump_config_save(const pump_config_t *c);
+
+int pump_get_basal_rates(pump_session_t *s, basal_rate_t *r, int len);
+int pump_get_battery(pump_session_t *s);
+int pump_get_carb_ratios(pump_session_t *s, carb_ratio_t *r, int len);
+carb_units_t pump_get_carb_units(pump_session_t *s);
+time_t pump_get_clock(pump_session_t *s);
+int pump_get_family(pump_session_t *s);
+uint8_t *pump_get_glucose_page(pump_session_t *s, int page_num);
+// Get the numbers of the oldest and newest glucose history pages.
+// Return 0 on success, -1 on error.
+int pump_get_glucose_page_range(pump_session_t *s, int *first, int *last);
+glucose_units_t pump_get_glucose_units(pump_session_t *s);
+uint8_t *pump_get_history_page(pump_session_t *s, int page_num);
+int pump_get_model(pump_session_t *s);
+// Return the model read earlier in this session, or before the last
+// deep sleep while the pump was still awake, or 0 if it is not known.
+int pump_cached_model(pump_session_t *s);
+insulin_t pump_get_reservoir(pump_session_t *s);
+int pump_get_sensitivities(pump_session_t *s, sensitivity_t *r, int len);
+int pump_get_settings(pump_session_t *s, settings_t *r);
+// Read the selected fields (a mask of snapshot_field_t) in one batch
+// of exchanges, using the cached settings and a recent status broadcast
+// when possible. Fields that were not selected or could not be read are -1
+// (or zero, for the status and settings). Return 0 if every selected field
+// was read, otherwise -1.
+int pump_get_snapshot(pump_session_t *s, int fields, pump_snapshot_t *r);
+int pump_get_status(pump_session_t *s, status_t *r);
+int pump_get_targets(pump_session_t *s, target_t *r, int len);
+insulin_t pump_get_temp_basal(pump_session_t *s, int *minutes);
+// The awake window and model are kept in RTC memory, so a session
+// started after deep sleep doesn't need to wake the pump again.
+bool pump_wakeup(pump_session_t *s);
+bool pump_is_awake(pump_session_t *s);
+int pump_awake_remaining(pump_session_t *s);
+void pump_set_awake_duration(pump_session_t *s, int seconds);
+bool pump_keep_alive(pump_session_t *s);
+int pump_set_temp_basal(pump_session_t *s, int duration_mins, insulin_t rate);
+
+// Decode a MySentry status packet (without its CRC byte) from the session's pump.
+// Return 0 on success, -1 if the packet is not one.
+int mysentry_decode_status(pump_session_t *s, uint8_t *pkt, int len, mysentry_status_t *m);
+
+// Wait up to timeout milliseconds for a packet broadcast by the pump.
+// A status broadcast is acknowledged, so the pump does not repeat it,
+// and saved in the session. Return true if one was received.
+bool pump_listen(pump_session_t *s, int timeout);
+
+// Return the last status broadcast by the pump if it was received
+// within max_age milliseconds, otherwise 0.
+const mysentry_status_t *pump_broadcast_status(pump_session_t *s, int max_age);
 
 time_of_day_t since_midnight(time_t t);
-time_t next_change(basal_rate_t *schedule, int len, time_t t);
+
+// Equivalent to mktime() with tm_isdst = -1, but faster, and tm is not modified.
+time_t make_local_time(const struct tm *tm);
 
 #define DECLARE_SCHEDULE_LOOKUP(type)	int type##_at(type##_t *r, int len, time_t t)
 
@@ -102,6 +288,32 @@ DECLARE_SCHEDULE_LOOKUP(carb_ratio);
 DECLARE_SCHEDULE_LOOKUP(sensitivity);
 DECLARE_SCHEDULE_LOOKUP(target);
 
+// A schedule compiled for constant-time lookups.
+// Pump schedules change on half-hour boundaries, so the entry in effect
+// at the start of each half hour is recorded; entries that start at
+// other times are handled by checking the following entries.
+#define SCHEDULE_SLOTS		48
+#define MAX_SCHEDULE_ENTRIES	MAX_BASAL_RATES
+
+typedef struct {
+	int len;
+	int8_t slot[SCHEDULE_SLOTS];	// -1 if no entry is in effect yet
+	time_of_day_t start[MAX_SCHEDULE_ENTRIES];
+} schedule_index_t;
+
+#define DECLARE_SCHEDULE_INDEX(type)	void type##_index(schedule_index_t *x, const type##_t *r, int len)
+
+DECLARE_SCHEDULE_INDEX(basal_rate);
+DECLARE_SCHEDULE_INDEX(carb_ratio);
+DECLARE_SCHEDULE_INDEX(sensitivity);
+DECLARE_SCHEDULE_INDEX(target);
+
+// Return the index of the entry in effect at time t, or -1 if none.
+int schedule_lookup(const schedule_index_t *x, time_t t);
+
+// Return the time when the next scheduled entry will take effect (strictly after t).
+time_t next_change(const schedule_index_t *x, time_t t);
+
 // YYYY-MM-DD HH:MM:SS
 #define TIME_STRING_SIZE	20
 char *time_string(time_t t, char *buf);
@@ -0,0 +1,49 @@
+#include "medtronic.h"
+#include "commands.h"
+
+// The status body layout follows the MySentry support in
+// github.com/ps2/rileylink_ios (MinimedKit).
+
+#define HEADER_LENGTH		5
+#define STATUS_LENGTH		36
+
+// Decode a 6-byte MySentry timestamp.
+static time_t decode_mysentry_time(const uint8_t *data) {
+	struct tm tm = {
+		.tm_hour = data[0] & 0x1F,
+		.tm_min = data[1] & 0x3F,
+		.tm_sec = data[2] & 0x3F,
+		.tm_year = (data[3] & 0x7F) + 100,
+		.tm_mon = (data[4] & 0x0F) - 1,
+		.tm_mday = data[5] & 0x1F,
+	};
+	return make_local_time(&tm);
+}
+
+// Glucose values are 9 bits, with the low bits of both readings in data[24]:
+// bit 2 for the current reading and bit 1 for the previous one.
+// Values below 40 are sensor states rather than readings.
+static glucose_t decode_glucose(int high, int low_bit) {
+	int g = high << 1 | low_bit;
+	return g < 40 ? 0 : g;
+}
+
+int mysentry_decode_status(pump_session_t *s, uint8_t *pkt, int len, mysentry_status_t *m) {
+	if (len < HEADER_LENGTH + STATUS_LENGTH || pkt[0] != MYSENTRY_DEVICE ||
+	    memcmp(&pkt[1], s->pump_id, sizeof(s->pump_id)) != 0 || pkt[4] != MYSENTRY_STATUS) {
+		return -1;
+	}
+	uint8_t *data = &pkt[HEADER_LENGTH];
+	m->seq = data[0];
+	m->clock = decode_mysentry_time(&data[2]);
+	m->glucose = decode_glucose(data[9], (data[24] >> 2) & 0x1);
+	m->prev_glucose = decode_glucose(data[10], (data[24] >> 1) & 0x1);
+	m->reservoir = int_to_insulin(two_byte_be_int(&data[12]), 23);
+	m->battery_percent = data[14] * 100 / 4;
+	m->reservoir_minutes = two_byte_be_int(&data[16]);
+	m->sensor_age = data[18];
+	m->sensor_remaining = data[19];
+	m->iob = int_to_insulin(two_byte_be_int(&data[22]), 23);
+	m->glucose_time = m->glucose ? decode_mysentry_time(&data[28]) : 0;
+	return 0;
+}
@@ -1,3 +1,5 @@
+#include <stdlib.h>
+
 #include "medtronic.h"
 #include "commands.h"
 
@@ -14,18 +16,16 @@ static inline glucose_t int_to_glucose(int n, glucose_units_t units) {
 	}
 }
 
-static int cached_pump_family;
-
-int pump_get_family(void) {
-	if (cached_pump_family == 0) {
-		pump_get_model();
+int pump_get_family(pump_session_t *s) {
+	if (s->family == 0) {
+		pump_get_model(s);
 	}
-	return cached_pump_family;
+	return s->family;
 }
 
-int pump_get_basal_rates(basal_rate_t *r, int len) {
+int pump_read_basal_rates(pump_session_t *s, basal_rate_t *r, int len) {
 	int n;
-	uint8_t *data = extended_response(CMD_BASAL_RATES, &n);
+	uint8_t *data = extended_response(s, CMD_BASAL_RATES, &n);
 	int count = 0;
 	for (int i = 0; i < n - 2 && count < len; i += 3, count++, r++) {
 		int rate = int_to_insulin(two_byte_le_int(&data[i]), 23);
@@ -40,32 +40,35 @@ int pump_get_basal_rates(basal_rate_t *r, int len) {
 	return count;
 }
 
-int pump_get_battery(void) {
-	int n;
-	uint8_t *data = short_command(CMD_BATTERY, &n);
+static int decode_battery(uint8_t *data, int n) {
 	if (!data || n < 4 || data[0] != 3) {
 		return -1;
 	}
 	return two_byte_be_int(&data[2]) * 10;
 }
 
-int pump_get_carb_ratios(carb_ratio_t *r, int len) {
-	// Call this before the main command so the response buffer isn't overwritten.
-	int fam = pump_get_family();
+int pump_get_battery(pump_session_t *s) {
 	int n;
-	uint8_t *data = short_command(CMD_CARB_RATIOS, &n);
+	uint8_t *data = short_command(s, CMD_BATTERY, &n);
+	return decode_battery(data, n);
+}
+
+int pump_read_carb_ratios(pump_session_t *s, carb_ratio_t *r, int len) {
+	int fam = pump_get_family(s);
+	int n;
+	uint8_t *data = short_command(s, CMD_CARB_RATIOS, &n);
 	if (!data || n < 2) {
-		ESP_LOGE(TAG, "pump_get_carb_ratios: data %p length %d", data, n);
+		ESP_LOGE(TAG, "pump_read_carb_ratios: data %p length %d", data, n);
 		return 0;
 	}
 	int step = fam <= 22 ? 2 : 3;
 	int num = data[0] - 1;
 	if (step + num >= n) {
-		ESP_LOGE(TAG, "pump_get_carb_ratios: invalid length field (%d) for %d-byte packet", num, n);
+		ESP_LOGE(TAG, "pump_read_carb_ratios: invalid length field (%d) for %d-byte packet", num, n);
 		return 0;
 	}
 	if (num % step != 0) {
-		ESP_LOGE(TAG, "pump_get_carb_ratios: length field (%d) not divisible by %d", num, step);
+		ESP_LOGE(TAG, "pump_read_carb_ratios: length field (%d) not divisible by %d", num, step);
 		return 0;
 	}
 	carb_units_t units = data[1];
@@ -88,7 +91,7 @@ int pump_get_carb_ratios(carb_ratio_t *r, int len) {
 				r->ratio = 100 * v;
 				break;
 			default:
-				ESP_LOGE(TAG, "pump_get_carb_ratios: unknown carb unit %d", units);
+				ESP_LOGE(TAG, "pump_read_carb_ratios: unknown carb unit %d", units);
 				return 0;
 			}
 		} else {
@@ -98,18 +101,16 @@ int pump_get_carb_ratios(carb_ratio_t *r, int len) {
 	return count;
 }
 
-carb_units_t pump_get_carb_units(void) {
+carb_units_t pump_get_carb_units(pump_session_t *s) {
 	int n;
-	uint8_t *data = short_command(CMD_CARB_UNITS, &n);
+	uint8_t *data = short_command(s, CMD_CARB_UNITS, &n);
 	if (!data || n < 2 || data[0] != 1) {
 		return -1;
 	}
 	return data[1];
 }
 
-time_t pump_get_clock(void) {
-	int n;
-	uint8_t *data = short_command(CMD_CLOCK, &n);
+static time_t decode_clock(uint8_t *data, int n) {
 	if (!data || n < 8 || data[0] != 7) {
 		return -1;
 	}
@@ -120,23 +121,51 @@ time_t pump_get_clock(void) {
 		.tm_year = two_byte_be_int(&data[4]) - 1900,
 		.tm_mon = data[6] - 1,
 		.tm_mday = data[7],
-		.tm_isdst = -1,
 	};
-	return mktime(&tm);
+	return make_local_time(&tm);
+}
+
+time_t pump_get_clock(pump_session_t *s) {
+	int n;
+	uint8_t *data = short_command(s, CMD_CLOCK, &n);
+	return decode_clock(data, n);
 }
 
-glucose_units_t pump_get_glucose_units(void) {
+uint8_t *pump_get_glucose_page(pump_session_t *s, int page_num) {
 	int n;
-	uint8_t *data = short_command(CMD_GLUCOSE_UNITS, &n);
+	uint8_t *data = download_page(s, CMD_GLUCOSE_PAGE, page_num, &n);
+	if (data == 0 || n != HISTORY_PAGE_SIZE) {
+		ESP_LOGE(TAG, "pump_get_glucose_page: data %p length %d", data, n);
+		return 0;
+	}
+	return data;
+}
+
+int pump_get_glucose_page_range(pump_session_t *s, int *first, int *last) {
+	int n;
+	uint8_t *data = short_command(s, CMD_GLUCOSE_PAGES, &n);
+	if (!data || n < 7 || data[0] < 6) {
+		return -1;
+	}
+	int current = data[1] << 24 | data[2] << 16 | data[3] << 8 | data[4];
+	int count = two_byte_be_int(&data[5]);
+	*last = current;
+	*first = count > 0 && count <= current + 1 ? current - count + 1 : current;
+	return 0;
+}
+
+glucose_units_t pump_get_glucose_units(pump_session_t *s) {
+	int n;
+	uint8_t *data = short_command(s, CMD_GLUCOSE_UNITS, &n);
 	if (!data || n < 2 || data[0] != 1) {
 		return -1;
 	}
 	return data[1];
 }
 
-uint8_t *pump_get_history_page(int page_num) {
+uint8_t *pump_get_history_page(pump_session_t *s, int page_num) {
 	int n;
-	uint8_t *data = download_page(CMD_HISTORY, page_num, &n);
+	uint8_t *data = download_page(s, CMD_HISTORY, page_num, &n);
 	if (data == 0 || n != HISTORY_PAGE_SIZE) {
 		ESP_LOGE(TAG, "pump_get_history_page: data %p length %d", data, n);
 		return 0;
@@ -144,9 +173,9 @@ uint8_t *pump_get_history_page(int page_num) {
 	return data;
 }
 
-int pump_get_model(void) {
+int pump_get_model(pump_session_t *s) {
 	int n;
-	uint8_t *data = short_command(CMD_MODEL, &n);
+	uint8_t *data = short_command(s, CMD_MODEL, &n);
 	if (!data || n < 2) {
 		return -1;
 	}
@@ -158,15 +187,20 @@ int pump_get_model(void) {
 	for (int i = 2; i < 2 + k; i++) {
 		model = 10*model + data[i] - '0';
 	}
-	cached_pump_family = model % 100;
+	s->model = model;
+	s->family = model % 100;
+	pump_save_awake_window(s);
 	return model;
 }
 
-insulin_t pump_get_reservoir(void) {
-	// Call this before the main command so the response buffer isn't overwritten.
-	int fam = pump_get_family();
-	int n;
-	uint8_t *data = short_command(CMD_RESERVOIR, &n);
+int pump_cached_model(pump_session_t *s) {
+	return s->model;
+}
+
+// A status broadcast this recent is used instead of asking the pump.
+#define BROADCAST_MAX_AGE	(5 * 60 * 1000)	// milliseconds
+
+static insulin_t decode_reservoir(uint8_t *data, int n, int fam) {
 	if (!data) {
 		return -1;
 	}
@@ -182,20 +216,31 @@ insulin_t pump_get_reservoir(void) {
 	return two_byte_be_int(&data[3]) * 25;
 }
 
-int pump_get_sensitivities(sensitivity_t *r, int len) {
+insulin_t pump_get_reservoir(pump_session_t *s) {
+	const mysentry_status_t *m = pump_broadcast_status(s, BROADCAST_MAX_AGE);
+	if (m != 0) {
+		return m->reservoir;
+	}
+	int fam = pump_get_family(s);
+	int n;
+	uint8_t *data = short_command(s, CMD_RESERVOIR, &n);
+	return decode_reservoir(data, n, fam);
+}
+
+int pump_read_sensitivities(pump_session_t *s, sensitivity_t *r, int len) {
 	int n;
-	uint8_t *data = short_command(CMD_SENSITIVITIES, &n);
+	uint8_t *data = short_command(s, CMD_SENSITIVITIES, &n);
 	if (!data || n < 2) {
-		ESP_LOGE(TAG, "pump_get_sensitivities: data %p length %d", data, n);
+		ESP_LOGE(TAG, "pump_read_sensitivities: data %p length %d", data, n);
 		return 0;
 	}
 	int num = data[0] - 1;
 	if (2 + num >= n) {
-		ESP_LOGE(TAG, "pump_get_sensitivities: invalid length field (%d) for %d-byte packet", num, n);
+		ESP_LOGE(TAG, "pump_read_sensitivities: invalid length field (%d) for %d-byte packet", num, n);
 		return 0;
 	}
 	if (num % 2 != 0) {
-		ESP_LOGE(TAG, "pump_get_sensitivities: length field (%d) not divisible by 2", num);
+		ESP_LOGE(TAG, "pump_read_sensitivities: length field (%d) not divisible by 2", num);
 		return 0;
 	}
 	glucose_units_t units = data[1];
@@ -207,20 +252,19 @@ int pump_get_sensitivities(sensitivity_t *r, int len) {
 		if (t == 0 && count != 0) {
 			break;
 		}
-		int s = (((v >> 6) & 0x1) << 8) | data[i + 1];
+		int sens = (((v >> 6) & 0x1) << 8) | data[i + 1];
 		r->start = half_hours(t);
 		r->units = units;
-		r->sensitivity = int_to_glucose(s, units);
+		r->sensitivity = int_to_glucose(sens, units);
 	}
 	return count;
 }
 
-int pump_get_settings(settings_t *r) {
-	// Call this before the main command so the response buffer isn't overwritten.
-	int fam = pump_get_family();
-	command_t cmd = fam <= 12 ? CMD_SETTINGS_512 : CMD_SETTINGS;
-	int n;
-	uint8_t *data = short_command(cmd, &n);
+static command_t settings_command(int fam) {
+	return fam <= 12 ? CMD_SETTINGS_512 : CMD_SETTINGS;
+}
+
+static int decode_settings(uint8_t *data, int n, int fam, settings_t *r) {
 	if (fam <= 12) {
 		if (!data || n < 19 || data[0] != 18) {
 			return -1;
@@ -248,9 +292,14 @@ int pump_get_settings(settings_t *r) {
 	return 0;
 }
 
-int pump_get_status(status_t *r) {
+int pump_read_settings(pump_session_t *s, settings_t *r) {
+	int fam = pump_get_family(s);
 	int n;
-	uint8_t *data = short_command(CMD_STATUS, &n);
+	uint8_t *data = short_command(s, settings_command(fam), &n);
+	return decode_settings(data, n, fam, r);
+}
+
+static int decode_status(uint8_t *data, int n, status_t *r) {
 	if (!data || n < 4 || data[0] != 3) {
 		return -1;
 	}
@@ -260,24 +309,29 @@ int pump_get_status(status_t *r) {
 	return 0;
 }
 
-int pump_get_targets(target_t *r, int len) {
-	// Call this before the main command so the response buffer isn't overwritten.
-	int fam = pump_get_family();
+int pump_get_status(pump_session_t *s, status_t *r) {
+	int n;
+	uint8_t *data = short_command(s, CMD_STATUS, &n);
+	return decode_status(data, n, r);
+}
+
+int pump_read_targets(pump_session_t *s, target_t *r, int len) {
+	int fam = pump_get_family(s);
 	command_t cmd = fam <= 12 ? CMD_TARGETS_512 : CMD_TARGETS;
 	int n;
-	uint8_t *data = short_command(cmd, &n);
+	uint8_t *data = short_command(s, cmd, &n);
 	if (!data || n < 2) {
-		ESP_LOGE(TAG, "pump_get_targets: data %p length %d", data, n);
+		ESP_LOGE(TAG, "pump_read_targets: data %p length %d", data, n);
 		return 0;
 	}
 	int step = fam <= 12 ? 2 : 3;
 	int num = data[0] - 1;
 	if (step + num >= n) {
-		ESP_LOGE(TAG, "pump_get_targets: invalid length field (%d) for %d-byte packet", num, n);
+		ESP_LOGE(TAG, "pump_read_targets: invalid length field (%d) for %d-byte packet", num, n);
 		return 0;
 	}
 	if (num % step != 0) {
-		ESP_LOGE(TAG, "pump_get_targets: length field (%d) not divisible by %d", num, step);
+		ESP_LOGE(TAG, "pump_read_targets: length field (%d) not divisible by %d", num, step);
 		return 0;
 	}
 	glucose_units_t units = data[1];
@@ -296,9 +350,7 @@ int pump_get_targets(target_t *r, int len) {
 	return count;
 }
 
-insulin_t pump_get_temp_basal(int *minutes) {
-	int n;
-	uint8_t *data = short_command(CMD_TEMP_BASAL, &n);
+static insulin_t decode_temp_basal(uint8_t *data, int n, int *minutes) {
 	if (!data || n < 7 || data[0] != 6) {
 		return -1;
 	}
@@ -310,6 +362,98 @@ insulin_t pump_get_temp_basal(int *minutes) {
 	return two_byte_be_int(&data[3]) * 25;
 }
 
+insulin_t pump_get_temp_basal(pump_session_t *s, int *minutes) {
+	int n;
+	uint8_t *data = short_command(s, CMD_TEMP_BASAL, &n);
+	return decode_temp_basal(data, n, minutes);
+}
+
+int pump_get_snapshot(pump_session_t *s, int fields, pump_snapshot_t *r) {
+	memset(r, 0, sizeof(*r));
+	r->clock = -1;
+	r->battery = -1;
+	r->reservoir = -1;
+	r->temp_basal = -1;
+	int fam = pump_get_family(s);
+	if (fam == 0) {
+		return -1;
+	}
+	command_t cmds[MAX_BATCH_COMMANDS];
+	int count = 0;
+	if (fields & SNAPSHOT_CLOCK) {
+		cmds[count++] = CMD_CLOCK;
+	}
+	if (fields & SNAPSHOT_BATTERY) {
+		cmds[count++] = CMD_BATTERY;
+	}
+	if (fields & SNAPSHOT_RESERVOIR) {
+		const mysentry_status_t *m = pump_broadcast_status(s, BROADCAST_MAX_AGE);
+		if (m != 0) {
+			r->reservoir = m->reservoir;
+		} else {
+			cmds[count++] = CMD_RESERVOIR;
+		}
+	}
+	if (fields & SNAPSHOT_STATUS) {
+		cmds[count++] = CMD_STATUS;
+	}
+	if (fields & SNAPSHOT_TEMP_BASAL) {
+		cmds[count++] = CMD_TEMP_BASAL;
+	}
+	if (fields & SNAPSHOT_SETTINGS) {
+		const settings_t *cached = pump_cached_settings(s);
+		if (cached != 0) {
+			r->settings = *cached;
+		} else {
+			cmds[count++] = settings_command(fam);
+		}
+	}
+	if (count == 0) {
+		return 0;
+	}
+	uint8_t *data[MAX_BATCH_COMMANDS];
+	int lens[MAX_BATCH_COMMANDS];
+	short_commands(s, cmds, count, data, lens);
+	// Decode the responses now that the pump is no longer waiting.
+	int err = 0;
+	for (int i = 0; i < count; i++) {
+		uint8_t *d = data[i];
+		int n = lens[i];
+		switch (cmds[i]) {
+		case CMD_CLOCK:
+			r->clock = decode_clock(d, n);
+			err |= r->clock == -1;
+			break;
+		case CMD_BATTERY:
+			r->battery = decode_battery(d, n);
+			err |= r->battery == -1;
+			break;
+		case CMD_RESERVOIR:
+			r->reservoir = decode_reservoir(d, n, fam);
+			err |= r->reservoir == -1;
+			break;
+		case CMD_STATUS:
+			err |= decode_status(d, n, &r->status) != 0;
+			break;
+		case CMD_TEMP_BASAL:
+			r->temp_basal = decode_temp_basal(d, n, &r->temp_basal_minutes);
+			err |= r->temp_basal == -1;
+			break;
+		case CMD_SETTINGS:
+		case CMD_SETTINGS_512:
+			if (decode_settings(d, n, fam, &r->settings) != 0) {
+				err = 1;
+				break;
+			}
+			pump_cache_settings(s, &r->settings);
+			break;
+		default:
+			assert(0);
+		}
+	}
+	return err ? -1 : 0;
+}
+
 #define MAX_BASAL	34000	// milliUnits
 
 uint16_t encode_basal_rate(insulin_t rate, int family) {
@@ -333,7 +477,7 @@ uint16_t encode_basal_rate(insulin_t rate, int family) {
 	return actual / 25;
 }
 
-int pump_set_temp_basal(int duration_mins, insulin_t rate) {
+int pump_set_temp_basal(pump_session_t *s, int duration_mins, insulin_t rate) {
 	if (duration_mins % 30 != 0) {
 		ESP_LOGE(TAG, "temp basal duration (%d) must be a multiple of 30m", duration_mins);
 		return -1;
@@ -346,8 +490,8 @@ int pump_set_temp_basal(int duration_mins, insulin_t rate) {
 		ESP_LOGE(TAG, "temp basal rate (%d) is larger than %d", rate, MAX_BASAL);
 		return -1;
 	}
-	uint16_t strokes = encode_basal_rate(rate, pump_get_family());
+	uint16_t strokes = encode_basal_rate(rate, pump_get_family(s));
 	uint8_t params[] = { strokes >> 8, strokes & 0xFF, half_hours };
 	int n;
-	return long_command(CMD_SET_ABS_TEMP_BASAL, params, sizeof(params), &n) ? 0 : -1;
+	return long_command(s, CMD_SET_ABS_TEMP_BASAL, params, sizeof(params), &n) ? 0 : -1;
 }
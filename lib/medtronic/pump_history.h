@@ -89,12 +89,57 @@ typedef enum PACKED {
 
 const char *history_record_type_string(history_record_type_t t);
 
+// Glucose values in wizard and meter records are in the pump's glucose units
+// (mg/dL, or 10x mmol/L).
+
+typedef struct {
+	glucose_t glucose;	// 0 if no BG was entered
+	int carbs;		// in the pump's carb units
+	int carb_ratio;		// 10x grams/unit or 1000x units/exchange
+	glucose_t sensitivity;
+	glucose_t target_low;
+	glucose_t target_high;
+	insulin_t correction;
+	insulin_t food;
+	insulin_t unabsorbed;
+	insulin_t estimate;
+} bolus_wizard_t;
+
+typedef struct {
+	glucose_t glucose;
+	uint8_t meter[3];	// meter ID
+} bg_received_t;
+
+typedef struct {
+	int carbs;
+	carb_units_t units;
+} meal_marker_t;
+
+// Maximum number of boluses decoded from an UnabsorbedInsulin record.
+// Older entries are dropped.
+#define MAX_UNABSORBED		16
+
+typedef struct {
+	int count;
+	struct {
+		insulin_t amount;
+		int age;	// minutes
+	} bolus[MAX_UNABSORBED];
+} unabsorbed_insulin_t;
+
 typedef struct {
 	history_record_type_t type;
 	uint8_t length;
 	time_t time;
 	insulin_t insulin;
 	int duration;		// seconds
+	// Details of bolus wizard, BG, and meal records.
+	union {
+		bolus_wizard_t bolus_wizard;
+		bg_received_t bg_received;
+		meal_marker_t meal_marker;
+		unabsorbed_insulin_t unabsorbed_insulin;
+	} info;
 } history_record_t;
 
 typedef enum PACKED {
@@ -112,8 +157,14 @@ time_t pump_decode_time(uint8_t *data);
 // Signature of function to be applied to history records during decoding.
 typedef int (*history_record_fn_t)(history_record_t *);
 
-// Decode the given history page and apply f to each insulin-related record.
+// Decode the given history page and apply f to each insulin-related,
+// configuration-change, bolus wizard, BG, meal, or daily total record.
 // If f returns a non-zero value, the decoding loop terminates.
 void pump_decode_history(uint8_t *page, int len, int family, history_record_fn_t decode_fn);
 
+// Invalidate the parts of the session's configuration cache
+// changed by the given history record after they were fetched.
+// Return true if anything was invalidated.
+bool pump_config_history(pump_session_t *s, history_record_t *r);
+
 #endif // _PUMP_HISTORY_H
@@ -18,11 +18,53 @@ DEFINE_SCHEDULE_LOOKUP(carb_ratio)
 DEFINE_SCHEDULE_LOOKUP(sensitivity)
 DEFINE_SCHEDULE_LOOKUP(target)
 
-// next_change returns the time when the next scheduled rate will take effect (strictly after t).
-time_t next_change(basal_rate_t *sched, int len, time_t t) {
-	int i = basal_rate_at(sched, len, t);
+#define SLOT_LENGTH	(24 * 3600 / SCHEDULE_SLOTS)
+
+// Fill in the slots after the start times have been stored.
+static void build_index(schedule_index_t *x) {
+	int i = -1;
+	for (int n = 0; n < SCHEDULE_SLOTS; n++) {
+		time_of_day_t d = n * SLOT_LENGTH;
+		while (i + 1 < x->len && x->start[i + 1] <= d) {
+			i++;
+		}
+		x->slot[n] = i;
+	}
+}
+
+#define DEFINE_SCHEDULE_INDEX(type)				\
+	DECLARE_SCHEDULE_INDEX(type) {				\
+		if (len > MAX_SCHEDULE_ENTRIES) {		\
+			len = MAX_SCHEDULE_ENTRIES;		\
+		}						\
+		x->len = len;					\
+		for (int i = 0; i < len; i++) {			\
+			x->start[i] = r[i].start;		\
+		}						\
+		build_index(x);					\
+	}
+
+DEFINE_SCHEDULE_INDEX(basal_rate)
+DEFINE_SCHEDULE_INDEX(carb_ratio)
+DEFINE_SCHEDULE_INDEX(sensitivity)
+DEFINE_SCHEDULE_INDEX(target)
+
+static int lookup(const schedule_index_t *x, time_of_day_t d) {
+	int i = x->slot[d / SLOT_LENGTH];
+	while (i + 1 < x->len && x->start[i + 1] <= d) {
+		i++;
+	}
+	return i;
+}
+
+int schedule_lookup(const schedule_index_t *x, time_t t) {
+	return lookup(x, since_midnight(t));
+}
+
+time_t next_change(const schedule_index_t *x, time_t t) {
+	time_of_day_t d = since_midnight(t);
+	int i = lookup(x, d);
 	assert(i >= 0);
-	time_of_day_t next = i + 1 < len ? sched[i+1].start : 24 * 3600;
-	time_of_day_t delta = next - since_midnight(t);
-	return t + delta;
+	time_of_day_t next = i + 1 < x->len ? x->start[i + 1] : 24 * 3600;
+	return t + next - d;
 }
@@ -0,0 +1,130 @@
+#include "medtronic_test.h"
+#include "pump_sim.h"
+
+static uint8_t arena[PUMP_SESSION_ARENA_SIZE];
+static pump_session_t pump;
+static pump_config_t config;
+
+static basal_rate_t basal_rates[MAX_BASAL_RATES];
+static int num_basal_rates;
+static settings_t settings;
+
+// Read the configuration and return the number of packets it took.
+static int read_config(void) {
+	int before = sim_packets();
+	num_basal_rates = pump_get_basal_rates(&pump, basal_rates, LEN(basal_rates));
+	if (pump_get_settings(&pump, &settings) != 0) {
+		test_failed("pump_get_settings failed");
+	}
+	return sim_packets() - before;
+}
+
+static void check_config(void) {
+	if (num_basal_rates != sim_pump.num_basal_rates) {
+		test_failed("got %d basal rates, want %d", num_basal_rates, sim_pump.num_basal_rates);
+		return;
+	}
+	for (int i = 0; i < num_basal_rates; i++) {
+		basal_rate_t *r = &basal_rates[i], *s = &sim_pump.basal_rates[i];
+		if (r->start != s->start || r->rate != s->rate) {
+			test_failed("basal rate %d: got %d at %d, want %d at %d", i, r->rate, r->start, s->rate, s->start);
+		}
+	}
+	settings_t *s = &sim_pump.settings;
+	if (settings.max_basal != s->max_basal || settings.max_bolus != s->max_bolus || settings.dia != s->dia) {
+		test_failed("got settings %d/%d/%d, want %d/%d/%d",
+			    settings.max_basal, settings.max_bolus, settings.dia,
+			    s->max_basal, s->max_bolus, s->dia);
+	}
+}
+
+static void start(void) {
+	sim_reset();
+	pump_session_init(&pump, SIM_PUMP_ID, arena, sizeof(arena));
+	pump_config_attach(&pump, &config);
+	if (!pump_wakeup(&pump)) {
+		test_failed("pump_wakeup failed");
+	}
+}
+
+void test_cache(void) {
+	sim_erase_config();
+	start();
+	int n = read_config();
+	if (n == 0) {
+		test_failed("first configuration read did not use the radio");
+	}
+	check_config();
+	n = read_config();
+	if (n != 0) {
+		test_failed("cached configuration read sent %d packets", n);
+	}
+	check_config();
+}
+
+void test_persistence(void) {
+	// Restart with the cache saved by test_cache.
+	start();
+	int n = read_config();
+	if (n != 0) {
+		test_failed("configuration read after restart sent %d packets", n);
+	}
+	check_config();
+	// A cache for a different pump must not be used.
+	pump_session_t other;
+	static uint8_t other_arena[PUMP_SESSION_ARENA_SIZE];
+	static pump_config_t other_config;
+	pump_session_init(&other, "654321", other_arena, sizeof(other_arena));
+	pump_config_attach(&other, &other_config);
+	if (other_config.valid != 0) {
+		test_failed("configuration cache used for a different pump");
+	}
+}
+
+void test_invalidation(void) {
+	sim_erase_config();
+	start();
+	// Use a pump clock far from the device's, to check that
+	// the two are never compared.
+	time_t t = time(0) - 365 * 24 * 60 * 60;
+	history_record_t r = { .type = Bolus, .time = t };
+	// Records that don't change the configuration are ignored.
+	if (pump_config_history(&pump, &r)) {
+		test_failed("Bolus record invalidated configuration");
+	}
+	read_config();
+	// So are changes made before the configuration was read.
+	r = (history_record_t){ .type = BasalProfileAfter, .time = t - 60 };
+	if (pump_config_history(&pump, &r)) {
+		test_failed("earlier BasalProfileAfter record invalidated configuration");
+	}
+	sim_pump.basal_rates[1].rate = 1200;
+	r.time = t + 60;
+	if (!pump_config_history(&pump, &r)) {
+		test_failed("BasalProfileAfter record did not invalidate configuration");
+	}
+	int n = read_config();
+	if (n == 0) {
+		test_failed("basal rates not read after invalidation");
+	}
+	check_config();
+	// Only the settings are affected by a MaxBasal change.
+	sim_pump.settings.max_basal = 2500;
+	r = (history_record_t){ .type = MaxBasal, .time = config.fetched[CONFIG_SETTINGS] + 60 };
+	pump_config_history(&pump, &r);
+	if (config.valid != 1 << CONFIG_BASAL_RATES) {
+		test_failed("MaxBasal record left valid mask %02X", config.valid);
+	}
+	n = read_config();
+	if (n != 1) {
+		test_failed("settings refresh sent %d packets, want 1", n);
+	}
+	check_config();
+}
+
+int main(int argc, char **argv) {
+	test_cache();
+	test_persistence();
+	test_invalidation();
+	exit_test();
+}
@@ -0,0 +1,142 @@
+#include "medtronic_test.h"
+#include "glucose_history.h"
+
+static uint8_t page[HISTORY_PAGE_SIZE];
+static int page_len;
+
+static void add(const uint8_t *data, int len) {
+	memcpy(&page[page_len], data, len);
+	page_len += len;
+}
+
+static void add_byte(uint8_t b) {
+	add(&b, 1);
+}
+
+// Add a 4-byte timestamp followed by the record type.
+static void add_timestamped(uint8_t type, time_t t) {
+	struct tm tm;
+	localtime_r(&t, &tm);
+	int month = tm.tm_mon + 1;
+	uint8_t data[5] = {
+		(month >> 2) << 6 | tm.tm_hour,
+		(month & 0x3) << 6 | tm.tm_min,
+		tm.tm_mday,
+		tm.tm_year - 100,
+		type,
+	};
+	add(data, sizeof(data));
+}
+
+#define MAX_READINGS	20
+static glucose_record_t readings[MAX_READINGS];
+static int num_readings, max_readings;
+
+static int save_reading(glucose_record_t *r) {
+	readings[num_readings++] = *r;
+	return num_readings == max_readings;
+}
+
+static void decode(void) {
+	num_readings = 0;
+	pump_decode_glucose(page, HISTORY_PAGE_SIZE, save_reading);
+}
+
+typedef struct {
+	glucose_record_type_t type;
+	time_t time;
+	glucose_t glucose;
+} reading_t;
+
+static void check_readings(const char *name, reading_t *want, int n) {
+	if (num_readings != n) {
+		test_failed("[%s] decoded %d readings, want %d", name, num_readings, n);
+		return;
+	}
+	for (int i = 0; i < n; i++) {
+		glucose_record_t *r = &readings[i];
+		if (r->type != want[i].type || r->time != want[i].time || r->glucose != want[i].glucose) {
+			char ts1[TIME_STRING_SIZE], ts2[TIME_STRING_SIZE];
+			test_failed("[%s] reading %d: got %02X %s %d, want %02X %s %d", name, i,
+				    r->type, time_string(r->time, ts1), r->glucose,
+				    want[i].type, time_string(want[i].time, ts2), want[i].glucose);
+		}
+	}
+}
+
+#define T1	TEST_TIME(8, 2)
+#define T2	TEST_TIME(9, 17)
+#define MINUTES(n)	((n) * 60)
+
+static void make_page(void) {
+	memset(page, 0, sizeof(page));
+	page_len = 0;
+	// Readings before the first timestamp can't be placed in time.
+	add_byte(0x30);
+	add_byte(0x31);
+	add_timestamped(GlucoseTimestamp, T1);
+	add_byte(0x40);
+	add_byte(0x41);
+	add_byte(GlucoseWeakSignal);
+	add((uint8_t[]){ 0x55, GlucoseDataLow }, 2);
+	// Records that are not readings don't take up a sensor interval,
+	// even if their data looks like glucose values.
+	add((uint8_t[]){ 0x99, GlucoseCal }, 2);
+	add((uint8_t[]){ 0x80, 0x81, 0x82, 0x83, GlucoseBatteryChange }, 5);
+	add_byte(0x50);
+	add((uint8_t[]){ 0x66, GlucoseDataHigh }, 2);
+	add_timestamped(GlucoseTimestamp, T2);
+	add_byte(0x60);
+	add_byte(0x61);
+	// The rest of the page is unused.
+}
+
+void test_decode(void) {
+	make_page();
+	max_readings = 0;
+	decode();
+	reading_t want[] = {
+		{ GlucoseValue, T2 + MINUTES(10), 0xC2 },
+		{ GlucoseValue, T2 + MINUTES(5), 0xC0 },
+		{ GlucoseDataHigh, T1 + MINUTES(30), GLUCOSE_HIGH },
+		{ GlucoseValue, T1 + MINUTES(25), 0xA0 },
+		{ GlucoseDataLow, T1 + MINUTES(20), GLUCOSE_LOW },
+		{ GlucoseValue, T1 + MINUTES(10), 0x82 },
+		{ GlucoseValue, T1 + MINUTES(5), 0x80 },
+	};
+	check_readings("decode", want, LEN(want));
+}
+
+void test_stop(void) {
+	make_page();
+	max_readings = 3;
+	decode();
+	reading_t want[] = {
+		{ GlucoseValue, T2 + MINUTES(10), 0xC2 },
+		{ GlucoseValue, T2 + MINUTES(5), 0xC0 },
+		{ GlucoseDataHigh, T1 + MINUTES(30), GLUCOSE_HIGH },
+	};
+	check_readings("stop", want, LEN(want));
+}
+
+void test_unknown_record(void) {
+	make_page();
+	// Decoding stops at an unknown record type.
+	add_byte(0x09);
+	add_byte(0x70);
+	add_timestamped(GlucoseTimestamp, T2 + MINUTES(60));
+	add_byte(0x71);
+	max_readings = 0;
+	decode();
+	reading_t want[] = {
+		{ GlucoseValue, T2 + MINUTES(65), 0xE2 },
+	};
+	check_readings("unknown", want, LEN(want));
+}
+
+int main(int argc, char **argv) {
+	test_decode();
+	test_stop();
+	test_unknown_record();
+	exit_test();
+}
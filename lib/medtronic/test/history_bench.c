@@ -0,0 +1,102 @@
+// Measure the speed of history page decoding.
+//
+// Usage: history_bench [directory]
+//
+// Every .data file in the directory (testdata by default) is decoded
+// repeatedly, using the pump family from its name (e.g. ps2-523-1.data).
+
+#include <dirent.h>
+
+#include "medtronic_test.h"
+
+#define MAX_PAGES	100
+#define ITERATIONS	2000
+
+typedef struct {
+	uint8_t data[HISTORY_PAGE_SIZE];
+	int length;
+	int family;
+} page_t;
+
+static page_t pages[MAX_PAGES];
+static int num_pages;
+
+static int records;
+
+static int count_record(history_record_t *r) {
+	records++;
+	return 0;
+}
+
+// Data file names have the form prefix-model[-n].data
+static int family_from_name(const char *name) {
+	const char *p = strchr(name, '-');
+	if (p == 0) {
+		return -1;
+	}
+	return atoi(p + 1) % 100;
+}
+
+static void read_pages(const char *dir_name) {
+	DIR *dir = opendir(dir_name);
+	if (dir == 0) {
+		perror(dir_name);
+		exit(1);
+	}
+	struct dirent *e;
+	while ((e = readdir(dir)) != 0 && num_pages < MAX_PAGES) {
+		const char *suffix = strrchr(e->d_name, '.');
+		if (suffix == 0 || strcmp(suffix, ".data") != 0) {
+			continue;
+		}
+		int family = family_from_name(e->d_name);
+		if (family <= 0) {
+			fprintf(stderr, "%s: cannot determine pump model\n", e->d_name);
+			continue;
+		}
+		char filename[512];
+		snprintf(filename, sizeof(filename), "%s/%s", dir_name, e->d_name);
+		FILE *f = fopen(filename, "r");
+		if (f == 0) {
+			perror(filename);
+			exit(1);
+		}
+		// read_bytes closes the file.
+		page_t *p = &pages[num_pages++];
+		p->length = read_bytes(f, p->data, sizeof(p->data));
+		p->family = family;
+	}
+	closedir(dir);
+	if (num_pages == 0) {
+		fprintf(stderr, "%s: no data files\n", dir_name);
+		exit(1);
+	}
+}
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+	if (argc > 2) {
+		fprintf(stderr, "Usage: %s [directory]\n", argv[0]);
+		exit(1);
+	}
+	read_pages(argc == 2 ? argv[1] : "testdata");
+	int bytes = 0;
+	for (int i = 0; i < num_pages; i++) {
+		bytes += pages[i].length;
+	}
+	double start = now();
+	for (int n = 0; n < ITERATIONS; n++) {
+		for (int i = 0; i < num_pages; i++) {
+			pump_decode_history(pages[i].data, pages[i].length, pages[i].family, count_record);
+		}
+	}
+	double elapsed = now() - start;
+	printf("%d pages, %d bytes, %d decoded records per pass\n", num_pages, bytes, records / ITERATIONS);
+	printf("%.0f pages/sec, %.0f records/sec, %.1f MB/sec\n",
+	       num_pages * ITERATIONS / elapsed, records / elapsed, bytes * ITERATIONS / elapsed / 1e6);
+}
@@ -0,0 +1,206 @@
+#include <math.h>
+
+#include "medtronic_test.h"
+#include "iob.h"
+
+static iob_state_t iob;
+
+static basal_rate_t flat_schedule[] = {
+	{ TOD(0, 0), 1000 },
+};
+
+static basal_rate_t varying_schedule[] = {
+	{ TOD( 0, 0),  800 },
+	{ TOD( 3, 0), 1200 },
+	{ TOD( 7, 30), 1000 },
+	{ TOD(22, 0),  900 },
+};
+
+static settings_t settings(int dia) {
+	return (settings_t){ .dia = dia };
+}
+
+// Floating-point version of the bilinear activity curve.
+static double curve(int dia, double minutes) {
+	minutes *= 3.0 / dia;
+	if (minutes < 75) {
+		double x = minutes / 5 + 1;
+		return 1 - 0.001852 * x * x + 0.001852 * x;
+	}
+	if (minutes < 180) {
+		double x = (minutes - 75) / 5;
+		return fmax(0, 0.001323 * x * x - 0.054233 * x + 0.55556);
+	}
+	return 0;
+}
+
+// Reference IOB computation: step through time, delivering the net basal
+// in small increments, and apply the curve to every increment separately.
+
+#define STEP		10	// seconds
+
+static double ref_iob(history_record_t *recs, int n, basal_rate_t *sched, int len, int dia, time_t t0, time_t t) {
+	double iob = 0;
+	insulin_t temp_rate = 0, ext_rate = 0;
+	time_t temp_rate_time = 0, temp_start = 0, temp_end = 0, ext_end = 0;
+	bool suspended = false;
+	for (int i = 0; i < n; i++) {
+		history_record_t *r = &recs[i];
+		if (r->type == Bolus && r->duration == 0 && r->time <= t) {
+			iob += r->insulin * curve(dia, (t - r->time) / 60.0);
+		}
+	}
+	int next = 0;
+	for (time_t s = t0; s < t; s += STEP) {
+		while (next < n && recs[next].time <= s) {
+			history_record_t *r = &recs[next++];
+			switch (r->type) {
+			case Bolus:
+				if (r->duration != 0) {
+					ext_rate = r->insulin * 3600 / r->duration;
+					ext_end = r->time + r->duration;
+				}
+				break;
+			case TempBasalRate:
+				temp_rate = r->insulin;
+				temp_rate_time = r->time;
+				break;
+			case TempBasalDuration:
+				temp_start = r->time;
+				temp_end = r->time + r->duration;
+				break;
+			case SuspendPump:
+				suspended = true;
+				break;
+			case ResumePump:
+				suspended = false;
+				break;
+			default:
+				break;
+			}
+		}
+		insulin_t scheduled = sched[basal_rate_at(sched, len, s)].rate;
+		insulin_t rate = 0;
+		if (!suspended) {
+			rate = s < temp_end && temp_rate_time == temp_start ? temp_rate : scheduled;
+			if (s < ext_end) {
+				rate += ext_rate;
+			}
+		}
+		double amount = (rate - scheduled) * STEP / 3600.0;
+		iob += amount * curve(dia, (t - s - STEP / 2.0) / 60.0);
+	}
+	return iob;
+}
+
+static void start(basal_rate_t *sched, int len, int dia) {
+	settings_t s = settings(dia);
+	iob_init(&iob, &s, sched, len);
+}
+
+static void check_iob(const char *name, time_t t, double want, double tolerance) {
+	insulin_t got = iob_at(&iob, t);
+	if (fabs(got - want) > tolerance) {
+		char ts[TIME_STRING_SIZE];
+		test_failed("[%s] iob_at(%s) = %d, want %.0f", name, time_string(t, ts), got, want);
+	}
+}
+
+// Feed the records, checking against the reference every 10 minutes.
+static void run_scenario(const char *name, history_record_t *recs, int n,
+			 basal_rate_t *sched, int len, int dia) {
+	start(sched, len, dia);
+	time_t t0 = recs[0].time;
+	int next = 0;
+	for (time_t t = t0; t < t0 + 12 * 3600; t += 10 * 60) {
+		while (next < n && recs[next].time <= t) {
+			iob_record(&iob, &recs[next++]);
+		}
+		double want = ref_iob(recs, next, sched, len, dia, t0, t);
+		check_iob(name, t, want, 5 + fabs(want) * 0.01);
+	}
+}
+
+void test_bolus(void) {
+	history_record_t r = { .type = Bolus, .time = TEST_TIME(8, 0), .insulin = 1000 };
+	start(flat_schedule, LEN(flat_schedule), 3);
+	iob_record(&iob, &r);
+	check_iob("bolus", r.time, 1000, 0);
+	check_iob("bolus", r.time + 75 * 60, 556, 1);
+	check_iob("bolus", r.time + 3 * 3600, 0, 0);
+	// The curve is stretched for a longer DIA.
+	start(flat_schedule, LEN(flat_schedule), 6);
+	iob_record(&iob, &r);
+	check_iob("bolus", r.time + 150 * 60, 556, 1);
+	check_iob("bolus", r.time + 6 * 3600 - 60, 0, 1);
+}
+
+#define REC(t, ...)	{ .time = TEST_TIME_NOW + (t), __VA_ARGS__ }
+
+void test_temp_basal(void) {
+	history_record_t recs[] = {
+		REC(TOD(1, 0), .type = Bolus, .insulin = 2500),
+		REC(TOD(2, 7), .type = TempBasalRate, .insulin = 0),
+		REC(TOD(2, 7), .type = TempBasalDuration, .duration = 60 * 60),
+		REC(TOD(3, 40), .type = TempBasalRate, .insulin = 2500),
+		REC(TOD(3, 40), .type = TempBasalDuration, .duration = 90 * 60),
+		// Cancel the temp basal early.
+		REC(TOD(4, 12), .type = TempBasalRate, .insulin = 0),
+		REC(TOD(4, 12), .type = TempBasalDuration, .duration = 0),
+	};
+	run_scenario("temp basal", recs, LEN(recs), varying_schedule, LEN(varying_schedule), 4);
+}
+
+// The TempBasalRate record of a percent temp basal is not decoded,
+// so only its TempBasalDuration record is seen.
+void test_percent_temp_basal(void) {
+	history_record_t recs[] = {
+		REC(TOD(1, 0), .type = TempBasalRate, .insulin = 2500),
+		REC(TOD(1, 0), .type = TempBasalDuration, .duration = 30 * 60),
+		REC(TOD(2, 0), .type = TempBasalDuration, .duration = 120 * 60),
+	};
+	run_scenario("percent temp basal", recs, LEN(recs), varying_schedule, LEN(varying_schedule), 4);
+	// The absolute rate must not carry over into the percent temp basal.
+	time_t t = recs[2].time + 120 * 60;
+	insulin_t got = iob_at(&iob, t);
+	start(varying_schedule, LEN(varying_schedule), 4);
+	for (int i = 0; i < 2; i++) {
+		iob_record(&iob, &recs[i]);
+	}
+	check_iob("percent temp basal", t, got, 0);
+}
+
+void test_suspend(void) {
+	history_record_t recs[] = {
+		REC(TOD(5, 0), .type = Bolus, .insulin = 1000),
+		REC(TOD(5, 33), .type = SuspendPump),
+		REC(TOD(7, 2), .type = ResumePump),
+		REC(TOD(8, 0), .type = Bolus, .insulin = 3000, .duration = 2 * 3600),
+		REC(TOD(9, 0), .type = Bolus, .insulin = 500),
+	};
+	run_scenario("suspend", recs, LEN(recs), varying_schedule, LEN(varying_schedule), 5);
+}
+
+void test_old_records(void) {
+	history_record_t r = { .type = Bolus, .time = TEST_TIME(8, 0), .insulin = 1000 };
+	start(flat_schedule, LEN(flat_schedule), 3);
+	iob_record(&iob, &r);
+	// Records older than the last one are ignored.
+	history_record_t old = { .type = Bolus, .time = TEST_TIME(7, 0), .insulin = 1000 };
+	iob_record(&iob, &old);
+	check_iob("old records", r.time, 1000, 0);
+	// Evaluating IOB does not prevent later records from being added.
+	iob_at(&iob, r.time + 3600);
+	r.time += 60;
+	iob_record(&iob, &r);
+	check_iob("old records", r.time, 1000 + 1000 * curve(3, 1), 1);
+}
+
+int main(int argc, char **argv) {
+	test_bolus();
+	test_temp_basal();
+	test_percent_temp_basal();
+	test_suspend();
+	test_old_records();
+	exit_test();
+}
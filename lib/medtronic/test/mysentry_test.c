@@ -0,0 +1,142 @@
+#include "medtronic_test.h"
+#include "pump_sim.h"
+#include "commands.h"
+
+static uint8_t arena[PUMP_SESSION_ARENA_SIZE];
+static pump_session_t pump;
+
+// A synthetic status broadcast, built by hand in the layout decoded by
+// MinimedKit. No sniffer captures are checked in, so this checks the
+// decoder against that layout but cannot catch an error in the layout itself.
+static uint8_t status_body[36] = {
+	0xC9,				// sequence number
+	0x51,				// glucose trend
+	0x09, 0x2C, 0x1E, 0x14, 0x04, 0x01,	// pump clock 2020-04-01 09:44:30
+	0x01,
+	0x32,				// glucose 0x32 << 1 | 1
+	0x33,				// previous glucose 0x33 << 1 | 0
+	0x00,
+	0x03, 0x7A,			// reservoir 890 strokes
+	0x02,				// battery 2/4
+	0x02,
+	0x05, 0xB0,			// reservoir minutes
+	0x18,				// sensor age
+	0x30,				// sensor remaining
+	0x13, 0x2B,
+	0x00, 0xD1,			// IOB 209 strokes
+	0x04,				// low bits: glucose (bit 2) 1, previous (bit 1) 0
+	0x00, 0x00, 0x70,
+	0x09, 0x2B, 0x00, 0x14, 0x04, 0x01,	// glucose time 2020-04-01 09:43:00
+	0x00, 0x93,
+};
+
+static void start(void) {
+	sim_reset();
+	pump_session_init(&pump, SIM_PUMP_ID, arena, sizeof(arena));
+}
+
+static time_t local_time(int year, int month, int day, int hour, int min, int sec) {
+	struct tm tm = {
+		.tm_year = year - 1900,
+		.tm_mon = month - 1,
+		.tm_mday = day,
+		.tm_hour = hour,
+		.tm_min = min,
+		.tm_sec = sec,
+		.tm_isdst = -1,
+	};
+	return mktime(&tm);
+}
+
+#define CHECK(name, got, want)	do {						\
+	if ((got) != (want)) {								\
+		test_failed("%s = %ld, want %ld", name, (long)(got), (long)(want));	\
+	}										\
+} while (0)
+
+// Build a packet as received from the radio, without the CRC byte.
+static int make_packet(uint8_t *pkt, uint8_t device, const uint8_t *id, uint8_t type) {
+	pkt[0] = device;
+	memcpy(&pkt[1], id, 3);
+	pkt[4] = type;
+	memcpy(&pkt[5], status_body, sizeof(status_body));
+	return 5 + sizeof(status_body);
+}
+
+void test_decode(void) {
+	start();
+	uint8_t pkt[64];
+	int n = make_packet(pkt, MYSENTRY_DEVICE, pump.pump_id, MYSENTRY_STATUS);
+	mysentry_status_t m;
+	if (mysentry_decode_status(&pump, pkt, n, &m) != 0) {
+		test_failed("mysentry_decode_status failed");
+		return;
+	}
+	CHECK("seq", m.seq, 0xC9);
+	CHECK("clock", m.clock, local_time(2020, 4, 1, 9, 44, 30));
+	CHECK("glucose", m.glucose, 101);
+	CHECK("previous glucose", m.prev_glucose, 102);
+	CHECK("glucose time", m.glucose_time, local_time(2020, 4, 1, 9, 43, 0));
+	CHECK("reservoir", m.reservoir, 22250);
+	CHECK("reservoir minutes", m.reservoir_minutes, 0x5B0);
+	CHECK("battery", m.battery_percent, 50);
+	CHECK("sensor age", m.sensor_age, 0x18);
+	CHECK("sensor remaining", m.sensor_remaining, 0x30);
+	CHECK("iob", m.iob, 5225);
+	// Sensor states are not glucose readings.
+	pkt[5 + 9] = 0x01;
+	mysentry_decode_status(&pump, pkt, n, &m);
+	CHECK("sensor state", m.glucose, 0);
+	CHECK("sensor state time", m.glucose_time, 0);
+	// Other packets are rejected.
+	uint8_t other_id[3] = { 0x65, 0x43, 0x21 };
+	make_packet(pkt, MYSENTRY_DEVICE, other_id, MYSENTRY_STATUS);
+	CHECK("other pump", mysentry_decode_status(&pump, pkt, n, &m), -1);
+	make_packet(pkt, MYSENTRY_DEVICE, pump.pump_id, 0x01);
+	CHECK("other message type", mysentry_decode_status(&pump, pkt, n, &m), -1);
+	make_packet(pkt, 0xA7, pump.pump_id, MYSENTRY_STATUS);
+	CHECK("other device", mysentry_decode_status(&pump, pkt, n, &m), -1);
+	make_packet(pkt, MYSENTRY_DEVICE, pump.pump_id, MYSENTRY_STATUS);
+	CHECK("short packet", mysentry_decode_status(&pump, pkt, n - 1, &m), -1);
+}
+
+void test_listen(void) {
+	start();
+	if (pump_listen(&pump, 1000)) {
+		test_failed("pump_listen succeeded with no broadcast");
+	}
+	if (pump_broadcast_status(&pump, 60 * 1000) != 0) {
+		test_failed("broadcast status available before any broadcast");
+	}
+	sim_broadcast("654321", MYSENTRY_STATUS, status_body, sizeof(status_body), 100);
+	if (pump_listen(&pump, 1000)) {
+		test_failed("pump_listen accepted a broadcast from another pump");
+	}
+	sim_broadcast(SIM_PUMP_ID, MYSENTRY_STATUS, status_body, sizeof(status_body), 100);
+	if (!pump_listen(&pump, 1000)) {
+		test_failed("pump_listen failed");
+		return;
+	}
+	CHECK("acks", sim_pump.mysentry_acks, 1);
+	CHECK("ack seq", sim_pump.mysentry_ack_seq, 0xC9);
+	const mysentry_status_t *m = pump_broadcast_status(&pump, 60 * 1000);
+	if (m == 0 || m->reservoir != 22250) {
+		test_failed("broadcast status not saved");
+	}
+	// The reservoir level comes from the broadcast without waking the pump.
+	int before = sim_packets();
+	CHECK("reservoir", pump_get_reservoir(&pump), 22250);
+	CHECK("packets", sim_packets() - before, 0);
+	// Once the broadcast is old, the pump is asked.
+	sim_sleep(6 * 60 * 1000);
+	if (!pump_wakeup(&pump)) {
+		test_failed("pump_wakeup failed");
+	}
+	CHECK("reservoir", pump_get_reservoir(&pump), sim_pump.reservoir);
+}
+
+int main(int argc, char **argv) {
+	test_decode();
+	test_listen();
+	exit_test();
+}
@@ -0,0 +1,174 @@
+#include "medtronic_test.h"
+#include "pump_sim.h"
+#include "commands.h"
+
+#define PAGE	3
+
+static uint8_t arena[PUMP_SESSION_ARENA_SIZE];
+static pump_session_t pump;
+
+// Responses to ACKs are numbered from 1 within each test,
+// so responses[i] determines the fate of the fragment after the i'th ACK.
+static int acks;
+static sim_fate_t responses[50];
+
+// Responses to CMD_HISTORY packets after this many are lost.
+static int history_responses, max_history_responses;
+
+static sim_fate_t fate(uint8_t cmd, int *delay) {
+	switch (cmd) {
+	case CMD_ACK:
+		acks++;
+		if (acks < LEN(responses)) {
+			return responses[acks];
+		}
+		break;
+	case CMD_HISTORY:
+		history_responses++;
+		if (history_responses > max_history_responses) {
+			return SIM_LOST;
+		}
+		break;
+	default:
+		break;
+	}
+	return SIM_DELIVERED;
+}
+
+static void start(void) {
+	sim_reset();
+	sim_pump.response_fn = fate;
+	acks = 0;
+	memset(responses, 0, sizeof(responses));
+	history_responses = 0;
+	max_history_responses = 1000;
+	pump_session_init(&pump, SIM_PUMP_ID, arena, sizeof(arena));
+	if (!pump_wakeup(&pump)) {
+		test_failed("pump_wakeup failed");
+	}
+}
+
+// Download the page and return the number of packets it took, or -1 if it failed.
+static int download(void) {
+	int before = sim_packets();
+	uint8_t *page = pump_get_history_page(&pump, PAGE);
+	if (page == 0) {
+		return -1;
+	}
+	uint8_t expected[HISTORY_PAGE_SIZE];
+	sim_history_page(PAGE, expected);
+	if (memcmp(page, expected, HISTORY_PAGE_SIZE) != 0) {
+		test_failed("downloaded page does not match");
+	}
+	return sim_packets() - before;
+}
+
+// Short and long CMD_HISTORY packets, then an ACK for each fragment but the last.
+#define CLEAN_DOWNLOAD	(2 + 15)
+
+void test_clean(void) {
+	start();
+	int n = download();
+	if (n != CLEAN_DOWNLOAD) {
+		test_failed("clean download took %d packets, want %d", n, CLEAN_DOWNLOAD);
+	}
+}
+
+void test_lost_fragment(void) {
+	start();
+	// The fragment after the 5th ACK is lost, so it is recovered with a NAK.
+	responses[5] = SIM_LOST;
+	int n = download();
+	if (n != CLEAN_DOWNLOAD + 1) {
+		test_failed("download with lost fragment took %d packets, want %d", n, CLEAN_DOWNLOAD + 1);
+	}
+}
+
+void test_skipped_fragment(void) {
+	start();
+	// Fragment 6 is skipped, so the page is requested again,
+	// stopping as soon as fragment 6 has been received.
+	responses[5] = SIM_SKIPPED;
+	int n = download();
+	int want = (2 + 14) + (2 + 5);
+	if (n != want) {
+		test_failed("download with skipped fragment took %d packets, want %d", n, want);
+	}
+}
+
+void test_resume(void) {
+	start();
+	// Fragment 3 is skipped, and the page can't be requested again.
+	responses[2] = SIM_SKIPPED;
+	max_history_responses = 2;
+	if (download() != -1) {
+		test_failed("download succeeded with missing fragment");
+	}
+	if (pump.download.page_num != PAGE || pump.download.received != 0xFFFF - (1 << 2)) {
+		test_failed("download state: page %d, fragments %04X", pump.download.page_num, pump.download.received);
+	}
+	// The next attempt only needs to get as far as fragment 3.
+	max_history_responses = 1000;
+	int n = download();
+	int want = 2 + 2;
+	if (n != want) {
+		test_failed("resumed download took %d packets, want %d", n, want);
+	}
+	if (pump.download.page_num != -1) {
+		test_failed("download state not cleared after success");
+	}
+}
+
+void test_bad_crc(void) {
+	start();
+	sim_pump.bad_page_crc = true;
+	if (download() != -1) {
+		test_failed("download succeeded with bad page CRC");
+	}
+	if (pump.download.page_num != -1) {
+		test_failed("download state not cleared after bad page CRC");
+	}
+}
+
+void test_glucose_page(void) {
+	start();
+	int first, last;
+	if (pump_get_glucose_page_range(&pump, &first, &last) != 0) {
+		test_failed("pump_get_glucose_page_range failed");
+		return;
+	}
+	int want_first = sim_pump.glucose_page - sim_pump.glucose_pages + 1;
+	if (first != want_first || last != sim_pump.glucose_page) {
+		test_failed("glucose pages %d to %d, want %d to %d", first, last, want_first, sim_pump.glucose_page);
+	}
+	// Glucose page numbers don't fit in a byte.
+	int before = sim_packets();
+	uint8_t *page = pump_get_glucose_page(&pump, last);
+	if (page == 0) {
+		test_failed("glucose page download failed");
+		return;
+	}
+	uint8_t expected[HISTORY_PAGE_SIZE];
+	sim_glucose_page(last, expected);
+	if (memcmp(page, expected, HISTORY_PAGE_SIZE) != 0) {
+		test_failed("downloaded glucose page does not match");
+	}
+	int n = sim_packets() - before;
+	if (n != CLEAN_DOWNLOAD) {
+		test_failed("glucose page download took %d packets, want %d", n, CLEAN_DOWNLOAD);
+	}
+	// Downloading a history page afterwards starts over.
+	if (download() != CLEAN_DOWNLOAD) {
+		test_failed("history page download after glucose page failed");
+	}
+}
+
+int main(int argc, char **argv) {
+	test_clean();
+	test_lost_fragment();
+	test_skipped_fragment();
+	test_resume();
+	test_bad_crc();
+	test_glucose_page();
+	exit_test();
+}
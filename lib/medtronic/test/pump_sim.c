@@ -0,0 +1,430 @@
+#include "medtronic_test.h"
+#include "pump_sim.h"
+
+#include "4b6b.h"
+#include "commands.h"
+#include "crc.h"
+#include "rfm95.h"
+
+#define CARELINK_DEVICE		0xA7
+
+#define PAYLOAD_LENGTH		64
+#define FRAGMENT_LENGTH		(PAYLOAD_LENGTH + 1)
+#define DONE_BIT		(1 << 7)
+#define NUM_FRAGMENTS		16
+
+sim_pump_t sim_pump;
+
+static int64_t now;
+static int64_t boot_time;
+static int64_t awake_until;
+static int wakeups_seen;
+static int packets;
+
+static uint8_t response[107];
+static int response_len;
+static int response_delay;
+static command_t pending_long_command;
+
+// Multi-fragment response in progress.
+static command_t fragment_command;
+static uint8_t fragments[NUM_FRAGMENTS][FRAGMENT_LENGTH];
+static int num_fragments, next_fragment;
+
+static pump_config_t saved_config;
+static bool config_saved;
+
+void sim_reset(void) {
+	sim_pump = (sim_pump_t){
+		.model = 523,
+		.awake_duration = 90,
+		.wakeup_packets = 5,
+		.response_delay = 10,
+		.battery = 1450,
+		.reservoir = 123450,
+		.temp_basal = 0,
+		.temp_basal_minutes = 0,
+		.status = { .code = STATUS_NORMAL },
+		.clock = 1585713600,
+		.glucose_page = 1234,
+		.glucose_pages = 32,
+		.settings = {
+			.dia = 4,
+			.temp_basal_type = ABSOLUTE,
+			.max_basal = 3000,
+			.max_bolus = 10000,
+		},
+		.num_basal_rates = 3,
+		.basal_rates = {
+			{ .start = 0, .rate = 800 },
+			{ .start = 6 * 3600, .rate = 1150 },
+			{ .start = 21 * 3600, .rate = 950 },
+		},
+	};
+	// Don't rewind the clock, since the library remembers when it last
+	// heard from the pump; move it far enough ahead for that to expire.
+	now += 60 * 60 * 1000;
+	awake_until = 0;
+	wakeups_seen = 0;
+	packets = 0;
+	response_len = 0;
+	pending_long_command = 0;
+	fragment_command = 0;
+}
+
+void sim_sleep(int ms) {
+	now += ms;
+}
+
+int sim_packets(void) {
+	return packets;
+}
+
+int64_t sim_time(void) {
+	return now;
+}
+
+int64_t monotonic_ms(void) {
+	return now - boot_time;
+}
+
+int64_t realtime_ms(void) {
+	return now;
+}
+
+void sim_reboot(void) {
+	boot_time = now;
+}
+
+void sim_erase_config(void) {
+	config_saved = false;
+}
+
+int pump_config_load(pump_config_t *c) {
+	if (!config_saved) {
+		return -1;
+	}
+	*c = saved_config;
+	return 0;
+}
+
+void pump_config_save(const pump_config_t *c) {
+	saved_config = *c;
+	config_saved = true;
+}
+
+static const uint8_t pump_id[3] = { 0x12, 0x34, 0x56 };	// SIM_PUMP_ID
+
+static void queue_packet(uint8_t device, const uint8_t *id, uint8_t cmd, const uint8_t *data, int len) {
+	uint8_t pkt[71];
+	int n = 0;
+	pkt[n++] = device;
+	memcpy(&pkt[n], id, 3);
+	n += 3;
+	pkt[n++] = cmd;
+	memcpy(&pkt[n], data, len);
+	n += len;
+	pkt[n] = crc8(pkt, n);
+	n++;
+	response_len = encode_4b6b(pkt, response, n);
+}
+
+// Queue a response packet with the given command code and payload.
+static void respond(command_t cmd, const uint8_t *data, int len) {
+	queue_packet(CARELINK_DEVICE, pump_id, cmd, data, len);
+}
+
+void sim_broadcast(const char *id, uint8_t type, const uint8_t *body, int len, int delay) {
+	int n = strtol(id, 0, 16);
+	uint8_t b[3] = { n >> 16, n >> 8, n };
+	queue_packet(MYSENTRY_DEVICE, b, type, body, len);
+	response_delay = delay;
+}
+
+static void ack(void) {
+	uint8_t zero = 0;
+	respond(CMD_ACK, &zero, 1);
+}
+
+static void put_be16(uint8_t *p, int n) {
+	p[0] = n >> 8;
+	p[1] = n;
+}
+
+static void model_response(void) {
+	char digits[8];
+	int k = sprintf(digits, "%d", sim_pump.model);
+	uint8_t data[10];
+	data[0] = k + 1;
+	data[1] = k;
+	memcpy(&data[2], digits, k);
+	respond(CMD_MODEL, data, 2 + k);
+}
+
+static void settings_response(void) {
+	settings_t *p = &sim_pump.settings;
+	uint8_t data[26] = { 25 };
+	data[7] = p->max_bolus / 100;
+	put_be16(&data[8], p->max_basal / 25);
+	data[14] = p->temp_basal_type;
+	data[18] = p->dia;
+	respond(CMD_SETTINGS, data, sizeof(data));
+}
+
+// Split an extended response into fragments and send the first one.
+// The rest are sent in response to ACKs.
+static void fragment_response(command_t cmd, const uint8_t *data, int len) {
+	num_fragments = (len + PAYLOAD_LENGTH - 1) / PAYLOAD_LENGTH;
+	for (int i = 0; i < num_fragments; i++) {
+		uint8_t *f = fragments[i];
+		memset(f, 0, FRAGMENT_LENGTH);
+		f[0] = i + 1;
+		if (i == num_fragments - 1) {
+			f[0] |= DONE_BIT;
+		}
+		int n = len - i * PAYLOAD_LENGTH;
+		memcpy(&f[1], &data[i * PAYLOAD_LENGTH], n < PAYLOAD_LENGTH ? n : PAYLOAD_LENGTH);
+	}
+	fragment_command = cmd;
+	next_fragment = 1;
+	respond(cmd, fragments[0], FRAGMENT_LENGTH);
+}
+
+static void basal_rates_response(void) {
+	uint8_t data[3 * MAX_BASAL_RATES] = { 0 };
+	for (int i = 0; i < sim_pump.num_basal_rates; i++) {
+		basal_rate_t *r = &sim_pump.basal_rates[i];
+		int strokes = r->rate / 25;
+		data[3 * i] = strokes & 0xFF;
+		data[3 * i + 1] = strokes >> 8;
+		data[3 * i + 2] = r->start / 1800;
+	}
+	fragment_response(CMD_BASAL_RATES, data, sizeof(data));
+}
+
+void sim_history_page(int page_num, uint8_t *page) {
+	for (int i = 0; i < HISTORY_PAGE_SIZE; i++) {
+		page[i] = page_num * 7 + i * 13;
+	}
+}
+
+void sim_glucose_page(int page_num, uint8_t *page) {
+	for (int i = 0; i < HISTORY_PAGE_SIZE; i++) {
+		page[i] = page_num * 11 + i * 17;
+	}
+}
+
+static void page_response(command_t cmd, int page_num) {
+	uint8_t data[NUM_FRAGMENTS * PAYLOAD_LENGTH];
+	if (cmd == CMD_GLUCOSE_PAGE) {
+		sim_glucose_page(page_num, data);
+	} else {
+		sim_history_page(page_num, data);
+	}
+	uint16_t crc = crc16(data, HISTORY_PAGE_SIZE);
+	if (sim_pump.bad_page_crc) {
+		crc = ~crc;
+	}
+	put_be16(&data[HISTORY_PAGE_SIZE], crc);
+	fragment_response(cmd, data, sizeof(data));
+}
+
+static void glucose_pages_response(void) {
+	int n = sim_pump.glucose_page;
+	uint8_t data[7] = { 6, n >> 24, n >> 16, n >> 8, n };
+	put_be16(&data[5], sim_pump.glucose_pages);
+	respond(CMD_GLUCOSE_PAGES, data, sizeof(data));
+}
+
+// Resend the last fragment in response to a NAK.
+static void repeat_fragment_response(void) {
+	if (fragment_command == 0) {
+		return;
+	}
+	respond(fragment_command, fragments[next_fragment - 1], FRAGMENT_LENGTH);
+}
+
+// Skip the fragment that was about to be sent.
+static void skip_fragment(void) {
+	if (fragment_command == 0 || next_fragment == num_fragments) {
+		response_len = 0;
+		return;
+	}
+	respond(fragment_command, fragments[next_fragment++], FRAGMENT_LENGTH);
+}
+
+static void next_fragment_response(void) {
+	if (fragment_command == 0 || next_fragment == num_fragments) {
+		fragment_command = 0;
+		return;
+	}
+	respond(fragment_command, fragments[next_fragment++], FRAGMENT_LENGTH);
+}
+
+static void clock_response(void) {
+	struct tm *tm = localtime(&sim_pump.clock);
+	uint8_t data[8] = {
+		7, tm->tm_hour, tm->tm_min, tm->tm_sec,
+		0, 0, tm->tm_mon + 1, tm->tm_mday,
+	};
+	put_be16(&data[4], tm->tm_year + 1900);
+	respond(CMD_CLOCK, data, sizeof(data));
+}
+
+static void handle_short_command(command_t cmd) {
+	uint8_t data[64] = { 0 };
+	switch (cmd) {
+	case CMD_WAKEUP:
+		ack();
+		break;
+	case CMD_ACK:
+		next_fragment_response();
+		break;
+	case CMD_NAK:
+		repeat_fragment_response();
+		break;
+	case CMD_BASAL_RATES:
+		basal_rates_response();
+		break;
+	case CMD_SETTINGS:
+		settings_response();
+		break;
+	case CMD_MODEL:
+		model_response();
+		break;
+	case CMD_BATTERY:
+		data[0] = 3;
+		put_be16(&data[2], sim_pump.battery / 10);
+		respond(cmd, data, 4);
+		break;
+	case CMD_RESERVOIR:
+		if (sim_pump.model % 100 <= 22) {
+			data[0] = 2;
+			put_be16(&data[1], sim_pump.reservoir / 100);
+			respond(cmd, data, 3);
+		} else {
+			data[0] = 4;
+			put_be16(&data[3], sim_pump.reservoir / 25);
+			respond(cmd, data, 5);
+		}
+		break;
+	case CMD_STATUS:
+		data[0] = 3;
+		data[1] = sim_pump.status.code;
+		data[2] = sim_pump.status.bolusing;
+		data[3] = sim_pump.status.suspended;
+		respond(cmd, data, 4);
+		break;
+	case CMD_CLOCK:
+		clock_response();
+		break;
+	case CMD_TEMP_BASAL:
+		data[0] = 6;
+		put_be16(&data[3], sim_pump.temp_basal / 25);
+		put_be16(&data[5], sim_pump.temp_basal_minutes);
+		respond(cmd, data, 7);
+		break;
+	case CMD_GLUCOSE_PAGES:
+		glucose_pages_response();
+		break;
+	case CMD_HISTORY:
+	case CMD_GLUCOSE_PAGE:
+	case CMD_SET_ABS_TEMP_BASAL:
+		// Acknowledge the short packet and wait for the parameters.
+		pending_long_command = cmd;
+		ack();
+		break;
+	default:
+		break;
+	}
+}
+
+static void handle_long_command(command_t cmd, const uint8_t *params) {
+	if (cmd != pending_long_command) {
+		return;
+	}
+	pending_long_command = 0;
+	switch (cmd) {
+	case CMD_HISTORY:
+		page_response(cmd, params[0]);
+		break;
+	case CMD_GLUCOSE_PAGE:
+		page_response(cmd, params[0] << 24 | params[1] << 16 | params[2] << 8 | params[3]);
+		break;
+	case CMD_SET_ABS_TEMP_BASAL:
+		sim_pump.temp_basal = two_byte_be_int((uint8_t *)params) * 25;
+		sim_pump.temp_basal_minutes = params[2] * 30;
+		ack();
+		break;
+	default:
+		break;
+	}
+}
+
+void transmit(uint8_t *buf, int count) {
+	// The radio sends about 2 bytes per millisecond.
+	now += count / 2;
+	packets++;
+	response_len = 0;
+	uint8_t pkt[80];
+	int n = decode_4b6b(buf, pkt, count);
+	if (n < 7 || pkt[n - 1] != crc8(pkt, n - 1)) {
+		return;
+	}
+	if (pkt[0] == MYSENTRY_DEVICE && pkt[4] == MYSENTRY_ACK && memcmp(&pkt[1], pump_id, 3) == 0) {
+		sim_pump.mysentry_acks++;
+		sim_pump.mysentry_ack_seq = pkt[5];
+		return;
+	}
+	if (pkt[0] != CARELINK_DEVICE) {
+		return;
+	}
+	if (memcmp(&pkt[1], pump_id, 3) != 0) {
+		return;
+	}
+	command_t cmd = pkt[4];
+	if (now >= awake_until) {
+		if (cmd != CMD_WAKEUP) {
+			return;
+		}
+		wakeups_seen++;
+		if (wakeups_seen < sim_pump.wakeup_packets) {
+			return;
+		}
+		wakeups_seen = 0;
+	}
+	awake_until = now + sim_pump.awake_duration * 1000;
+	if (n == 7) {
+		handle_short_command(cmd);
+	} else {
+		handle_long_command(cmd, &pkt[6]);
+	}
+	response_delay = sim_pump.response_delay;
+	if (response_len != 0 && sim_pump.response_fn) {
+		switch (sim_pump.response_fn(cmd, &response_delay)) {
+		case SIM_DELIVERED:
+			break;
+		case SIM_LOST:
+			response_len = 0;
+			break;
+		case SIM_CORRUPTED:
+			response[response_len / 2] ^= 0x55;
+			break;
+		case SIM_SKIPPED:
+			skip_fragment();
+			break;
+		}
+	}
+}
+
+int receive(uint8_t *buf, int count, int timeout) {
+	if (response_len == 0 || response_delay >= timeout) {
+		now += timeout;
+		return 0;
+	}
+	now += response_delay + response_len / 2;
+	int n = response_len < count ? response_len : count;
+	memcpy(buf, response, n);
+	response_len = 0;
+	return n;
+}
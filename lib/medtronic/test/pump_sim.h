@@ -0,0 +1,76 @@
+#ifndef _PUMP_SIM_H
+#define _PUMP_SIM_H
+
+// Simulated pump and radio for host tests.
+// It implements the rfm95.h transmit/receive API and the clocks,
+// decoding each transmitted packet and queueing the pump's response.
+
+#include "medtronic.h"
+
+#define SIM_PUMP_ID	"123456"
+
+typedef enum {
+	SIM_DELIVERED,
+	SIM_LOST,
+	SIM_CORRUPTED,
+	SIM_SKIPPED,	// the pump skips a fragment and sends the next one
+} sim_fate_t;
+
+typedef struct {
+	int model;
+	int awake_duration;	// seconds the radio stays on after the last exchange
+	int wakeup_packets;	// wakeup packets needed before the pump responds
+	int response_delay;	// milliseconds
+	// If set, this is called for each response to decide its fate
+	// and optionally change its delay.
+	sim_fate_t (*response_fn)(uint8_t cmd, int *delay);
+	int battery;		// milliVolts
+	insulin_t reservoir;
+	insulin_t temp_basal;
+	int temp_basal_minutes;
+	status_t status;
+	time_t clock;
+	settings_t settings;
+	int num_basal_rates;
+	basal_rate_t basal_rates[MAX_BASAL_RATES];
+	bool bad_page_crc;
+	int glucose_page;	// number of the current glucose page
+	int glucose_pages;	// number of glucose pages stored
+	int mysentry_acks;	// MySentry acknowledgements received
+	uint8_t mysentry_ack_seq;	// sequence number in the last one
+} sim_pump_t;
+
+extern sim_pump_t sim_pump;
+
+// Reset the simulated pump to its default (asleep) state
+// and advance the simulated clock by an hour.
+void sim_reset(void);
+
+// Advance the simulated clock without any radio activity.
+void sim_sleep(int ms);
+
+// Restart monotonic_ms() from zero, as waking from deep sleep does.
+// Only the system clock and RTC memory carry over.
+void sim_reboot(void);
+
+// Number of packets transmitted to the pump since the last reset.
+int sim_packets(void);
+
+// Simulated time in milliseconds.
+int64_t sim_time(void);
+
+// Fill in the contents of a simulated history page (HISTORY_PAGE_SIZE bytes).
+void sim_history_page(int page_num, uint8_t *page);
+
+// Fill in the contents of a simulated glucose page (HISTORY_PAGE_SIZE bytes).
+void sim_glucose_page(int page_num, uint8_t *page);
+
+// Queue a MySentry packet from the given pump ID, with the given
+// message type and body, to be received after delay milliseconds.
+void sim_broadcast(const char *pump_id, uint8_t type, const uint8_t *body, int len, int delay);
+
+// Forget the configuration cache saved by pump_config_save(),
+// as if the flash had been erased.
+void sim_erase_config(void);
+
+#endif // _PUMP_SIM_H
@@ -0,0 +1,224 @@
+// Check decoding of bolus wizard, BG, meal, and daily total records
+// using hand-assembled history pages.
+
+#include "medtronic_test.h"
+
+static uint8_t page[HISTORY_PAGE_SIZE];
+static int page_len;
+
+static void start_page(void) {
+	memset(page, 0, sizeof(page));
+	page_len = 0;
+}
+
+static uint8_t *add_record(int len) {
+	uint8_t *p = &page[page_len];
+	page_len += len;
+	assert(page_len <= sizeof(page));
+	return p;
+}
+
+// Encode a 5-byte timestamp (the inverse of pump_decode_time).
+static void put_time(uint8_t *p, const struct tm *tm) {
+	int month = tm->tm_mon + 1;
+	p[0] = (month >> 2) << 6 | tm->tm_sec;
+	p[1] = (month & 0x3) << 6 | tm->tm_min;
+	p[2] = tm->tm_hour;
+	p[3] = tm->tm_mday;
+	p[4] = tm->tm_year - 100;
+}
+
+static struct tm test_tm(int hour, int min) {
+	time_t t = TEST_TIME(hour, min);
+	struct tm tm;
+	localtime_r(&t, &tm);
+	return tm;
+}
+
+static int num_records;
+
+static int save_record(history_record_t *r) {
+	if (num_records == MAX_HISTORY) {
+		return 1;
+	}
+	history[num_records++] = *r;
+	return 0;
+}
+
+static history_record_t *decode(int family, int want) {
+	num_records = 0;
+	pump_decode_history(page, page_len, family, save_record);
+	if (num_records != want) {
+		test_failed("x%d: decoded %d records, want %d", family, num_records, want);
+		exit_test();
+	}
+	return history;
+}
+
+#define CHECK(name, got, want)	do {						\
+	if ((got) != (want)) {								\
+		test_failed("%s = %d, want %d", name, (int)(got), (int)(want));		\
+	}										\
+} while (0)
+
+static void check_time(const char *name, time_t got, time_t want) {
+	if (got != want) {
+		char ts1[TIME_STRING_SIZE], ts2[TIME_STRING_SIZE];
+		test_failed("%s time = %s, want %s", name, time_string(got, ts1), time_string(want, ts2));
+	}
+}
+
+void test_bolus_wizard_x23(void) {
+	struct tm tm = test_tm(12, 30);
+	start_page();
+	uint8_t *p = add_record(22);
+	p[0] = BolusWizard;
+	put_time(&p[2], &tm);
+	p[1] = 0x1B;		// glucose 0x11B
+	p[7] = 0x2C;		// carbs 0x12C
+	p[8] = 0x04 | 0x01;
+	p[9] = 0x00;		// carb ratio 12.5
+	p[10] = 125;
+	p[11] = 40;		// sensitivity
+	p[12] = 100;		// target low
+	p[13] = 0x23;		// correction 0x123
+	p[14] = 0x01;		// food 0x190
+	p[15] = 0x90;
+	p[16] = 0x08;
+	p[17] = 0x00;		// unabsorbed 0x28
+	p[18] = 0x28;
+	p[19] = 0x02;		// estimate 0x28B
+	p[20] = 0x8B;
+	p[21] = 120;		// target high
+	history_record_t *r = decode(23, 1);
+	bolus_wizard_t *w = &r->info.bolus_wizard;
+	check_time("BolusWizard", r->time, TEST_TIME(12, 30));
+	CHECK("glucose", w->glucose, 0x11B);
+	CHECK("carbs", w->carbs, 0x12C);
+	CHECK("carb ratio", w->carb_ratio, 125);
+	CHECK("sensitivity", w->sensitivity, 40);
+	CHECK("target low", w->target_low, 100);
+	CHECK("target high", w->target_high, 120);
+	CHECK("correction", w->correction, 0x123 * 25);
+	CHECK("food", w->food, 0x190 * 25);
+	CHECK("unabsorbed", w->unabsorbed, 0x28 * 25);
+	CHECK("estimate", w->estimate, 0x28B * 25);
+	CHECK("insulin", r->insulin, w->estimate);
+}
+
+void test_bolus_wizard_x22(void) {
+	struct tm tm = test_tm(7, 45);
+	start_page();
+	uint8_t *p = add_record(20);
+	p[0] = BolusWizard;
+	put_time(&p[2], &tm);
+	p[1] = 0x2C;		// glucose 0x32C
+	p[7] = 60;		// carbs
+	p[8] = 0x03;
+	p[9] = 15;		// carb ratio
+	p[10] = 50;		// sensitivity
+	p[11] = 90;		// target low
+	p[12] = 0x02;		// correction 13 + 2
+	p[13] = 40;		// food
+	p[14] = 13;
+	p[16] = 5;		// unabsorbed
+	p[18] = 50;		// estimate
+	p[19] = 110;		// target high
+	history_record_t *r = decode(22, 1);
+	bolus_wizard_t *w = &r->info.bolus_wizard;
+	check_time("BolusWizard", r->time, TEST_TIME(7, 45));
+	CHECK("glucose", w->glucose, 0x32C);
+	CHECK("carbs", w->carbs, 60);
+	CHECK("carb ratio", w->carb_ratio, 150);
+	CHECK("sensitivity", w->sensitivity, 50);
+	CHECK("target low", w->target_low, 90);
+	CHECK("target high", w->target_high, 110);
+	CHECK("correction", w->correction, 1500);
+	CHECK("food", w->food, 4000);
+	CHECK("unabsorbed", w->unabsorbed, 500);
+	CHECK("estimate", w->estimate, 5000);
+}
+
+void test_bg_and_meal(void) {
+	struct tm tm = test_tm(18, 5);
+	start_page();
+	uint8_t *p = add_record(10);
+	p[0] = BGReceived;
+	put_time(&p[2], &tm);
+	// Glucose 437 = 54 << 3 | 5
+	p[1] = 54;
+	p[4] |= 5 << 5;
+	p[7] = 0xA1;
+	p[8] = 0xB2;
+	p[9] = 0xC3;
+	p = add_record(9);
+	p[0] = MealMarker;
+	put_time(&p[2], &tm);
+	p[7] = GRAMS << 1 | 1;
+	p[8] = 0x04;		// carbs 0x104
+	history_record_t *r = decode(23, 2);
+	bg_received_t *bg = &r[0].info.bg_received;
+	check_time("BGReceived", r[0].time, TEST_TIME(18, 5));
+	CHECK("glucose", bg->glucose, 437);
+	CHECK("meter", bg->meter[0] << 16 | bg->meter[1] << 8 | bg->meter[2], 0xA1B2C3);
+	meal_marker_t *m = &r[1].info.meal_marker;
+	check_time("MealMarker", r[1].time, TEST_TIME(18, 5));
+	CHECK("carbs", m->carbs, 0x104);
+	CHECK("carb units", m->units, GRAMS);
+}
+
+void test_daily_total(void) {
+	time_t midnight = TEST_TIME_NOW - since_midnight(TEST_TIME_NOW);
+	struct tm tm;
+	localtime_r(&midnight, &tm);
+	int month = tm.tm_mon + 1;
+	start_page();
+	uint8_t *p = add_record(44);
+	p[0] = DailyTotal522;
+	p[1] = (month >> 1) << 5 | tm.tm_mday;
+	p[2] = (month & 1) << 7 | (tm.tm_year - 100);
+	p[3] = 0x03;		// total 0x3B6
+	p[4] = 0xB6;
+	history_record_t *r = decode(23, 1);
+	check_time("DailyTotal522", r->time, midnight);
+	CHECK("total", r->insulin, 0x3B6 * 25);
+}
+
+void test_unabsorbed_insulin(void) {
+	struct tm tm = test_tm(9, 0);
+	start_page();
+	int n = MAX_UNABSORBED + 4;
+	uint8_t *p = add_record(2 + 3 * n);
+	p[0] = UnabsorbedInsulin;
+	p[1] = 2 + 3 * n;
+	for (int i = 0; i < n; i++) {
+		int age = 20 * i + 300;
+		p[2 + 3*i] = 4 * (i + 1);
+		p[3 + 3*i] = age & 0xFF;
+		p[4 + 3*i] = (age >> 8) << 4;
+	}
+	// The wizard record that follows.
+	p = add_record(22);
+	p[0] = BolusWizard;
+	put_time(&p[2], &tm);
+	history_record_t *r = decode(23, 2);
+	unabsorbed_insulin_t *u = &r[0].info.unabsorbed_insulin;
+	CHECK("unabsorbed type", r[0].type, UnabsorbedInsulin);
+	CHECK("unabsorbed time", r[0].time, 0);
+	CHECK("count", u->count, MAX_UNABSORBED);
+	for (int i = 0; i < u->count; i++) {
+		CHECK("amount", u->bolus[i].amount, 100 * (i + 1));
+		CHECK("age", u->bolus[i].age, 20 * i + 300);
+	}
+	CHECK("wizard type", r[1].type, BolusWizard);
+	check_time("BolusWizard", r[1].time, TEST_TIME(9, 0));
+}
+
+int main(int argc, char **argv) {
+	test_bolus_wizard_x23();
+	test_bolus_wizard_x22();
+	test_bg_and_meal();
+	test_daily_total();
+	test_unabsorbed_insulin();
+	exit_test();
+}
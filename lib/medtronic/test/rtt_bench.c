@@ -0,0 +1,150 @@
+// Replay a sequence of pump response times against the simulated pump,
+// with fixed and with adaptive receive timeouts, and compare the time
+// spent per polling cycle.
+//
+// Usage: rtt_bench [trace-file]
+//
+// Each line of the trace file is a response time in milliseconds,
+// or "lost" or "corrupt"; the lines are used cyclically.
+// Without a trace file, a synthetic sequence is used.
+
+#include "medtronic_test.h"
+#include "pump_sim.h"
+#include "commands.h"
+
+#define CYCLES		500
+#define MAX_TRACE	10000
+
+#define LOST		(-1)
+#define CORRUPT		(-2)
+
+static int trace[MAX_TRACE];
+static int trace_len;
+static int trace_pos;
+
+static uint32_t seed;
+
+static int next_random(int n) {
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) % n;
+}
+
+// Fragments of extended responses take longer than short responses.
+static int synthetic_delay(uint8_t cmd) {
+	int p = next_random(100);
+	if (p < 4) {
+		return LOST;
+	}
+	if (p < 6) {
+		return CORRUPT;
+	}
+	int d = 15 + next_random(10);
+	if (cmd == CMD_ACK) {
+		d += 25;
+	}
+	if (p >= 95) {
+		d += 80;
+	}
+	return d;
+}
+
+static sim_fate_t replay(uint8_t cmd, int *delay) {
+	int d;
+	if (trace_len != 0) {
+		d = trace[trace_pos];
+		trace_pos = (trace_pos + 1) % trace_len;
+	} else {
+		d = synthetic_delay(cmd);
+	}
+	switch (d) {
+	case LOST:
+		return SIM_LOST;
+	case CORRUPT:
+		return SIM_CORRUPTED;
+	default:
+		*delay = d;
+		return SIM_DELIVERED;
+	}
+}
+
+static void read_trace(char *filename) {
+	FILE *f = fopen(filename, "r");
+	if (f == 0) {
+		perror(filename);
+		exit(1);
+	}
+	char line[32];
+	while (trace_len < MAX_TRACE && fgets(line, sizeof(line), f)) {
+		if (strncmp(line, "lost", 4) == 0) {
+			trace[trace_len++] = LOST;
+		} else if (strncmp(line, "corrupt", 7) == 0) {
+			trace[trace_len++] = CORRUPT;
+		} else {
+			trace[trace_len++] = atoi(line);
+		}
+	}
+	fclose(f);
+	if (trace_len == 0) {
+		fprintf(stderr, "%s: no response times\n", filename);
+		exit(1);
+	}
+}
+
+static uint8_t arena[PUMP_SESSION_ARENA_SIZE];
+static pump_session_t pump;
+
+static void print_stats(void) {
+	int n;
+	const pump_rtt_t *e = pump_rtt_stats(&pump, &n);
+	printf("  cmd  len  samples  srtt  rttvar  timeout  no_resp  bad_resp\n");
+	for (int i = 0; i < n; i++, e++) {
+		printf("  %02X  %5s  %7d  %4d  %6d  %7d  %7d  %8d\n",
+		       e->command, e->long_packet ? "long" : "short", e->samples,
+		       e->srtt >> 3, e->rttvar >> 2, e->timeout, e->no_response, e->bad_response);
+	}
+}
+
+static void run(const char *name, int min_timeout, int max_timeout) {
+	sim_reset();
+	sim_pump.awake_duration = 10 * 60;
+	sim_pump.response_fn = replay;
+	trace_pos = 0;
+	seed = 1;
+	pump_session_init(&pump, SIM_PUMP_ID, arena, sizeof(arena));
+	pump_set_timeout_limits(&pump, min_timeout, max_timeout);
+	if (!pump_wakeup(&pump)) {
+		fprintf(stderr, "%s: pump_wakeup failed\n", name);
+		exit(1);
+	}
+	int64_t start = sim_time();
+	int start_packets = sim_packets();
+	int failures = 0;
+	for (int i = 0; i < CYCLES; i++) {
+		int minutes;
+		status_t status;
+		basal_rate_t rates[MAX_BASAL_RATES];
+		failures += pump_get_battery(&pump) == -1;
+		failures += pump_get_reservoir(&pump) == -1;
+		failures += pump_get_temp_basal(&pump, &minutes) == -1;
+		failures += pump_get_status(&pump, &status) == -1;
+		failures += pump_get_clock(&pump) == -1;
+		if (i % 10 == 0) {
+			failures += pump_get_basal_rates(&pump, rates, LEN(rates)) == 0;
+		}
+	}
+	double elapsed = sim_time() - start;
+	printf("%s timeouts: %.1f ms per cycle, %.2f packets per cycle, %d failed commands\n",
+	       name, elapsed / CYCLES, (double)(sim_packets() - start_packets) / CYCLES, failures);
+}
+
+int main(int argc, char **argv) {
+	if (argc == 2) {
+		read_trace(argv[1]);
+	} else if (argc != 1) {
+		fprintf(stderr, "Usage: %s [trace-file]\n", argv[0]);
+		exit(1);
+	}
+	run("fixed", 500, 500);
+	run("adaptive", 40, 1000);
+	print_stats();
+}
@@ -0,0 +1,103 @@
+#include "medtronic_test.h"
+#include "pump_sim.h"
+#include "commands.h"
+
+static uint8_t arena[PUMP_SESSION_ARENA_SIZE];
+static pump_session_t pump;
+
+static sim_fate_t next_fate;
+
+static sim_fate_t fate(uint8_t cmd, int *delay) {
+	sim_fate_t f = next_fate;
+	next_fate = SIM_DELIVERED;
+	return f;
+}
+
+static const pump_rtt_t *battery_rtt(void) {
+	int n;
+	const pump_rtt_t *e = pump_rtt_stats(&pump, &n);
+	for (int i = 0; i < n; i++, e++) {
+		if (e->command == CMD_BATTERY && !e->long_packet) {
+			return e;
+		}
+	}
+	test_failed("no statistics for battery command");
+	exit_test();
+	return 0;
+}
+
+static void start(void) {
+	sim_reset();
+	sim_pump.response_delay = 20;
+	sim_pump.response_fn = fate;
+	pump_session_init(&pump, SIM_PUMP_ID, arena, sizeof(arena));
+	if (!pump_wakeup(&pump)) {
+		test_failed("pump_wakeup failed");
+	}
+}
+
+void test_convergence(void) {
+	start();
+	for (int i = 0; i < 20; i++) {
+		pump_get_battery(&pump);
+	}
+	const pump_rtt_t *e = battery_rtt();
+	int srtt = e->srtt >> 3;
+	if (e->samples != 20 || srtt < sim_pump.response_delay || srtt > 2 * sim_pump.response_delay) {
+		test_failed("%d samples with smoothed response time %d ms", e->samples, srtt);
+	}
+	if (e->timeout < srtt || e->timeout > 100) {
+		test_failed("timeout %d ms for %d ms response time", e->timeout, srtt);
+	}
+}
+
+void test_backoff(void) {
+	start();
+	for (int i = 0; i < 20; i++) {
+		pump_get_battery(&pump);
+	}
+	const pump_rtt_t *e = battery_rtt();
+	int timeout = e->timeout;
+	int64_t t0 = sim_time();
+	next_fate = SIM_LOST;
+	if (pump_get_battery(&pump) == -1) {
+		test_failed("pump_get_battery failed after lost response");
+	}
+	int elapsed = sim_time() - t0;
+	if (elapsed > timeout + 100) {
+		test_failed("lost response cost %d ms with %d ms timeout", elapsed, timeout);
+	}
+	if (e->no_response != 1) {
+		test_failed("no_response = %d, want 1", e->no_response);
+	}
+	// A corrupted response arrives on time, so the timeout is not increased.
+	timeout = e->timeout;
+	next_fate = SIM_CORRUPTED;
+	if (pump_get_battery(&pump) == -1) {
+		test_failed("pump_get_battery failed after corrupted response");
+	}
+	if (e->bad_response != 1) {
+		test_failed("bad_response = %d, want 1", e->bad_response);
+	}
+	if (e->timeout > timeout + 20) {
+		test_failed("timeout increased from %d to %d ms after corrupted response", timeout, e->timeout);
+	}
+}
+
+void test_limits(void) {
+	start();
+	pump_set_timeout_limits(&pump, 500, 500);
+	for (int i = 0; i < 5; i++) {
+		pump_get_battery(&pump);
+	}
+	if (battery_rtt()->timeout != 500) {
+		test_failed("timeout %d ms with fixed limits", battery_rtt()->timeout);
+	}
+}
+
+int main(int argc, char **argv) {
+	test_convergence();
+	test_backoff();
+	test_limits();
+	exit_test();
+}
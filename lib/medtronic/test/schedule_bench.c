@@ -0,0 +1,59 @@
+// Compare schedule lookups by linear search with the half-hour index,
+// for the pattern of an IOB or net basal calculation: a lookup every
+// few minutes over a week of history, repeated many times.
+
+#include "medtronic_test.h"
+
+#define ITERATIONS	200
+#define STEP		(5 * 60)
+#define SPAN		(7 * 24 * 60 * 60)
+
+static basal_rate_t rates[MAX_BASAL_RATES];
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void report(const char *name, double elapsed, long sum) {
+	double lookups = (double)ITERATIONS * (SPAN / STEP);
+	printf("%-16s %6.1f ns/lookup (checksum %ld)\n", name, elapsed / lookups * 1e9, sum);
+}
+
+int main(int argc, char **argv) {
+	// A full schedule with a different rate every half hour.
+	for (int i = 0; i < MAX_BASAL_RATES; i++) {
+		rates[i] = (basal_rate_t){ .start = i * 30 * 60, .rate = 500 + 25 * i };
+	}
+	time_t start = TEST_TIME_NOW - SPAN;
+
+	long sum = 0;
+	double t0 = now();
+	for (int n = 0; n < ITERATIONS; n++) {
+		for (time_t t = start; t < start + SPAN; t += STEP) {
+			sum += basal_rate_at(rates, MAX_BASAL_RATES, t);
+		}
+	}
+	report("basal_rate_at", now() - t0, sum);
+
+	schedule_index_t x;
+	basal_rate_index(&x, rates, MAX_BASAL_RATES);
+	sum = 0;
+	t0 = now();
+	for (int n = 0; n < ITERATIONS; n++) {
+		for (time_t t = start; t < start + SPAN; t += STEP) {
+			sum += schedule_lookup(&x, t);
+		}
+	}
+	report("schedule_lookup", now() - t0, sum);
+
+	sum = 0;
+	t0 = now();
+	for (int n = 0; n < ITERATIONS; n++) {
+		for (time_t t = start; t < start + SPAN; t += STEP) {
+			sum += next_change(&x, t) - t;
+		}
+	}
+	report("next_change", now() - t0, sum);
+}
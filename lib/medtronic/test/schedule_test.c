@@ -57,9 +57,11 @@ next_change_case_t next_change_cases[] = {
 #define NUM_NEXT_CHANGE_CASES	(sizeof(next_change_cases)/sizeof(next_change_cases[0]))
 
 void test_next_change(void) {
+	schedule_index_t x;
+	basal_rate_index(&x, test_profile, LEN(test_profile));
 	for (int i = 0; i < NUM_NEXT_CHANGE_CASES; i++) {
 		next_change_case_t *c = &next_change_cases[i];
-		time_t next = next_change(test_profile, LEN(test_profile), c->cur);
+		time_t next = next_change(&x, c->cur);
 		if (next != c->next) {
 			char t1[TIME_STRING_SIZE], t2[TIME_STRING_SIZE], t3[TIME_STRING_SIZE];
 			test_failed("[%d] next_change(%s) = %s, want %s", i,
@@ -68,8 +70,37 @@ void test_next_change(void) {
 	}
 }
 
+// Includes entries that don't start on a half-hour boundary,
+// and a schedule that doesn't start at midnight.
+basal_rate_t index_profiles[][6] = {
+	{ { TOD(0, 0) }, { TOD(0, 30) }, { TOD(6, 0) }, { TOD(6, 30) }, { TOD(23, 30) } },
+	{ { TOD(0, 0) }, { TOD(2, 10) }, { TOD(2, 20) }, { TOD(2, 50) }, { TOD(14, 0) } },
+	{ { TOD(1, 0) }, { TOD(1, 45) }, { TOD(22, 0) } },
+	{ { TOD(0, 0) } },
+};
+int index_profile_lengths[] = { 5, 5, 3, 1 };
+
+void test_schedule_index(void) {
+	for (int i = 0; i < LEN(index_profiles); i++) {
+		basal_rate_t *sched = index_profiles[i];
+		int len = index_profile_lengths[i];
+		schedule_index_t x;
+		basal_rate_index(&x, sched, len);
+		// Every 5 minutes over two days.
+		for (time_t t = TEST_TIME(0, 0); t < TEST_TIME(48, 0); t += 5 * 60 + 7) {
+			int n = schedule_lookup(&x, t);
+			int want = basal_rate_at(sched, len, t);
+			if (n != want) {
+				char ts[TIME_STRING_SIZE];
+				test_failed("[%d] schedule_lookup(%s) = %d, want %d", i, time_string(t, ts), n, want);
+			}
+		}
+	}
+}
+
 int main(int argc, char **argv) {
 	test_basal_rate_at();
 	test_next_change();
+	test_schedule_index();
 	exit_test();
 }
@@ -0,0 +1,135 @@
+#include "medtronic_test.h"
+#include "pump_sim.h"
+#include "commands.h"
+
+static uint8_t arena[PUMP_SESSION_ARENA_SIZE];
+static pump_session_t pump;
+static pump_config_t config;
+
+static void start(void) {
+	sim_reset();
+	pump_session_init(&pump, SIM_PUMP_ID, arena, sizeof(arena));
+	if (!pump_wakeup(&pump)) {
+		test_failed("pump_wakeup failed");
+	}
+	// Learn the pump family, so only the snapshot commands are counted.
+	pump_get_family(&pump);
+}
+
+#define CHECK(name, got, want)	do {						\
+	if ((got) != (want)) {								\
+		test_failed("%s = %ld, want %ld", name, (long)(got), (long)(want));	\
+	}										\
+} while (0)
+
+static void check_snapshot(pump_snapshot_t *r) {
+	CHECK("clock", r->clock, sim_pump.clock);
+	CHECK("battery", r->battery, sim_pump.battery);
+	CHECK("reservoir", r->reservoir, sim_pump.reservoir);
+	CHECK("status", r->status.code, sim_pump.status.code);
+	CHECK("suspended", r->status.suspended, sim_pump.status.suspended);
+	CHECK("temp basal", r->temp_basal, sim_pump.temp_basal);
+	CHECK("temp basal minutes", r->temp_basal_minutes, sim_pump.temp_basal_minutes);
+	CHECK("max basal", r->settings.max_basal, sim_pump.settings.max_basal);
+	CHECK("max bolus", r->settings.max_bolus, sim_pump.settings.max_bolus);
+	CHECK("dia", r->settings.dia, sim_pump.settings.dia);
+}
+
+// Return the number of packets sent by pump_get_snapshot.
+static int snapshot_fields(int fields, pump_snapshot_t *r, int want) {
+	int before = sim_packets();
+	int err = pump_get_snapshot(&pump, fields, r);
+	if (err != want) {
+		test_failed("pump_get_snapshot returned %d, want %d", err, want);
+	}
+	return sim_packets() - before;
+}
+
+static int snapshot(pump_snapshot_t *r, int want) {
+	return snapshot_fields(SNAPSHOT_ALL, r, want);
+}
+
+void test_snapshot(void) {
+	start();
+	sim_pump.temp_basal = 1250;
+	sim_pump.temp_basal_minutes = 90;
+	sim_pump.status.suspended = 1;
+	pump_snapshot_t r;
+	int n = snapshot(&r, 0);
+	check_snapshot(&r);
+	CHECK("packets", n, 6);
+	// The snapshot must agree with the individual getters.
+	int minutes;
+	CHECK("pump_get_battery", pump_get_battery(&pump), r.battery);
+	CHECK("pump_get_temp_basal", pump_get_temp_basal(&pump, &minutes), r.temp_basal);
+	CHECK("pump_get_clock", pump_get_clock(&pump), r.clock);
+}
+
+void test_cached(void) {
+	sim_erase_config();
+	start();
+	pump_config_attach(&pump, &config);
+	pump_snapshot_t r;
+	snapshot(&r, 0);
+	check_snapshot(&r);
+	// The settings are now cached.
+	int n = snapshot(&r, 0);
+	check_snapshot(&r);
+	CHECK("packets with cached settings", n, 5);
+	settings_t settings;
+	int before = sim_packets();
+	pump_get_settings(&pump, &settings);
+	CHECK("pump_get_settings packets", sim_packets() - before, 0);
+}
+
+void test_fields(void) {
+	start();
+	pump_snapshot_t r;
+	int n = snapshot_fields(SNAPSHOT_BATTERY | SNAPSHOT_TEMP_BASAL, &r, 0);
+	CHECK("packets", n, 2);
+	CHECK("battery", r.battery, sim_pump.battery);
+	CHECK("temp basal", r.temp_basal, sim_pump.temp_basal);
+	// Fields not selected are not read.
+	CHECK("clock", r.clock, -1);
+	CHECK("reservoir", r.reservoir, -1);
+	CHECK("dia", r.settings.dia, 0);
+	n = snapshot_fields(0, &r, 0);
+	CHECK("packets with no fields", n, 0);
+}
+
+static sim_fate_t corrupt_status(uint8_t cmd, int *delay) {
+	return cmd == CMD_STATUS ? SIM_CORRUPTED : SIM_DELIVERED;
+}
+
+void test_lost_response(void) {
+	start();
+	sim_pump.response_fn = corrupt_status;
+	pump_snapshot_t r;
+	snapshot(&r, -1);
+	CHECK("status", r.status.code, 0);
+	// The other commands are still answered.
+	CHECK("battery", r.battery, sim_pump.battery);
+	CHECK("temp basal", r.temp_basal, sim_pump.temp_basal);
+	CHECK("dia", r.settings.dia, sim_pump.settings.dia);
+}
+
+void test_asleep(void) {
+	start();
+	// Let the pump fall asleep.
+	sim_sleep((sim_pump.awake_duration + 1) * 1000);
+	pump_snapshot_t r;
+	int n = snapshot(&r, -1);
+	CHECK("clock", r.clock, -1);
+	CHECK("battery", r.battery, -1);
+	// The batch stops after the first command goes unanswered.
+	CHECK("packets", n, 3);
+}
+
+int main(int argc, char **argv) {
+	test_snapshot();
+	test_cached();
+	test_fields();
+	test_lost_response();
+	test_asleep();
+	exit_test();
+}
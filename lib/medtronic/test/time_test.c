@@ -106,10 +106,113 @@ void test_since_midnight(void) {
 	}
 }
 
+static char *time_zones[] = {
+	"America/New_York",
+	"Europe/London",
+	"Australia/Lord_Howe",
+	"Asia/Kolkata",
+	"UTC",
+	"EST5EDT,M3.2.0,M11.1.0",
+};
+#define NUM_TIME_ZONES	(sizeof(time_zones)/sizeof(time_zones[0]))
+
+static void check_local_time(struct tm *tm) {
+	time_t t = make_local_time(tm);
+	struct tm tm2 = *tm;
+	tm2.tm_isdst = -1;
+	time_t want = mktime(&tm2);
+	if (t != want) {
+		test_failed("[%s] make_local_time(%04d-%02d-%02d %02d:%02d:%02d) = %ld, want %ld",
+			    getenv("TZ"), tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday,
+			    tm->tm_hour, tm->tm_min, tm->tm_sec, (long)t, (long)want);
+	}
+}
+
+void test_make_local_time(void) {
+	char *saved = getenv("TZ");
+	if (saved != 0) {
+		saved = strdup(saved);
+	}
+	for (int i = 0; i < NUM_TIME_ZONES; i++) {
+		setenv("TZ", time_zones[i], 1);
+		tzset();
+		// Every 10 minutes (at varying seconds) from 2015 through 2021,
+		// including the times skipped and repeated at DST transitions.
+		int n = 0;
+		for (int year = 2015; year <= 2021; year++) {
+			for (int mon = 0; mon < 12; mon++) {
+				for (int mday = 1; mday <= 31; mday++) {
+					for (int min = 0; min < 24 * 60; min += 10) {
+						struct tm tm = {
+							.tm_year = year - 1900,
+							.tm_mon = mon,
+							.tm_mday = mday,
+							.tm_hour = min / 60,
+							.tm_min = min % 60,
+							.tm_sec = n++ % 60,
+						};
+						check_local_time(&tm);
+					}
+				}
+			}
+		}
+		// Out-of-range fields, as found in corrupted pump records.
+		struct tm tm = { .tm_year = 118, .tm_mon = -1, .tm_mday = 0, .tm_hour = 31, .tm_min = 63, .tm_sec = 63 };
+		check_local_time(&tm);
+	}
+	if (saved != 0) {
+		setenv("TZ", saved, 1);
+		free(saved);
+	} else {
+		unsetenv("TZ");
+	}
+	tzset();
+}
+
+static time_of_day_t localtime_since_midnight(time_t t) {
+	struct tm *tm = localtime(&t);
+	return tm->tm_hour * 3600 + tm->tm_min * 60 + tm->tm_sec;
+}
+
+void test_since_midnight_cache(void) {
+	char *saved = getenv("TZ");
+	if (saved != 0) {
+		saved = strdup(saved);
+	}
+	for (int i = 0; i < NUM_TIME_ZONES; i++) {
+		setenv("TZ", time_zones[i], 1);
+		tzset();
+		// About every 7 minutes through 2020 and 2021, forward and
+		// then backward, so that the cache is used across DST changes.
+		int step = 7 * 60 + 13;
+		for (int dir = 0; dir < 2; dir++) {
+			for (int n = 0; n < (1640995200 - 1577836800) / step; n++) {
+				time_t t = dir == 0 ? 1577836800 + n * step : 1640995200 - n * step;
+				time_of_day_t s = since_midnight(t);
+				time_of_day_t want = localtime_since_midnight(t);
+				if (s != want) {
+					char ts[TIME_STRING_SIZE];
+					test_failed("[%s] since_midnight(%s) = %d, want %d",
+						    time_zones[i], time_string(t, ts), s, want);
+				}
+			}
+		}
+	}
+	if (saved != 0) {
+		setenv("TZ", saved, 1);
+		free(saved);
+	} else {
+		unsetenv("TZ");
+	}
+	tzset();
+}
+
 int main(int argc, char **argv) {
 	test_decode_time();
 	test_parse_json_time();
 	test_parse_duration();
 	test_since_midnight();
+	test_make_local_time();
+	test_since_midnight_cache();
 	exit_test();
 }
@@ -0,0 +1,197 @@
+#include "medtronic_test.h"
+#include "pump_sim.h"
+
+#define SECOND	1000
+
+static uint8_t arena[PUMP_SESSION_ARENA_SIZE];
+static pump_session_t pump;
+
+// One polling cycle, as done by pumpstat.
+// Return the number of packets sent to the pump.
+static int poll_pump(void) {
+	int before = sim_packets();
+	if (!pump_wakeup(&pump)) {
+		test_failed("pump_wakeup failed at %ld ms", (long)sim_time());
+		return -1;
+	}
+	int minutes;
+	if (pump_get_battery(&pump) != sim_pump.battery) {
+		test_failed("pump_get_battery failed");
+	}
+	if (pump_get_reservoir(&pump) != sim_pump.reservoir) {
+		test_failed("pump_get_reservoir failed");
+	}
+	if (pump_get_temp_basal(&pump, &minutes) != sim_pump.temp_basal) {
+		test_failed("pump_get_temp_basal failed");
+	}
+	return sim_packets() - before;
+}
+
+static int poll_cycles(int n, int interval) {
+	int total = 0;
+	for (int i = 0; i < n; i++) {
+		total += poll_pump();
+		sim_sleep(interval);
+	}
+	return total;
+}
+
+void test_awake_window(void) {
+	sim_reset();
+	pump_set_awake_duration(&pump, 60);
+	int first = poll_pump();
+	if (first <= 3) {
+		test_failed("first cycle sent only %d packets; pump was asleep", first);
+	}
+	if (!pump_is_awake(&pump)) {
+		test_failed("pump not considered awake after successful exchange");
+	}
+	sim_sleep(30 * SECOND);
+	int second = poll_pump();
+	if (second != 3) {
+		test_failed("cycle within awake window sent %d packets, want 3", second);
+	}
+	// Let the pump fall asleep; the next cycle must wake it up again.
+	sim_sleep(5 * 60 * SECOND);
+	if (pump_is_awake(&pump)) {
+		test_failed("pump considered awake after awake window closed");
+	}
+	int third = poll_pump();
+	if (third <= 3) {
+		test_failed("cycle after awake window sent only %d packets; pump was asleep", third);
+	}
+}
+
+void test_keep_alive(void) {
+	sim_reset();
+	pump_set_awake_duration(&pump, 60);
+	poll_pump();
+	sim_sleep(20 * SECOND);
+	int before = sim_packets();
+	pump_keep_alive(&pump);
+	if (sim_packets() != before) {
+		test_failed("keep-alive sent a packet with %d seconds remaining", pump_awake_remaining(&pump));
+	}
+	sim_sleep(30 * SECOND);
+	before = sim_packets();
+	if (!pump_keep_alive(&pump)) {
+		test_failed("keep-alive failed");
+	}
+	if (sim_packets() != before + 1) {
+		test_failed("keep-alive sent %d packets, want 1", sim_packets() - before);
+	}
+	sim_sleep(45 * SECOND);
+	if (!pump_is_awake(&pump)) {
+		test_failed("pump not considered awake after keep-alive");
+	}
+	int n = poll_pump();
+	if (n != 3) {
+		test_failed("cycle after keep-alive sent %d packets, want 3", n);
+	}
+}
+
+void test_missed_window(void) {
+	// If the pump goes to sleep sooner than expected, the library
+	// must stop trusting the awake window and wake it up again.
+	sim_reset();
+	sim_pump.awake_duration = 20;
+	pump_set_awake_duration(&pump, 60);
+	poll_pump();
+	sim_sleep(30 * SECOND);
+	if (pump_get_battery(&pump) != -1) {
+		test_failed("sleeping pump answered");
+	}
+	if (pump_is_awake(&pump)) {
+		test_failed("pump considered awake after failed exchange");
+	}
+	if (poll_pump() < 0) {
+		test_failed("could not wake pump after missed window");
+	}
+}
+
+void test_deep_sleep(void) {
+	sim_reset();
+	pump_set_awake_duration(&pump, 60);
+	poll_pump();
+	int model = pump_cached_model(&pump);
+	// Deep sleep loses the session but not the RTC memory.
+	sim_sleep(30 * SECOND);
+	sim_reboot();
+	pump_session_init(&pump, SIM_PUMP_ID, arena, sizeof(arena));
+	pump_set_awake_duration(&pump, 60);
+	if (!pump_is_awake(&pump)) {
+		test_failed("awake window lost in deep sleep");
+	}
+	if (pump_cached_model(&pump) != model || pump_cached_model(&pump) == 0) {
+		test_failed("model %d after deep sleep, want %d", pump_cached_model(&pump), model);
+	}
+	int n = poll_pump();
+	if (n != 3) {
+		test_failed("cycle after deep sleep sent %d packets, want 3", n);
+	}
+	// The window still closes on time.
+	sim_sleep(90 * SECOND);
+	sim_reboot();
+	pump_session_init(&pump, SIM_PUMP_ID, arena, sizeof(arena));
+	pump_set_awake_duration(&pump, 60);
+	if (pump_is_awake(&pump)) {
+		test_failed("pump considered awake after deep sleep past its window");
+	}
+	if (poll_pump() <= 3) {
+		test_failed("cycle after long deep sleep did not wake the pump");
+	}
+}
+
+#define CYCLES		20
+#define INTERVAL	(30 * SECOND)
+
+void compare_packet_counts(void) {
+	sim_reset();
+	pump_set_awake_duration(&pump, 0);
+	int without = poll_cycles(CYCLES, INTERVAL);
+	sim_reset();
+	pump_set_awake_duration(&pump, 60);
+	int with = poll_cycles(CYCLES, INTERVAL);
+	printf("%d polling cycles at %d s intervals: %d packets without awake window, %d with\n",
+	       CYCLES, INTERVAL / SECOND, without, with);
+	if (with >= without) {
+		test_failed("awake window did not reduce packet count (%d >= %d)", with, without);
+	}
+}
+
+void test_sessions(void) {
+	uint8_t small[PUMP_SESSION_ARENA_SIZE - 1];
+	pump_session_t other;
+	if (pump_session_init(&other, SIM_PUMP_ID, small, sizeof(small)) != -1) {
+		test_failed("pump_session_init accepted a %d-byte arena", (int)sizeof(small));
+	}
+	// A session for a different pump must not share the first session's state.
+	static uint8_t other_arena[PUMP_SESSION_ARENA_SIZE];
+	pump_session_init(&other, "654321", other_arena, sizeof(other_arena));
+	sim_reset();
+	pump_set_awake_duration(&pump, 60);
+	poll_pump();
+	if (pump_is_awake(&other)) {
+		test_failed("other session considered awake");
+	}
+	if (pump_get_model(&other) != -1) {
+		test_failed("simulated pump answered a different pump ID");
+	}
+	if (!pump_is_awake(&pump)) {
+		test_failed("session lost its awake state");
+	}
+	if (pump_get_family(&other) != 0 || pump_get_family(&pump) != sim_pump.model % 100) {
+		test_failed("pump family shared between sessions");
+	}
+}
+
+int main(int argc, char **argv) {
+	pump_session_init(&pump, SIM_PUMP_ID, arena, sizeof(arena));
+	test_awake_window();
+	test_keep_alive();
+	test_missed_window();
+	test_deep_sleep();
+	compare_packet_counts();
+	test_sessions();
+	exit_test();
+}
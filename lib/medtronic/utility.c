@@ -2,11 +2,6 @@
 
 #include "medtronic.h"
 
-time_of_day_t since_midnight(time_t t) {
-	struct tm *tm = localtime(&t);
-	return tm->tm_hour * 3600 + tm->tm_min * 60 + tm->tm_sec;
-}
-
 char *format_time(time_t t, const char *fmt, char *buf, int len) {
 	strftime(buf, len, fmt, localtime(&t));
 	return buf;
@@ -0,0 +1,48 @@
+#include <nvs.h>
+
+#define TAG		"NS"
+
+#include <esp_log.h>
+
+#include "nightscout.h"
+
+#define STORAGE_NAMESPACE	"nightscout"
+#define CURSOR_KEY		"cursor"
+
+int nightscout_cursor_load(nightscout_cursor_t *c) {
+	nvs_handle handle;
+	esp_err_t err = nvs_open(STORAGE_NAMESPACE, NVS_READONLY, &handle);
+	if (err != ESP_OK) {
+		ESP_LOGI(TAG, "nightscout_cursor_load: nvs_open: %s", esp_err_to_name(err));
+		return -1;
+	}
+	size_t size = sizeof(*c);
+	err = nvs_get_blob(handle, CURSOR_KEY, c, &size);
+	nvs_close(handle);
+	if (err != ESP_OK) {
+		ESP_LOGI(TAG, "nightscout_cursor_load: nvs_get_blob: %s", esp_err_to_name(err));
+		return -1;
+	}
+	if (size != sizeof(*c)) {
+		ESP_LOGI(TAG, "nightscout_cursor_load: found %d bytes instead of %d", (int)size, (int)sizeof(*c));
+		return -1;
+	}
+	return 0;
+}
+
+void nightscout_cursor_save(const nightscout_cursor_t *c) {
+	nvs_handle handle;
+	esp_err_t err = nvs_open(STORAGE_NAMESPACE, NVS_READWRITE, &handle);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "nightscout_cursor_save: nvs_open: %s", esp_err_to_name(err));
+		return;
+	}
+	err = nvs_set_blob(handle, CURSOR_KEY, c, sizeof(*c));
+	if (err == ESP_OK) {
+		err = nvs_commit(handle);
+	}
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "nightscout_cursor_save: %s", esp_err_to_name(err));
+	}
+	nvs_close(handle);
+}
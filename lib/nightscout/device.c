@@ -2,53 +2,66 @@
 
 #include <esp_log.h>
 
-#include <cJSON.h>
-
+#include "json_writer.h"
 #include "nightscout.h"
+#include "upload_queue.h"
 
-static char *device_status_json(nightscout_device_status_t *s) {
-	cJSON *root = cJSON_CreateObject();
+int device_status_json(const nightscout_device_status_t *s, char *buf, int size) {
+	json_writer_t w;
+	json_writer_init(&w, buf, size);
+	json_begin_object(&w, 0);
 
 	char ts[ISO_TIME_STRING_SIZE];
 	print_iso_time(ts, s->tv);
-	cJSON_AddItemToObject(root, "created_at", cJSON_CreateString(ts));
-	cJSON_AddItemToObject(root, "device",  cJSON_CreateString("GNARL"));
-
-	cJSON *openaps = cJSON_CreateObject();
-	cJSON_AddItemToObject(root, "openaps", openaps);
-	cJSON *iob = cJSON_CreateObject();
-	cJSON_AddItemToObject(openaps, "iob",  iob);
-	cJSON *i = cJSON_CreateObject();
-	cJSON_AddItemToObject(iob, "iob",  i);
-	cJSON_AddItemToObject(i, "iob", cJSON_CreateNumber(s->iob / 1000.0));
-
-	cJSON *pump = cJSON_CreateObject();
-	cJSON_AddItemToObject(root, "pump", pump);
+	json_string(&w, "created_at", ts);
+	json_string(&w, "device", "GNARL");
+
+	json_begin_object(&w, "openaps");
+	json_begin_object(&w, "iob");
+	json_begin_object(&w, "iob");
+	json_number(&w, "iob", s->iob / 1000.0);
+	json_end_object(&w);
+	json_end_object(&w);
+	json_end_object(&w);
+
+	json_begin_object(&w, "pump");
 	struct timeval tv = { .tv_sec = s->pump_clock };
 	print_iso_time(ts, tv);
-	cJSON_AddItemToObject(pump, "clock", cJSON_CreateString(ts));
-	cJSON_AddItemToObject(pump, "reservoir", cJSON_CreateNumber(s->reservoir / 1000.0));
-	cJSON *battery = cJSON_CreateObject();
-	cJSON_AddItemToObject(pump, "battery", battery);
-	cJSON_AddItemToObject(battery, "voltage",  cJSON_CreateNumber(s->pump_battery / 1000.0));
-	cJSON *status = cJSON_CreateObject();
-	cJSON_AddItemToObject(pump, "status", status);
-	cJSON_AddItemToObject(status, "status",  cJSON_CreateString(s->pump_status));
-	cJSON_AddItemToObject(status, "bolusing",  cJSON_CreateBool(s->bolusing));
-	cJSON_AddItemToObject(status, "suspended",  cJSON_CreateBool(s->suspended));
-
-	cJSON *uploader = cJSON_CreateObject();
-	cJSON_AddItemToObject(root, "uploader", uploader);
-	cJSON_AddItemToObject(uploader, "battery",  cJSON_CreateNumber(s->battery_percent));
-	cJSON_AddItemToObject(uploader, "batteryVoltage",  cJSON_CreateNumber(s->battery_voltage / 1000.0));
-
-	char *json = cJSON_PrintUnformatted(root);
-	cJSON_Delete(root);
-	return json;
+	json_string(&w, "clock", ts);
+	json_number(&w, "reservoir", s->reservoir / 1000.0);
+	json_begin_object(&w, "battery");
+	json_number(&w, "voltage", s->pump_battery / 1000.0);
+	json_end_object(&w);
+	json_begin_object(&w, "status");
+	json_string(&w, "status", s->pump_status);
+	json_bool(&w, "bolusing", s->bolusing);
+	json_bool(&w, "suspended", s->suspended);
+	json_end_object(&w);
+	json_end_object(&w);
+
+	json_begin_object(&w, "uploader");
+	json_number(&w, "battery", s->battery_percent);
+	json_number(&w, "batteryVoltage", s->battery_voltage / 1000.0);
+	json_end_object(&w);
+
+	json_end_object(&w);
+	return json_writer_end(&w);
 }
 
 void upload_device_status(esp_http_client_handle_t client, nightscout_device_status_t *s) {
-	char *json = device_status_json(s);
+	char json[DEVICE_STATUS_JSON_SIZE];
+	if (device_status_json(s, json, sizeof(json)) >= sizeof(json)) {
+		ESP_LOGE(TAG, "device status JSON is too large");
+		return;
+	}
 	nightscout_upload(client, "/api/v1/devicestatus", json);
-	free(json);
+}
+
+int queue_device_status(upload_queue_t *q, const nightscout_device_status_t *s) {
+	char json[DEVICE_STATUS_JSON_SIZE];
+	if (device_status_json(s, json, sizeof(json)) >= sizeof(json)) {
+		ESP_LOGE(TAG, "device status JSON is too large");
+		return -1;
+	}
+	return upload_queue_add(q, UPLOAD_DEVICE_STATUS, json);
 }
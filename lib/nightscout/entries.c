@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
@@ -6,66 +7,59 @@
 
 #include <esp_log.h>
 
-#include <cJSON.h>
-
+#include "json_writer.h"
 #include "nightscout.h"
 
-static void do_entry(const cJSON *e, nightscout_entry_callback_t cb) {
-	const cJSON *item = cJSON_GetObjectItem(e, "type");
-	if (!item) {
-		ESP_LOGE(TAG, "JSON entry has no type field");
-		return;
-	}
-	const char *typ = item->valuestring;
-	if (strcmp(typ, "sgv") != 0) {
-		ESP_LOGI(TAG, "ignoring JSON entry with type %s", typ);
-		return;
-	}
-
-	item = cJSON_GetObjectItem(e, "date");
-	if (!item) {
-		ESP_LOGE(TAG, "JSON entry has no date field");
-		return;
-	}
-	struct timeval tv = timeval_from_milliseconds(item->valuedouble);
+static int parse_entries(void *context, const char *buf, int len) {
+	return nightscout_entries_parse(context, buf, len);
+}
 
-	item = cJSON_GetObjectItem(e, "sgv");
-	if (!item) {
-		ESP_LOGI(TAG, "ignoring JSON entry with no sgv field");
-		return;
+int get_nightscout_entries(esp_http_client_handle_t client, const char *endpoint, nightscout_entry_callback_t callback, void *context) {
+	nightscout_entries_parser_t p;
+	nightscout_entries_init(&p, callback, context);
+	if (http_get_stream(client, endpoint, parse_entries, &p) != 0) {
+		return -1;
 	}
-	int sgv = item->valueint;
+	return nightscout_entries_end(&p);
+}
 
-	nightscout_entry_t entry = {
-		.tv = tv,
-		.sgv = sgv,
-	};
-	cb(&entry);
+void print_nightscout_entry(void *context, const nightscout_entry_t *e) {
+	printf("%s  %3d\n", nightscout_time_string(round_to_seconds(e->tv)), e->sgv);
 }
 
-void process_nightscout_entries(const char *json, nightscout_entry_callback_t callback) {
-	if (!json) {
-		ESP_LOGE(TAG, "no response");
-		return;
+int entries_json(const nightscout_entry_t *entries, int n, char *buf, int size) {
+	json_writer_t w;
+	json_writer_init(&w, buf, size);
+	json_begin_array(&w, 0);
+	for (int i = 0; i < n; i++) {
+		const nightscout_entry_t *e = &entries[i];
+		json_begin_object(&w, 0);
+		json_string(&w, "type", "sgv");
+		json_number(&w, "sgv", e->sgv);
+		double ms = e->tv.tv_sec * 1000.0 + e->tv.tv_usec / 1000;
+		json_number(&w, "date", ms);
+		char ts[ISO_TIME_STRING_SIZE];
+		print_iso_time(ts, e->tv);
+		json_string(&w, "dateString", ts);
+		json_string(&w, "device", "GNARL");
+		json_end_object(&w);
 	}
-	cJSON *root = cJSON_Parse(json);
-	if (!root) {
-		ESP_LOGE(TAG, "cannot parse response \"%s\"", json);
+	json_end_array(&w);
+	return json_writer_end(&w);
+}
+
+void upload_entries(esp_http_client_handle_t client, const nightscout_entry_t *entries, int n) {
+	if (n == 0) {
 		return;
 	}
-	if (!cJSON_IsArray(root)) {
-		ESP_LOGE(TAG, "response \"%s\" is not a JSON array", json);
-		cJSON_Delete(root);
+	// Measure the JSON first, so that a single buffer of the right size is needed.
+	int len = entries_json(entries, n, 0, 0);
+	char *json = malloc(len + 1);
+	if (!json) {
+		ESP_LOGE(TAG, "cannot allocate %d bytes for entries JSON", len + 1);
 		return;
 	}
-	int n = cJSON_GetArraySize(root);
-	ESP_LOGI(TAG, "received JSON array of %d entries", n);
-	for (int i = 0; i < n; i++) {
-		do_entry(cJSON_GetArrayItem(root, i), callback);
-	}
-	cJSON_Delete(root);
-}
-
-void print_nightscout_entry(const nightscout_entry_t *e) {
-	printf("%s  %3d\n", nightscout_time_string(round_to_seconds(e->tv)), e->sgv);
+	entries_json(entries, n, json, len + 1);
+	nightscout_upload(client, "/api/v1/entries", json);
+	free(json);
 }
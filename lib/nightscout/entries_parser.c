@@ -0,0 +1,115 @@
+#include <stdlib.h>
+#include <string.h>
+
+#define TAG		"NS"
+
+#include <esp_log.h>
+
+#include "nightscout.h"
+
+static void start_entry(nightscout_entries_parser_t *p) {
+	p->have_type = false;
+	p->is_sgv = false;
+	p->have_date = false;
+	p->have_sgv = false;
+}
+
+static void end_entry(nightscout_entries_parser_t *p) {
+	if (!p->have_type) {
+		ESP_LOGE(TAG, "JSON entry has no type field");
+		return;
+	}
+	if (!p->is_sgv) {
+		return;
+	}
+	if (!p->have_date) {
+		ESP_LOGE(TAG, "JSON entry has no date field");
+		return;
+	}
+	if (!p->have_sgv) {
+		ESP_LOGI(TAG, "ignoring JSON entry with no sgv field");
+		return;
+	}
+	p->callback(p->context, &p->entry);
+	p->count++;
+	if (timercmp(&p->entry.tv, &p->latest, >)) {
+		p->latest = p->entry.tv;
+	}
+}
+
+static void entry_field(nightscout_entries_parser_t *p, json_event_t event, const char *key, const char *value) {
+	if (strcmp(key, "type") == 0 && event == JSON_STRING) {
+		p->have_type = true;
+		p->is_sgv = strcmp(value, "sgv") == 0;
+		if (!p->is_sgv) {
+			ESP_LOGI(TAG, "ignoring JSON entry with type %s", value);
+		}
+	} else if (strcmp(key, "date") == 0 && event == JSON_NUMBER) {
+		p->have_date = true;
+		p->entry.tv = timeval_from_milliseconds(strtod(value, 0));
+	} else if (strcmp(key, "sgv") == 0 && event == JSON_NUMBER) {
+		p->have_sgv = true;
+		p->entry.sgv = atoi(value);
+	}
+}
+
+// The response is an array of entry objects; anything nested
+// more deeply within an entry is skipped.
+static void entries_event(json_parser_t *json, json_event_t event, const char *key, const char *value) {
+	nightscout_entries_parser_t *p = json->context;
+	switch (json->depth) {
+	case 0:
+		if (event != JSON_BEGIN_ARRAY && event != JSON_END_ARRAY) {
+			p->not_array = true;
+		}
+		break;
+	case 1:
+		if (event == JSON_BEGIN_OBJECT) {
+			start_entry(p);
+		} else if (event == JSON_END_OBJECT) {
+			end_entry(p);
+		}
+		break;
+	case 2:
+		entry_field(p, event, key, value);
+		break;
+	}
+}
+
+void nightscout_entries_init(nightscout_entries_parser_t *p, nightscout_entry_callback_t callback, void *context) {
+	memset(p, 0, sizeof(*p));
+	json_parser_init(&p->json, entries_event, p);
+	p->callback = callback;
+	p->context = context;
+}
+
+int nightscout_entries_parse(nightscout_entries_parser_t *p, const char *buf, int len) {
+	if (p->not_array) {
+		return -1;
+	}
+	return json_parse(&p->json, buf, len);
+}
+
+int nightscout_entries_end(nightscout_entries_parser_t *p) {
+	if (json_parse_end(&p->json) != 0) {
+		ESP_LOGE(TAG, "cannot parse response");
+		return -1;
+	}
+	if (p->not_array) {
+		ESP_LOGE(TAG, "response is not a JSON array");
+		return -1;
+	}
+	ESP_LOGI(TAG, "received %d entries", p->count);
+	return p->count;
+}
+
+void process_nightscout_entries(const char *json, nightscout_entry_callback_t callback, void *context) {
+	if (!json) {
+		ESP_LOGE(TAG, "no response");
+		return;
+	}
+	nightscout_entries_parser_t p;
+	nightscout_entries_init(&p, callback, context);
+	nightscout_entries_parse(&p, json, strlen(json));
+	nightscout_entries_end(&p);
+}
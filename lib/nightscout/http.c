@@ -1,3 +1,7 @@
+// This is needed for the declaration of strptime() in host tests.
+#define _GNU_SOURCE
+
+#include <string.h>
 #include <strings.h>
 #include <time.h>
 
@@ -9,46 +13,140 @@
 
 time_t http_server_time;
 
-char *http_get(esp_http_client_handle_t client, const char *endpoint) {
-	esp_http_client_set_url(client, endpoint);
-	esp_http_client_set_method(client, HTTP_METHOD_GET);
-	esp_http_client_set_header(client, "accept", "application/json");
-	http_server_time = 0;
-	esp_err_t err = esp_http_client_open(client, 0);
+// Size of the pieces in which a response body is read.
+#define HTTP_READ_SIZE		512
+
+http_client_stats_t http_client_stats;
+
+// Client with an open connection, as reported to http_header_callback.
+// Only the most recent one is tracked, which suffices for an app
+// that talks to one server at a time.
+static esp_http_client_handle_t connected_client;
+
+// Send the request and read the response headers.
+// Return the value of esp_http_client_fetch_headers, or -2 on failure.
+static int send_request(esp_http_client_handle_t client, const char *data, int data_len) {
+	esp_err_t err = esp_http_client_open(client, data_len);
 	if (err != ESP_OK) {
 		ESP_LOGE(TAG, "esp_http_client_open: %s", esp_err_to_name(err));
-		return 0;
+		return -2;
 	}
-	int content_length = esp_http_client_fetch_headers(client);
-	static char response[MAX_HTTP_RESPONSE];
-	char *p = response;
-	int len = content_length;
-	if (len == -1) {
+	if (data_len > 0 && esp_http_client_write(client, data, data_len) != data_len) {
+		ESP_LOGE(TAG, "esp_http_client_write: failure");
+		return -2;
+	}
+	// The result is -1 both on failure and when the length is unknown,
+	// so a failure is recognized by the lack of a status code.
+	int len = esp_http_client_fetch_headers(client);
+	if (len < 0 && esp_http_client_get_status_code(client) <= 0) {
 		ESP_LOGE(TAG, "esp_http_client_fetch_headers: failure");
-		return 0;
+		return -2;
+	}
+	return len;
+}
+
+int http_request(esp_http_client_handle_t client, const char *data, int data_len, http_body_fn_t *body_fn, void *context) {
+	http_server_time = 0;
+	http_client_stats.requests++;
+	bool reused = connected_client == client;
+	int connections = http_client_stats.connections;
+	int len = send_request(client, data, data_len);
+	if (len == -2 && reused && http_client_stats.connections == connections) {
+		// The request was sent on a kept-alive connection,
+		// which the server may have closed in the meantime.
+		ESP_LOGD(TAG, "retrying request on a new connection");
+		http_client_stats.reconnects++;
+		esp_http_client_close(client);
+		len = send_request(client, data, data_len);
 	}
-	if (len >= sizeof(response)) {
-		ESP_LOGE(TAG, "%d-byte HTTP response is too large for %d-byte buffer",
-			 content_length, sizeof(response));
-		len = sizeof(response)-1;
+	if (len == -2) {
+		esp_http_client_close(client);
+		return -1;
 	}
-	while (len > 0) {
-		int n = esp_http_client_read(client, p, len);
-		if (n <= 0) {
+	// Without a Content-Length, the body ends with the last chunk
+	// or when the server closes the connection.
+	bool until_end = len < 0 || esp_http_client_is_chunked_response(client);
+	char buf[HTTP_READ_SIZE];
+	while (until_end || len > 0) {
+		int n = esp_http_client_read(client, buf, !until_end && len < sizeof(buf) ? len : sizeof(buf));
+		if (n < 0 || (n == 0 && !until_end)) {
 			ESP_LOGE(TAG, "esp_http_client_read returned %d", n);
-			err = ESP_FAIL;
+			esp_http_client_close(client);
+			return -1;
+		}
+		if (n == 0) {
 			break;
 		}
-		p += n;
-		len -= n;
-        }
-	*p = 0;
-	return err == ESP_OK ? response : 0;
+		if (body_fn && body_fn(context, buf, n) != 0) {
+			// Don't leave the rest of the response on the connection.
+			esp_http_client_close(client);
+			return -1;
+		}
+		if (!until_end) {
+			len -= n;
+		}
+	}
+	if (esp_http_client_is_chunked_response(client) && !esp_http_client_is_complete_data_received(client)) {
+		ESP_LOGE(TAG, "chunked response ended without its last chunk");
+		esp_http_client_close(client);
+		return -1;
+	}
+	return 0;
+}
+
+int http_get_stream(esp_http_client_handle_t client, const char *endpoint, http_body_fn_t *body_fn, void *context) {
+	esp_http_client_set_url(client, endpoint);
+	esp_http_client_set_method(client, HTTP_METHOD_GET);
+	esp_http_client_set_header(client, "accept", "application/json");
+	return http_request(client, 0, 0, body_fn, context);
+}
+
+typedef struct {
+	char *p;
+	int room;	// bytes left in the buffer, including the terminating NUL
+	bool truncated;
+} response_buffer_t;
+
+static int save_response(void *context, const char *buf, int len) {
+	response_buffer_t *r = context;
+	if (len >= r->room) {
+		if (!r->truncated) {
+			ESP_LOGE(TAG, "HTTP response is too large for %d-byte buffer", MAX_HTTP_RESPONSE);
+			r->truncated = true;
+		}
+		len = r->room - 1;
+	}
+	memcpy(r->p, buf, len);
+	r->p += len;
+	r->room -= len;
+	return 0;
+}
+
+char *http_get(esp_http_client_handle_t client, const char *endpoint) {
+	static char response[MAX_HTTP_RESPONSE];
+	response_buffer_t r = {
+		.p = response,
+		.room = sizeof(response),
+	};
+	int err = http_get_stream(client, endpoint, save_response, &r);
+	*r.p = 0;
+	return err == 0 ? response : 0;
 }
 
 static const char *rfc1123_format = "%a, %d %b %Y %T %Z";
 
 esp_err_t http_header_callback(esp_http_client_event_t *e) {
+	if (e->event_id == HTTP_EVENT_ON_CONNECTED) {
+		http_client_stats.connections++;
+		connected_client = e->client;
+		return ESP_OK;
+	}
+	if (e->event_id == HTTP_EVENT_DISCONNECTED) {
+		if (connected_client == e->client) {
+			connected_client = 0;
+		}
+		return ESP_OK;
+	}
 	if (e->event_id != HTTP_EVENT_ON_HEADER) {
 		return ESP_OK;
 	}
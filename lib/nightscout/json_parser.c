@@ -0,0 +1,308 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_parser.h"
+
+enum {
+	PARSE_VALUE,
+	PARSE_VALUE_OR_END,	// after '['
+	PARSE_KEY,		// after ',' in an object
+	PARSE_KEY_OR_END,	// after '{'
+	PARSE_COLON,
+	PARSE_STRING,
+	PARSE_ESCAPE,		// after '\' in a string
+	PARSE_UNICODE,		// PARSE_UNICODE + i after i hex digits of a \u escape
+	PARSE_LITERAL = PARSE_UNICODE + 4,	// number, true, false, or null
+	PARSE_AFTER_VALUE,
+	PARSE_DONE,
+};
+
+void json_parser_init(json_parser_t *p, json_event_fn_t *event_fn, void *context) {
+	memset(p, 0, sizeof(*p));
+	p->event_fn = event_fn;
+	p->context = context;
+	p->state = PARSE_VALUE;
+}
+
+static bool is_space(char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static bool is_literal_char(char c) {
+	return ('0' <= c && c <= '9') || ('a' <= c && c <= 'z') || c == '-' || c == '+' || c == '.' || c == 'E';
+}
+
+static int hex_digit(char c) {
+	if ('0' <= c && c <= '9') {
+		return c - '0';
+	}
+	if ('a' <= c && c <= 'f') {
+		return 10 + c - 'a';
+	}
+	if ('A' <= c && c <= 'F') {
+		return 10 + c - 'A';
+	}
+	return -1;
+}
+
+static void add_char(json_parser_t *p, char c) {
+	if (p->token_len < JSON_MAX_TOKEN - 1) {
+		p->token[p->token_len++] = c;
+	}
+}
+
+// Add a code point from a \u escape in UTF-8.
+// Surrogate pairs are not combined.
+static void add_code_point(json_parser_t *p, unsigned int u) {
+	if (u < 0x80) {
+		add_char(p, u);
+	} else if (u < 0x800) {
+		add_char(p, 0xC0 | u >> 6);
+		add_char(p, 0x80 | (u & 0x3F));
+	} else {
+		add_char(p, 0xE0 | u >> 12);
+		add_char(p, 0x80 | ((u >> 6) & 0x3F));
+		add_char(p, 0x80 | (u & 0x3F));
+	}
+}
+
+static const char *token(json_parser_t *p) {
+	p->token[p->token_len] = 0;
+	return p->token;
+}
+
+static bool in_object(json_parser_t *p) {
+	return p->depth > 0 && p->stack[p->depth - 1] == '{';
+}
+
+// Report an event for a value in the current container.
+static void value_event(json_parser_t *p, json_event_t event, const char *value) {
+	p->event_fn(p, event, in_object(p) ? p->key : "", value);
+}
+
+static void after_value(json_parser_t *p) {
+	p->state = p->depth == 0 ? PARSE_DONE : PARSE_AFTER_VALUE;
+}
+
+static int begin_container(json_parser_t *p, char c) {
+	if (p->depth == JSON_MAX_DEPTH) {
+		return -1;
+	}
+	value_event(p, c == '{' ? JSON_BEGIN_OBJECT : JSON_BEGIN_ARRAY, "");
+	p->stack[p->depth++] = c;
+	p->state = c == '{' ? PARSE_KEY_OR_END : PARSE_VALUE_OR_END;
+	return 0;
+}
+
+static int end_container(json_parser_t *p, char c) {
+	char open = c == '}' ? '{' : '[';
+	if (p->depth == 0 || p->stack[p->depth - 1] != open) {
+		return -1;
+	}
+	p->depth--;
+	p->event_fn(p, c == '}' ? JSON_END_OBJECT : JSON_END_ARRAY, "", "");
+	after_value(p);
+	return 0;
+}
+
+static void start_token(json_parser_t *p, int state) {
+	p->token_len = 0;
+	p->state = state;
+}
+
+static void end_string(json_parser_t *p) {
+	if (p->in_key) {
+		memcpy(p->key, token(p), p->token_len + 1);
+		p->state = PARSE_COLON;
+		return;
+	}
+	value_event(p, JSON_STRING, token(p));
+	after_value(p);
+}
+
+static int end_literal(json_parser_t *p) {
+	const char *s = token(p);
+	json_event_t event;
+	if (strcmp(s, "true") == 0) {
+		event = JSON_TRUE;
+	} else if (strcmp(s, "false") == 0) {
+		event = JSON_FALSE;
+	} else if (strcmp(s, "null") == 0) {
+		event = JSON_NULL;
+	} else {
+		if (s[0] != '-' && (s[0] < '0' || s[0] > '9')) {
+			return -1;
+		}
+		char *end;
+		strtod(s, &end);
+		if (*end != 0 || strpbrk(s, "xX") != 0) {
+			return -1;
+		}
+		event = JSON_NUMBER;
+	}
+	value_event(p, event, s);
+	after_value(p);
+	return 0;
+}
+
+static int parse_char(json_parser_t *p, char c) {
+	switch (p->state) {
+	case PARSE_VALUE_OR_END:
+		if (c == ']') {
+			return end_container(p, c);
+		}
+		// fall through
+	case PARSE_VALUE:
+		if (is_space(c)) {
+			return 0;
+		}
+		if (c == '{' || c == '[') {
+			return begin_container(p, c);
+		}
+		if (c == '"') {
+			p->in_key = false;
+			start_token(p, PARSE_STRING);
+			return 0;
+		}
+		if (c == '-' || ('0' <= c && c <= '9') || ('a' <= c && c <= 'z')) {
+			start_token(p, PARSE_LITERAL);
+			add_char(p, c);
+			return 0;
+		}
+		return -1;
+	case PARSE_KEY_OR_END:
+		if (c == '}') {
+			return end_container(p, c);
+		}
+		// fall through
+	case PARSE_KEY:
+		if (is_space(c)) {
+			return 0;
+		}
+		if (c != '"') {
+			return -1;
+		}
+		p->in_key = true;
+		start_token(p, PARSE_STRING);
+		return 0;
+	case PARSE_COLON:
+		if (is_space(c)) {
+			return 0;
+		}
+		if (c != ':') {
+			return -1;
+		}
+		p->state = PARSE_VALUE;
+		return 0;
+	case PARSE_STRING:
+		if (c == '"') {
+			end_string(p);
+			return 0;
+		}
+		if (c == '\\') {
+			p->state = PARSE_ESCAPE;
+			return 0;
+		}
+		if ((unsigned char)c < 0x20) {
+			return -1;
+		}
+		add_char(p, c);
+		return 0;
+	case PARSE_ESCAPE:
+		switch (c) {
+		case '"':
+		case '\\':
+		case '/':
+			add_char(p, c);
+			break;
+		case 'b':
+			add_char(p, '\b');
+			break;
+		case 'f':
+			add_char(p, '\f');
+			break;
+		case 'n':
+			add_char(p, '\n');
+			break;
+		case 'r':
+			add_char(p, '\r');
+			break;
+		case 't':
+			add_char(p, '\t');
+			break;
+		case 'u':
+			p->unicode = 0;
+			p->state = PARSE_UNICODE;
+			return 0;
+		default:
+			return -1;
+		}
+		p->state = PARSE_STRING;
+		return 0;
+	case PARSE_UNICODE:
+	case PARSE_UNICODE + 1:
+	case PARSE_UNICODE + 2:
+	case PARSE_UNICODE + 3: {
+		int d = hex_digit(c);
+		if (d < 0) {
+			return -1;
+		}
+		p->unicode = p->unicode << 4 | d;
+		p->state++;
+		if (p->state == PARSE_LITERAL) {
+			add_code_point(p, p->unicode);
+			p->state = PARSE_STRING;
+		}
+		return 0;
+	}
+	case PARSE_LITERAL:
+		if (is_literal_char(c)) {
+			add_char(p, c);
+			return 0;
+		}
+		if (end_literal(p) != 0) {
+			return -1;
+		}
+		return parse_char(p, c);
+	case PARSE_AFTER_VALUE:
+		if (is_space(c)) {
+			return 0;
+		}
+		if (c == ',') {
+			p->state = in_object(p) ? PARSE_KEY : PARSE_VALUE;
+			return 0;
+		}
+		if (c == '}' || c == ']') {
+			return end_container(p, c);
+		}
+		return -1;
+	case PARSE_DONE:
+		return is_space(c) ? 0 : -1;
+	default:
+		return -1;
+	}
+}
+
+int json_parse(json_parser_t *p, const char *buf, int len) {
+	if (p->error) {
+		return -1;
+	}
+	for (int i = 0; i < len; i++) {
+		if (parse_char(p, buf[i]) != 0) {
+			p->error = true;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int json_parse_end(json_parser_t *p) {
+	if (p->error) {
+		return -1;
+	}
+	if (p->state == PARSE_LITERAL && p->depth == 0 && end_literal(p) != 0) {
+		p->error = true;
+		return -1;
+	}
+	return p->state == PARSE_DONE ? 0 : -1;
+}
@@ -0,0 +1,58 @@
+#ifndef _JSON_PARSER_H
+#define _JSON_PARSER_H
+
+#include <stdbool.h>
+
+// Incremental JSON parser.
+// The input can be supplied in pieces of any size as it arrives,
+// and an event is reported for each value, so no document tree is built
+// and the memory needed does not depend on the size of the input.
+
+typedef enum {
+	JSON_BEGIN_OBJECT,
+	JSON_END_OBJECT,
+	JSON_BEGIN_ARRAY,
+	JSON_END_ARRAY,
+	JSON_STRING,
+	JSON_NUMBER,
+	JSON_TRUE,
+	JSON_FALSE,
+	JSON_NULL,
+} json_event_t;
+
+#define JSON_MAX_DEPTH	8
+#define JSON_MAX_TOKEN	64	// longer keys and values are truncated
+
+typedef struct json_parser json_parser_t;
+
+// Signature of the function called for each event.
+// key is the member name for values within an object, and empty otherwise.
+// value is the text of strings (unescaped), numbers, and literals.
+// p->depth is the number of containers enclosing the value.
+typedef void (json_event_fn_t)(json_parser_t *p, json_event_t event, const char *key, const char *value);
+
+struct json_parser {
+	json_event_fn_t *event_fn;
+	void *context;		// for use by event_fn
+	int depth;
+	char stack[JSON_MAX_DEPTH];	// '{' or '[' for each open container
+	int state;
+	bool error;
+	bool in_key;		// the string being parsed is a member name
+	unsigned int unicode;	// code point of a \u escape being parsed
+	int token_len;
+	char token[JSON_MAX_TOKEN];
+	char key[JSON_MAX_TOKEN];
+};
+
+void json_parser_init(json_parser_t *p, json_event_fn_t *event_fn, void *context);
+
+// Parse the next len bytes of input.
+// Return 0 on success, -1 if the input so far is not valid JSON.
+int json_parse(json_parser_t *p, const char *buf, int len);
+
+// Signal the end of the input.
+// Return 0 if it contained exactly one complete JSON value, otherwise -1.
+int json_parse_end(json_parser_t *p);
+
+#endif // _JSON_PARSER_H
@@ -0,0 +1,158 @@
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "json_writer.h"
+
+void json_writer_init(json_writer_t *w, char *buf, int size) {
+	w->buf = buf;
+	w->size = size;
+	w->len = 0;
+	w->need_comma = false;
+}
+
+static void put_char(json_writer_t *w, char c) {
+	if (w->len < w->size) {
+		w->buf[w->len] = c;
+	}
+	w->len++;
+}
+
+static void put_bytes(json_writer_t *w, const char *s, int n) {
+	int room = w->size - w->len;
+	if (room > 0) {
+		memcpy(w->buf + w->len, s, n < room ? n : room);
+	}
+	w->len += n;
+}
+
+// Escape the same characters as cJSON.
+static void put_string(json_writer_t *w, const char *s) {
+	put_char(w, '"');
+	const char *run = s;
+	for (const unsigned char *p = (const unsigned char *)s; *p; p++) {
+		if (*p >= ' ' && *p != '"' && *p != '\\') {
+			continue;
+		}
+		put_bytes(w, run, (const char *)p - run);
+		run = (const char *)p + 1;
+		put_char(w, '\\');
+		switch (*p) {
+		case '"':
+		case '\\':
+			put_char(w, *p);
+			break;
+		case '\b':
+			put_char(w, 'b');
+			break;
+		case '\f':
+			put_char(w, 'f');
+			break;
+		case '\n':
+			put_char(w, 'n');
+			break;
+		case '\r':
+			put_char(w, 'r');
+			break;
+		case '\t':
+			put_char(w, 't');
+			break;
+		default: {
+			char u[8];
+			put_bytes(w, u, sprintf(u, "u%04x", *p));
+			break;
+		}
+		}
+	}
+	put_bytes(w, run, strlen(run));
+	put_char(w, '"');
+}
+
+static void begin_value(json_writer_t *w, const char *key) {
+	if (w->need_comma) {
+		put_char(w, ',');
+	}
+	if (key) {
+		put_string(w, key);
+		put_char(w, ':');
+	}
+	w->need_comma = true;
+}
+
+void json_begin_object(json_writer_t *w, const char *key) {
+	begin_value(w, key);
+	put_char(w, '{');
+	w->need_comma = false;
+}
+
+void json_end_object(json_writer_t *w) {
+	put_char(w, '}');
+	w->need_comma = true;
+}
+
+void json_begin_array(json_writer_t *w, const char *key) {
+	begin_value(w, key);
+	put_char(w, '[');
+	w->need_comma = false;
+}
+
+void json_end_array(json_writer_t *w) {
+	put_char(w, ']');
+	w->need_comma = true;
+}
+
+void json_string(json_writer_t *w, const char *key, const char *value) {
+	begin_value(w, key);
+	put_string(w, value);
+}
+
+// Compare as cJSON does when checking that a number reads back correctly.
+static bool same_double(double a, double b) {
+	double max = fabs(a) > fabs(b) ? fabs(a) : fabs(b);
+	return fabs(a - b) <= max * DBL_EPSILON;
+}
+
+// Format numbers as cJSON does: integral values that fit in an int
+// without a fraction, and others with the fewest of 15 or 17 digits
+// that read back as the same value.
+void json_number(json_writer_t *w, const char *key, double value) {
+	begin_value(w, key);
+	char buf[32];
+	int n;
+	if (!isfinite(value)) {
+		put_bytes(w, "null", 4);
+		return;
+	}
+	// Only finite values can be converted to int.
+	int i = value >= INT_MAX ? INT_MAX : value <= (double)INT_MIN ? INT_MIN : (int)value;
+	if (value == (double)i) {
+		n = sprintf(buf, "%d", i);
+	} else {
+		n = sprintf(buf, "%1.15g", value);
+		double test;
+		if (sscanf(buf, "%lg", &test) != 1 || !same_double(test, value)) {
+			n = sprintf(buf, "%1.17g", value);
+		}
+	}
+	put_bytes(w, buf, n);
+}
+
+void json_bool(json_writer_t *w, const char *key, bool value) {
+	begin_value(w, key);
+	if (value) {
+		put_bytes(w, "true", 4);
+	} else {
+		put_bytes(w, "false", 5);
+	}
+}
+
+int json_writer_end(json_writer_t *w) {
+	if (w->len < w->size) {
+		w->buf[w->len] = 0;
+	} else if (w->size > 0) {
+		w->buf[w->size - 1] = 0;
+	}
+	return w->len;
+}
@@ -0,0 +1,37 @@
+#ifndef _JSON_WRITER_H
+#define _JSON_WRITER_H
+
+#include <stdbool.h>
+
+// Streaming JSON writer.
+// Output goes directly into a caller-supplied buffer, without building
+// a document tree or allocating memory. The output is the same as
+// cJSON_PrintUnformatted would produce for the same document.
+//
+// As with snprintf, the length keeps being counted after the buffer
+// is full, so a pass with a zero-size buffer gives the size needed.
+
+typedef struct {
+	char *buf;
+	int size;
+	int len;		// length of the complete output so far
+	bool need_comma;	// a value has been written in the current container
+} json_writer_t;
+
+void json_writer_init(json_writer_t *w, char *buf, int size);
+
+// The key is the member name for values within an object,
+// and must be null for array elements and the top-level value.
+void json_begin_object(json_writer_t *w, const char *key);
+void json_end_object(json_writer_t *w);
+void json_begin_array(json_writer_t *w, const char *key);
+void json_end_array(json_writer_t *w);
+void json_string(json_writer_t *w, const char *key, const char *value);
+void json_number(json_writer_t *w, const char *key, double value);
+void json_bool(json_writer_t *w, const char *key, bool value);
+
+// Terminate the output with a NUL if there is room, and return its length.
+// The output is complete only if the length is less than the buffer size.
+int json_writer_end(json_writer_t *w);
+
+#endif // _JSON_WRITER_H
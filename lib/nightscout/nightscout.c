@@ -18,18 +18,35 @@ extern const char root_cert_pem_start[] asm("_binary_root_cert_pem_start");
 
 esp_err_t http_header_callback(esp_http_client_event_t *e);
 
+extern esp_http_client_handle_t xdrip_client;
+
+static esp_http_client_handle_t nightscout_client;
+
 esp_http_client_handle_t nightscout_client_handle(void) {
+	if (nightscout_client) {
+		return nightscout_client;
+	}
 	esp_http_client_config_t config = {
 		.url = NIGHTSCOUT_BASE,
 		.timeout_ms = 10000,
 		.cert_pem = root_cert_pem_start,
 		.event_handler = http_header_callback,
+		.keep_alive_enable = true,
 	};
 	ESP_LOGI(TAG, "Nightscout URL: %s", config.url);
-	return esp_http_client_init(&config);
+	nightscout_client = esp_http_client_init(&config);
+	return nightscout_client;
 }
 
 void nightscout_client_close(esp_http_client_handle_t client) {
+	ESP_LOGI(TAG, "%d requests, %d connections, %d reconnects",
+		 http_client_stats.requests, http_client_stats.connections, http_client_stats.reconnects);
 	esp_http_client_close(client);
 	esp_http_client_cleanup(client);
+	if (client == nightscout_client) {
+		nightscout_client = 0;
+	}
+	if (client == xdrip_client) {
+		xdrip_client = 0;
+	}
 }
@@ -3,20 +3,54 @@
 
 #include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/time.h>
 #include <time.h>
 
 #include <esp_http_client.h>
 
+#include "json_parser.h"
 #include "nightscout_config.h"
 
+// Return the Nightscout or xDrip client, creating it on first use.
+// The same client is returned by later calls, so its connection
+// is kept alive and reused instead of paying for a new TLS handshake
+// with every request.
 esp_http_client_handle_t nightscout_client_handle(void);
 esp_http_client_handle_t xdrip_client_handle(void);
+
+// Close the connection and free the client.
 void nightscout_client_close(esp_http_client_handle_t client);
 
+// Statistics for requests made by the functions in this library.
+typedef struct {
+	int requests;
+	int connections;	// each one costs a TLS handshake for HTTPS
+	int reconnects;		// requests retried after a kept-alive connection was closed
+} http_client_stats_t;
+
+extern http_client_stats_t http_client_stats;
+
 #define MAX_HTTP_RESPONSE	8192
 char *http_get(esp_http_client_handle_t client, const char *endpoint);
 
+// Signature of function applied to each part of an HTTP response body
+// as it is received. A non-zero return value abandons the response.
+typedef int (http_body_fn_t)(void *context, const char *buf, int len);
+
+// Perform a GET request and pass the response body to body_fn as it arrives,
+// instead of collecting it in a buffer. The body can be delimited by
+// Content-Length, chunked, or ended by the server closing the connection.
+// Return 0 on success, -1 on failure.
+int http_get_stream(esp_http_client_handle_t client, const char *endpoint, http_body_fn_t *body_fn, void *context);
+
+// Send a request whose URL, method, and headers have already been set,
+// with the given body data if data_len is non-zero, and pass the response body
+// to body_fn (which may be null). If the connection kept alive from an earlier
+// request has been closed by the server, the request is retried once on a new one.
+// Return 0 on success, -1 on failure.
+int http_request(esp_http_client_handle_t client, const char *data, int data_len, http_body_fn_t *body_fn, void *context);
+
 extern time_t http_server_time;
 
 time_t make_gmt(struct tm *tm);
@@ -35,11 +69,49 @@ typedef struct {
 	int sgv;
 } nightscout_entry_t;
 
-typedef void (nightscout_entry_callback_t)(const nightscout_entry_t *e);
+typedef void (nightscout_entry_callback_t)(void *context, const nightscout_entry_t *e);
+
+// Incremental parser for a JSON array of entries, such as the response
+// from /api/v1/entries or xDrip's /sgv.json. The callback is applied
+// to each sgv entry, with the given context, as soon as it has been parsed.
+typedef struct {
+	json_parser_t json;
+	nightscout_entry_callback_t *callback;
+	void *context;		// for use by callback
+	nightscout_entry_t entry;
+	bool not_array;
+	bool have_type;
+	bool is_sgv;
+	bool have_date;
+	bool have_sgv;
+	int count;	// number of entries passed to the callback
+	struct timeval latest;	// time of the newest entry passed to the callback
+} nightscout_entries_parser_t;
 
-void process_nightscout_entries(const char *json, nightscout_entry_callback_t callback);
+void nightscout_entries_init(nightscout_entries_parser_t *p, nightscout_entry_callback_t callback, void *context);
 
-void print_nightscout_entry(const nightscout_entry_t *e);
+// Parse the next part of the response. Return 0 on success, -1 on error.
+int nightscout_entries_parse(nightscout_entries_parser_t *p, const char *buf, int len);
+
+// Finish parsing the response. Return the number of entries
+// passed to the callback, or -1 if the response was not a JSON array.
+int nightscout_entries_end(nightscout_entries_parser_t *p);
+
+void process_nightscout_entries(const char *json, nightscout_entry_callback_t callback, void *context);
+
+// Fetch entries from the given endpoint, parsing the response as it arrives,
+// and apply the callback to each one. Return the number of entries, or -1 on error.
+int get_nightscout_entries(esp_http_client_handle_t client, const char *endpoint, nightscout_entry_callback_t callback, void *context);
+
+void print_nightscout_entry(void *context, const nightscout_entry_t *e);
+
+// Write the JSON for an array of entries into buf. As with snprintf,
+// return its length; it is complete only if that is less than size.
+int entries_json(const nightscout_entry_t *entries, int n, char *buf, int size);
+
+// Upload sensor glucose entries, such as readings from the pump's
+// glucose history, in a single request.
+void upload_entries(esp_http_client_handle_t client, const nightscout_entry_t *entries, int n);
 
 typedef enum {
 	NS_UNKNOWN = 0,
@@ -59,8 +131,35 @@ typedef struct {
 
 time_t get_last_treatment_time(esp_http_client_handle_t client);
 
+// Return the created_at time of the treatment in the response from
+// a query with count=1, 0 if the response is empty, or -1 on error.
+time_t query_treatment_time(esp_http_client_handle_t client, const char *endpoint);
+
+// Write the JSON for a treatment into buf, as for entries_json.
+#define TREATMENT_JSON_SIZE	256
+int treatment_json(const nightscout_treatment_t *t, char *buf, int size);
+
 void upload_treatment(esp_http_client_handle_t client, nightscout_treatment_t *t);
 
+// Statistics accumulated by upload_treatments.
+typedef struct {
+	int requests;
+	int failures;
+	int bytes;		// total size of the uploaded JSON
+	int total_ms;		// sum of request latencies
+	int max_ms;		// longest request latency
+} nightscout_upload_stats_t;
+
+#define DEFAULT_UPLOAD_BATCH_SIZE	4096
+
+// Upload treatments in batches, each a JSON array of at most max_bytes,
+// so a backfill takes one request per batch rather than one per treatment.
+// If stats is not null, the statistics for each request are added to it.
+// Uploading stops at the first failed batch, or at a treatment too large
+// for a batch. Return the index of the first treatment not uploaded
+// (n if all were), so the caller can resume from there.
+int upload_treatments(esp_http_client_handle_t client, const nightscout_treatment_t *t, int n, int max_bytes, nightscout_upload_stats_t *stats);
+
 typedef struct {
 	struct timeval tv;
 	int iob;		// milliUnits
@@ -75,12 +174,68 @@ typedef struct {
 	int battery_voltage;	// milliVolts
 } nightscout_device_status_t;
 
+// Write the JSON for a device status into buf, as for entries_json.
+#define DEVICE_STATUS_JSON_SIZE	512
+int device_status_json(const nightscout_device_status_t *s, char *buf, int size);
+
 void upload_device_status(esp_http_client_handle_t client, nightscout_device_status_t *s);
 
-void nightscout_upload(esp_http_client_handle_t client, const char *endpoint, const char *json);
+// Cursor for incremental sync: the newest documents already seen,
+// so that queries can ask the server for only newer ones.
+typedef struct {
+	int64_t entry_ms;	// date of the newest entry, in milliseconds
+	time_t treatment;	// created_at time of the newest treatment
+} nightscout_cursor_t;
+
+// Load the cursor from NVS. Return 0 on success, -1 if there is none.
+int nightscout_cursor_load(nightscout_cursor_t *c);
+
+void nightscout_cursor_save(const nightscout_cursor_t *c);
+
+// Maximum number of entries requested in one sync,
+// which limits the first one or one after a long gap.
+#define SYNC_MAX_ENTRIES	288
+
+#define MAX_QUERY_SIZE		128
+
+// Build the endpoint and query for entries with dates after ms,
+// or for treatments created after t.
+void entries_since_query(char *buf, int size, int64_t ms, int count);
+void treatments_since_query(char *buf, int size, time_t t);
+
+// Fetch the entries newer than the cursor, apply the callback
+// to each one, and advance the cursor past them.
+// Return the number of entries, or -1 on error.
+int sync_nightscout_entries(esp_http_client_handle_t client, nightscout_cursor_t *c, nightscout_entry_callback_t callback, void *context);
+
+// Return the time of the last treatment, fetching it only if it is newer
+// than the cursor, and advance the cursor. Return 0 on error.
+time_t sync_last_treatment_time(esp_http_client_handle_t client, nightscout_cursor_t *c);
+
+// POST the JSON data to the given endpoint.
+// Return 0 on success, -1 on failure or a non-2xx response.
+int nightscout_upload(esp_http_client_handle_t client, const char *endpoint, const char *json);
+
+// A JSON array of objects collected for a single upload.
+typedef struct {
+	char *buf;
+	int max_bytes;
+	int len;
+	int count;	// number of objects in the array
+} upload_batch_t;
+
+// Allocate a batch of at most max_bytes. Return 0 on success, -1 on failure.
+int upload_batch_init(upload_batch_t *b, int max_bytes);
+
+void upload_batch_free(upload_batch_t *b);
+
+// Add the len bytes of a JSON object to the batch.
+// Return 0 on success, -1 if there is not enough room.
+int upload_batch_add(upload_batch_t *b, const char *json, int len);
 
-#ifdef NIGHTSCOUT_DEBUG
-#define cJSON_PrintUnformatted	cJSON_Print
-#endif
+// Upload the batch, if it is not empty, and add the statistics
+// for the request to stats if it is not null. The batch is emptied
+// whether or not the upload succeeds. Return 0 on success, -1 on failure.
+int upload_batch_send(esp_http_client_handle_t client, const char *endpoint, upload_batch_t *b, nightscout_upload_stats_t *stats);
 
 #endif // _NIGHTSCOUT_H
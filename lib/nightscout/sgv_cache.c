@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <string.h>
+
+#define TAG		"NS"
+
+#include <esp_log.h>
+
+#include "sgv_cache.h"
+
+void sgv_cache_init(sgv_cache_t *c) {
+	c->count = 0;
+}
+
+bool sgv_cache_add(sgv_cache_t *c, const nightscout_entry_t *e) {
+	// Find the position after all older entries.
+	int i = c->count;
+	while (i > 0 && timercmp(&c->entries[i - 1].tv, &e->tv, >)) {
+		i--;
+	}
+	if (i > 0 && timercmp(&c->entries[i - 1].tv, &e->tv, ==)) {
+		return false;
+	}
+	if (c->count == SGV_CACHE_SIZE) {
+		if (i == 0) {
+			return false;
+		}
+		// Drop the oldest entry.
+		i--;
+		memmove(&c->entries[0], &c->entries[1], i * sizeof(c->entries[0]));
+	} else {
+		memmove(&c->entries[i + 1], &c->entries[i], (c->count - i) * sizeof(c->entries[0]));
+		c->count++;
+	}
+	c->entries[i] = *e;
+	return true;
+}
+
+const nightscout_entry_t *sgv_cache_get(const sgv_cache_t *c, int i) {
+	if (i < 0 || i >= c->count) {
+		return 0;
+	}
+	return &c->entries[c->count - 1 - i];
+}
+
+// The state of a poll, passed to add_entry as its context.
+typedef struct {
+	sgv_cache_t *cache;
+	nightscout_entry_callback_t *callback;
+	void *context;
+	int new_entries;
+} poll_t;
+
+static void add_entry(void *context, const nightscout_entry_t *e) {
+	poll_t *p = context;
+	if (sgv_cache_add(p->cache, e)) {
+		p->new_entries++;
+		if (p->callback) {
+			p->callback(p->context, e);
+		}
+	}
+}
+
+static int get_sgvs(esp_http_client_handle_t client, poll_t *p, int count) {
+	char endpoint[32];
+	snprintf(endpoint, sizeof(endpoint), "/sgv.json?count=%d", count);
+	return get_nightscout_entries(client, endpoint, add_entry, p);
+}
+
+int xdrip_poll(esp_http_client_handle_t client, sgv_cache_t *c, nightscout_entry_callback_t callback, void *context) {
+	poll_t p = {
+		.cache = c,
+		.callback = callback,
+		.context = context,
+	};
+	const nightscout_entry_t *last = sgv_cache_get(c, 0);
+	if (!last) {
+		if (get_sgvs(client, &p, SGV_CACHE_SIZE) < 0) {
+			return -1;
+		}
+		return p.new_entries;
+	}
+	time_t prev = last->tv.tv_sec;
+	if (get_sgvs(client, &p, 1) < 0) {
+		return -1;
+	}
+	// A gap of more than one interval means readings were missed.
+	time_t gap = sgv_cache_get(c, 0)->tv.tv_sec - prev;
+	if (p.new_entries != 0 && gap > SGV_INTERVAL + SGV_INTERVAL / 2) {
+		int count = (gap + SGV_INTERVAL / 2) / SGV_INTERVAL + 1;
+		if (count > SGV_CACHE_SIZE) {
+			count = SGV_CACHE_SIZE;
+		}
+		ESP_LOGD(TAG, "filling %ld-second gap with %d readings", (long)gap, count);
+		if (get_sgvs(client, &p, count) < 0) {
+			return -1;
+		}
+	}
+	return p.new_entries;
+}
+
+int xdrip_poll_delay(const sgv_cache_t *c, time_t now) {
+	const nightscout_entry_t *last = sgv_cache_get(c, 0);
+	if (!last) {
+		return XDRIP_POLL_SLOW;
+	}
+	time_t due = last->tv.tv_sec + SGV_INTERVAL;
+	time_t start = due - XDRIP_POLL_LEAD;
+	if (now < start) {
+		// The clock may be wrong or not yet set.
+		return start - now < SGV_INTERVAL ? start - now : SGV_INTERVAL;
+	}
+	if (now < due + XDRIP_POLL_WINDOW) {
+		return XDRIP_POLL_FAST;
+	}
+	return XDRIP_POLL_SLOW;
+}
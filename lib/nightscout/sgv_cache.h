@@ -0,0 +1,48 @@
+#ifndef _SGV_CACHE_H
+#define _SGV_CACHE_H
+
+#include <stdbool.h>
+#include <time.h>
+
+#include "nightscout.h"
+
+// Cache of the most recent sensor glucose readings, kept in order of time,
+// so that xDrip can be polled for just the newest one.
+
+#define SGV_CACHE_SIZE		36		// 3 hours of readings
+#define SGV_INTERVAL		(5 * 60)	// seconds between CGM readings
+
+typedef struct {
+	nightscout_entry_t entries[SGV_CACHE_SIZE];	// oldest first
+	int count;
+} sgv_cache_t;
+
+void sgv_cache_init(sgv_cache_t *c);
+
+// Add an entry in order of time, dropping the oldest one if the cache is full.
+// Return false if an entry with the same time is already present,
+// or the cache is full and the entry is older than all of them.
+bool sgv_cache_add(sgv_cache_t *c, const nightscout_entry_t *e);
+
+// Return the ith most recent entry (0 is the newest), or null.
+const nightscout_entry_t *sgv_cache_get(const sgv_cache_t *c, int i);
+
+// Poll xDrip's /sgv.json for readings not yet in the cache.
+// Only the newest reading is requested, unless the cache is empty
+// or that reading shows a gap since the last one, in which case enough
+// are requested to fill it. The callback, if any, is applied to each
+// new entry with the given context.
+// Return the number of new entries, or -1 on error.
+int xdrip_poll(esp_http_client_handle_t client, sgv_cache_t *c, nightscout_entry_callback_t callback, void *context);
+
+// Polling is fast around the time the next reading is due,
+// and slow when it is well overdue or nothing is known yet.
+#define XDRIP_POLL_LEAD		10	// seconds before the next reading is due
+#define XDRIP_POLL_FAST		5	// seconds between polls while it is due
+#define XDRIP_POLL_WINDOW	120	// seconds after it is due to keep polling fast
+#define XDRIP_POLL_SLOW		60	// seconds between polls otherwise
+
+// Return the number of seconds to wait before the next call to xdrip_poll.
+int xdrip_poll_delay(const sgv_cache_t *c, time_t now);
+
+#endif // _SGV_CACHE_H
@@ -0,0 +1,61 @@
+#include <inttypes.h>
+#include <stdio.h>
+
+#define TAG		"NS"
+
+#include <esp_log.h>
+
+#include "nightscout.h"
+
+// The query parameters find[date][$gt] and find[created_at][$gt],
+// percent-encoded (and with the percent signs doubled for printf),
+// since brackets and dollar signs are not allowed unescaped in a URL.
+#define FIND_DATE_GT		"find%%5Bdate%%5D%%5B%%24gt%%5D"
+#define FIND_CREATED_AT_GT	"find%%5Bcreated_at%%5D%%5B%%24gt%%5D"
+
+void entries_since_query(char *buf, int size, int64_t ms, int count) {
+	snprintf(buf, size, "/api/v1/entries?" FIND_DATE_GT "=%" PRId64 "&count=%d", ms, count);
+}
+
+void treatments_since_query(char *buf, int size, time_t t) {
+	char ts[ISO_TIME_STRING_SIZE];
+	struct timeval tv = { .tv_sec = t };
+	print_iso_time(ts, tv);
+	snprintf(buf, size, "/api/v1/treatments?" FIND_CREATED_AT_GT "=%s&count=1", ts);
+}
+
+static int parse_entries(void *context, const char *buf, int len) {
+	return nightscout_entries_parse(context, buf, len);
+}
+
+int sync_nightscout_entries(esp_http_client_handle_t client, nightscout_cursor_t *c, nightscout_entry_callback_t callback, void *context) {
+	char endpoint[MAX_QUERY_SIZE];
+	entries_since_query(endpoint, sizeof(endpoint), c->entry_ms, SYNC_MAX_ENTRIES);
+	nightscout_entries_parser_t p;
+	nightscout_entries_init(&p, callback, context);
+	if (http_get_stream(client, endpoint, parse_entries, &p) != 0) {
+		return -1;
+	}
+	int n = nightscout_entries_end(&p);
+	if (n > 0) {
+		int64_t ms = (int64_t)p.latest.tv_sec * 1000 + p.latest.tv_usec / 1000;
+		if (ms > c->entry_ms) {
+			c->entry_ms = ms;
+		}
+	}
+	ESP_LOGD(TAG, "synced %d entries", n);
+	return n;
+}
+
+time_t sync_last_treatment_time(esp_http_client_handle_t client, nightscout_cursor_t *c) {
+	char endpoint[MAX_QUERY_SIZE];
+	treatments_since_query(endpoint, sizeof(endpoint), c->treatment);
+	time_t t = query_treatment_time(client, endpoint);
+	if (t < 0) {
+		return 0;
+	}
+	if (t > c->treatment) {
+		c->treatment = t;
+	}
+	return c->treatment;
+}
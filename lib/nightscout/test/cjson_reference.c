@@ -0,0 +1,114 @@
+// The cJSON implementations of treatment_json, device_status_json, and
+// entries_json that the JSON writer replaced, for checking that the output
+// is unchanged and for comparison in json_bench.
+
+#include <stdio.h>
+
+#include <cJSON.h>
+
+#include "cjson_reference.h"
+
+char *cjson_treatment_json(const nightscout_treatment_t *t) {
+	cJSON *root = cJSON_CreateObject();
+
+	char ts[ISO_TIME_STRING_SIZE];
+	print_iso_time(ts, t->tv);
+	cJSON_AddItemToObject(root, "created_at", cJSON_CreateString(ts));
+
+	cJSON_AddItemToObject(root, "enteredBy",  cJSON_CreateString(NIGHTSCOUT_USER));
+
+	char buf[64];
+	const char *e;
+	switch (t->type) {
+	case NS_BG_CHECK:
+		e = "BG Check";
+		cJSON_AddItemToObject(root, "glucose", cJSON_CreateNumber(t->value));
+		cJSON_AddItemToObject(root, "units", cJSON_CreateString("mg/dl"));
+		break;
+	case NS_CORRECTION_BOLUS:
+		e = "Correction Bolus";
+		cJSON_AddItemToObject(root, "insulin", cJSON_CreateNumber(t->value / 1000.0));
+		break;
+	case NS_MEAL_BOLUS:
+		e = "Meal Bolus";
+		cJSON_AddItemToObject(root, "insulin", cJSON_CreateNumber(t->value / 1000.0));
+		break;
+	case NS_SITE_CHANGE:
+		e = "Site Change";
+		break;
+	case NS_TEMP_BASAL:
+		e = "Temp Basal";
+		cJSON_AddItemToObject(root, "absolute", cJSON_CreateNumber(t->value / 1000.0));
+		cJSON_AddItemToObject(root, "duration", cJSON_CreateNumber(t->minutes));
+		break;
+	default:
+		sprintf(buf, "unknown (%d)", t->type);
+		e = buf;
+		break;
+	}
+	cJSON_AddItemToObject(root, "eventType", cJSON_CreateString(e));
+	char *json = cJSON_PrintUnformatted(root);
+	cJSON_Delete(root);
+	return json;
+}
+
+char *cjson_device_status_json(const nightscout_device_status_t *s) {
+	cJSON *root = cJSON_CreateObject();
+
+	char ts[ISO_TIME_STRING_SIZE];
+	print_iso_time(ts, s->tv);
+	cJSON_AddItemToObject(root, "created_at", cJSON_CreateString(ts));
+	cJSON_AddItemToObject(root, "device",  cJSON_CreateString("GNARL"));
+
+	cJSON *openaps = cJSON_CreateObject();
+	cJSON_AddItemToObject(root, "openaps", openaps);
+	cJSON *iob = cJSON_CreateObject();
+	cJSON_AddItemToObject(openaps, "iob",  iob);
+	cJSON *i = cJSON_CreateObject();
+	cJSON_AddItemToObject(iob, "iob",  i);
+	cJSON_AddItemToObject(i, "iob", cJSON_CreateNumber(s->iob / 1000.0));
+
+	cJSON *pump = cJSON_CreateObject();
+	cJSON_AddItemToObject(root, "pump", pump);
+	struct timeval tv = { .tv_sec = s->pump_clock };
+	print_iso_time(ts, tv);
+	cJSON_AddItemToObject(pump, "clock", cJSON_CreateString(ts));
+	cJSON_AddItemToObject(pump, "reservoir", cJSON_CreateNumber(s->reservoir / 1000.0));
+	cJSON *battery = cJSON_CreateObject();
+	cJSON_AddItemToObject(pump, "battery", battery);
+	cJSON_AddItemToObject(battery, "voltage",  cJSON_CreateNumber(s->pump_battery / 1000.0));
+	cJSON *status = cJSON_CreateObject();
+	cJSON_AddItemToObject(pump, "status", status);
+	cJSON_AddItemToObject(status, "status",  cJSON_CreateString(s->pump_status));
+	cJSON_AddItemToObject(status, "bolusing",  cJSON_CreateBool(s->bolusing));
+	cJSON_AddItemToObject(status, "suspended",  cJSON_CreateBool(s->suspended));
+
+	cJSON *uploader = cJSON_CreateObject();
+	cJSON_AddItemToObject(root, "uploader", uploader);
+	cJSON_AddItemToObject(uploader, "battery",  cJSON_CreateNumber(s->battery_percent));
+	cJSON_AddItemToObject(uploader, "batteryVoltage",  cJSON_CreateNumber(s->battery_voltage / 1000.0));
+
+	char *json = cJSON_PrintUnformatted(root);
+	cJSON_Delete(root);
+	return json;
+}
+
+char *cjson_entries_json(const nightscout_entry_t *entries, int n) {
+	cJSON *root = cJSON_CreateArray();
+	for (int i = 0; i < n; i++) {
+		const nightscout_entry_t *e = &entries[i];
+		cJSON *entry = cJSON_CreateObject();
+		cJSON_AddItemToObject(entry, "type", cJSON_CreateString("sgv"));
+		cJSON_AddItemToObject(entry, "sgv", cJSON_CreateNumber(e->sgv));
+		double ms = e->tv.tv_sec * 1000.0 + e->tv.tv_usec / 1000;
+		cJSON_AddItemToObject(entry, "date", cJSON_CreateNumber(ms));
+		char ts[ISO_TIME_STRING_SIZE];
+		print_iso_time(ts, e->tv);
+		cJSON_AddItemToObject(entry, "dateString", cJSON_CreateString(ts));
+		cJSON_AddItemToObject(entry, "device", cJSON_CreateString("GNARL"));
+		cJSON_AddItemToArray(root, entry);
+	}
+	char *json = cJSON_PrintUnformatted(root);
+	cJSON_Delete(root);
+	return json;
+}
@@ -0,0 +1,12 @@
+#ifndef _CJSON_REFERENCE_H
+#define _CJSON_REFERENCE_H
+
+#include "nightscout.h"
+
+// JSON for Nightscout uploads built with cJSON, as before the JSON writer.
+// The result must be freed by the caller.
+char *cjson_treatment_json(const nightscout_treatment_t *t);
+char *cjson_device_status_json(const nightscout_device_status_t *s);
+char *cjson_entries_json(const nightscout_entry_t *entries, int n);
+
+#endif // _CJSON_REFERENCE_H
@@ -0,0 +1,107 @@
+// Measure the speed of incremental entries parsing.
+//
+// Usage: entries_bench [file ...]
+//
+// Each file should contain a response from /api/v1/entries or /sgv.json.
+// Without arguments, a response with a day of entries (count=288)
+// in the format returned by Nightscout is generated.
+
+#include <sys/time.h>
+
+#include "testing.h"
+#include "nightscout.h"
+
+#define ITERATIONS	200
+#define PIECE_SIZE	512	// as read by http_get_stream
+#define DAY_ENTRIES	288
+
+static char *generate_day(void) {
+	static char buf[DAY_ENTRIES * 400];
+	char *p = buf;
+	p += sprintf(p, "[");
+	time_t t = 1586736000;
+	for (int i = 0; i < DAY_ENTRIES; i++, t -= 5 * 60) {
+		char ts[ISO_TIME_STRING_SIZE];
+		struct timeval tv = { t, 0 };
+		print_iso_time(ts, tv);
+		int sgv = 120 + (i * 37) % 90 - 45;
+		p += sprintf(p, "%s{\"_id\":\"5e93b1c6f1d2a1e3c4b5%04x\",\"device\":\"xDrip-DexcomG6\","
+			     "\"date\":%ld000,\"dateString\":\"%s\",\"sgv\":%d,\"delta\":%.3f,"
+			     "\"direction\":\"Flat\",\"type\":\"sgv\",\"filtered\":%d,\"unfiltered\":%d,"
+			     "\"rssi\":100,\"noise\":1,\"sysTime\":\"%s\",\"utcOffset\":-240}",
+			     i == 0 ? "" : ",", i, (long)t, ts, sgv, (i % 7) - 3.5,
+			     sgv * 1000, sgv * 1000 + 250, ts);
+		assert(p - buf < sizeof(buf) - 400);
+	}
+	p += sprintf(p, "]");
+	return buf;
+}
+
+static char *read_response(const char *name, int *len) {
+	FILE *f = fopen(name, "r");
+	if (f == 0) {
+		perror(name);
+		exit(1);
+	}
+	fseek(f, 0, SEEK_END);
+	long n = ftell(f);
+	rewind(f);
+	char *buf = malloc(n + 1);
+	if (fread(buf, 1, n, f) != n) {
+		perror(name);
+		exit(1);
+	}
+	fclose(f);
+	buf[n] = 0;
+	*len = n;
+	return buf;
+}
+
+static int entries;
+
+static void count_entry(void *context, const nightscout_entry_t *e) {
+	entries++;
+}
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void bench(const char *name, const char *json, int len) {
+	entries = 0;
+	double start = now();
+	for (int k = 0; k < ITERATIONS; k++) {
+		nightscout_entries_parser_t p;
+		nightscout_entries_init(&p, count_entry, 0);
+		for (int i = 0; i < len; i += PIECE_SIZE) {
+			int n = len - i < PIECE_SIZE ? len - i : PIECE_SIZE;
+			nightscout_entries_parse(&p, json + i, n);
+		}
+		if (nightscout_entries_end(&p) < 0) {
+			fprintf(stderr, "%s: cannot parse response\n", name);
+			exit(1);
+		}
+	}
+	double elapsed = now() - start;
+	printf("%s: %d bytes, %d entries: %.1f MB/s, %.0f entries/s\n",
+	       name, len, entries / ITERATIONS,
+	       (double)len * ITERATIONS / elapsed / 1e6, entries / elapsed);
+}
+
+int main(int argc, char **argv) {
+	printf("parser state: %d bytes\n", (int)sizeof(nightscout_entries_parser_t));
+	if (argc == 1) {
+		char *json = generate_day();
+		bench("generated day", json, strlen(json));
+		return 0;
+	}
+	for (int i = 1; i < argc; i++) {
+		int len;
+		char *json = read_response(argv[i], &len);
+		bench(argv[i], json, len);
+		free(json);
+	}
+	return 0;
+}
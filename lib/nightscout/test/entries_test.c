@@ -0,0 +1,161 @@
+#include "testing.h"
+#include "nightscout.h"
+
+// A response in the format returned by /api/v1/entries,
+// with an mbg entry, an sgv entry with no value, and nested fields.
+static const char *response =
+	"[{\"_id\":\"5e93b1c6f1d2a1e3c4b5a697\",\"device\":\"xDrip-DexcomG5\","
+	"\"date\":1586737600000,\"dateString\":\"2020-04-13T00:26:40.000Z\","
+	"\"sgv\":123,\"delta\":-2.5,\"direction\":\"Flat\",\"type\":\"sgv\","
+	"\"filtered\":130000,\"unfiltered\":128000,\"rssi\":100,\"noise\":1,"
+	"\"sysTime\":\"2020-04-13T00:26:40.000Z\",\"utcOffset\":-240},\n"
+	" {\"_id\":\"5e93b09af1d2a1e3c4b5a696\",\"type\":\"mbg\",\"mbg\":118,"
+	"\"date\":1586737400000,\"device\":\"Contour\\u00AE \\\"Next\\\"\"},\n"
+	" {\"_id\":\"5e93b06ef1d2a1e3c4b5a695\",\"date\":1586737300500,"
+	"\"sgv\":98,\"type\":\"sgv\",\"extra\":{\"type\":\"mbg\",\"sgv\":1,\"list\":[1,2,{\"sgv\":3}]}},\n"
+	" {\"_id\":\"5e93b06ef1d2a1e3c4b5a694\",\"date\":1586737000000,\"type\":\"sgv\"},\n"
+	" {\"type\":\"sgv\",\"sgv\":401,\"date\":1.5867367e12}]\n";
+
+static const nightscout_entry_t expected[] = {
+	{ { 1586737600, 0 }, 123 },
+	{ { 1586737300, 500000 }, 98 },
+	{ { 1586736700, 0 }, 401 },
+};
+
+#define MAX_ENTRIES	10
+
+static nightscout_entry_t entries[MAX_ENTRIES];
+static int num_entries;
+
+static void save_entry(void *context, const nightscout_entry_t *e) {
+	if (num_entries < MAX_ENTRIES) {
+		entries[num_entries] = *e;
+	}
+	num_entries++;
+}
+
+static void check_entries(const char *what) {
+	if (num_entries != LEN(expected)) {
+		test_failed("%s: %d entries, want %d", what, num_entries, (int)LEN(expected));
+		return;
+	}
+	for (int i = 0; i < num_entries; i++) {
+		const nightscout_entry_t *e = &entries[i], *x = &expected[i];
+		if (e->sgv != x->sgv || e->tv.tv_sec != x->tv.tv_sec || e->tv.tv_usec != x->tv.tv_usec) {
+			test_failed("%s: entry %d = %d at { %ld, %ld }, want %d at { %ld, %ld }", what, i,
+				    e->sgv, e->tv.tv_sec, e->tv.tv_usec, x->sgv, x->tv.tv_sec, x->tv.tv_usec);
+		}
+	}
+}
+
+// Parse the response in pieces of the given size.
+static int parse_in_pieces(const char *json, int size) {
+	nightscout_entries_parser_t p;
+	nightscout_entries_init(&p, save_entry, 0);
+	num_entries = 0;
+	int len = strlen(json);
+	for (int i = 0; i < len; i += size) {
+		int n = len - i < size ? len - i : size;
+		nightscout_entries_parse(&p, json + i, n);
+	}
+	return nightscout_entries_end(&p);
+}
+
+void test_entries(void) {
+	char what[32];
+	for (int size = 1; size <= strlen(response); size++) {
+		int n = parse_in_pieces(response, size);
+		sprintf(what, "%d-byte pieces", size);
+		if (n != LEN(expected)) {
+			test_failed("%s: returned %d", what, n);
+		}
+		check_entries(what);
+	}
+	num_entries = 0;
+	process_nightscout_entries(response, save_entry, 0);
+	check_entries("process_nightscout_entries");
+}
+
+static const char *invalid_responses[] = {
+	"",
+	"{\"sgv\":100}",
+	"\"sgv\"",
+	"[{\"type\":\"sgv\",\"sgv\":100,\"date\":1}",
+	"[{\"type\":\"sgv\",\"sgv\":100,\"date\":1}]]",
+	"[{\"type\":\"sgv\" \"sgv\":100}]",
+	"[{\"type\":\"sgv\",\"sgv\":1x0}]",
+	"[{\"type\":\"sgv\",\"sgv\":100,}]",
+	"[{\"type\":\"sgv\",\"sgv\":tru}]",
+	"[{\"type\":\"s\\qv\"}]",
+	"[[[[[[[[[[]]]]]]]]]]",
+	"[1] 2",
+};
+
+void test_invalid(void) {
+	for (int i = 0; i < LEN(invalid_responses); i++) {
+		const char *json = invalid_responses[i];
+		if (parse_in_pieces(json, 3) != -1) {
+			test_failed("invalid response %s was accepted", json);
+		}
+	}
+	if (parse_in_pieces(" [ ] ", 1) != 0) {
+		test_failed("empty array was not accepted");
+	}
+}
+
+typedef struct {
+	json_event_t event;
+	const char *key;
+	const char *value;
+	int depth;
+} event_t;
+
+static const event_t expected_events[] = {
+	{ JSON_BEGIN_OBJECT, "", "", 0 },
+	{ JSON_STRING, "a\tb", "\xC3\xA9\xE2\x82\xAC/\"", 1 },
+	{ JSON_BEGIN_ARRAY, "list", "", 1 },
+	{ JSON_TRUE, "", "true", 2 },
+	{ JSON_FALSE, "", "false", 2 },
+	{ JSON_NULL, "", "null", 2 },
+	{ JSON_NUMBER, "", "-1.5e+3", 2 },
+	{ JSON_END_ARRAY, "", "", 1 },
+	{ JSON_BEGIN_OBJECT, "empty", "", 1 },
+	{ JSON_END_OBJECT, "", "", 1 },
+	{ JSON_NUMBER, "n", "0", 1 },
+	{ JSON_END_OBJECT, "", "", 0 },
+};
+
+static int num_events;
+
+static void check_event(json_parser_t *p, json_event_t event, const char *key, const char *value) {
+	int i = num_events++;
+	if (i >= LEN(expected_events)) {
+		test_failed("unexpected event %d", event);
+		return;
+	}
+	const event_t *e = &expected_events[i];
+	if (event != e->event || strcmp(key, e->key) != 0 || strcmp(value, e->value) != 0 || p->depth != e->depth) {
+		test_failed("event %d = %d \"%s\" \"%s\" at depth %d, want %d \"%s\" \"%s\" at depth %d", i,
+			    event, key, value, p->depth, e->event, e->key, e->value, e->depth);
+	}
+}
+
+void test_events(void) {
+	const char *json = "{ \"a\\tb\" : \"\\u00e9\\u20AC\\/\\\"\", \"list\": [true, false, null, -1.5e+3],"
+		"\"empty\": {}, \"n\": 0 }";
+	json_parser_t p;
+	json_parser_init(&p, check_event, 0);
+	if (json_parse(&p, json, strlen(json)) != 0 || json_parse_end(&p) != 0) {
+		test_failed("cannot parse %s", json);
+	}
+	if (num_events != LEN(expected_events)) {
+		test_failed("%d events, want %d", num_events, (int)LEN(expected_events));
+	}
+}
+
+int main(int argc, char **argv) {
+	test_entries();
+	test_invalid();
+	test_events();
+	exit_test();
+}
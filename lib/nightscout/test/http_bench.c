@@ -0,0 +1,134 @@
+// Measure upload and sync throughput of lib/nightscout against
+// the mock Nightscout server, over the host HTTP client.
+//
+// Usage: http_bench [latency_ms]
+//
+// The latency (default 0) is added by the server before each response,
+// to model the round trip to a real Nightscout site.
+
+#include "testing.h"
+#include "nightscout.h"
+#include "mock_nightscout.h"
+
+esp_err_t http_header_callback(esp_http_client_event_t *e);
+
+#define DAY_ENTRIES		288
+#define NUM_TREATMENTS		500
+
+static int latency_ms;
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void report(const char *name, double elapsed) {
+	printf("%-36s %5d requests %3d connections %8.1f ms %8.3f ms/request %9.1f KB/s\n",
+	       name, mock_stats.requests, http_client_stats.connections, elapsed * 1000,
+	       elapsed / mock_stats.requests * 1000, (mock_stats.bytes_sent + mock_stats.bytes_received) / elapsed / 1000);
+}
+
+static void reset(void) {
+	mock_nightscout_reset();
+	mock_options.latency_ms = latency_ms;
+	memset(&http_client_stats, 0, sizeof(http_client_stats));
+}
+
+static void ignore_entry(void *context, const nightscout_entry_t *e) {
+}
+
+// Fetch a day of entries, as a full sync does.
+static void bench_full_sync(esp_http_client_handle_t client, http_framing_t framing, int padding, const char *name) {
+	reset();
+	mock_add_entries(DAY_ENTRIES);
+	mock_options.framing = framing;
+	mock_options.chunk_size = 1400;
+	mock_options.entry_padding = padding;
+	int iterations = latency_ms ? 5 : 50;
+	double start = now();
+	for (int i = 0; i < iterations; i++) {
+		nightscout_cursor_t c = {0};
+		if (sync_nightscout_entries(client, &c, ignore_entry, 0) != DAY_ENTRIES) {
+			fprintf(stderr, "%s: sync failed\n", name);
+			exit(1);
+		}
+	}
+	report(name, now() - start);
+}
+
+// Poll for a new entry every 5 minutes, with and without the cursor.
+static void bench_polling(esp_http_client_handle_t client, bool incremental, const char *name) {
+	reset();
+	mock_add_entries(DAY_ENTRIES);
+	int iterations = latency_ms ? 10 : 200;
+	nightscout_cursor_t c = {0};
+	sync_nightscout_entries(client, &c, ignore_entry, 0);
+	mock_stats = (mock_nightscout_stats_t){0};
+	memset(&http_client_stats, 0, sizeof(http_client_stats));
+	double start = now();
+	for (int i = 0; i < iterations; i++) {
+		mock_add_entries(1);
+		int n;
+		if (incremental) {
+			n = sync_nightscout_entries(client, &c, ignore_entry, 0);
+		} else {
+			n = get_nightscout_entries(client, "/api/v1/entries?count=288", ignore_entry, 0);
+		}
+		if (n < 1) {
+			fprintf(stderr, "%s: poll failed\n", name);
+			exit(1);
+		}
+	}
+	report(name, now() - start);
+}
+
+static nightscout_treatment_t treatments[NUM_TREATMENTS];
+
+static void bench_uploads(esp_http_client_handle_t client, int max_bytes, const char *name) {
+	reset();
+	for (int i = 0; i < NUM_TREATMENTS; i++) {
+		treatments[i] = (nightscout_treatment_t){
+			.tv = { TEST_TIME_NOW + 300 * i, 0 },
+			.type = NS_BG_CHECK + i % 5,
+			.value = 1000 + 25 * i,
+			.minutes = 30,
+		};
+	}
+	nightscout_upload_stats_t stats = {0};
+	double start = now();
+	int n = upload_treatments(client, treatments, NUM_TREATMENTS, max_bytes, &stats);
+	double elapsed = now() - start;
+	if (n != NUM_TREATMENTS || mock_num_treatments() != NUM_TREATMENTS) {
+		fprintf(stderr, "%s: uploaded %d treatments\n", name, n);
+		exit(1);
+	}
+	report(name, elapsed);
+}
+
+int main(int argc, char **argv) {
+	if (argc > 1) {
+		latency_ms = atoi(argv[1]);
+	}
+	int port = mock_nightscout_start();
+	char url[64];
+	sprintf(url, "http://localhost:%d", port);
+	esp_http_client_config_t config = {
+		.url = url,
+		.event_handler = http_header_callback,
+	};
+	esp_http_client_handle_t client = esp_http_client_init(&config);
+	printf("latency %d ms\n", latency_ms);
+	bench_full_sync(client, FRAME_LENGTH, 0, "day of entries, Content-Length");
+	bench_full_sync(client, FRAME_CHUNKED, 0, "day of entries, chunked");
+	bench_full_sync(client, FRAME_CLOSE, 0, "day of entries, close-delimited");
+	bench_full_sync(client, FRAME_CHUNKED, 2000, "day of 2K-padded entries, chunked");
+	bench_polling(client, false, "polling, full day each time");
+	bench_polling(client, true, "polling, incremental");
+	bench_uploads(client, 120, "treatments, one per request");
+	bench_uploads(client, 1000, "treatments, 1000-byte batches");
+	bench_uploads(client, DEFAULT_UPLOAD_BATCH_SIZE, "treatments, default batches");
+	esp_http_client_cleanup(client);
+	mock_nightscout_stop();
+	return 0;
+}
@@ -0,0 +1,453 @@
+// Host implementation of the ESP-IDF HTTP client functions used by lib/nightscout.
+// It speaks HTTP/1.1 over plain TCP (the certificate is ignored),
+// handles Content-Length, chunked, and close-delimited responses,
+// and reports each response header to the event handler.
+// As in ESP-IDF, the connection is kept open after a complete response
+// and reused for the next request unless the server asked to close it.
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "testing.h"
+#include "esp_http_client.h"
+
+#define MAX_HEADERS	8
+#define MAX_LINE	512
+#define RX_BUF_SIZE	4096
+
+typedef struct {
+	char key[64];
+	char value[256];
+} header_t;
+
+struct esp_http_client {
+	char host[128];
+	char port[8];
+	char path[512];
+	int timeout_ms;
+	http_event_handle_cb event_handler;
+	void *user_data;
+	esp_http_client_method_t method;
+	int num_headers;
+	header_t headers[MAX_HEADERS];
+	const char *post_data;
+	int post_len;
+	int fd;
+	// Response state.
+	int status_code;
+	int content_length;	// -1 if not given
+	bool chunked;
+	bool complete;
+	bool keep_alive;	// the server did not send "Connection: close"
+	int remaining;		// in the body or the current chunk
+	uint8_t rx_buf[RX_BUF_SIZE];
+	int rx_start, rx_end;
+};
+
+const char *esp_err_to_name(esp_err_t err) {
+	return err == ESP_OK ? "ESP_OK" : "ESP_FAIL";
+}
+
+// Parse http://host[:port][/path], or just a path to keep the current host.
+static esp_err_t parse_url(esp_http_client_handle_t c, const char *url) {
+	if (url[0] == '/') {
+		snprintf(c->path, sizeof(c->path), "%s", url);
+		return ESP_OK;
+	}
+	const char *prefix = "http://";
+	if (strncmp(url, prefix, strlen(prefix)) != 0) {
+		fprintf(stderr, "unsupported URL %s\n", url);
+		return ESP_FAIL;
+	}
+	const char *host = url + strlen(prefix);
+	const char *path = strchr(host, '/');
+	if (path == 0) {
+		path = host + strlen(host);
+	}
+	const char *colon = memchr(host, ':', path - host);
+	const char *host_end = colon ? colon : path;
+	snprintf(c->host, sizeof(c->host), "%.*s", (int)(host_end - host), host);
+	if (colon) {
+		snprintf(c->port, sizeof(c->port), "%.*s", (int)(path - colon - 1), colon + 1);
+	} else {
+		strcpy(c->port, "80");
+	}
+	snprintf(c->path, sizeof(c->path), "%s", *path ? path : "/");
+	return ESP_OK;
+}
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config) {
+	esp_http_client_handle_t c = calloc(1, sizeof(*c));
+	c->fd = -1;
+	c->timeout_ms = config->timeout_ms ? config->timeout_ms : 5000;
+	c->event_handler = config->event_handler;
+	c->user_data = config->user_data;
+	if (parse_url(c, config->url) != ESP_OK) {
+		free(c);
+		return 0;
+	}
+	return c;
+}
+
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t c, const char *url) {
+	return parse_url(c, url);
+}
+
+esp_err_t esp_http_client_set_method(esp_http_client_handle_t c, esp_http_client_method_t method) {
+	c->method = method;
+	return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t c, const char *key, const char *value) {
+	header_t *h = 0;
+	for (int i = 0; i < c->num_headers; i++) {
+		if (strcasecmp(c->headers[i].key, key) == 0) {
+			h = &c->headers[i];
+			break;
+		}
+	}
+	if (h == 0) {
+		if (c->num_headers == MAX_HEADERS) {
+			return ESP_FAIL;
+		}
+		h = &c->headers[c->num_headers++];
+	}
+	snprintf(h->key, sizeof(h->key), "%s", key);
+	snprintf(h->value, sizeof(h->value), "%s", value);
+	return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_post_field(esp_http_client_handle_t c, const char *data, int len) {
+	c->post_data = data;
+	c->post_len = len;
+	return ESP_OK;
+}
+
+static void send_event(esp_http_client_handle_t c, esp_http_client_event_id_t id, char *key, char *value) {
+	if (c->event_handler == 0) {
+		return;
+	}
+	esp_http_client_event_t e = {
+		.event_id = id,
+		.client = c,
+		.user_data = c->user_data,
+		.header_key = key,
+		.header_value = value,
+	};
+	c->event_handler(&e);
+}
+
+static int connect_to_server(esp_http_client_handle_t c) {
+	struct addrinfo hints = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+	};
+	struct addrinfo *addrs;
+	if (getaddrinfo(c->host, c->port, &hints, &addrs) != 0) {
+		return -1;
+	}
+	int fd = -1;
+	for (struct addrinfo *a = addrs; a != 0; a = a->ai_next) {
+		fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+		if (fd < 0) {
+			continue;
+		}
+		if (connect(fd, a->ai_addr, a->ai_addrlen) == 0) {
+			break;
+		}
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(addrs);
+	if (fd < 0) {
+		return -1;
+	}
+	struct timeval tv = {
+		.tv_sec = c->timeout_ms / 1000,
+		.tv_usec = (c->timeout_ms % 1000) * 1000,
+	};
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	// As with lwIP in ESP-IDF, the request headers and body are sent without delay.
+	int on = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	return fd;
+}
+
+static int write_all(int fd, const char *buf, int len) {
+	for (int i = 0; i < len; ) {
+		int n = send(fd, buf + i, len - i, MSG_NOSIGNAL);
+		if (n <= 0) {
+			return -1;
+		}
+		i += n;
+	}
+	return len;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t c, int write_len) {
+	bool reuse = c->fd >= 0 && c->complete && c->keep_alive && c->rx_start == c->rx_end;
+	if (!reuse) {
+		esp_http_client_close(c);
+	}
+	c->status_code = 0;
+	c->content_length = -1;
+	c->chunked = false;
+	c->complete = false;
+	c->keep_alive = true;
+	c->rx_start = c->rx_end = 0;
+	if (!reuse) {
+		c->fd = connect_to_server(c);
+		if (c->fd < 0) {
+			return ESP_FAIL;
+		}
+		send_event(c, HTTP_EVENT_ON_CONNECTED, 0, 0);
+	}
+	char req[2048];
+	int n = snprintf(req, sizeof(req), "%s %s HTTP/1.1\r\nHost: %s\r\n",
+			 c->method == HTTP_METHOD_POST ? "POST" : "GET", c->path, c->host);
+	for (int i = 0; i < c->num_headers; i++) {
+		n += snprintf(req + n, sizeof(req) - n, "%s: %s\r\n", c->headers[i].key, c->headers[i].value);
+	}
+	if (c->method == HTTP_METHOD_POST || write_len > 0) {
+		n += snprintf(req + n, sizeof(req) - n, "Content-Length: %d\r\n", write_len);
+	}
+	n += snprintf(req + n, sizeof(req) - n, "\r\n");
+	if (write_all(c->fd, req, n) < 0) {
+		esp_http_client_close(c);
+		return ESP_FAIL;
+	}
+	send_event(c, HTTP_EVENT_HEADER_SENT, 0, 0);
+	return ESP_OK;
+}
+
+int esp_http_client_write(esp_http_client_handle_t c, const char *buf, int len) {
+	if (c->fd < 0) {
+		return -1;
+	}
+	return write_all(c->fd, buf, len);
+}
+
+// Return the number of buffered bytes, reading more if there are none.
+// Return 0 at the end of the connection and -1 on error.
+static int fill(esp_http_client_handle_t c) {
+	if (c->rx_start < c->rx_end) {
+		return c->rx_end - c->rx_start;
+	}
+	int n = recv(c->fd, c->rx_buf, sizeof(c->rx_buf), 0);
+	if (n < 0) {
+		return -1;
+	}
+	c->rx_start = 0;
+	c->rx_end = n;
+	return n;
+}
+
+static int read_line(esp_http_client_handle_t c, char *line, int size) {
+	int len = 0;
+	for (;;) {
+		if (fill(c) <= 0) {
+			return -1;
+		}
+		char ch = c->rx_buf[c->rx_start++];
+		if (ch == '\n') {
+			break;
+		}
+		if (len < size - 1) {
+			line[len++] = ch;
+		}
+	}
+	if (len > 0 && line[len - 1] == '\r') {
+		len--;
+	}
+	line[len] = 0;
+	return len;
+}
+
+int esp_http_client_fetch_headers(esp_http_client_handle_t c) {
+	if (c->fd < 0) {
+		return ESP_FAIL;
+	}
+	char line[MAX_LINE];
+	if (read_line(c, line, sizeof(line)) < 0 || sscanf(line, "HTTP/%*d.%*d %d", &c->status_code) != 1) {
+		c->status_code = 0;
+		return ESP_FAIL;
+	}
+	for (;;) {
+		int n = read_line(c, line, sizeof(line));
+		if (n < 0) {
+			c->status_code = 0;
+			return ESP_FAIL;
+		}
+		if (n == 0) {
+			break;
+		}
+		char *colon = strchr(line, ':');
+		if (colon == 0) {
+			continue;
+		}
+		*colon = 0;
+		char *value = colon + 1;
+		while (*value == ' ') {
+			value++;
+		}
+		if (strcasecmp(line, "content-length") == 0) {
+			c->content_length = atoi(value);
+		} else if (strcasecmp(line, "transfer-encoding") == 0 && strcasecmp(value, "chunked") == 0) {
+			c->chunked = true;
+		} else if (strcasecmp(line, "connection") == 0 && strcasecmp(value, "close") == 0) {
+			c->keep_alive = false;
+		}
+		send_event(c, HTTP_EVENT_ON_HEADER, line, value);
+	}
+	if (c->chunked) {
+		c->content_length = -1;
+		c->remaining = 0;
+	} else {
+		c->remaining = c->content_length;
+		c->complete = c->content_length == 0;
+	}
+	return c->content_length;
+}
+
+bool esp_http_client_is_chunked_response(esp_http_client_handle_t c) {
+	return c->chunked;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t c) {
+	return c->status_code;
+}
+
+bool esp_http_client_is_complete_data_received(esp_http_client_handle_t c) {
+	return c->complete;
+}
+
+static int read_body(esp_http_client_handle_t c, char *buf, int len) {
+	int n = fill(c);
+	if (n <= 0) {
+		return n;
+	}
+	if (n > len) {
+		n = len;
+	}
+	memcpy(buf, &c->rx_buf[c->rx_start], n);
+	c->rx_start += n;
+	return n;
+}
+
+// Start the next chunk. Return its size, 0 for the last one, or -1 on error.
+static int next_chunk(esp_http_client_handle_t c) {
+	char line[MAX_LINE];
+	if (read_line(c, line, sizeof(line)) < 0) {
+		return -1;
+	}
+	char *end;
+	long size = strtol(line, &end, 16);
+	if (end == line || size < 0) {
+		return -1;
+	}
+	if (size == 0) {
+		// Skip any trailers.
+		while ((size = read_line(c, line, sizeof(line))) > 0) {
+		}
+		return size < 0 ? -1 : 0;
+	}
+	return size;
+}
+
+int esp_http_client_read(esp_http_client_handle_t c, char *buf, int len) {
+	if (c->fd < 0) {
+		return -1;
+	}
+	if (c->complete) {
+		return 0;
+	}
+	if (!c->chunked) {
+		bool until_close = c->content_length < 0;
+		if (!until_close && len > c->remaining) {
+			len = c->remaining;
+		}
+		int n = read_body(c, buf, len);
+		if (n == 0 && until_close) {
+			c->complete = true;
+			return 0;
+		}
+		if (n <= 0) {
+			return -1;
+		}
+		if (!until_close) {
+			c->remaining -= n;
+			c->complete = c->remaining == 0;
+		}
+		return n;
+	}
+	int total = 0;
+	while (total < len) {
+		if (c->remaining == 0) {
+			int size = next_chunk(c);
+			if (size < 0) {
+				return total > 0 ? total : -1;
+			}
+			if (size == 0) {
+				c->complete = true;
+				break;
+			}
+			c->remaining = size;
+		}
+		int want = len - total < c->remaining ? len - total : c->remaining;
+		int n = read_body(c, buf + total, want);
+		if (n <= 0) {
+			return total > 0 ? total : -1;
+		}
+		total += n;
+		c->remaining -= n;
+		if (c->remaining == 0) {
+			// Skip the CRLF after the chunk data.
+			char line[MAX_LINE];
+			if (read_line(c, line, sizeof(line)) < 0) {
+				return total > 0 ? total : -1;
+			}
+		}
+	}
+	return total;
+}
+
+esp_err_t esp_http_client_perform(esp_http_client_handle_t c) {
+	int len = c->method == HTTP_METHOD_POST ? c->post_len : 0;
+	if (esp_http_client_open(c, len) != ESP_OK) {
+		return ESP_FAIL;
+	}
+	if (len > 0 && esp_http_client_write(c, c->post_data, len) != len) {
+		esp_http_client_close(c);
+		return ESP_FAIL;
+	}
+	if (esp_http_client_fetch_headers(c) < 0 && c->status_code == 0) {
+		esp_http_client_close(c);
+		return ESP_FAIL;
+	}
+	char buf[512];
+	int n;
+	while ((n = esp_http_client_read(c, buf, sizeof(buf))) > 0) {
+	}
+	send_event(c, HTTP_EVENT_ON_FINISH, 0, 0);
+	return n == 0 ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t c) {
+	if (c->fd >= 0) {
+		close(c->fd);
+		c->fd = -1;
+		send_event(c, HTTP_EVENT_DISCONNECTED, 0, 0);
+	}
+	return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t c) {
+	esp_http_client_close(c);
+	free(c);
+	return ESP_OK;
+}
@@ -0,0 +1,180 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "testing.h"
+#include "http_server.h"
+
+#define MAX_REQUEST	(64 * 1024)
+
+static int listen_fd = -1;
+static http_handler_t *handler;
+static pthread_t server_thread;
+
+static int write_all(int fd, const char *buf, int len) {
+	for (int i = 0; i < len; ) {
+		int n = send(fd, buf + i, len - i, MSG_NOSIGNAL);
+		if (n <= 0) {
+			return -1;
+		}
+		i += n;
+	}
+	return len;
+}
+
+// Read a request into buf. Return its total length, 0 if the client
+// closed the connection, or -1 on error.
+static int read_request(int fd, char *buf, int size, http_request_t *req) {
+	int len = 0;
+	char *body = 0;
+	for (;;) {
+		if (len == size - 1) {
+			return -1;
+		}
+		int n = recv(fd, buf + len, size - 1 - len, 0);
+		if (n <= 0) {
+			return len == 0 && n == 0 ? 0 : -1;
+		}
+		len += n;
+		buf[len] = 0;
+		body = strstr(buf, "\r\n\r\n");
+		if (body != 0) {
+			break;
+		}
+	}
+	*body = 0;
+	body += 4;
+	if (sscanf(buf, "%7s %511s", req->method, req->path) != 2) {
+		return -1;
+	}
+	int content_length = 0;
+	req->api_secret[0] = 0;
+	for (char *line = strstr(buf, "\r\n"); line != 0; line = strstr(line + 2, "\r\n")) {
+		if (strncasecmp(line + 2, "content-length:", 15) == 0) {
+			content_length = atoi(line + 2 + 15);
+		} else if (strncasecmp(line + 2, "api-secret:", 11) == 0) {
+			sscanf(line + 2 + 11, " %63[^\r]", req->api_secret);
+		}
+	}
+	int header_len = body - buf;
+	while (len - header_len < content_length) {
+		if (len == size - 1) {
+			return -1;
+		}
+		int n = recv(fd, buf + len, size - 1 - len, 0);
+		if (n <= 0) {
+			return -1;
+		}
+		len += n;
+	}
+	buf[len] = 0;
+	req->body = body;
+	req->body_len = content_length;
+	return len;
+}
+
+static int send_response(int fd, http_response_t *r) {
+	char head[512];
+	int n = sprintf(head, "HTTP/1.1 %d %s\r\nContent-Type: application/json\r\n",
+			r->status, r->status == 200 ? "OK" : "Error");
+	if (r->date) {
+		n += sprintf(head + n, "Date: %s\r\n", r->date);
+	}
+	switch (r->framing) {
+	case FRAME_LENGTH:
+		n += sprintf(head + n, "Content-Length: %d\r\n", r->body_len);
+		break;
+	case FRAME_CHUNKED:
+		n += sprintf(head + n, "Transfer-Encoding: chunked\r\n");
+		break;
+	case FRAME_CLOSE:
+		n += sprintf(head + n, "Connection: close\r\n");
+		break;
+	}
+	n += sprintf(head + n, "\r\n");
+	if (write_all(fd, head, n) < 0) {
+		return -1;
+	}
+	int len = r->send_len ? r->send_len : r->body_len;
+	if (r->framing != FRAME_CHUNKED) {
+		return write_all(fd, r->body, len);
+	}
+	int size = r->chunk_size ? r->chunk_size : 1000;
+	for (int i = 0; i < len; i += size) {
+		int k = len - i < size ? len - i : size;
+		char line[16];
+		n = sprintf(line, "%x\r\n", k);
+		if (write_all(fd, line, n) < 0 || write_all(fd, r->body + i, k) < 0 || write_all(fd, "\r\n", 2) < 0) {
+			return -1;
+		}
+	}
+	if (r->send_len) {
+		return 0;
+	}
+	return write_all(fd, "0\r\n\r\n", 5);
+}
+
+static void serve_connection(int fd) {
+	static char buf[MAX_REQUEST];
+	for (;;) {
+		http_request_t req;
+		if (read_request(fd, buf, sizeof(buf), &req) <= 0) {
+			break;
+		}
+		http_response_t resp = {
+			.status = 200,
+			.framing = FRAME_LENGTH,
+		};
+		handler(&req, &resp);
+		if (send_response(fd, &resp) < 0 || resp.framing == FRAME_CLOSE || resp.send_len || resp.drop) {
+			break;
+		}
+	}
+	close(fd);
+}
+
+static void *serve(void *arg) {
+	for (;;) {
+		int fd = accept(listen_fd, 0, 0);
+		if (fd < 0) {
+			break;
+		}
+		// The headers and body are written separately, so without this
+		// the body waits for the client's delayed ACK of the headers.
+		int on = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		serve_connection(fd);
+	}
+	return 0;
+}
+
+int http_server_start(http_handler_t *h) {
+	handler = h;
+	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	assert(listen_fd >= 0);
+	int on = 1;
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, 4) != 0) {
+		perror("http_server_start");
+		exit(1);
+	}
+	socklen_t len = sizeof(addr);
+	getsockname(listen_fd, (struct sockaddr *)&addr, &len);
+	pthread_create(&server_thread, 0, serve, 0);
+	return ntohs(addr.sin_port);
+}
+
+void http_server_stop(void) {
+	shutdown(listen_fd, SHUT_RDWR);
+	close(listen_fd);
+	pthread_join(server_thread, 0);
+	listen_fd = -1;
+}
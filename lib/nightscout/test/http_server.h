@@ -0,0 +1,44 @@
+#ifndef _HTTP_SERVER_H
+#define _HTTP_SERVER_H
+
+#include <stdbool.h>
+
+// Local HTTP server for host tests, standing in for Nightscout or xDrip.
+// It runs in its own thread and serves one connection at a time.
+
+typedef enum {
+	FRAME_LENGTH,	// Content-Length header
+	FRAME_CHUNKED,	// Transfer-Encoding: chunked
+	FRAME_CLOSE,	// neither; the server closes the connection after the body
+} http_framing_t;
+
+typedef struct {
+	int status;
+	http_framing_t framing;
+	int chunk_size;		// for FRAME_CHUNKED
+	const char *date;	// value of the Date header, if any
+	const char *body;
+	int body_len;
+	int send_len;		// if non-zero, close the connection after this many body bytes
+	bool drop;		// close the connection after the response without saying so,
+				// as a server does when a kept-alive connection times out
+} http_response_t;
+
+typedef struct {
+	char method[8];
+	char path[512];
+	char api_secret[64];	// value of the api-secret header, if any
+	const char *body;
+	int body_len;
+} http_request_t;
+
+// Signature of the function that fills in the response to each request.
+// The response fields are set to a 200 Content-Length response beforehand.
+typedef void (http_handler_t)(const http_request_t *req, http_response_t *resp);
+
+// Start the server on a free local port and return the port number.
+int http_server_start(http_handler_t *handler);
+
+void http_server_stop(void);
+
+#endif // _HTTP_SERVER_H
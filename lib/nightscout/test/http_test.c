@@ -0,0 +1,130 @@
+// Check http_get and http_get_stream against the local HTTP server
+// with each kind of response framing.
+
+#include "testing.h"
+#include "nightscout.h"
+#include "http_server.h"
+
+esp_err_t http_header_callback(esp_http_client_event_t *e);
+
+#define SERVER_DATE	"Mon, 13 Apr 2020 00:27:02 GMT"
+#define SERVER_TIME	1586737622
+
+#define NUM_ENTRIES	288
+
+static char entries_body[NUM_ENTRIES * 100];
+static int entries_len;
+
+static void make_entries(void) {
+	char *p = entries_body;
+	p += sprintf(p, "[");
+	for (int i = 0; i < NUM_ENTRIES; i++) {
+		p += sprintf(p, "%s{\"type\":\"sgv\",\"sgv\":%d,\"date\":%ld000,\"direction\":\"Flat\"}",
+			     i == 0 ? "" : ",", 100 + i % 50, 1586737600L - 300 * i);
+	}
+	p += sprintf(p, "]");
+	entries_len = p - entries_body;
+}
+
+static const char *small_body = "[{\"created_at\":\"2020-04-13T00:26:40.000Z\"}]";
+
+static http_framing_t framing;
+static int truncate_at;
+
+static void handle(const http_request_t *req, http_response_t *resp) {
+	resp->framing = framing;
+	resp->chunk_size = 777;
+	resp->date = SERVER_DATE;
+	if (strcmp(req->path, "/api/v1/entries") == 0) {
+		resp->body = entries_body;
+		resp->body_len = entries_len;
+	} else {
+		resp->body = small_body;
+		resp->body_len = strlen(small_body);
+	}
+	resp->send_len = truncate_at;
+}
+
+static const char *framing_name[] = {
+	[FRAME_LENGTH] = "Content-Length",
+	[FRAME_CHUNKED] = "chunked",
+	[FRAME_CLOSE] = "close-delimited",
+};
+
+static int num_entries;
+
+static void count_entry(void *context, const nightscout_entry_t *e) {
+	num_entries++;
+}
+
+static int parse_entries(void *context, const char *buf, int len) {
+	return nightscout_entries_parse(context, buf, len);
+}
+
+static int get_entries(esp_http_client_handle_t client) {
+	nightscout_entries_parser_t p;
+	nightscout_entries_init(&p, count_entry, 0);
+	num_entries = 0;
+	if (http_get_stream(client, "/api/v1/entries", parse_entries, &p) != 0) {
+		return -1;
+	}
+	return nightscout_entries_end(&p);
+}
+
+void test_framing(esp_http_client_handle_t client) {
+	for (framing = FRAME_LENGTH; framing <= FRAME_CLOSE; framing++) {
+		const char *name = framing_name[framing];
+		truncate_at = 0;
+		int n = get_entries(client);
+		if (n != NUM_ENTRIES) {
+			test_failed("%s: %d entries, want %d", name, n, NUM_ENTRIES);
+		}
+		if (http_server_time != SERVER_TIME) {
+			test_failed("%s: server time %ld, want %ld", name, http_server_time, (long)SERVER_TIME);
+		}
+		char *resp = http_get(client, "/api/v1/treatments?count=1");
+		if (resp == 0 || strcmp(resp, small_body) != 0) {
+			test_failed("%s: http_get returned %s", name, resp ? resp : "null");
+		}
+	}
+}
+
+void test_truncated(esp_http_client_handle_t client) {
+	// A close-delimited response can't be recognized as truncated
+	// by the HTTP layer, but the JSON parser notices.
+	for (framing = FRAME_LENGTH; framing <= FRAME_CLOSE; framing++) {
+		truncate_at = entries_len / 2;
+		if (get_entries(client) != -1) {
+			test_failed("%s: truncated response was accepted", framing_name[framing]);
+		}
+	}
+	truncate_at = 0;
+}
+
+void test_large(esp_http_client_handle_t client) {
+	// http_get still collects the response in its fixed-size buffer.
+	framing = FRAME_CHUNKED;
+	const char *endpoint = "/api/v1/entries";
+	char *resp = http_get(client, endpoint);
+	if (resp == 0 || strlen(resp) != MAX_HTTP_RESPONSE - 1 || strncmp(resp, entries_body, MAX_HTTP_RESPONSE - 1) != 0) {
+		test_failed("http_get of %d-byte response did not return the first %d bytes", entries_len, MAX_HTTP_RESPONSE - 1);
+	}
+}
+
+int main(int argc, char **argv) {
+	make_entries();
+	int port = http_server_start(handle);
+	char url[64];
+	sprintf(url, "http://localhost:%d", port);
+	esp_http_client_config_t config = {
+		.url = url,
+		.event_handler = http_header_callback,
+	};
+	esp_http_client_handle_t client = esp_http_client_init(&config);
+	test_framing(client);
+	test_truncated(client);
+	test_large(client);
+	esp_http_client_cleanup(client);
+	http_server_stop();
+	exit_test();
+}
@@ -0,0 +1,133 @@
+// Compare the JSON writer with cJSON for Nightscout uploads:
+// time and heap allocations per document.
+//
+// Allocations are counted by interposing malloc, so this only works
+// with the GNU C library.
+//
+// Usage: json_bench [iterations]
+
+#include "testing.h"
+#include "json_writer.h"
+#include "nightscout.h"
+#include "cjson_reference.h"
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *p, size_t size);
+
+static long allocations;
+
+void *malloc(size_t size) {
+	allocations++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+	allocations++;
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size) {
+	allocations++;
+	return __libc_realloc(p, size);
+}
+
+#define DAY_ENTRIES	288
+
+static nightscout_treatment_t treatment = {
+	.tv = { 1586737660, 250000 },
+	.type = NS_TEMP_BASAL,
+	.value = 725,
+	.minutes = 30,
+};
+
+static nightscout_device_status_t device_status = {
+	.tv = { 1586737600, 123000 },
+	.iob = -1350,
+	.pump_clock = 1586737542,
+	.pump_battery = 1420,
+	.reservoir = 87650,
+	.pump_status = "normal",
+	.suspended = true,
+	.battery_percent = 87,
+	.battery_voltage = 3987,
+};
+
+static nightscout_entry_t entries[DAY_ENTRIES];
+
+typedef enum {
+	TREATMENT,
+	DEVICE_STATUS,
+	ENTRIES,
+} doc_t;
+
+static const char *doc_name[] = {
+	[TREATMENT] = "treatment",
+	[DEVICE_STATUS] = "devicestatus",
+	[ENTRIES] = "288 entries",
+};
+
+static int with_cjson(doc_t doc) {
+	char *json = 0;
+	switch (doc) {
+	case TREATMENT:
+		json = cjson_treatment_json(&treatment);
+		break;
+	case DEVICE_STATUS:
+		json = cjson_device_status_json(&device_status);
+		break;
+	case ENTRIES:
+		json = cjson_entries_json(entries, DAY_ENTRIES);
+		break;
+	}
+	int n = strlen(json);
+	free(json);
+	return n;
+}
+
+static int with_writer(doc_t doc) {
+	static char json[DAY_ENTRIES * 128];
+	switch (doc) {
+	case TREATMENT:
+		return treatment_json(&treatment, json, sizeof(json));
+	case DEVICE_STATUS:
+		return device_status_json(&device_status, json, sizeof(json));
+	case ENTRIES:
+		return entries_json(entries, DAY_ENTRIES, json, sizeof(json));
+	}
+	return 0;
+}
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void bench(const char *method, int (*fn)(doc_t), doc_t doc, int iterations) {
+	if (doc == ENTRIES) {
+		iterations /= 100;
+	}
+	allocations = 0;
+	int len = 0;
+	double start = now();
+	for (int i = 0; i < iterations; i++) {
+		len = fn(doc);
+	}
+	double elapsed = now() - start;
+	printf("%-8s %-13s %6d bytes %8.2f us %8.1f allocations\n", method, doc_name[doc], len,
+	       elapsed / iterations * 1e6, (double)allocations / iterations);
+}
+
+int main(int argc, char **argv) {
+	int iterations = argc > 1 ? atoi(argv[1]) : 20000;
+	for (int i = 0; i < DAY_ENTRIES; i++) {
+		entries[i].tv.tv_sec = 1586737600 - 300 * i;
+		entries[i].sgv = 100 + i % 50;
+	}
+	for (doc_t doc = TREATMENT; doc <= ENTRIES; doc++) {
+		bench("cJSON", with_cjson, doc, iterations);
+		bench("writer", with_writer, doc, iterations);
+	}
+	return 0;
+}
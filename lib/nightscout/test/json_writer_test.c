@@ -0,0 +1,217 @@
+// Check the JSON writer against golden files and against cJSON.
+
+#include <cJSON.h>
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+
+#include "testing.h"
+#include "json_writer.h"
+#include "nightscout.h"
+#include "cjson_reference.h"
+
+#define GOLDEN_DIR	"golden/"
+
+// The golden files contain this in place of the configured user name.
+#define USER_PLACEHOLDER	"@NIGHTSCOUT_USER@"
+
+static const struct {
+	const char *file;
+	nightscout_treatment_t t;
+} golden_treatments[] = {
+	{ "treatment_bg_check.json", { { 1586737600, 0 }, NS_BG_CHECK, 123, 0 } },
+	{ "treatment_correction_bolus.json", { { 1586737660, 250000 }, NS_CORRECTION_BOLUS, 1350, 0 } },
+	{ "treatment_meal_bolus.json", { { 1586737720, 0 }, NS_MEAL_BOLUS, 2500, 0 } },
+	{ "treatment_site_change.json", { { 1586737780, 0 }, NS_SITE_CHANGE, 0, 0 } },
+	{ "treatment_temp_basal.json", { { 1586737840, 999000 }, NS_TEMP_BASAL, 725, 30 } },
+	{ "treatment_unknown.json", { { 1586737900, 0 }, 99, 100, 0 } },
+};
+
+static const nightscout_device_status_t golden_device_status = {
+	.tv = { 1586737600, 123000 },
+	.iob = -1350,
+	.pump_clock = 1586737542,
+	.pump_battery = 1420,
+	.reservoir = 87650,
+	.pump_status = "normal",
+	.bolusing = false,
+	.suspended = true,
+	.battery_percent = 87,
+	.battery_voltage = 3987,
+};
+
+static const nightscout_entry_t golden_entries[] = {
+	{ { 1586737600, 0 }, 123 },
+	{ { 1586737300, 500000 }, 98 },
+	{ { 1586737000, 0 }, 401 },
+};
+
+// Read a golden file, replacing the placeholder with the user name.
+static char *read_golden(const char *name) {
+	static char buf[4096];
+	char path[256];
+	sprintf(path, GOLDEN_DIR "%s", name);
+	FILE *f = fopen(path, "r");
+	if (f == 0) {
+		perror(path);
+		exit(1);
+	}
+	char raw[sizeof(buf)];
+	int n = fread(raw, 1, sizeof(raw) - 1, f);
+	fclose(f);
+	raw[n] = 0;
+	char *p = strstr(raw, USER_PLACEHOLDER);
+	if (p == 0) {
+		strcpy(buf, raw);
+	} else {
+		sprintf(buf, "%.*s%s%s", (int)(p - raw), raw, NIGHTSCOUT_USER, p + strlen(USER_PLACEHOLDER));
+	}
+	return buf;
+}
+
+static void check_output(const char *what, const char *json, int len, const char *want) {
+	if (strcmp(json, want) != 0) {
+		test_failed("%s:\n  got  %s\n  want %s", what, json, want);
+	}
+	if (len != strlen(want)) {
+		test_failed("%s: length %d, want %d", what, len, (int)strlen(want));
+	}
+}
+
+void test_golden(void) {
+	char json[4096];
+	for (int i = 0; i < LEN(golden_treatments); i++) {
+		int n = treatment_json(&golden_treatments[i].t, json, sizeof(json));
+		check_output(golden_treatments[i].file, json, n, read_golden(golden_treatments[i].file));
+	}
+	int n = device_status_json(&golden_device_status, json, sizeof(json));
+	check_output("device_status.json", json, n, read_golden("device_status.json"));
+	n = entries_json(golden_entries, LEN(golden_entries), json, sizeof(json));
+	check_output("entries.json", json, n, read_golden("entries.json"));
+}
+
+// Compare with cJSON for many pseudo-random values.
+void test_random(void) {
+	srand(1);
+	char json[4096];
+	for (int i = 0; i < 10000; i++) {
+		nightscout_treatment_t t = {
+			.tv = { 1586737600 + rand(), rand() % 1000000 },
+			.type = NS_BG_CHECK + rand() % 5,
+			.value = rand() % 100000 - 1000,
+			.minutes = rand() % 1440,
+		};
+		int n = treatment_json(&t, json, sizeof(json));
+		char *want = cjson_treatment_json(&t);
+		check_output("random treatment", json, n, want);
+		free(want);
+
+		nightscout_device_status_t s = {
+			.tv = { 1586737600 + rand(), rand() % 1000000 },
+			.iob = rand() % 20000 - 5000,
+			.pump_clock = 1586737600 + rand(),
+			.pump_battery = rand() % 2000,
+			.reservoir = rand() % 300000,
+			.pump_status = i % 2 ? "normal" : "error",
+			.bolusing = rand() % 2,
+			.suspended = rand() % 2,
+			.battery_percent = rand() % 101,
+			.battery_voltage = 3000 + rand() % 1300,
+		};
+		n = device_status_json(&s, json, sizeof(json));
+		want = cjson_device_status_json(&s);
+		check_output("random device status", json, n, want);
+		free(want);
+	}
+}
+
+static const double numbers[] = {
+	0, -0.0, 1, -1, 0.1, 0.2 + 0.1, 1.0 / 3, -2.5, 1e-7, 123.456, 1e21, 1e300, -1e-300,
+	INT_MAX, INT_MIN, INT_MAX + 1.0, INT_MIN - 1.0, INT_MAX + 0.5, 1586737600000.0,
+	DBL_MAX, DBL_MIN, DBL_EPSILON, NAN, INFINITY, -INFINITY,
+};
+
+static const char *strings[] = {
+	"", "plain", "quote \" and backslash \\", "\b\f\n\r\t", "\x01\x1f control",
+	"/slash/", "\xC3\xA9\xE2\x82\xAC utf-8",
+};
+
+// Write the same document with cJSON and with the writer into buf.
+static char *write_document(char *buf, int size, int *len) {
+	cJSON *root = cJSON_CreateObject();
+	json_writer_t w;
+	json_writer_init(&w, buf, size);
+	json_begin_object(&w, 0);
+
+	cJSON *a = cJSON_CreateArray();
+	cJSON_AddItemToObject(root, "numbers", a);
+	json_begin_array(&w, "numbers");
+	for (int i = 0; i < LEN(numbers); i++) {
+		cJSON_AddItemToArray(a, cJSON_CreateNumber(numbers[i]));
+		json_number(&w, 0, numbers[i]);
+	}
+	json_end_array(&w);
+
+	cJSON *o = cJSON_CreateObject();
+	cJSON_AddItemToObject(root, "strings", o);
+	json_begin_object(&w, "strings");
+	for (int i = 0; i < LEN(strings); i++) {
+		cJSON_AddItemToObject(o, strings[i], cJSON_CreateString(strings[i]));
+		json_string(&w, strings[i], strings[i]);
+	}
+	json_end_object(&w);
+
+	cJSON *nested = cJSON_CreateArray();
+	cJSON_AddItemToObject(root, "nested", nested);
+	json_begin_array(&w, "nested");
+	cJSON_AddItemToArray(nested, cJSON_CreateObject());
+	json_begin_object(&w, 0);
+	json_end_object(&w);
+	cJSON_AddItemToArray(nested, cJSON_CreateArray());
+	json_begin_array(&w, 0);
+	json_end_array(&w);
+	cJSON_AddItemToArray(nested, cJSON_CreateBool(true));
+	json_bool(&w, 0, true);
+	cJSON_AddItemToArray(nested, cJSON_CreateBool(false));
+	json_bool(&w, 0, false);
+	json_end_array(&w);
+
+	json_end_object(&w);
+	*len = json_writer_end(&w);
+	char *want = cJSON_PrintUnformatted(root);
+	cJSON_Delete(root);
+	return want;
+}
+
+void test_document(void) {
+	char json[4096];
+	int len;
+	char *want = write_document(json, sizeof(json), &len);
+	check_output("document", json, len, want);
+
+	// With a smaller buffer, the output is truncated
+	// but the full length is returned.
+	for (int size = 0; size <= len; size++) {
+		char buf[4096];
+		memset(buf, 'x', sizeof(buf));
+		int n;
+		free(write_document(buf, size, &n));
+		if (n != len) {
+			test_failed("%d-byte buffer: length %d, want %d", size, n, len);
+		}
+		if (size > 0 && (strncmp(buf, want, size - 1) != 0 || buf[size - 1] != 0)) {
+			test_failed("%d-byte buffer: output is not a terminated prefix", size);
+		}
+		if (buf[size] != 'x') {
+			test_failed("%d-byte buffer: wrote past the end", size);
+		}
+	}
+	free(want);
+}
+
+int main(int argc, char **argv) {
+	test_golden();
+	test_random();
+	test_document();
+	exit_test();
+}
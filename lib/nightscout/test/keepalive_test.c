@@ -0,0 +1,126 @@
+// Check that requests reuse a kept-alive connection to the local HTTP server,
+// and are retried on a new connection when the server has closed it.
+
+#include "testing.h"
+#include "nightscout.h"
+#include "http_server.h"
+
+esp_err_t http_header_callback(esp_http_client_event_t *e);
+
+static const char *body = "[{\"type\":\"sgv\",\"sgv\":123,\"date\":1586737600000}]";
+
+static int server_requests;
+static bool drop;
+static http_framing_t framing;
+
+static void handle(const http_request_t *req, http_response_t *resp) {
+	server_requests++;
+	resp->framing = framing;
+	resp->drop = drop;
+	resp->body = body;
+	resp->body_len = strlen(body);
+}
+
+static void count_entry(void *context, const nightscout_entry_t *e) {
+}
+
+// Alternate between GET and POST requests.
+static void make_requests(esp_http_client_handle_t client, int n, const char *what) {
+	for (int i = 0; i < n; i++) {
+		int err;
+		if (i % 2 == 0) {
+			err = get_nightscout_entries(client, "/api/v1/entries", count_entry, 0) == 1 ? 0 : -1;
+		} else {
+			err = nightscout_upload(client, "/api/v1/treatments", "[]");
+		}
+		if (err != 0) {
+			test_failed("%s: request %d failed", what, i);
+		}
+	}
+}
+
+static void check_stats(const char *what, int requests, int connections, int reconnects) {
+	http_client_stats_t *s = &http_client_stats;
+	if (s->requests != requests || s->connections != connections || s->reconnects != reconnects) {
+		test_failed("%s: %d requests, %d connections, %d reconnects; want %d, %d, %d", what,
+			    s->requests, s->connections, s->reconnects, requests, connections, reconnects);
+	}
+	if (server_requests != requests) {
+		test_failed("%s: server received %d requests, want %d", what, server_requests, requests);
+	}
+}
+
+static void reset(void) {
+	memset(&http_client_stats, 0, sizeof(http_client_stats));
+	server_requests = 0;
+	drop = false;
+	framing = FRAME_LENGTH;
+}
+
+static esp_http_client_handle_t new_client(int port) {
+	static char url[64];
+	sprintf(url, "http://localhost:%d", port);
+	esp_http_client_config_t config = {
+		.url = url,
+		.event_handler = http_header_callback,
+		.keep_alive_enable = true,
+	};
+	return esp_http_client_init(&config);
+}
+
+void test_reuse(int port, http_framing_t f) {
+	reset();
+	framing = f;
+	esp_http_client_handle_t client = new_client(port);
+	make_requests(client, 10, "keep-alive");
+	check_stats("keep-alive", 10, 1, 0);
+	esp_http_client_cleanup(client);
+}
+
+void test_close(int port) {
+	// Each connection is closed by the server as announced,
+	// so a new one is made for every request without any retries.
+	reset();
+	framing = FRAME_CLOSE;
+	esp_http_client_handle_t client = new_client(port);
+	make_requests(client, 10, "Connection: close");
+	check_stats("Connection: close", 10, 10, 0);
+	esp_http_client_cleanup(client);
+}
+
+void test_dropped(int port) {
+	// The server closes each connection after its response without warning,
+	// so every request after the first fails on the old connection
+	// and is retried on a new one.
+	reset();
+	drop = true;
+	esp_http_client_handle_t client = new_client(port);
+	make_requests(client, 10, "dropped");
+	check_stats("dropped", 10, 10, 9);
+	esp_http_client_cleanup(client);
+}
+
+void test_no_server(void) {
+	reset();
+	int port = http_server_start(handle);
+	http_server_stop();
+	esp_http_client_handle_t client = new_client(port);
+	if (nightscout_upload(client, "/api/v1/treatments", "[]") == 0) {
+		test_failed("upload succeeded without a server");
+	}
+	if (http_client_stats.reconnects != 0) {
+		test_failed("failed connection was retried");
+	}
+	esp_http_client_cleanup(client);
+}
+
+int main(int argc, char **argv) {
+	int port = http_server_start(handle);
+	test_reuse(port, FRAME_LENGTH);
+	test_reuse(port, FRAME_CHUNKED);
+	test_close(port);
+	test_dropped(port);
+	http_server_stop();
+	test_no_server();
+	exit_test();
+}
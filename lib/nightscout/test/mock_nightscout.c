@@ -0,0 +1,363 @@
+#include <cJSON.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#include "testing.h"
+#include "nightscout.h"
+#include "mock_nightscout.h"
+
+#define ENTRY_INTERVAL		(5 * 60)
+
+#define DEFAULT_COUNT		10
+#define DEFAULT_XDRIP_COUNT	24
+
+mock_nightscout_options_t mock_options;
+mock_nightscout_stats_t mock_stats;
+
+// Documents are kept oldest first.
+
+static nightscout_entry_t *entries;
+static int num_entries, max_entries;
+
+typedef struct {
+	time_t created_at;
+	char *json;
+} treatment_t;
+
+static treatment_t *treatments;
+static int num_treatments, max_treatments;
+
+static int num_device_statuses;
+static char *last_device_status;
+
+static void *grow(void *array, int *max, int elem_size) {
+	*max = *max ? 2 * *max : 256;
+	array = realloc(array, *max * elem_size);
+	assert(array);
+	return array;
+}
+
+static void insert_entry(struct timeval tv, int sgv) {
+	if (num_entries == max_entries) {
+		entries = grow(entries, &max_entries, sizeof(entries[0]));
+	}
+	int i = num_entries;
+	while (i > 0 && timercmp(&entries[i - 1].tv, &tv, >)) {
+		entries[i] = entries[i - 1];
+		i--;
+	}
+	entries[i] = (nightscout_entry_t){ .tv = tv, .sgv = sgv };
+	num_entries++;
+}
+
+static void insert_treatment(time_t created_at, char *json) {
+	if (num_treatments == max_treatments) {
+		treatments = grow(treatments, &max_treatments, sizeof(treatments[0]));
+	}
+	int i = num_treatments;
+	while (i > 0 && treatments[i - 1].created_at > created_at) {
+		treatments[i] = treatments[i - 1];
+		i--;
+	}
+	treatments[i] = (treatment_t){ .created_at = created_at, .json = json };
+	num_treatments++;
+}
+
+void mock_add_entry(time_t t, int sgv) {
+	insert_entry((struct timeval){ .tv_sec = t }, sgv);
+}
+
+void mock_add_entries(int n) {
+	time_t t = num_entries == 0 ? TEST_TIME_NOW : entries[num_entries - 1].tv.tv_sec + ENTRY_INTERVAL;
+	for (int i = 0; i < n; i++, t += ENTRY_INTERVAL) {
+		mock_add_entry(t, 100 + (t / ENTRY_INTERVAL) % 150);
+	}
+}
+
+int mock_num_entries(void) {
+	return num_entries;
+}
+
+int mock_num_treatments(void) {
+	return num_treatments;
+}
+
+int mock_num_device_statuses(void) {
+	return num_device_statuses;
+}
+
+time_t mock_last_treatment_time(void) {
+	return num_treatments == 0 ? 0 : treatments[num_treatments - 1].created_at;
+}
+
+const char *mock_last_device_status(void) {
+	return last_device_status;
+}
+
+void mock_nightscout_reset(void) {
+	for (int i = 0; i < num_treatments; i++) {
+		free(treatments[i].json);
+	}
+	num_entries = 0;
+	num_treatments = 0;
+	num_device_statuses = 0;
+	free(last_device_status);
+	last_device_status = 0;
+	memset(&mock_options, 0, sizeof(mock_options));
+	memset(&mock_stats, 0, sizeof(mock_stats));
+}
+
+// Response body, reused for each request.
+static char *body;
+static int body_size, body_len;
+
+static void append(const char *format, ...) {
+	for (;;) {
+		va_list ap;
+		va_start(ap, format);
+		int n = vsnprintf(body + body_len, body_size - body_len, format, ap);
+		va_end(ap);
+		if (body_len + n < body_size) {
+			body_len += n;
+			return;
+		}
+		body_size = body_size ? 2 * body_size + n : 4096 + n;
+		body = realloc(body, body_size);
+		assert(body);
+	}
+}
+
+static int hex_digit(char c) {
+	return isdigit(c) ? c - '0' : tolower(c) - 'a' + 10;
+}
+
+// Copy a percent-encoded query component of length n.
+static void url_decode(char *dst, int size, const char *src, int n) {
+	int k = 0;
+	for (int i = 0; i < n && k < size - 1; i++) {
+		if (src[i] == '%' && i + 2 < n && isxdigit(src[i + 1]) && isxdigit(src[i + 2])) {
+			dst[k++] = hex_digit(src[i + 1]) << 4 | hex_digit(src[i + 2]);
+			i += 2;
+		} else {
+			dst[k++] = src[i] == '+' ? ' ' : src[i];
+		}
+	}
+	dst[k] = 0;
+}
+
+// Find the named parameter in the query and copy its decoded value.
+// Return false if it is not present.
+static bool query_param(const char *path, const char *name, char *value, int size) {
+	const char *p = strchr(path, '?');
+	while (p) {
+		p++;
+		const char *end = strchr(p, '&');
+		int n = end ? end - p : strlen(p);
+		const char *eq = memchr(p, '=', n);
+		if (eq) {
+			char key[64];
+			url_decode(key, sizeof(key), p, eq - p);
+			if (strcmp(key, name) == 0) {
+				url_decode(value, size, eq + 1, p + n - eq - 1);
+				return true;
+			}
+		}
+		p = end;
+	}
+	return false;
+}
+
+static int count_param(const char *path, int default_count) {
+	char value[16];
+	return query_param(path, "count", value, sizeof(value)) ? atoi(value) : default_count;
+}
+
+static int64_t milliseconds(struct timeval tv) {
+	return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static void append_padding(void) {
+	int n = mock_options.entry_padding;
+	if (n == 0) {
+		return;
+	}
+	append(",\"pad\":\"%*s\"", n, "");
+	memset(body + body_len - n - 1, 'x', n);
+}
+
+// Entries in the format returned by Nightscout.
+static void get_entries(const char *path) {
+	char value[32];
+	bool since = query_param(path, "find[date][$gt]", value, sizeof(value));
+	int64_t gt = since ? strtoll(value, 0, 10) : 0;
+	int count = count_param(path, DEFAULT_COUNT);
+	append("[");
+	for (int i = num_entries - 1, n = 0; i >= 0 && n < count; i--, n++) {
+		const nightscout_entry_t *e = &entries[i];
+		int64_t ms = milliseconds(e->tv);
+		if (since && ms <= gt) {
+			break;
+		}
+		char ts[ISO_TIME_STRING_SIZE];
+		print_iso_time(ts, e->tv);
+		append("%s{\"_id\":\"5e93b1c6f1d2a1e3%08x\",\"device\":\"xDrip-DexcomG6\","
+		       "\"date\":%" PRId64 ",\"dateString\":\"%s\",\"sgv\":%d,\"delta\":0,"
+		       "\"direction\":\"Flat\",\"type\":\"sgv\",\"filtered\":%d,\"unfiltered\":%d,"
+		       "\"rssi\":100,\"noise\":1,\"sysTime\":\"%s\",\"utcOffset\":0",
+		       n == 0 ? "" : ",", i, ms, ts, e->sgv, e->sgv * 1000, e->sgv * 1000, ts);
+		append_padding();
+		append("}");
+	}
+	append("]");
+}
+
+// Entries in the format returned by xDrip's web service,
+// where the first one carries a units hint.
+static void get_xdrip_entries(const char *path) {
+	int count = count_param(path, DEFAULT_XDRIP_COUNT);
+	append("[");
+	for (int i = num_entries - 1, n = 0; i >= 0 && n < count; i--, n++) {
+		const nightscout_entry_t *e = &entries[i];
+		char ts[ISO_TIME_STRING_SIZE];
+		print_iso_time(ts, e->tv);
+		append("%s{\"_id\":\"8d5c1a70-%04x-4a4e-9b1e-5f0c2a6e%04x\",\"device\":\"G6 Native\","
+		       "\"dateString\":\"%s\",\"sysTime\":\"%s\",\"date\":%" PRId64 ",\"sgv\":%d,"
+		       "\"delta\":0,\"direction\":\"Flat\",\"noise\":1,\"filtered\":0,\"unfiltered\":-127,"
+		       "\"rssi\":100,\"type\":\"sgv\"%s",
+		       n == 0 ? "" : ",", i >> 16, i & 0xFFFF, ts, ts, milliseconds(e->tv), e->sgv,
+		       n == 0 ? ",\"units_hint\":\"mgdl\"" : "");
+		append_padding();
+		append("}");
+	}
+	append("]");
+}
+
+static void get_treatments(const char *path) {
+	char value[32];
+	bool since = query_param(path, "find[created_at][$gt]", value, sizeof(value));
+	time_t gt = since ? parse_iso_time(value).tv_sec : 0;
+	int count = count_param(path, DEFAULT_COUNT);
+	append("[");
+	for (int i = num_treatments - 1, n = 0; i >= 0 && n < count; i--, n++) {
+		if (since && treatments[i].created_at <= gt) {
+			break;
+		}
+		append("%s%s", n == 0 ? "" : ",", treatments[i].json);
+	}
+	append("]");
+}
+
+// Apply fn to the object, or to each element if it is an array.
+// Return false if the JSON is not an object or an array of objects.
+static bool for_each_object(const http_request_t *req, void (*fn)(cJSON *item)) {
+	char *json = strndup(req->body, req->body_len);
+	cJSON *root = cJSON_Parse(json);
+	free(json);
+	bool ok = root && (cJSON_IsObject(root) || cJSON_IsArray(root));
+	if (cJSON_IsArray(root)) {
+		const cJSON *item;
+		cJSON_ArrayForEach(item, root) {
+			ok = ok && cJSON_IsObject(item);
+		}
+	}
+	if (ok && cJSON_IsArray(root)) {
+		cJSON *item;
+		cJSON_ArrayForEach(item, root) {
+			fn(item);
+		}
+	} else if (ok) {
+		fn(root);
+	}
+	cJSON_Delete(root);
+	return ok;
+}
+
+static void post_entry(cJSON *item) {
+	const cJSON *date = cJSON_GetObjectItem(item, "date");
+	const cJSON *sgv = cJSON_GetObjectItem(item, "sgv");
+	if (cJSON_IsNumber(date) && cJSON_IsNumber(sgv)) {
+		insert_entry(timeval_from_milliseconds(date->valuedouble), sgv->valueint);
+	}
+}
+
+// As Nightscout does, use the current time if created_at is missing.
+static void post_treatment(cJSON *item) {
+	const cJSON *created_at = cJSON_GetObjectItem(item, "created_at");
+	time_t t = cJSON_IsString(created_at) ? round_to_seconds(parse_iso_time(created_at->valuestring)) : time(0);
+	insert_treatment(t, cJSON_PrintUnformatted(item));
+}
+
+static void reply(http_response_t *resp, int status, const char *message) {
+	resp->status = status;
+	append("{\"status\":%d,\"message\":\"%s\"}", status, message);
+}
+
+static void handle(const http_request_t *req, http_response_t *resp) {
+	mock_stats.requests++;
+	mock_stats.bytes_received += req->body_len;
+	body_len = 0;
+	append("");
+	if (mock_options.latency_ms) {
+		usleep(mock_options.latency_ms * 1000);
+	}
+	resp->framing = mock_options.framing;
+	resp->chunk_size = mock_options.chunk_size;
+	static char date[32];
+	time_t now = time(0);
+	strftime(date, sizeof(date), "%a, %d %b %Y %T GMT", gmtime(&now));
+	resp->date = date;
+	char path[sizeof(req->path)];
+	strcpy(path, req->path);
+	char *q = strchr(path, '?');
+	if (q) {
+		*q = 0;
+	}
+	bool get = strcmp(req->method, "GET") == 0;
+	bool post = strcmp(req->method, "POST") == 0;
+	if (mock_options.fail_every && mock_stats.requests % mock_options.fail_every == 0) {
+		mock_stats.failures++;
+		reply(resp, mock_options.fail_status ? mock_options.fail_status : 500, "injected failure");
+	} else if (post && strcmp(req->api_secret, NIGHTSCOUT_API_SECRET) != 0) {
+		reply(resp, 401, "Unauthorized");
+	} else if (get && strcmp(path, "/api/v1/entries") == 0) {
+		get_entries(req->path);
+	} else if (get && strcmp(path, "/sgv.json") == 0) {
+		get_xdrip_entries(req->path);
+	} else if (get && strcmp(path, "/api/v1/treatments") == 0) {
+		get_treatments(req->path);
+	} else if (post && strcmp(path, "/api/v1/entries") == 0) {
+		if (!for_each_object(req, post_entry)) {
+			reply(resp, 400, "Bad Request");
+		} else {
+			append("{}");
+		}
+	} else if (post && strcmp(path, "/api/v1/treatments") == 0) {
+		if (!for_each_object(req, post_treatment)) {
+			reply(resp, 400, "Bad Request");
+		} else {
+			append("{}");
+		}
+	} else if (post && strcmp(path, "/api/v1/devicestatus") == 0) {
+		num_device_statuses++;
+		free(last_device_status);
+		last_device_status = strndup(req->body, req->body_len);
+		append("{}");
+	} else {
+		reply(resp, 404, "Not Found");
+	}
+	resp->body = body;
+	resp->body_len = body_len;
+	mock_stats.bytes_sent += body_len;
+}
+
+int mock_nightscout_start(void) {
+	mock_nightscout_reset();
+	return http_server_start(handle);
+}
+
+void mock_nightscout_stop(void) {
+	http_server_stop();
+	mock_nightscout_reset();
+}
@@ -0,0 +1,68 @@
+#ifndef _MOCK_NIGHTSCOUT_H
+#define _MOCK_NIGHTSCOUT_H
+
+#include <stdbool.h>
+#include <time.h>
+
+#include "http_server.h"
+
+// Mock Nightscout and xDrip server for host tests and benchmarks,
+// running on the local HTTP server. It keeps entries, treatments,
+// and device status in memory and implements the requests made by
+// lib/nightscout:
+//
+//   GET  /api/v1/entries		newest first; find[date][$gt] and count (default 10)
+//   POST /api/v1/entries
+//   GET  /api/v1/treatments		newest first; find[created_at][$gt] and count (default 10)
+//   POST /api/v1/treatments		a single object or an array
+//   POST /api/v1/devicestatus
+//   GET  /sgv.json			xDrip's web service; count (default 24)
+//
+// POST requests must have the api-secret header.
+
+typedef struct {
+	int latency_ms;		// delay before each response
+	http_framing_t framing;
+	int chunk_size;		// for FRAME_CHUNKED
+	int fail_every;		// respond to every nth request with fail_status, if non-zero
+	int fail_status;	// 500 if not set
+	int entry_padding;	// size of an extra field in each entry, for large payloads
+} mock_nightscout_options_t;
+
+typedef struct {
+	int requests;
+	int failures;		// responses with an injected error
+	long bytes_received;	// in request bodies
+	long bytes_sent;	// in response bodies
+} mock_nightscout_stats_t;
+
+// These may be changed between requests.
+extern mock_nightscout_options_t mock_options;
+extern mock_nightscout_stats_t mock_stats;
+
+// Start the server and return its port.
+int mock_nightscout_start(void);
+
+void mock_nightscout_stop(void);
+
+// Remove all documents and reset the options and statistics.
+void mock_nightscout_reset(void);
+
+// Add an entry.
+void mock_add_entry(time_t t, int sgv);
+
+// Add n entries at 5-minute intervals after the last one,
+// or starting at TEST_TIME_NOW if there are none yet.
+void mock_add_entries(int n);
+
+int mock_num_entries(void);
+int mock_num_treatments(void);
+int mock_num_device_statuses(void);
+
+// Return the created_at time of the newest treatment, or 0 if there are none.
+time_t mock_last_treatment_time(void);
+
+// Return the JSON of the last device status received, or null.
+const char *mock_last_device_status(void);
+
+#endif // _MOCK_NIGHTSCOUT_H
@@ -0,0 +1,235 @@
+// Check lib/nightscout end to end against the mock Nightscout and xDrip server:
+// fetching and syncing entries, uploading treatments, entries, and device
+// status, and handling latency, response framing, large payloads, and errors.
+
+#include "testing.h"
+#include "nightscout.h"
+#include "mock_nightscout.h"
+
+esp_err_t http_header_callback(esp_http_client_event_t *e);
+
+static nightscout_entry_t received[SYNC_MAX_ENTRIES + 1];
+static int num_received;
+
+static void save_entry(void *context, const nightscout_entry_t *e) {
+	if (num_received < LEN(received)) {
+		received[num_received] = *e;
+	}
+	num_received++;
+}
+
+static const char *framing_name[] = {
+	[FRAME_LENGTH] = "Content-Length",
+	[FRAME_CHUNKED] = "chunked",
+	[FRAME_CLOSE] = "close-delimited",
+};
+
+// Check that n entries were received, newest first,
+// ending with the newest one on the server.
+static void check_received(const char *what, int n, int want) {
+	if (n != want || num_received != want) {
+		test_failed("%s: %d entries (%d passed to callback), want %d", what, n, num_received, want);
+		return;
+	}
+	time_t newest = TEST_TIME_NOW + 5 * 60 * (mock_num_entries() - 1);
+	for (int i = 0; i < n; i++) {
+		time_t t = newest - 5 * 60 * i;
+		if (received[i].tv.tv_sec != t || received[i].sgv != 100 + (t / 300) % 150) {
+			test_failed("%s: entry %d is %d at %ld, want %d at %ld", what, i,
+				    received[i].sgv, (long)received[i].tv.tv_sec, 100 + (int)(t / 300) % 150, (long)t);
+			return;
+		}
+	}
+}
+
+void test_entries(esp_http_client_handle_t client) {
+	mock_nightscout_reset();
+	mock_add_entries(500);
+	char what[64];
+	for (http_framing_t f = FRAME_LENGTH; f <= FRAME_CLOSE; f++) {
+		mock_options.framing = f;
+		mock_options.chunk_size = 333;
+		num_received = 0;
+		int n = get_nightscout_entries(client, "/api/v1/entries?count=288", save_entry, 0);
+		sprintf(what, "Nightscout entries, %s", framing_name[f]);
+		check_received(what, n, 288);
+		num_received = 0;
+		n = get_nightscout_entries(client, "/sgv.json?count=24", save_entry, 0);
+		sprintf(what, "xDrip entries, %s", framing_name[f]);
+		check_received(what, n, 24);
+		num_received = 0;
+		n = get_nightscout_entries(client, "/sgv.json", save_entry, 0);
+		sprintf(what, "xDrip entries, default count, %s", framing_name[f]);
+		check_received(what, n, 24);
+	}
+}
+
+void test_large(esp_http_client_handle_t client) {
+	mock_nightscout_reset();
+	mock_add_entries(SYNC_MAX_ENTRIES);
+	mock_options.framing = FRAME_CHUNKED;
+	mock_options.chunk_size = 1400;
+	mock_options.entry_padding = 4000;
+	nightscout_cursor_t c = {0};
+	num_received = 0;
+	int n = sync_nightscout_entries(client, &c, save_entry, 0);
+	check_received("large entries", n, SYNC_MAX_ENTRIES);
+	if (mock_stats.bytes_sent < SYNC_MAX_ENTRIES * 4000) {
+		test_failed("large entries: only %ld bytes sent", mock_stats.bytes_sent);
+	}
+}
+
+void test_sync(esp_http_client_handle_t client) {
+	mock_nightscout_reset();
+	mock_add_entries(20);
+	nightscout_cursor_t c = {0};
+	num_received = 0;
+	check_received("first sync", sync_nightscout_entries(client, &c, save_entry, 0), 20);
+	for (int i = 0; i < 5; i++) {
+		mock_add_entries(1);
+		num_received = 0;
+		check_received("next sync", sync_nightscout_entries(client, &c, save_entry, 0), 1);
+	}
+	num_received = 0;
+	check_received("sync with nothing new", sync_nightscout_entries(client, &c, save_entry, 0), 0);
+}
+
+#define NUM_TREATMENTS	50
+
+void test_uploads(esp_http_client_handle_t client) {
+	mock_nightscout_reset();
+	nightscout_treatment_t t[NUM_TREATMENTS];
+	for (int i = 0; i < NUM_TREATMENTS; i++) {
+		t[i] = (nightscout_treatment_t){
+			.tv = { TEST_TIME_NOW + 600 * i, 0 },
+			.type = NS_CORRECTION_BOLUS + i % 2,
+			.value = 1500,
+		};
+	}
+	nightscout_upload_stats_t stats = {0};
+	int n = upload_treatments(client, t, NUM_TREATMENTS, 1000, &stats);
+	if (n != NUM_TREATMENTS || mock_num_treatments() != NUM_TREATMENTS) {
+		test_failed("uploaded %d treatments, server has %d, want %d", n, mock_num_treatments(), NUM_TREATMENTS);
+	}
+	if (stats.requests != mock_stats.requests || stats.failures != 0) {
+		test_failed("upload stats: %d requests, %d failures; server received %d requests",
+			    stats.requests, stats.failures, mock_stats.requests);
+	}
+	time_t last = t[NUM_TREATMENTS - 1].tv.tv_sec;
+	if (mock_last_treatment_time() != last || get_last_treatment_time(client) != last) {
+		test_failed("last treatment at %ld (server %ld), want %ld",
+			    (long)get_last_treatment_time(client), (long)mock_last_treatment_time(), (long)last);
+	}
+	nightscout_cursor_t c = { .treatment = last - 600 };
+	if (sync_last_treatment_time(client, &c) != last) {
+		test_failed("sync_last_treatment_time did not find the last treatment");
+	}
+
+	nightscout_device_status_t s = {
+		.tv = { TEST_TIME_NOW, 0 },
+		.iob = 2500,
+		.pump_clock = TEST_TIME_NOW,
+		.pump_battery = 1400,
+		.reservoir = 87000,
+		.pump_status = "normal",
+		.battery_percent = 80,
+		.battery_voltage = 3900,
+	};
+	upload_device_status(client, &s);
+	char want[DEVICE_STATUS_JSON_SIZE];
+	device_status_json(&s, want, sizeof(want));
+	if (mock_num_device_statuses() != 1 || strcmp(mock_last_device_status(), want) != 0) {
+		test_failed("server received %d device status uploads, last %s", mock_num_device_statuses(),
+			    mock_last_device_status() ? mock_last_device_status() : "null");
+	}
+
+	nightscout_entry_t e[3];
+	for (int i = 0; i < LEN(e); i++) {
+		e[i] = (nightscout_entry_t){ .tv = { TEST_TIME_NOW + 300 * i, 0 }, .sgv = 100 + (TEST_TIME_NOW / 300 + i) % 150 };
+	}
+	upload_entries(client, e, LEN(e));
+	num_received = 0;
+	n = get_nightscout_entries(client, "/api/v1/entries", save_entry, 0);
+	check_received("uploaded entries", n, LEN(e));
+}
+
+void test_errors(esp_http_client_handle_t client) {
+	mock_nightscout_reset();
+	mock_options.fail_every = 3;
+	mock_options.fail_status = 503;
+	nightscout_treatment_t t[NUM_TREATMENTS];
+	for (int i = 0; i < NUM_TREATMENTS; i++) {
+		t[i] = (nightscout_treatment_t){
+			.tv = { TEST_TIME_NOW + 600 * i, 0 },
+			.type = NS_BG_CHECK,
+			.value = 100,
+		};
+	}
+	nightscout_upload_stats_t stats = {0};
+	int n = upload_treatments(client, t, NUM_TREATMENTS, 500, &stats);
+	if (stats.failures != mock_stats.failures || stats.failures != 1) {
+		test_failed("upload stats report %d failures, server injected %d, want 1", stats.failures, mock_stats.failures);
+	}
+	if (n != mock_num_treatments() || n == NUM_TREATMENTS) {
+		test_failed("uploaded %d treatments, server has %d", n, mock_num_treatments());
+	}
+	// An error response to a GET is not valid entries JSON.
+	mock_nightscout_reset();
+	mock_add_entries(10);
+	mock_options.fail_every = 1;
+	if (get_nightscout_entries(client, "/api/v1/entries", save_entry, 0) != -1) {
+		test_failed("error response was accepted as entries");
+	}
+	// Uploads need the API secret.
+	mock_options.fail_every = 0;
+	esp_http_client_set_url(client, "/api/v1/treatments");
+	esp_http_client_set_method(client, HTTP_METHOD_POST);
+	esp_http_client_set_header(client, "api-secret", "wrong");
+	const char *json = "{\"eventType\":\"Note\"}";
+	if (http_request(client, json, strlen(json), 0, 0) != 0 || esp_http_client_get_status_code(client) != 401) {
+		test_failed("upload with wrong API secret got status %d", esp_http_client_get_status_code(client));
+	}
+	if (mock_num_treatments() != 0) {
+		test_failed("upload with wrong API secret was stored");
+	}
+}
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+void test_latency(esp_http_client_handle_t client) {
+	mock_nightscout_reset();
+	mock_add_entries(10);
+	mock_options.latency_ms = 100;
+	double start = now();
+	if (get_nightscout_entries(client, "/api/v1/entries", save_entry, 0) != 10) {
+		test_failed("request with latency failed");
+	}
+	double elapsed = now() - start;
+	if (elapsed < 0.1) {
+		test_failed("request with 100 ms latency took %.0f ms", elapsed * 1000);
+	}
+}
+
+int main(int argc, char **argv) {
+	int port = mock_nightscout_start();
+	char url[64];
+	sprintf(url, "http://localhost:%d", port);
+	esp_http_client_config_t config = {
+		.url = url,
+		.event_handler = http_header_callback,
+	};
+	esp_http_client_handle_t client = esp_http_client_init(&config);
+	test_entries(client);
+	test_large(client);
+	test_sync(client);
+	test_uploads(client);
+	test_errors(client);
+	test_latency(client);
+	esp_http_client_cleanup(client);
+	mock_nightscout_stop();
+	exit_test();
+}
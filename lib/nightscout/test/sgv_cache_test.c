@@ -0,0 +1,188 @@
+// Check the SGV cache, and polling xDrip for new readings
+// against the mock server's /sgv.json.
+
+#include "testing.h"
+#include "sgv_cache.h"
+#include "mock_nightscout.h"
+
+esp_err_t http_header_callback(esp_http_client_event_t *e);
+
+static nightscout_entry_t entry(time_t t) {
+	return (nightscout_entry_t){ .tv = { t, 0 }, .sgv = 100 + t % 150 };
+}
+
+// Check that the cache holds the n readings ending at newest, in order.
+static void check_cache(const char *what, const sgv_cache_t *c, time_t newest, int n) {
+	if (c->count != n) {
+		test_failed("%s: cache has %d entries, want %d", what, c->count, n);
+		return;
+	}
+	for (int i = 0; i < n; i++) {
+		const nightscout_entry_t *e = sgv_cache_get(c, i);
+		time_t t = newest - SGV_INTERVAL * i;
+		if (e->tv.tv_sec != t) {
+			test_failed("%s: entry %d at %ld, want %ld", what, i, (long)e->tv.tv_sec, (long)t);
+			return;
+		}
+	}
+	if (sgv_cache_get(c, n) != 0) {
+		test_failed("%s: entry %d is present", what, n);
+	}
+}
+
+void test_cache(void) {
+	static sgv_cache_t c;
+	sgv_cache_init(&c);
+	if (sgv_cache_get(&c, 0) != 0) {
+		test_failed("empty cache has an entry");
+	}
+	time_t t0 = TEST_TIME_NOW;
+	// Out of order, with duplicates.
+	int order[] = { 2, 0, 4, 1, 3 };
+	for (int i = 0; i < LEN(order); i++) {
+		nightscout_entry_t e = entry(t0 + SGV_INTERVAL * order[i]);
+		if (!sgv_cache_add(&c, &e)) {
+			test_failed("entry %d was not added", order[i]);
+		}
+		if (sgv_cache_add(&c, &e)) {
+			test_failed("duplicate of entry %d was added", order[i]);
+		}
+	}
+	check_cache("out of order", &c, t0 + 4 * SGV_INTERVAL, 5);
+	// Fill the cache and overflow it.
+	for (int i = 5; i < SGV_CACHE_SIZE + 10; i++) {
+		nightscout_entry_t e = entry(t0 + SGV_INTERVAL * i);
+		sgv_cache_add(&c, &e);
+	}
+	time_t newest = t0 + SGV_INTERVAL * (SGV_CACHE_SIZE + 9);
+	check_cache("overflow", &c, newest, SGV_CACHE_SIZE);
+	nightscout_entry_t old = entry(t0);
+	if (sgv_cache_add(&c, &old)) {
+		test_failed("entry older than a full cache was added");
+	}
+	// An entry that fills a hole in a full cache drops the oldest.
+	sgv_cache_init(&c);
+	for (int i = 0; i < SGV_CACHE_SIZE + 1; i++) {
+		if (i == 10) {
+			continue;
+		}
+		nightscout_entry_t e = entry(t0 + SGV_INTERVAL * i);
+		sgv_cache_add(&c, &e);
+	}
+	nightscout_entry_t hole = entry(t0 + SGV_INTERVAL * 10);
+	if (!sgv_cache_add(&c, &hole)) {
+		test_failed("entry filling a hole was not added");
+	}
+	check_cache("hole", &c, t0 + SGV_INTERVAL * SGV_CACHE_SIZE, SGV_CACHE_SIZE);
+}
+
+static int num_new;
+static time_t last_new;
+
+static void new_entry(void *context, const nightscout_entry_t *e) {
+	int *count = context;
+	(*count)++;
+	last_new = e->tv.tv_sec;
+}
+
+static time_t newest_on_server(void) {
+	return TEST_TIME_NOW + SGV_INTERVAL * (mock_num_entries() - 1);
+}
+
+static void poll(esp_http_client_handle_t client, sgv_cache_t *c, const char *what, int want, int want_requests) {
+	num_new = 0;
+	mock_stats = (mock_nightscout_stats_t){0};
+	int n = xdrip_poll(client, c, new_entry, &num_new);
+	if (n != want || num_new != want) {
+		test_failed("%s: %d new entries (%d passed to callback), want %d", what, n, num_new, want);
+	}
+	if (mock_stats.requests != want_requests) {
+		test_failed("%s: %d requests, want %d", what, mock_stats.requests, want_requests);
+	}
+	int size = c->count < SGV_CACHE_SIZE ? mock_num_entries() : SGV_CACHE_SIZE;
+	check_cache(what, c, newest_on_server(), size);
+}
+
+void test_poll(esp_http_client_handle_t client) {
+	static sgv_cache_t c;
+	sgv_cache_init(&c);
+	mock_add_entries(100);
+	poll(client, &c, "first poll", SGV_CACHE_SIZE, 1);
+	long full = mock_stats.bytes_sent;
+	poll(client, &c, "no new reading", 0, 1);
+	long single = mock_stats.bytes_sent;
+	if (single * 10 > full) {
+		test_failed("poll with no new reading transferred %ld bytes, first poll %ld", single, full);
+	}
+	for (int i = 0; i < 3; i++) {
+		mock_add_entries(1);
+		poll(client, &c, "one new reading", 1, 1);
+		if (last_new != newest_on_server()) {
+			test_failed("new reading at %ld, want %ld", (long)last_new, (long)newest_on_server());
+		}
+	}
+	mock_add_entries(4);
+	poll(client, &c, "gap of 4 readings", 4, 2);
+	mock_add_entries(SGV_CACHE_SIZE + 20);
+	poll(client, &c, "gap longer than the cache", SGV_CACHE_SIZE, 2);
+	// An error leaves the cache unchanged.
+	mock_add_entries(1);
+	mock_options.fail_every = 1;
+	num_new = 0;
+	if (xdrip_poll(client, &c, new_entry, &num_new) != -1) {
+		test_failed("poll with error response did not fail");
+	}
+	mock_options.fail_every = 0;
+	if (sgv_cache_get(&c, 0)->tv.tv_sec == newest_on_server()) {
+		test_failed("cache updated by failed poll");
+	}
+}
+
+void test_poll_delay(void) {
+	static sgv_cache_t c;
+	sgv_cache_init(&c);
+	if (xdrip_poll_delay(&c, TEST_TIME_NOW) != XDRIP_POLL_SLOW) {
+		test_failed("delay with empty cache is not XDRIP_POLL_SLOW");
+	}
+	time_t t = TEST_TIME_NOW;
+	nightscout_entry_t e = entry(t);
+	sgv_cache_add(&c, &e);
+	struct {
+		time_t now;
+		int delay;
+	} cases[] = {
+		{ t, SGV_INTERVAL - XDRIP_POLL_LEAD },
+		{ t + 60, SGV_INTERVAL - XDRIP_POLL_LEAD - 60 },
+		{ t + SGV_INTERVAL - XDRIP_POLL_LEAD - 1, 1 },
+		{ t + SGV_INTERVAL - XDRIP_POLL_LEAD, XDRIP_POLL_FAST },
+		{ t + SGV_INTERVAL + XDRIP_POLL_WINDOW - 1, XDRIP_POLL_FAST },
+		{ t + SGV_INTERVAL + XDRIP_POLL_WINDOW, XDRIP_POLL_SLOW },
+		{ t + 3600, XDRIP_POLL_SLOW },
+		// Clock not set.
+		{ 0, SGV_INTERVAL },
+	};
+	for (int i = 0; i < LEN(cases); i++) {
+		int d = xdrip_poll_delay(&c, cases[i].now);
+		if (d != cases[i].delay) {
+			test_failed("[%d] delay %d seconds after last reading is %d, want %d",
+				    i, (int)(cases[i].now - t), d, cases[i].delay);
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	test_cache();
+	test_poll_delay();
+	int port = mock_nightscout_start();
+	char url[64];
+	sprintf(url, "http://localhost:%d", port);
+	esp_http_client_config_t config = {
+		.url = url,
+		.event_handler = http_header_callback,
+	};
+	esp_http_client_handle_t client = esp_http_client_init(&config);
+	test_poll(client);
+	esp_http_client_cleanup(client);
+	mock_nightscout_stop();
+	exit_test();
+}
@@ -0,0 +1,242 @@
+// Check incremental sync against a local server that applies
+// the find[date][$gt] and find[created_at][$gt] filters as Nightscout does.
+
+#include <inttypes.h>
+
+#include "testing.h"
+#include "nightscout.h"
+#include "http_server.h"
+
+esp_err_t http_header_callback(esp_http_client_event_t *e);
+
+#define START_TIME	1586737622L	// Mon, 13 Apr 2020 00:27:02 GMT
+#define INTERVAL	300
+
+#define MAX_ENTRIES	1000
+
+// Entries on the server, oldest first.
+static int num_entries;
+static time_t last_treatment;
+
+// Current response, and the number of body bytes sent.
+static char body[MAX_ENTRIES * 100];
+static int bytes_sent;
+
+static char last_path[512];
+static bool truncate_response;
+
+static void add_entries(int n) {
+	num_entries += n;
+}
+
+static time_t entry_time(int i) {
+	return START_TIME + INTERVAL * i;
+}
+
+static const char *query_param(const char *path, const char *name) {
+	const char *p = strstr(path, name);
+	if (!p) {
+		return 0;
+	}
+	p += strlen(name);
+	return *p == '=' ? p + 1 : 0;
+}
+
+static void entries_response(const char *path) {
+	int64_t gt = 0;
+	const char *v = query_param(path, "find%5Bdate%5D%5B%24gt%5D");
+	if (v) {
+		gt = strtoll(v, 0, 10);
+	}
+	int count = 10;
+	v = query_param(path, "count");
+	if (v) {
+		count = atoi(v);
+	}
+	char *p = body;
+	p += sprintf(p, "[");
+	int n = 0;
+	for (int i = num_entries - 1; i >= 0 && n < count; i--) {
+		int64_t ms = (int64_t)entry_time(i) * 1000;
+		if (ms <= gt) {
+			break;
+		}
+		p += sprintf(p, "%s{\"type\":\"sgv\",\"sgv\":%d,\"date\":%" PRId64 ",\"direction\":\"Flat\"}",
+			     n == 0 ? "" : ",", 100 + i % 50, ms);
+		n++;
+	}
+	sprintf(p, "]");
+}
+
+static void treatments_response(const char *path) {
+	time_t gt = 0;
+	const char *v = query_param(path, "find%5Bcreated_at%5D%5B%24gt%5D");
+	if (v) {
+		char iso[ISO_TIME_STRING_SIZE];
+		snprintf(iso, sizeof(iso), "%.24s", v);
+		gt = parse_iso_time(iso).tv_sec;
+	}
+	if (last_treatment > gt) {
+		char ts[ISO_TIME_STRING_SIZE];
+		print_iso_time(ts, (struct timeval){ .tv_sec = last_treatment });
+		sprintf(body, "[{\"eventType\":\"Correction Bolus\",\"created_at\":\"%s\",\"insulin\":1.5}]", ts);
+	} else {
+		sprintf(body, "[]");
+	}
+}
+
+static void handle(const http_request_t *req, http_response_t *resp) {
+	strcpy(last_path, req->path);
+	if (strncmp(req->path, "/api/v1/entries?", 16) == 0) {
+		entries_response(req->path);
+	} else if (strncmp(req->path, "/api/v1/treatments?", 19) == 0) {
+		treatments_response(req->path);
+	} else {
+		resp->status = 404;
+		sprintf(body, "Not Found");
+	}
+	resp->body = body;
+	resp->body_len = strlen(body);
+	if (truncate_response) {
+		resp->send_len = resp->body_len / 2;
+	}
+	bytes_sent += resp->body_len;
+}
+
+static int num_received;
+static time_t last_received;
+
+static void receive_entry(void *context, const nightscout_entry_t *e) {
+	if (num_received != 0 && e->tv.tv_sec >= last_received) {
+		test_failed("entries out of order");
+	}
+	num_received++;
+	last_received = e->tv.tv_sec;
+}
+
+void test_queries(void) {
+	char buf[MAX_QUERY_SIZE];
+	entries_since_query(buf, sizeof(buf), 1586737622000LL, SYNC_MAX_ENTRIES);
+	const char *want = "/api/v1/entries?find%5Bdate%5D%5B%24gt%5D=1586737622000&count=288";
+	if (strcmp(buf, want) != 0) {
+		test_failed("entries query %s, want %s", buf, want);
+	}
+	treatments_since_query(buf, sizeof(buf), START_TIME);
+	want = "/api/v1/treatments?find%5Bcreated_at%5D%5B%24gt%5D=2020-04-13T00:27:02.000Z&count=1";
+	if (strcmp(buf, want) != 0) {
+		test_failed("treatments query %s, want %s", buf, want);
+	}
+}
+
+static int sync_entries(esp_http_client_handle_t client, nightscout_cursor_t *c) {
+	num_received = 0;
+	int n = sync_nightscout_entries(client, c, receive_entry, 0);
+	if (n != num_received) {
+		test_failed("sync returned %d but passed %d entries to the callback", n, num_received);
+	}
+	return n;
+}
+
+void test_entries(esp_http_client_handle_t client) {
+	nightscout_cursor_t c = {0};
+	// The first sync is limited to SYNC_MAX_ENTRIES.
+	add_entries(500);
+	int n = sync_entries(client, &c);
+	if (n != SYNC_MAX_ENTRIES) {
+		test_failed("first sync returned %d entries, want %d", n, SYNC_MAX_ENTRIES);
+	}
+	int64_t want = (int64_t)entry_time(num_entries - 1) * 1000;
+	if (c.entry_ms != want) {
+		test_failed("cursor %" PRId64 " after first sync, want %" PRId64, c.entry_ms, want);
+	}
+	int full = bytes_sent;
+	// With nothing new, the response is empty.
+	bytes_sent = 0;
+	n = sync_entries(client, &c);
+	if (n != 0) {
+		test_failed("sync with no new entries returned %d", n);
+	}
+	if (c.entry_ms != want) {
+		test_failed("cursor moved without new entries");
+	}
+	if (bytes_sent != 2) {
+		test_failed("%d bytes sent with no new entries, want 2", bytes_sent);
+	}
+	// In steady state, each sync returns one new entry.
+	bytes_sent = 0;
+	const int cycles = 12;
+	for (int i = 0; i < cycles; i++) {
+		add_entries(1);
+		n = sync_entries(client, &c);
+		if (n != 1) {
+			test_failed("steady-state sync returned %d entries, want 1", n);
+		}
+		if (last_received != entry_time(num_entries - 1)) {
+			test_failed("steady-state sync returned entry at %ld, want %ld", (long)last_received, (long)entry_time(num_entries - 1));
+		}
+	}
+	int steady = bytes_sent / cycles;
+	if (steady * 50 > full) {
+		test_failed("steady-state sync transferred %d bytes, full sync %d", steady, full);
+	}
+	printf("full sync: %d bytes; steady state: %d bytes per sync\n", full, steady);
+	// An error leaves the cursor unchanged.
+	nightscout_cursor_t before = c;
+	add_entries(1);
+	truncate_response = true;
+	if (sync_nightscout_entries(client, &c, receive_entry, 0) != -1) {
+		test_failed("sync with truncated response did not fail");
+	}
+	truncate_response = false;
+	if (c.entry_ms != before.entry_ms) {
+		test_failed("cursor moved after failed sync");
+	}
+}
+
+void test_treatments(esp_http_client_handle_t client) {
+	nightscout_cursor_t c = {0};
+	if (sync_last_treatment_time(client, &c) != 0 || c.treatment != 0) {
+		test_failed("sync with no treatments returned a time");
+	}
+	last_treatment = START_TIME + 1000;
+	time_t t = sync_last_treatment_time(client, &c);
+	if (t != last_treatment || c.treatment != last_treatment) {
+		test_failed("last treatment %ld (cursor %ld), want %ld", (long)t, (long)c.treatment, (long)last_treatment);
+	}
+	// With nothing new, the response is empty and the cursor is returned.
+	bytes_sent = 0;
+	t = sync_last_treatment_time(client, &c);
+	if (t != last_treatment) {
+		test_failed("last treatment %ld with nothing new, want %ld", (long)t, (long)last_treatment);
+	}
+	if (bytes_sent != 2) {
+		test_failed("%d bytes sent with no new treatments, want 2", bytes_sent);
+	}
+	char want[MAX_QUERY_SIZE];
+	treatments_since_query(want, sizeof(want), last_treatment);
+	if (strcmp(last_path, want) != 0) {
+		test_failed("request for %s, want %s", last_path, want);
+	}
+	last_treatment += 600;
+	t = sync_last_treatment_time(client, &c);
+	if (t != last_treatment || c.treatment != last_treatment) {
+		test_failed("last treatment %ld (cursor %ld), want %ld", (long)t, (long)c.treatment, (long)last_treatment);
+	}
+}
+
+int main(int argc, char **argv) {
+	test_queries();
+	int port = http_server_start(handle);
+	char url[64];
+	sprintf(url, "http://localhost:%d", port);
+	esp_http_client_config_t config = {
+		.url = url,
+		.event_handler = http_header_callback,
+	};
+	esp_http_client_handle_t client = esp_http_client_init(&config);
+	test_treatments(client);
+	test_entries(client);
+	esp_http_client_cleanup(client);
+	http_server_stop();
+	exit_test();
+}
@@ -0,0 +1,149 @@
+// Measure the speed of the date conversions done for each entry and
+// treatment, over a day of entries (count=288), compared with the
+// gmtime, strftime, and sscanf versions they replaced.
+
+#include "testing.h"
+#include "nightscout.h"
+
+#define ITERATIONS	2000
+#define DAY_ENTRIES	288
+
+static int ref_is_leap_year(int y) {
+	return y % 4 == 0 && (y % 100 != 0 || y % 400 == 0);
+}
+
+static int ref_days_per_month(int m, int y) {
+	if (m > 6) {
+		return 30 + m % 2;
+	}
+	if (m % 2 == 0) {
+		return 31;
+	}
+	if (m == 1) {
+		return 28 + ref_is_leap_year(y);
+	}
+	return 30;
+}
+
+static time_t ref_make_gmt(struct tm *tm) {
+	int year = 1900 + tm->tm_year;
+	time_t days = 0;
+	for (int y = 1970; y < year; y++) {
+		days += 365 + ref_is_leap_year(y);
+	}
+	for (int m = 0; m < tm->tm_mon; m++) {
+		days += ref_days_per_month(m, year);
+	}
+	days += tm->tm_mday - 1;
+	return (days * 24 + tm->tm_hour) * 3600 + tm->tm_min * 60 + tm->tm_sec;
+}
+
+static void ref_print_iso_time(char *buf, struct timeval tv) {
+	struct tm *tm = gmtime(&tv.tv_sec);
+	int n = strftime(buf, ISO_TIME_STRING_SIZE, "%FT%T", tm);
+	sprintf(&buf[n], ".%03ldZ", tv.tv_usec / 1000);
+}
+
+static struct timeval ref_parse_iso_time(const char *str) {
+	struct timeval tv = { 0 };
+	struct tm tm = { 0 };
+	int ms;
+	int n = sscanf(str, "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ",
+		       &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+		       &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &ms);
+	if (n != 7) {
+		return tv;
+	}
+	tm.tm_year -= 1900;
+	tm.tm_mon--;
+	tv.tv_sec = ref_make_gmt(&tm);
+	tv.tv_usec = ms * 1000;
+	return tv;
+}
+
+static struct timeval day[DAY_ENTRIES];
+static char day_strings[DAY_ENTRIES][ISO_TIME_STRING_SIZE];
+static struct tm day_tm[DAY_ENTRIES];
+
+static void generate_day(void) {
+	time_t t = 1586736000;
+	for (int i = 0; i < DAY_ENTRIES; i++, t -= 5 * 60) {
+		day[i] = (struct timeval){ t, (i * 7919 % 1000) * 1000 };
+		ref_print_iso_time(day_strings[i], day[i]);
+		gmtime_r(&t, &day_tm[i]);
+	}
+}
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+typedef void (bench_fn_t)(int i);
+
+static volatile time_t sink;
+
+static void bench(const char *name, bench_fn_t *fn) {
+	double start = now();
+	for (int k = 0; k < ITERATIONS; k++) {
+		for (int i = 0; i < DAY_ENTRIES; i++) {
+			fn(i);
+		}
+	}
+	double elapsed = now() - start;
+	printf("%-22s %7.1f ns/call\n", name, elapsed / (ITERATIONS * DAY_ENTRIES) * 1e9);
+}
+
+static void make_gmt_new(int i) {
+	sink = make_gmt(&day_tm[i]);
+}
+
+static void make_gmt_ref(int i) {
+	sink = ref_make_gmt(&day_tm[i]);
+}
+
+static void print_new(int i) {
+	char ts[ISO_TIME_STRING_SIZE];
+	print_iso_time(ts, day[i]);
+	sink = ts[18];
+}
+
+static void print_ref(int i) {
+	char ts[ISO_TIME_STRING_SIZE];
+	ref_print_iso_time(ts, day[i]);
+	sink = ts[18];
+}
+
+static void parse_new(int i) {
+	sink = parse_iso_time(day_strings[i]).tv_sec;
+}
+
+static void parse_ref(int i) {
+	sink = ref_parse_iso_time(day_strings[i]).tv_sec;
+}
+
+// Check that both versions agree before timing them.
+static void check(void) {
+	for (int i = 0; i < DAY_ENTRIES; i++) {
+		char ts[ISO_TIME_STRING_SIZE];
+		print_iso_time(ts, day[i]);
+		assert(strcmp(ts, day_strings[i]) == 0);
+		struct timeval tv = parse_iso_time(ts);
+		struct timeval ref = ref_parse_iso_time(ts);
+		assert(tv.tv_sec == ref.tv_sec && tv.tv_usec == ref.tv_usec);
+		assert(make_gmt(&day_tm[i]) == ref_make_gmt(&day_tm[i]));
+	}
+}
+
+int main(int argc, char **argv) {
+	generate_day();
+	check();
+	bench("make_gmt", make_gmt_new);
+	bench("make_gmt (loop)", make_gmt_ref);
+	bench("print_iso_time", print_new);
+	bench("print_iso_time (libc)", print_ref);
+	bench("parse_iso_time", parse_new);
+	bench("parse_iso_time (libc)", parse_ref);
+	return 0;
+}
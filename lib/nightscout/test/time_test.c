@@ -18,6 +18,10 @@ void test_make_gmt(void) {
 	for (time_t t = 1000000000; t <= 3000000000; t += 10000000) {
 		test_time(t);
 	}
+	// Every day from 1970 through 2199, across leap days and centuries.
+	for (time_t t = 0; t < 7258118400; t += 86400) {
+		test_time(t + 12345);
+	}
 }
 
 typedef struct {
@@ -64,6 +68,11 @@ iso_time_case_t iso_time_cases[] = {
 	{ "2019-12-31T23:59:59.001Z", "2019-12-31T23:59:59.000Z" },
 	{ "2019-12-31T23:59:59.500Z", "2020-01-01T00:00:00.000Z" },
 	{ "2019-12-31T23:59:59.999Z", "2020-01-01T00:00:00.000Z" },
+	{ "1970-01-01T00:00:00.000Z", 0 },
+	{ "2000-02-29T12:00:00.250Z", 0 },
+	{ "2020-02-29T23:59:59.999Z", "2020-03-01T00:00:00.000Z" },
+	{ "2100-02-28T23:59:59.500Z", "2100-03-01T00:00:00.000Z" },
+	{ "2038-01-19T03:14:08.000Z", 0 },
 };
 #define NUM_ISO_TIME_CASES	(sizeof(iso_time_cases)/sizeof(iso_time_cases[0]))
 
@@ -84,9 +93,67 @@ void test_iso_time(void) {
 	}
 }
 
+// Compare print_iso_time and parse_iso_time with gmtime and strftime.
+void test_iso_time_range(void) {
+	char ts[ISO_TIME_STRING_SIZE];
+	char want[ISO_TIME_STRING_SIZE];
+	for (time_t t = 0; t < 7258118400; t += 86400 + 3607) {
+		struct timeval tv = { t, (t % 1000) * 1000 };
+		print_iso_time(ts, tv);
+		struct tm tm;
+		gmtime_r(&t, &tm);
+		int n = strftime(want, sizeof(want), "%FT%T", &tm);
+		sprintf(&want[n], ".%03ldZ", tv.tv_usec / 1000);
+		if (strcmp(ts, want) != 0) {
+			test_failed("print_iso_time(%ld) = %s, want %s", t, ts, want);
+		}
+		struct timeval tv2 = parse_iso_time(ts);
+		if (tv2.tv_sec != tv.tv_sec || tv2.tv_usec != tv.tv_usec) {
+			test_failed("parse_iso_time(%s) = { %ld, %ld }, want { %ld, %ld }",
+				    ts, tv2.tv_sec, tv2.tv_usec, tv.tv_sec, tv.tv_usec);
+		}
+	}
+}
+
+typedef struct {
+	char *str;
+	char *iso_str;	// expected result, or null if the string is rejected
+} parse_case_t;
+
+parse_case_t parse_cases[] = {
+	// Fields that are not fixed-width are still accepted.
+	{ "2020-4-13T00:26:40.000Z", "2020-04-13T00:26:40.000Z" },
+	{ "2020-04-13T0:26:40.700Z", "2020-04-13T00:26:40.700Z" },
+	{ "2020-04-13T00:26:40Z", 0 },
+	{ "2020-04-13T00:26:4x.000Z", 0 },
+	{ "2020-04-13", 0 },
+	{ "", 0 },
+};
+#define NUM_PARSE_CASES	(sizeof(parse_cases)/sizeof(parse_cases[0]))
+
+void test_parse_iso_time(void) {
+	char ts[ISO_TIME_STRING_SIZE];
+	for (int i = 0; i < NUM_PARSE_CASES; i++) {
+		parse_case_t *c = &parse_cases[i];
+		struct timeval tv = parse_iso_time(c->str);
+		if (!c->iso_str) {
+			if (tv.tv_sec != 0 || tv.tv_usec != 0) {
+				test_failed("[%d] parse_iso_time(%s) was accepted", i, c->str);
+			}
+			continue;
+		}
+		print_iso_time(ts, tv);
+		if (strcmp(ts, c->iso_str) != 0) {
+			test_failed("[%d] parse_iso_time(%s) = %s, want %s", i, c->str, ts, c->iso_str);
+		}
+	}
+}
+
 int main(int argc, char **argv) {
 	test_make_gmt();
 	test_timeval_from_milliseconds();
 	test_iso_time();
+	test_iso_time_range();
+	test_parse_iso_time();
 	exit_test();
 }
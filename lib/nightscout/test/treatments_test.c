@@ -0,0 +1,134 @@
+// Check batched treatment uploads against the local HTTP server.
+// A 120-byte limit leaves room for only one treatment per batch.
+
+#include <cJSON.h>
+
+#include "testing.h"
+#include "nightscout.h"
+#include "http_server.h"
+
+#define NUM_TREATMENTS	100
+
+static nightscout_treatment_t treatments[NUM_TREATMENTS];
+
+static void make_treatments(void) {
+	for (int i = 0; i < NUM_TREATMENTS; i++) {
+		nightscout_treatment_t *t = &treatments[i];
+		t->tv.tv_sec = 1586737600 + 300 * i;
+		t->type = NS_BG_CHECK + i % 5;
+		t->value = 1000 + 25 * i;
+		t->minutes = 30;
+	}
+}
+
+static int requests;
+static int received;		// number of treatments in successful requests
+static int max_request_len;
+static int fail_request;	// respond to this request (counting from 1) with an error
+
+static void handle(const http_request_t *req, http_response_t *resp) {
+	requests++;
+	if (strcmp(req->method, "POST") != 0 || strcmp(req->path, "/api/v1/treatments") != 0) {
+		test_failed("unexpected request %s %s", req->method, req->path);
+		resp->status = 404;
+		return;
+	}
+	if (req->body_len > max_request_len) {
+		max_request_len = req->body_len;
+	}
+	char *json = strndup(req->body, req->body_len);
+	cJSON *root = cJSON_Parse(json);
+	if (!cJSON_IsArray(root)) {
+		test_failed("request body %s is not a JSON array", json);
+	} else if (requests != fail_request) {
+		received += cJSON_GetArraySize(root);
+	}
+	cJSON_Delete(root);
+	free(json);
+	if (requests == fail_request) {
+		resp->status = 500;
+	}
+	resp->body = "[]";
+	resp->body_len = 2;
+}
+
+static void reset(void) {
+	requests = 0;
+	received = 0;
+	max_request_len = 0;
+	fail_request = 0;
+}
+
+void test_batches(esp_http_client_handle_t client) {
+	static const int sizes[] = { 120, 1000, 4096, 100000 };
+	for (int i = 0; i < LEN(sizes); i++) {
+		int max_bytes = sizes[i];
+		reset();
+		nightscout_upload_stats_t stats = {0};
+		int n = upload_treatments(client, treatments, NUM_TREATMENTS, max_bytes, &stats);
+		if (n != NUM_TREATMENTS || received != NUM_TREATMENTS) {
+			test_failed("%d-byte batches: uploaded %d, server received %d, want %d",
+				    max_bytes, n, received, NUM_TREATMENTS);
+		}
+		if (max_request_len > max_bytes) {
+			test_failed("%d-byte batches: request of %d bytes", max_bytes, max_request_len);
+		}
+		if (stats.requests != requests || stats.failures != 0) {
+			test_failed("%d-byte batches: stats report %d requests and %d failures, want %d and 0",
+				    max_bytes, stats.requests, stats.failures, requests);
+		}
+		if (max_bytes >= 100000 && requests != 1) {
+			test_failed("%d-byte batches: %d requests, want 1", max_bytes, requests);
+		}
+		if (max_bytes == 120 && requests != NUM_TREATMENTS) {
+			test_failed("%d-byte batches: %d requests, want %d", max_bytes, requests, NUM_TREATMENTS);
+		}
+	}
+}
+
+void test_failure(esp_http_client_handle_t client) {
+	reset();
+	fail_request = 2;
+	nightscout_upload_stats_t stats = {0};
+	int n = upload_treatments(client, treatments, NUM_TREATMENTS, 1000, &stats);
+	if (n != received || n == 0 || n >= NUM_TREATMENTS) {
+		test_failed("with one failed batch: uploaded %d, server accepted %d", n, received);
+	}
+	if (stats.failures != 1) {
+		test_failed("stats report %d failures, want 1", stats.failures);
+	}
+	// Uploading stops at the failed batch.
+	if (requests != 2) {
+		test_failed("%d requests after a failed batch, want 2", requests);
+	}
+	// Resuming from the returned index uploads the rest.
+	int rest = upload_treatments(client, &treatments[n], NUM_TREATMENTS - n, 1000, 0);
+	if (n + rest != NUM_TREATMENTS || received != NUM_TREATMENTS) {
+		test_failed("resumed upload: uploaded %d, server accepted %d, want %d",
+			    n + rest, received, NUM_TREATMENTS);
+	}
+}
+
+void test_too_small(esp_http_client_handle_t client) {
+	reset();
+	if (upload_treatments(client, treatments, 3, 50, 0) != 0 || requests != 0) {
+		test_failed("treatments larger than the batch size were uploaded");
+	}
+}
+
+int main(int argc, char **argv) {
+	make_treatments();
+	int port = http_server_start(handle);
+	char url[64];
+	sprintf(url, "http://localhost:%d", port);
+	esp_http_client_config_t config = {
+		.url = url,
+	};
+	esp_http_client_handle_t client = esp_http_client_init(&config);
+	test_batches(client);
+	test_failure(client);
+	test_too_small(client);
+	esp_http_client_cleanup(client);
+	http_server_stop();
+	exit_test();
+}
@@ -0,0 +1,257 @@
+// Check the persistent upload queue, kept in a file emulating flash,
+// against the local HTTP server, which fails requests on command.
+
+#include <cJSON.h>
+#include <unistd.h>
+
+#include "testing.h"
+#include "upload_queue.h"
+#include "http_server.h"
+#include "store_file.h"
+
+#define QUEUE_FILE	"upload_queue_test.data"
+#define QUEUE_SIZE	(16 * UPLOAD_QUEUE_SECTOR_SIZE)
+
+static int treatment_requests;
+static int status_requests;
+static int received;			// treatments in successful requests
+static char last_status[256];
+static int fail_from;			// fail requests from this one on (counting from 1), if non-zero
+
+static void handle(const http_request_t *req, http_response_t *resp) {
+	int n = treatment_requests + status_requests + 1;
+	bool fail = fail_from != 0 && n >= fail_from;
+	resp->body = "{}";
+	resp->body_len = 2;
+	if (strcmp(req->path, "/api/v1/treatments") == 0) {
+		treatment_requests++;
+		char *json = strndup(req->body, req->body_len);
+		cJSON *root = cJSON_Parse(json);
+		if (!cJSON_IsArray(root)) {
+			test_failed("treatments %s are not a JSON array", json);
+		} else if (!fail) {
+			received += cJSON_GetArraySize(root);
+		}
+		cJSON_Delete(root);
+		free(json);
+	} else if (strcmp(req->path, "/api/v1/devicestatus") == 0) {
+		status_requests++;
+		if (!fail) {
+			snprintf(last_status, sizeof(last_status), "%.*s", req->body_len, req->body);
+		}
+	} else {
+		test_failed("unexpected request %s %s", req->method, req->path);
+	}
+	if (fail) {
+		resp->status = 503;
+	}
+}
+
+static void reset_server(void) {
+	treatment_requests = 0;
+	status_requests = 0;
+	received = 0;
+	last_status[0] = 0;
+	fail_from = 0;
+}
+
+static store_flash_t flash;
+static upload_queue_t queue;
+
+static void open_queue(size_t size) {
+	if (store_file_flash(QUEUE_FILE, size, &flash) != 0 || upload_queue_open(&queue, &flash) != 0) {
+		test_failed("cannot open queue");
+		exit_test();
+	}
+}
+
+static void reopen_queue(void) {
+	size_t size = flash.size;
+	store_file_close(&flash);
+	open_queue(size);
+}
+
+static void new_queue(size_t size) {
+	if (flash.map) {
+		store_file_close(&flash);
+	}
+	unlink(QUEUE_FILE);
+	open_queue(size);
+}
+
+static void add_treatments(int n) {
+	for (int i = 0; i < n; i++) {
+		char json[128];
+		sprintf(json, "{\"eventType\":\"Correction Bolus\",\"insulin\":%d.5,\"n\":%d}", i % 10, i);
+		if (upload_queue_add(&queue, UPLOAD_TREATMENT, json) != 0) {
+			test_failed("cannot add treatment %d", i);
+		}
+	}
+}
+
+static void add_status(int n) {
+	char json[64];
+	sprintf(json, "{\"device\":\"GNARL\",\"n\":%d}", n);
+	if (upload_queue_add(&queue, UPLOAD_DEVICE_STATUS, json) != 0) {
+		test_failed("cannot add device status %d", n);
+	}
+}
+
+static void check_pending(const char *what, int want) {
+	if (queue.pending != want) {
+		test_failed("%s: %d pending, want %d", what, queue.pending, want);
+	}
+}
+
+void test_outage(esp_http_client_handle_t client) {
+	new_queue(QUEUE_SIZE);
+	reset_server();
+	add_treatments(40);
+	for (int i = 1; i <= 3; i++) {
+		add_status(i);
+	}
+	check_pending("after adding", 41);
+
+	// While the server is failing, retries are spaced out by increasing delays.
+	fail_from = 1;
+	time_t now = TEST_TIME_NOW;
+	int delay = UPLOAD_RETRY_MIN;
+	for (int i = 1; i <= 10; i++) {
+		int requests = treatment_requests + status_requests;
+		if (upload_queue_drain(&queue, client, now, 1000, 0) != -1) {
+			test_failed("drain %d did not fail", i);
+		}
+		if (treatment_requests + status_requests != requests + 1) {
+			test_failed("drain %d made %d requests, want 1", i, treatment_requests + status_requests - requests);
+		}
+		int wait = queue.retry_time - now;
+		if (wait < delay / 2 || wait > delay) {
+			test_failed("after %d failures: retry in %d seconds, want %d to %d", i, wait, delay / 2, delay);
+		}
+		requests = treatment_requests + status_requests;
+		if (upload_queue_drain(&queue, client, queue.retry_time - 1, 1000, 0) != 0 ||
+		    treatment_requests + status_requests != requests) {
+			test_failed("after %d failures: drain before retry time made a request", i);
+		}
+		now = queue.retry_time;
+		delay = delay * 2 > UPLOAD_RETRY_MAX ? UPLOAD_RETRY_MAX : delay * 2;
+	}
+	check_pending("during outage", 41);
+
+	// The pending uploads survive a restart,
+	// which also resets the retry delay.
+	reopen_queue();
+	check_pending("after reopening", 41);
+
+	// When the server comes back, the queue drains in batches.
+	reset_server();
+	nightscout_upload_stats_t stats = {0};
+	int n = upload_queue_drain(&queue, client, now, 1000, &stats);
+	if (n != 41 || received != 40) {
+		test_failed("drained %d, server received %d treatments, want 41 and 40", n, received);
+	}
+	if (treatment_requests < 2 || treatment_requests > 5 || stats.requests != treatment_requests) {
+		test_failed("%d treatment requests (%d counted), want 2 to 5", treatment_requests, stats.requests);
+	}
+	if (status_requests != 1 || strcmp(last_status, "{\"device\":\"GNARL\",\"n\":3}") != 0) {
+		test_failed("%d device status requests, last %s; want only the latest", status_requests, last_status);
+	}
+	check_pending("after draining", 0);
+	reopen_queue();
+	check_pending("after draining and reopening", 0);
+}
+
+void test_partial(esp_http_client_handle_t client) {
+	// When the second request fails, the first batch is not uploaded again.
+	new_queue(QUEUE_SIZE);
+	reset_server();
+	add_treatments(40);
+	fail_from = 2;
+	if (upload_queue_drain(&queue, client, TEST_TIME_NOW, 1000, 0) != -1) {
+		test_failed("partial drain did not fail");
+	}
+	int first = received;
+	check_pending("after partial drain", 40 - first);
+	reopen_queue();
+	check_pending("after partial drain and reopening", 40 - first);
+	reset_server();
+	if (upload_queue_drain(&queue, client, queue.retry_time, 1000, 0) != 40 - first || first + received != 40) {
+		test_failed("uploaded %d then %d treatments, want 40 in all", first, received);
+	}
+}
+
+void test_full(esp_http_client_handle_t client) {
+	// With 2 sectors, the oldest records are dropped to make room.
+	new_queue(2 * UPLOAD_QUEUE_SECTOR_SIZE);
+	reset_server();
+	add_treatments(200);
+	if (queue.dropped == 0 || queue.pending + queue.dropped != 200) {
+		test_failed("full queue: %d pending and %d dropped, want 200 in all", queue.pending, queue.dropped);
+	}
+	int pending = queue.pending;
+	reopen_queue();
+	check_pending("full queue after reopening", pending);
+	if (upload_queue_drain(&queue, client, TEST_TIME_NOW, 4096, 0) != pending || received != pending) {
+		test_failed("full queue: server received %d treatments, want %d", received, pending);
+	}
+}
+
+void test_torn(esp_http_client_handle_t client) {
+	// A payload written without its header is ignored,
+	// and the next record goes in a new sector.
+	new_queue(QUEUE_SIZE);
+	reset_server();
+	add_treatments(3);
+	size_t offset = queue.current * UPLOAD_QUEUE_SECTOR_SIZE + queue.next_offset;
+	flash.write(flash.ctx, offset + 4, "{\"torn\"", 7);
+	reopen_queue();
+	check_pending("after torn write", 3);
+	add_treatments(2);
+	reopen_queue();
+	check_pending("after torn write and more records", 5);
+	if (upload_queue_drain(&queue, client, TEST_TIME_NOW, 4096, 0) != 5 || received != 5) {
+		test_failed("after torn write: server received %d treatments, want 5", received);
+	}
+}
+
+void test_wrappers(esp_http_client_handle_t client) {
+	new_queue(QUEUE_SIZE);
+	reset_server();
+	nightscout_treatment_t t = {
+		.tv = { TEST_TIME_NOW, 0 },
+		.type = NS_MEAL_BOLUS,
+		.value = 2500,
+	};
+	nightscout_device_status_t s = {
+		.tv = { TEST_TIME_NOW, 0 },
+		.pump_status = "normal",
+	};
+	if (queue_treatment(&queue, &t) != 0 || queue_device_status(&queue, &s) != 0 ||
+	    queue_device_status(&queue, &s) != 0) {
+		test_failed("cannot queue treatment and device status");
+	}
+	check_pending("after queueing treatment and device status", 2);
+	if (upload_queue_drain(&queue, client, TEST_TIME_NOW, 4096, 0) != 2 || received != 1 || status_requests != 1) {
+		test_failed("server received %d treatments and %d device status", received, status_requests);
+	}
+}
+
+int main(int argc, char **argv) {
+	int port = http_server_start(handle);
+	char url[64];
+	sprintf(url, "http://localhost:%d", port);
+	esp_http_client_config_t config = {
+		.url = url,
+	};
+	esp_http_client_handle_t client = esp_http_client_init(&config);
+	test_outage(client);
+	test_partial(client);
+	test_full(client);
+	test_torn(client);
+	test_wrappers(client);
+	esp_http_client_cleanup(client);
+	http_server_stop();
+	store_file_close(&flash);
+	unlink(QUEUE_FILE);
+	exit_test();
+}
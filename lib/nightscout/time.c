@@ -1,41 +1,36 @@
 #include <stdio.h>
+#include <string.h>
 
 #include "nightscout.h"
 
-static int is_leap_year(int y) {
-	if (y % 4 != 0) {
-		return 0;
-	}
-	if (y % 100 != 0) {
-		return 1;
-	}
-	return y % 400 == 0;
+// Days since 1970-01-01 of the given date in the proleptic Gregorian calendar,
+// in constant time. See http://howardhinnant.github.io/date_algorithms.html
+static time_t days_from_civil(int y, int m, int d) {
+	// Count years from March, so the leap day is at the end.
+	y -= m <= 2;
+	int era = (y >= 0 ? y : y - 399) / 400;
+	int yoe = y - era * 400;				// [0, 399]
+	int doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;	// [0, 365]
+	int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;	// [0, 146096]
+	return (time_t)era * 146097 + doe - 719468;
 }
 
-static int days_per_month(int m, int y) {
-	if (m > 6) {
-		return 30 + m % 2;
-	}
-	if (m % 2 == 0) {
-		return 31;
-	}
-	if (m == 1) {
-		return 28 + is_leap_year(y);
-	}
-	return 30;
+// Inverse of days_from_civil.
+static void civil_from_days(time_t days, int *year, int *month, int *day) {
+	days += 719468;
+	int era = (days >= 0 ? days : days - 146096) / 146097;
+	int doe = days - (time_t)era * 146097;
+	int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	int mp = (5 * doy + 2) / 153;
+	*day = doy - (153 * mp + 2) / 5 + 1;
+	*month = mp < 10 ? mp + 3 : mp - 9;
+	*year = yoe + era * 400 + (*month <= 2);
 }
 
 time_t make_gmt(struct tm *tm) {
-	int year = 1900 + tm->tm_year;
-	time_t days = 0;
-	for (int y = 1970; y < year; y++) {
-		days += 365 + is_leap_year(y);
-	}
-	for (int m = 0; m < tm->tm_mon; m++) {
-		days += days_per_month(m, year);
-	}
-	days += tm->tm_mday -1;
-	return (days * 24 + tm->tm_hour) * 3600 + tm->tm_min * 60  + tm->tm_sec;
+	time_t days = days_from_civil(1900 + tm->tm_year, tm->tm_mon + 1, tm->tm_mday);
+	return (days * 24 + tm->tm_hour) * 3600 + tm->tm_min * 60 + tm->tm_sec;
 }
 
 char *nightscout_time_string(time_t t) {
@@ -63,10 +58,70 @@ time_t round_to_seconds(struct timeval tv) {
 
 // See https://developer.mozilla.org/en-US/docs/Web/JavaScript/Reference/Global_Objects/Date/toISOString
 
+static char *put_digits(char *p, int n, int width) {
+	for (int i = width - 1; i >= 0; i--) {
+		p[i] = '0' + n % 10;
+		n /= 10;
+	}
+	return p + width;
+}
+
+// Format as YYYY-MM-DDTHH:MM:SS.sssZ without gmtime or printf.
 void print_iso_time(char *buf, struct timeval tv) {
-	struct tm *tm = gmtime(&tv.tv_sec);
-	int n = strftime(buf, ISO_TIME_STRING_SIZE, "%FT%T", tm);
-	sprintf(&buf[n], ".%03ldZ", tv.tv_usec / 1000);
+	time_t days = tv.tv_sec / 86400;
+	int secs = tv.tv_sec % 86400;
+	if (secs < 0) {
+		secs += 86400;
+		days--;
+	}
+	int year, month, day;
+	civil_from_days(days, &year, &month, &day);
+	char *p = buf;
+	p = put_digits(p, year, 4);
+	*p++ = '-';
+	p = put_digits(p, month, 2);
+	*p++ = '-';
+	p = put_digits(p, day, 2);
+	*p++ = 'T';
+	p = put_digits(p, secs / 3600, 2);
+	*p++ = ':';
+	p = put_digits(p, secs / 60 % 60, 2);
+	*p++ = ':';
+	p = put_digits(p, secs % 60, 2);
+	*p++ = '.';
+	p = put_digits(p, tv.tv_usec / 1000, 3);
+	*p++ = 'Z';
+	*p = 0;
+}
+
+// Parse a field of exactly width digits, or return -1.
+static int get_digits(const char *p, int width) {
+	int n = 0;
+	for (int i = 0; i < width; i++) {
+		if (p[i] < '0' || p[i] > '9') {
+			return -1;
+		}
+		n = n * 10 + p[i] - '0';
+	}
+	return n;
+}
+
+// Parse the fixed-width form produced by print_iso_time
+// (and by JavaScript's Date.toISOString), or return false.
+static bool parse_fixed_iso_time(const char *s, struct tm *tm, int *ms) {
+	if (s[4] != '-' || s[7] != '-' || s[10] != 'T' || s[13] != ':' ||
+	    s[16] != ':' || s[19] != '.' || s[23] != 'Z') {
+		return false;
+	}
+	tm->tm_year = get_digits(s, 4);
+	tm->tm_mon = get_digits(s + 5, 2);
+	tm->tm_mday = get_digits(s + 8, 2);
+	tm->tm_hour = get_digits(s + 11, 2);
+	tm->tm_min = get_digits(s + 14, 2);
+	tm->tm_sec = get_digits(s + 17, 2);
+	*ms = get_digits(s + 20, 3);
+	return tm->tm_year >= 0 && tm->tm_mon >= 0 && tm->tm_mday >= 0 &&
+		tm->tm_hour >= 0 && tm->tm_min >= 0 && tm->tm_sec >= 0 && *ms >= 0;
 }
 
 struct timeval parse_iso_time(const char *str) {
@@ -76,11 +131,16 @@ struct timeval parse_iso_time(const char *str) {
 	}
 	struct tm tm = { 0 };
 	int ms;
-	int n = sscanf(str, "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ",
-		       &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
-		       &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &ms);
-	if (n != 7) {
-		return tv;
+	if (strnlen(str, ISO_TIME_STRING_SIZE - 1) < ISO_TIME_STRING_SIZE - 1 ||
+	    !parse_fixed_iso_time(str, &tm, &ms)) {
+		// Fall back to sscanf for fields of other widths.
+		memset(&tm, 0, sizeof(tm));
+		int n = sscanf(str, "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ",
+			       &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+			       &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &ms);
+		if (n != 7) {
+			return tv;
+		}
 	}
 	tm.tm_year -= 1900;
 	tm.tm_mon--;
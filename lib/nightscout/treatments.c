@@ -1,40 +1,49 @@
+#include <stdio.h>
+
 #define TAG		"NS"
 
 #include <esp_log.h>
 
 #include <cJSON.h>
 
+#include "json_writer.h"
 #include "nightscout.h"
+#include "upload_queue.h"
 
-time_t get_last_treatment_time(esp_http_client_handle_t client) {
-	char *json = http_get(client, "/api/v1/treatments?count=1");
+time_t query_treatment_time(esp_http_client_handle_t client, const char *endpoint) {
+	char *json = http_get(client, endpoint);
 	if (!json) {
 		ESP_LOGE(TAG, "no response");
-		return 0;
+		return -1;
 	}
 	cJSON *root = cJSON_Parse(json);
 	if (!root) {
 		ESP_LOGE(TAG, "cannot parse response \"%s\"", json);
-		return 0;
+		return -1;
 	}
-	time_t t = 0;
+	time_t t = -1;
 	if (!cJSON_IsArray(root)) {
 		ESP_LOGE(TAG, "response \"%s\" is not a JSON array", json);
 		goto done;
 	}
 	int n = cJSON_GetArraySize(root);
+	if (n == 0) {
+		t = 0;
+		goto done;
+	}
 	if (n != 1) {
 		ESP_LOGE(TAG, "response \"%s\" has length %d, expected 1", json, n);
 		goto done;
 	}
 	const cJSON *item = cJSON_GetObjectItem(cJSON_GetArrayItem(root, 0), "created_at");
-	if (!item) {
+	if (!item || !item->valuestring) {
 		ESP_LOGE(TAG, "JSON object has no created_at field");
 		goto done;
 	}
 	t = round_to_seconds(parse_iso_time(item->valuestring));
 	if (!t) {
 		ESP_LOGE(TAG, "cannot parse ISO time \"%s\"", item->valuestring);
+		t = -1;
 		goto done;
 	}
 done:
@@ -42,53 +51,110 @@ done:
 	return t;
 }
 
-static char *treatment_json(nightscout_treatment_t *t) {
-	cJSON *root = cJSON_CreateObject();
+time_t get_last_treatment_time(esp_http_client_handle_t client) {
+	time_t t = query_treatment_time(client, "/api/v1/treatments?count=1");
+	return t > 0 ? t : 0;
+}
+
+int treatment_json(const nightscout_treatment_t *t, char *buf, int size) {
+	json_writer_t w;
+	json_writer_init(&w, buf, size);
+	json_begin_object(&w, 0);
 
 	char ts[ISO_TIME_STRING_SIZE];
 	print_iso_time(ts, t->tv);
-	cJSON_AddItemToObject(root, "created_at", cJSON_CreateString(ts));
+	json_string(&w, "created_at", ts);
 
-	cJSON_AddItemToObject(root, "enteredBy",  cJSON_CreateString(NIGHTSCOUT_USER));
+	json_string(&w, "enteredBy", NIGHTSCOUT_USER);
 
+	char unknown[32];
 	const char *e;
 	switch (t->type) {
 	case NS_BG_CHECK:
 		e = "BG Check";
-		cJSON_AddItemToObject(root, "glucose", cJSON_CreateNumber(t->value));
-		cJSON_AddItemToObject(root, "units", cJSON_CreateString("mg/dl"));
+		json_number(&w, "glucose", t->value);
+		json_string(&w, "units", "mg/dl");
 		break;
 	case NS_CORRECTION_BOLUS:
 		e = "Correction Bolus";
-		cJSON_AddItemToObject(root, "insulin", cJSON_CreateNumber(t->value / 1000.0));
+		json_number(&w, "insulin", t->value / 1000.0);
 		break;
 	case NS_MEAL_BOLUS:
 		e = "Meal Bolus";
-		cJSON_AddItemToObject(root, "insulin", cJSON_CreateNumber(t->value / 1000.0));
+		json_number(&w, "insulin", t->value / 1000.0);
 		break;
 	case NS_SITE_CHANGE:
 		e = "Site Change";
 		break;
 	case NS_TEMP_BASAL:
 		e = "Temp Basal";
-		cJSON_AddItemToObject(root, "absolute", cJSON_CreateNumber(t->value / 1000.0));
-		cJSON_AddItemToObject(root, "duration", cJSON_CreateNumber(t->minutes));
+		json_number(&w, "absolute", t->value / 1000.0);
+		json_number(&w, "duration", t->minutes);
 		break;
 	default:
 		ESP_LOGE(TAG, "unknown treatment type (%d)", t->type);
-		char buf[64];
-		sprintf(buf, "unknown (%d)", t->type);
-		e = buf;
+		sprintf(unknown, "unknown (%d)", t->type);
+		e = unknown;
 		break;
 	}
-	cJSON_AddItemToObject(root, "eventType", cJSON_CreateString(e));
-	char *json = cJSON_PrintUnformatted(root);
-	cJSON_Delete(root);
-	return json;
+	json_string(&w, "eventType", e);
+	json_end_object(&w);
+	return json_writer_end(&w);
 }
 
 void upload_treatment(esp_http_client_handle_t client, nightscout_treatment_t *t) {
-	char *json = treatment_json(t);
+	char json[TREATMENT_JSON_SIZE];
+	if (treatment_json(t, json, sizeof(json)) >= sizeof(json)) {
+		ESP_LOGE(TAG, "treatment JSON is too large");
+		return;
+	}
 	nightscout_upload(client, "/api/v1/treatments", json);
-	free(json);
+}
+
+int queue_treatment(upload_queue_t *q, const nightscout_treatment_t *t) {
+	char json[TREATMENT_JSON_SIZE];
+	if (treatment_json(t, json, sizeof(json)) >= sizeof(json)) {
+		ESP_LOGE(TAG, "treatment JSON is too large");
+		return -1;
+	}
+	return upload_queue_add(q, UPLOAD_TREATMENT, json);
+}
+
+int upload_treatments(esp_http_client_handle_t client, const nightscout_treatment_t *t, int n, int max_bytes, nightscout_upload_stats_t *stats) {
+	upload_batch_t b;
+	if (upload_batch_init(&b, max_bytes) != 0) {
+		return 0;
+	}
+	// Index of the first treatment in the current batch.
+	int start = 0;
+	int i;
+	for (i = 0; i < n; i++) {
+		char json[TREATMENT_JSON_SIZE];
+		int len = treatment_json(&t[i], json, sizeof(json));
+		if (len >= sizeof(json)) {
+			ESP_LOGE(TAG, "treatment JSON is too large");
+			break;
+		}
+		if (upload_batch_add(&b, json, len) == 0) {
+			continue;
+		}
+		// The batch is full: send it and start the next one with this treatment.
+		if (b.count != 0) {
+			if (upload_batch_send(client, "/api/v1/treatments", &b, stats) != 0) {
+				i = start;
+				break;
+			}
+			start = i;
+			if (upload_batch_add(&b, json, len) == 0) {
+				continue;
+			}
+		}
+		ESP_LOGE(TAG, "%d-byte treatment does not fit in %d-byte batch", len, max_bytes);
+		break;
+	}
+	if (upload_batch_send(client, "/api/v1/treatments", &b, stats) != 0) {
+		i = start;
+	}
+	upload_batch_free(&b);
+	return i;
 }
@@ -1,4 +1,6 @@
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #define TAG		"NS"
 #define LOG_LOCAL_LEVEL	ESP_LOG_DEBUG
@@ -6,11 +8,12 @@
 
 #include "nightscout.h"
 
-void nightscout_upload(esp_http_client_handle_t client, const char *endpoint, const char *json) {
+int nightscout_upload(esp_http_client_handle_t client, const char *endpoint, const char *json) {
 	int json_len = strlen(json);
 #ifdef NIGHTSCOUT_DEBUG
 	ESP_LOGD(TAG, "*** not uploading %d bytes to %s ***", json_len, endpoint);
 	printf("%s\n", json);
+	return 0;
 #else
 	ESP_LOGD(TAG, "uploading %d bytes to %s", json_len, endpoint);
 	esp_http_client_set_url(client, endpoint);
@@ -18,10 +21,79 @@ void nightscout_upload(esp_http_client_handle_t client, const char *endpoint, co
 	// Content-Type must be set before the POST data.
 	esp_http_client_set_header(client, "content-type", "application/json");
 	esp_http_client_set_header(client, "api-secret", NIGHTSCOUT_API_SECRET);
-	esp_http_client_set_post_field(client, json, json_len);
-	esp_err_t err = esp_http_client_perform(client);
-	if (err != ESP_OK) {
-		ESP_LOGE(TAG, "upload to %s failed: %s", endpoint, esp_err_to_name(err));
+	if (http_request(client, json, json_len, 0, 0) != 0) {
+		ESP_LOGE(TAG, "upload to %s failed", endpoint);
+		return -1;
 	}
+	int status = esp_http_client_get_status_code(client);
+	if (status / 100 != 2) {
+		ESP_LOGE(TAG, "upload to %s failed: HTTP status %d", endpoint, status);
+		return -1;
+	}
+	return 0;
 #endif
 }
+
+int upload_batch_init(upload_batch_t *b, int max_bytes) {
+	*b = (upload_batch_t){
+		.buf = malloc(max_bytes + 1),
+		.max_bytes = max_bytes,
+	};
+	if (!b->buf) {
+		ESP_LOGE(TAG, "cannot allocate %d-byte upload buffer", max_bytes);
+		return -1;
+	}
+	return 0;
+}
+
+void upload_batch_free(upload_batch_t *b) {
+	free(b->buf);
+	b->buf = 0;
+}
+
+int upload_batch_add(upload_batch_t *b, const char *json, int len) {
+	// Room is needed for the separator or opening bracket,
+	// and for the closing bracket.
+	if (b->len + 1 + len + 1 > b->max_bytes) {
+		return -1;
+	}
+	b->buf[b->len++] = b->count == 0 ? '[' : ',';
+	memcpy(b->buf + b->len, json, len);
+	b->len += len;
+	b->count++;
+	return 0;
+}
+
+static int milliseconds_since(const struct timespec *start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+int upload_batch_send(esp_http_client_handle_t client, const char *endpoint, upload_batch_t *b, nightscout_upload_stats_t *stats) {
+	if (b->count == 0) {
+		return 0;
+	}
+	b->buf[b->len++] = ']';
+	b->buf[b->len] = 0;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int err = nightscout_upload(client, endpoint, b->buf);
+	int ms = milliseconds_since(&start);
+	ESP_LOGI(TAG, "uploaded batch of %d records (%d bytes) to %s in %d ms%s",
+		 b->count, b->len, endpoint, ms, err ? " [failed]" : "");
+	if (stats) {
+		stats->requests++;
+		if (err) {
+			stats->failures++;
+		}
+		stats->bytes += b->len;
+		stats->total_ms += ms;
+		if (ms > stats->max_ms) {
+			stats->max_ms = ms;
+		}
+	}
+	b->len = 0;
+	b->count = 0;
+	return err;
+}
@@ -0,0 +1,337 @@
+#include <stdlib.h>
+#include <string.h>
+
+#define TAG		"NS"
+
+#include <esp_log.h>
+
+#include "upload_queue.h"
+
+#define QUEUE_MAGIC		0x51554E47	// "GNUQ"
+
+#define RECORD_ERASED		0xFF
+#define RECORD_PENDING		0xFF
+#define RECORD_DONE		0x00
+
+// Maximum number of records uploaded in one request.
+#define MAX_BATCH_RECORDS	64
+
+typedef struct {
+	uint32_t magic;
+	uint32_t seq;
+} sector_header_t;
+
+typedef struct {
+	uint16_t len;		// of the payload
+	uint8_t kind;
+	uint8_t state;
+} record_t;
+
+_Static_assert(sizeof(sector_header_t) == 8, "unexpected sector header size");
+_Static_assert(sizeof(record_t) == 4, "unexpected record size");
+
+static const sector_header_t *header(upload_queue_t *q, int sector) {
+	return (const sector_header_t *)(q->flash.map + sector * UPLOAD_QUEUE_SECTOR_SIZE);
+}
+
+static const record_t *record_at(upload_queue_t *q, size_t offset) {
+	return (const record_t *)(q->flash.map + offset);
+}
+
+static const char *payload(upload_queue_t *q, size_t offset) {
+	return (const char *)(q->flash.map + offset + sizeof(record_t));
+}
+
+static size_t record_size(int len) {
+	return sizeof(record_t) + ((len + 3) & ~3);
+}
+
+static bool in_use(const sector_header_t *h) {
+	return h->magic == QUEUE_MAGIC && h->seq != UINT32_MAX;
+}
+
+// Sectors in use follow the current one in order of age.
+static int next_sector(upload_queue_t *q, int sector) {
+	return sector + 1 == q->num_sectors ? 0 : sector + 1;
+}
+
+// Signature of function applied to pending records.
+// If it returns a non-zero value, the iteration terminates.
+typedef int (record_fn_t)(upload_queue_t *q, size_t offset, const record_t *r, void *arg);
+
+// Apply fn to the pending records of the given kind (or all kinds if 0)
+// in a sector. Return the first non-zero result of fn, or 0.
+static int scan_sector(upload_queue_t *q, int sector, upload_kind_t kind, record_fn_t *fn, void *arg) {
+	size_t base = sector * UPLOAD_QUEUE_SECTOR_SIZE;
+	size_t off = sizeof(sector_header_t);
+	while (off + sizeof(record_t) <= UPLOAD_QUEUE_SECTOR_SIZE) {
+		const record_t *r = record_at(q, base + off);
+		if (r->kind == RECORD_ERASED) {
+			break;
+		}
+		size_t size = record_size(r->len);
+		if (off + size > UPLOAD_QUEUE_SECTOR_SIZE) {
+			break;
+		}
+		if (r->state == RECORD_PENDING && (kind == 0 || r->kind == kind)) {
+			int err = fn(q, base + off, r, arg);
+			if (err) {
+				return err;
+			}
+		}
+		off += size;
+	}
+	return 0;
+}
+
+// Apply fn to the pending records of the given kind, oldest first.
+static int scan_queue(upload_queue_t *q, upload_kind_t kind, record_fn_t *fn, void *arg) {
+	if (q->current == -1) {
+		return 0;
+	}
+	int sector = q->current;
+	for (int i = 0; i < q->num_sectors; i++) {
+		sector = next_sector(q, sector);
+		if (!in_use(header(q, sector))) {
+			continue;
+		}
+		int err = scan_sector(q, sector, kind, fn, arg);
+		if (err) {
+			return err;
+		}
+	}
+	return 0;
+}
+
+static int count_record(upload_queue_t *q, size_t offset, const record_t *r, void *arg) {
+	(*(int *)arg)++;
+	return 0;
+}
+
+static int mark_done(upload_queue_t *q, size_t offset, const record_t *r, void *arg) {
+	record_t done = *r;
+	done.state = RECORD_DONE;
+	if (q->flash.write(q->flash.ctx, offset, &done, sizeof(done)) != 0) {
+		ESP_LOGE(TAG, "cannot mark upload queue record done");
+		return -1;
+	}
+	q->pending--;
+	return 0;
+}
+
+int upload_queue_open(upload_queue_t *q, const store_flash_t *flash) {
+	memset(q, 0, sizeof(*q));
+	q->flash = *flash;
+	q->num_sectors = flash->size / UPLOAD_QUEUE_SECTOR_SIZE;
+	if (q->num_sectors < 2) {
+		return -1;
+	}
+	q->current = -1;
+	for (int i = 0; i < q->num_sectors; i++) {
+		const sector_header_t *h = header(q, i);
+		if (!in_use(h)) {
+			continue;
+		}
+		if (q->current == -1 || h->seq > q->seq) {
+			q->current = i;
+			q->seq = h->seq;
+		}
+	}
+	if (q->current == -1) {
+		return 0;
+	}
+	scan_queue(q, 0, count_record, &q->pending);
+	// Find the end of the current sector.
+	size_t base = q->current * UPLOAD_QUEUE_SECTOR_SIZE;
+	size_t off = sizeof(sector_header_t);
+	while (off + sizeof(record_t) <= UPLOAD_QUEUE_SECTOR_SIZE) {
+		const record_t *r = record_at(q, base + off);
+		if (r->kind == RECORD_ERASED) {
+			break;
+		}
+		off += record_size(r->len);
+	}
+	// If a payload was written without its header when the last session
+	// ended, the space is not erased and a new sector must be started.
+	for (size_t i = off; i < UPLOAD_QUEUE_SECTOR_SIZE; i++) {
+		if (q->flash.map[base + i] != 0xFF) {
+			off = UPLOAD_QUEUE_SECTOR_SIZE;
+			break;
+		}
+	}
+	q->next_offset = off;
+	return 0;
+}
+
+static int start_sector(upload_queue_t *q) {
+	int sector = q->current == -1 ? 0 : next_sector(q, q->current);
+	if (in_use(header(q, sector))) {
+		int n = 0;
+		scan_sector(q, sector, 0, count_record, &n);
+		if (n != 0) {
+			ESP_LOGE(TAG, "upload queue is full: dropping %d records", n);
+			q->pending -= n;
+			q->dropped += n;
+		}
+	}
+	size_t base = sector * UPLOAD_QUEUE_SECTOR_SIZE;
+	if (q->flash.erase(q->flash.ctx, base, UPLOAD_QUEUE_SECTOR_SIZE) != 0) {
+		return -1;
+	}
+	sector_header_t h = {
+		.magic = QUEUE_MAGIC,
+		.seq = q->current == -1 ? 1 : q->seq + 1,
+	};
+	if (q->flash.write(q->flash.ctx, base, &h, sizeof(h)) != 0) {
+		return -1;
+	}
+	q->current = sector;
+	q->seq = h.seq;
+	q->next_offset = sizeof(sector_header_t);
+	return 0;
+}
+
+int upload_queue_add(upload_queue_t *q, upload_kind_t kind, const char *json) {
+	int len = strlen(json);
+	if (len > UPLOAD_QUEUE_MAX_RECORD) {
+		ESP_LOGE(TAG, "%d-byte upload is too large for queue", len);
+		return -1;
+	}
+	if (kind == UPLOAD_DEVICE_STATUS) {
+		// Only the latest device status is of interest.
+		scan_queue(q, UPLOAD_DEVICE_STATUS, mark_done, 0);
+	}
+	size_t size = record_size(len);
+	if (q->current == -1 || q->next_offset + size > UPLOAD_QUEUE_SECTOR_SIZE) {
+		if (start_sector(q) != 0) {
+			return -1;
+		}
+	}
+	size_t offset = q->current * UPLOAD_QUEUE_SECTOR_SIZE + q->next_offset;
+	record_t r = {
+		.len = len,
+		.kind = kind,
+		.state = RECORD_PENDING,
+	};
+	// Write the header last, so the record is complete when it appears.
+	if (q->flash.write(q->flash.ctx, offset + sizeof(r), json, len) != 0 ||
+	    q->flash.write(q->flash.ctx, offset, &r, sizeof(r)) != 0) {
+		// Don't append to a sector that may be partially written.
+		q->next_offset = UPLOAD_QUEUE_SECTOR_SIZE;
+		return -1;
+	}
+	q->next_offset += size;
+	q->pending++;
+	return 0;
+}
+
+typedef struct {
+	esp_http_client_handle_t client;
+	nightscout_upload_stats_t *stats;
+	upload_batch_t batch;
+	size_t offsets[MAX_BATCH_RECORDS];	// of the records in the batch
+	size_t latest;				// offset of the latest device status
+	int uploaded;
+} drain_t;
+
+static int send_batch(upload_queue_t *q, drain_t *d) {
+	int n = d->batch.count;
+	if (upload_batch_send(d->client, "/api/v1/treatments", &d->batch, d->stats) != 0) {
+		return -1;
+	}
+	for (int i = 0; i < n; i++) {
+		mark_done(q, d->offsets[i], record_at(q, d->offsets[i]), 0);
+	}
+	d->uploaded += n;
+	return 0;
+}
+
+static int add_treatment(upload_queue_t *q, size_t offset, const record_t *r, void *arg) {
+	drain_t *d = arg;
+	const char *json = payload(q, offset);
+	if (d->batch.count == MAX_BATCH_RECORDS || upload_batch_add(&d->batch, json, r->len) != 0) {
+		if (d->batch.count == 0) {
+			ESP_LOGE(TAG, "%d-byte treatment does not fit in %d-byte batch", r->len, d->batch.max_bytes);
+			return mark_done(q, offset, r, 0);
+		}
+		if (send_batch(q, d) != 0) {
+			return -1;
+		}
+		return add_treatment(q, offset, r, arg);
+	}
+	d->offsets[d->batch.count - 1] = offset;
+	return 0;
+}
+
+static int find_latest(upload_queue_t *q, size_t offset, const record_t *r, void *arg) {
+	drain_t *d = arg;
+	if (d->latest) {
+		mark_done(q, d->latest, record_at(q, d->latest), 0);
+	}
+	d->latest = offset;
+	return 0;
+}
+
+static int send_device_status(upload_queue_t *q, drain_t *d) {
+	scan_queue(q, UPLOAD_DEVICE_STATUS, find_latest, d);
+	if (!d->latest) {
+		return 0;
+	}
+	const record_t *r = record_at(q, d->latest);
+	char *json = malloc(r->len + 1);
+	if (!json) {
+		return -1;
+	}
+	memcpy(json, payload(q, d->latest), r->len);
+	json[r->len] = 0;
+	int err = nightscout_upload(d->client, "/api/v1/devicestatus", json);
+	free(json);
+	if (err) {
+		return -1;
+	}
+	mark_done(q, d->latest, r, 0);
+	d->uploaded++;
+	return 0;
+}
+
+static void back_off(upload_queue_t *q, time_t now) {
+	int delay = UPLOAD_RETRY_MIN;
+	for (int i = 1; i < q->failures && delay < UPLOAD_RETRY_MAX; i++) {
+		delay *= 2;
+	}
+	if (delay > UPLOAD_RETRY_MAX) {
+		delay = UPLOAD_RETRY_MAX;
+	}
+	delay -= rand() % (delay / 2 + 1);
+	q->retry_time = now + delay;
+	ESP_LOGI(TAG, "upload failed %d times; retrying in %d seconds", q->failures, delay);
+}
+
+int upload_queue_drain(upload_queue_t *q, esp_http_client_handle_t client, time_t now, int max_bytes, nightscout_upload_stats_t *stats) {
+	if (q->pending == 0 || now < q->retry_time) {
+		return 0;
+	}
+	drain_t d = {
+		.client = client,
+		.stats = stats,
+	};
+	if (upload_batch_init(&d.batch, max_bytes) != 0) {
+		return -1;
+	}
+	int err = scan_queue(q, UPLOAD_TREATMENT, add_treatment, &d);
+	if (!err) {
+		err = send_batch(q, &d);
+	}
+	upload_batch_free(&d.batch);
+	if (!err) {
+		err = send_device_status(q, &d);
+	}
+	if (err) {
+		q->failures++;
+		back_off(q, now);
+		return -1;
+	}
+	q->failures = 0;
+	q->retry_time = 0;
+	return d.uploaded;
+}
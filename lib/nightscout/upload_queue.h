@@ -0,0 +1,67 @@
+#ifndef _UPLOAD_QUEUE_H
+#define _UPLOAD_QUEUE_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "nightscout.h"
+#include "store.h"
+
+// A persistent queue of pending uploads in flash, so that treatments
+// and device status survive network outages and restarts.
+//
+// The queue is a ring of 4K sectors, each starting with a header
+// giving its sequence number, followed by variable-length records.
+// Each record has a 4-byte header (length, kind, and state) followed by
+// its JSON payload, padded to a multiple of 4 bytes. The payload is written
+// before the header, so a record interrupted by a reset is never seen.
+// A record is marked done by clearing its state byte, which flash allows
+// without an erase. When the ring is full, the oldest sector is erased
+// and any records still pending in it are dropped.
+
+#define UPLOAD_QUEUE_SECTOR_SIZE	4096
+#define UPLOAD_QUEUE_MAX_RECORD		(UPLOAD_QUEUE_SECTOR_SIZE - 8 - 4)
+
+// Delay before retrying after failed uploads. It doubles with each
+// consecutive failure up to the maximum, and a random amount of up to half
+// is subtracted so that retries are spread out.
+#define UPLOAD_RETRY_MIN	30	// seconds
+#define UPLOAD_RETRY_MAX	(30 * 60)
+
+typedef enum {
+	UPLOAD_TREATMENT = 1,
+	UPLOAD_DEVICE_STATUS = 2,
+} upload_kind_t;
+
+typedef struct {
+	store_flash_t flash;
+	int num_sectors;
+	int current;		// sector being appended to, or -1 if the queue is empty
+	int next_offset;	// offset of the next record in the current sector
+	uint32_t seq;		// sequence number of the current sector
+	int pending;		// number of records not yet uploaded
+	int dropped;		// pending records lost when the ring was full
+	int failures;		// consecutive failed uploads
+	time_t retry_time;	// no uploads are attempted before this time
+} upload_queue_t;
+
+// Open the queue in the given flash region, recovering pending records
+// from the last session. Return 0 on success, -1 on error.
+int upload_queue_open(upload_queue_t *q, const store_flash_t *flash);
+
+// Add a JSON object to the queue. Adding a device status supersedes
+// any that are still pending, so only the latest one is uploaded.
+// Return 0 on success, -1 on error.
+int upload_queue_add(upload_queue_t *q, upload_kind_t kind, const char *json);
+
+// Upload pending records, with the treatments in batches of at most
+// max_bytes, unless a retry delay after an earlier failure has not yet
+// passed. Draining stops at the first failed upload.
+// Return the number of records uploaded, or -1 if an upload failed.
+int upload_queue_drain(upload_queue_t *q, esp_http_client_handle_t client, time_t now, int max_bytes, nightscout_upload_stats_t *stats);
+
+// Add a treatment or device status to the queue.
+int queue_treatment(upload_queue_t *q, const nightscout_treatment_t *t);
+int queue_device_status(upload_queue_t *q, const nightscout_device_status_t *s);
+
+#endif // _UPLOAD_QUEUE_H
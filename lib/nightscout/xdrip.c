@@ -13,16 +13,22 @@ esp_err_t http_header_callback(esp_http_client_event_t *e);
 #define XDRIP_HOST	XDRIP_WIFI_HOST
 #endif
 
+esp_http_client_handle_t xdrip_client;
+
 esp_http_client_handle_t xdrip_client_handle(void) {
+	if (xdrip_client) {
+		return xdrip_client;
+	}
 	static char url[256];
 	snprintf(url, sizeof(url), "http://%s:17580", XDRIP_HOST);
 	esp_http_client_config_t config = {
 		.url = url,
 		.timeout_ms = 10000,
 		.event_handler = http_header_callback,
+		.keep_alive_enable = true,
 	};
 	ESP_LOGI(TAG, "xDrip URL: %s", config.url);
-	esp_http_client_handle_t client = esp_http_client_init(&config);
-	esp_http_client_set_header(client, "api-secret", NIGHTSCOUT_API_SECRET);
-	return client;
+	xdrip_client = esp_http_client_init(&config);
+	esp_http_client_set_header(xdrip_client, "api-secret", NIGHTSCOUT_API_SECRET);
+	return xdrip_client;
 }
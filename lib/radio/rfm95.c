@@ -12,6 +12,7 @@
 #include "module.h"
 #include "rfm95.h"
 #include "spi.h"
+#include "trace.h"
 
 #define MILLISECOND	1000
 
@@ -31,7 +32,7 @@ static void set_mode(uint8_t mode) {
 		return;
 	}
 	write_register(REG_OP_MODE, FSK_OOK_MODE | MODULATION_OOK | mode);
-	ESP_LOGD(TAG, "set_mode %d -> %d", cur_mode, mode);
+	TRACE(TRACE_SET_MODE, cur_mode, mode);
 	if (cur_mode == MODE_SLEEP) {
 		usleep(100);
 	}
@@ -41,7 +42,7 @@ static void set_mode(uint8_t mode) {
 			return;
 		}
 	}
-	ESP_LOGI(TAG, "set_mode(%d) timeout in mode %d", mode, cur_mode);
+	TRACE(TRACE_SET_MODE_TIMEOUT, mode, cur_mode);
 }
 
 static inline void set_mode_sleep(void) {
@@ -179,7 +180,7 @@ static void wait_for_transmit_done(void) {
 	for (int w = 0; w < MAX_WAIT; w++) {
 		mode = read_mode();
 		if (mode == MODE_STDBY) {
-			ESP_LOGD(TAG, "transmit done; waits = %d", w);
+			TRACE(TRACE_TX_DONE, w);
 			return;
 		}
 		usleep(1*MILLISECOND);
@@ -190,7 +191,7 @@ static void wait_for_transmit_done(void) {
 }
 
 void transmit(uint8_t *buf, int count) {
-	ESP_LOGD(TAG, "transmit %d-byte packet", count);
+	TRACE(TRACE_TRANSMIT, count);
 	clear_fifo();
 	set_mode_standby();
 	// Automatically enter Transmit state on FifoLevel interrupt.
@@ -201,9 +202,8 @@ void transmit(uint8_t *buf, int count) {
 		if (avail > count) {
 			avail = count;
 		}
-		ESP_LOGD(TAG, "writing %d bytes to TX FIFO", avail);
+		TRACE(TRACE_TX_FIFO_WRITE, avail);
 		xmit(buf, avail);
-		ESP_LOGD(TAG, "after xmit: mode = %d", read_mode());
 		buf += avail;
 		count -= avail;
 		if (count == 0) {
@@ -231,7 +231,7 @@ void transmit(uint8_t *buf, int count) {
 static bool packet_seen(void) {
 	bool seen = (read_register(REG_IRQ_FLAGS_1) & SYNC_ADDRESS_MATCH) != 0;
 	if (seen) {
-		ESP_LOGD(TAG, "incoming packet seen");
+		TRACE(TRACE_RX_PACKET_SEEN);
 	}
 	return seen;
 }
@@ -249,7 +249,7 @@ int read_rssi(void) {
 typedef void wait_fn_t(int);
 
 static int rx_common(wait_fn_t wait_fn, uint8_t *buf, int count, int timeout) {
-	ESP_LOGD(TAG, "starting receive");
+	TRACE(TRACE_RX_START);
 	gpio_intr_enable(LORA_DIO2);
 	set_mode_receive();
 	if (!packet_seen()) {
@@ -257,7 +257,7 @@ static int rx_common(wait_fn_t wait_fn, uint8_t *buf, int count, int timeout) {
 		wait_fn(timeout);
 		if (!packet_seen()) {
 			set_mode_sleep();
-			ESP_LOGD(TAG, "receive timeout");
+			TRACE(TRACE_RX_TIMEOUT);
 			return 0;
 		}
 	}
@@ -269,7 +269,7 @@ static int rx_common(wait_fn_t wait_fn, uint8_t *buf, int count, int timeout) {
 			usleep(500);
 			w++;
 			if (w >= MAX_WAIT) {
-				ESP_LOGD(TAG, "max RX FIFO wait reached");
+				TRACE(TRACE_RX_FIFO_WAIT);
 				break;
 			}
 			continue;
@@ -288,7 +288,7 @@ static int rx_common(wait_fn_t wait_fn, uint8_t *buf, int count, int timeout) {
 		// Remove spurious final byte consisting of just one or two high bits.
 		uint8_t b = buf[n-1];
 		if (b == 0x80 || b == 0xC0) {
-			ESP_LOGD(TAG, "end-of-packet glitch %X with RSSI %d", b >> 6, read_rssi());
+			TRACE(TRACE_RX_GLITCH, b >> 6, read_rssi());
 			n--;
 		}
 	}
@@ -346,11 +346,11 @@ static void install_isr(void) {
 
 static void wait_until_interrupt(int timeout) {
 	install_isr();
-	ESP_LOGD(TAG, "waiting until interrupt");
+	TRACE(TRACE_RX_WAIT);
 	rx_waiting_task = xTaskGetCurrentTaskHandle();
 	xTaskNotifyWait(0, 0, 0, pdMS_TO_TICKS(timeout));
 	rx_waiting_task = 0;
-	ESP_LOGD(TAG, "finished waiting");
+	TRACE(TRACE_RX_WAIT_DONE);
 }
 
 #endif
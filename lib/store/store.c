@@ -0,0 +1,249 @@
+#include <string.h>
+
+#include "store.h"
+
+#define STORE_MAGIC		0x54534E47	// "GNST"
+
+// Record type giving an absolute time in the value field,
+// used when the gap since the last record is too long for a delta,
+// and at the start of each session in case the last record was torn.
+#define STORE_TIME		0xFE
+#define STORE_ERASED		0xFF
+
+typedef struct {
+	uint32_t magic;
+	uint32_t seq;
+	uint32_t erase_count;
+	uint32_t first_time;
+} sector_header_t;
+
+typedef struct {
+	uint8_t type;
+	uint8_t check;
+	uint16_t delta;		// seconds since the previous record
+	int32_t value;
+	int32_t duration;
+} record_t;
+
+_Static_assert(sizeof(sector_header_t) == 16, "unexpected sector header size");
+_Static_assert(sizeof(record_t) == 12, "unexpected record size");
+
+#define RECORDS_PER_SECTOR	((STORE_SECTOR_SIZE - sizeof(sector_header_t)) / sizeof(record_t))
+
+static const sector_header_t *header(store_t *s, int sector) {
+	return (const sector_header_t *)(s->flash.map + sector * STORE_SECTOR_SIZE);
+}
+
+static const record_t *records(store_t *s, int sector) {
+	return (const record_t *)(s->flash.map + sector * STORE_SECTOR_SIZE + sizeof(sector_header_t));
+}
+
+static size_t record_offset(int sector, int slot) {
+	return sector * STORE_SECTOR_SIZE + sizeof(sector_header_t) + slot * sizeof(record_t);
+}
+
+static bool in_use(const sector_header_t *h) {
+	return h->magic == STORE_MAGIC && h->seq != UINT32_MAX;
+}
+
+static uint8_t record_check(const record_t *r) {
+	const uint8_t *p = (const uint8_t *)r;
+	uint8_t sum = 0x5A;
+	for (int i = 0; i < sizeof(*r); i++) {
+		if (i != offsetof(record_t, check)) {
+			sum = (sum << 1 | sum >> 7) ^ p[i];
+		}
+	}
+	return sum;
+}
+
+static bool record_valid(const record_t *r) {
+	return r->check == record_check(r);
+}
+
+// Sectors in use follow the current one in order of age.
+static int next_sector(store_t *s, int sector) {
+	return sector + 1 == s->num_sectors ? 0 : sector + 1;
+}
+
+int store_open(store_t *s, const store_flash_t *flash) {
+	memset(s, 0, sizeof(*s));
+	s->flash = *flash;
+	s->num_sectors = flash->size / STORE_SECTOR_SIZE;
+	if (s->num_sectors > STORE_MAX_SECTORS) {
+		s->num_sectors = STORE_MAX_SECTORS;
+	}
+	if (s->num_sectors < 2) {
+		return -1;
+	}
+	s->current = -1;
+	for (int i = 0; i < s->num_sectors; i++) {
+		const sector_header_t *h = header(s, i);
+		if (!in_use(h)) {
+			continue;
+		}
+		s->first_time[i] = h->first_time;
+		if (s->current == -1 || h->seq > s->seq) {
+			s->current = i;
+			s->seq = h->seq;
+		}
+	}
+	if (s->current == -1) {
+		return 0;
+	}
+	// Find the end of the current sector and the time of its last record.
+	const record_t *r = records(s, s->current);
+	time_t t = s->first_time[s->current];
+	int n;
+	for (n = 0; n < RECORDS_PER_SECTOR && r[n].type != STORE_ERASED; n++) {
+		if (!record_valid(&r[n])) {
+			continue;
+		}
+		if (r[n].type == STORE_TIME) {
+			t = (uint32_t)r[n].value;
+		} else {
+			t += r[n].delta;
+		}
+	}
+	s->next_slot = n;
+	s->last_time = t;
+	s->need_time = true;
+	return 0;
+}
+
+static int start_sector(store_t *s, time_t t) {
+	int sector = s->current == -1 ? 0 : next_sector(s, s->current);
+	const sector_header_t *old = header(s, sector);
+	sector_header_t h = {
+		.magic = STORE_MAGIC,
+		.seq = s->current == -1 ? 1 : s->seq + 1,
+		.erase_count = (in_use(old) ? old->erase_count : 0) + 1,
+		.first_time = t,
+	};
+	s->first_time[sector] = 0;
+	if (s->flash.erase(s->flash.ctx, sector * STORE_SECTOR_SIZE, STORE_SECTOR_SIZE) != 0 ||
+	    s->flash.write(s->flash.ctx, sector * STORE_SECTOR_SIZE, &h, sizeof(h)) != 0) {
+		return -1;
+	}
+	s->current = sector;
+	s->seq = h.seq;
+	s->first_time[sector] = t;
+	s->next_slot = 0;
+	s->last_time = t;
+	s->need_time = false;
+	return 0;
+}
+
+static int write_record(store_t *s, uint8_t type, int delta, int32_t value, int32_t duration) {
+	record_t r = {
+		.type = type,
+		.delta = delta,
+		.value = value,
+		.duration = duration,
+	};
+	r.check = record_check(&r);
+	if (s->flash.write(s->flash.ctx, record_offset(s->current, s->next_slot), &r, sizeof(r)) != 0) {
+		return -1;
+	}
+	s->next_slot++;
+	return 0;
+}
+
+int store_append(store_t *s, const store_event_t *e) {
+	if (s->current != -1 && e->time < s->last_time) {
+		return -1;
+	}
+	if (s->current == -1 || s->next_slot == RECORDS_PER_SECTOR) {
+		if (start_sector(s, e->time) != 0) {
+			return -1;
+		}
+	} else if (s->need_time || e->time - s->last_time > UINT16_MAX) {
+		if (write_record(s, STORE_TIME, 0, e->time, 0) != 0) {
+			return -1;
+		}
+		s->last_time = e->time;
+		s->need_time = false;
+		if (s->next_slot == RECORDS_PER_SECTOR && start_sector(s, e->time) != 0) {
+			return -1;
+		}
+	}
+	if (write_record(s, e->type, e->time - s->last_time, e->value, e->duration) != 0) {
+		return -1;
+	}
+	s->last_time = e->time;
+	return 0;
+}
+
+// Return the oldest sector in use whose events may include the given time.
+static int find_sector(store_t *s, time_t since) {
+	int oldest = next_sector(s, s->current);
+	while (oldest != s->current && !in_use(header(s, oldest))) {
+		oldest = next_sector(s, oldest);
+	}
+	// Binary search over the sectors in order of age for the last one
+	// that starts before since. Events at since itself may end the
+	// previous sector when a sector starts at exactly that time.
+	int n = s->current - oldest;
+	if (n < 0) {
+		n += s->num_sectors;
+	}
+	int lo = 0, hi = n;
+	while (lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+		int sector = (oldest + mid) % s->num_sectors;
+		if (s->first_time[sector] < since) {
+			lo = mid;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	return (oldest + lo) % s->num_sectors;
+}
+
+int store_scan(store_t *s, time_t since, store_scan_fn_t fn, void *arg) {
+	if (s->current == -1) {
+		return 0;
+	}
+	int count = 0;
+	int sector = find_sector(s, since);
+	for (;;) {
+		const record_t *r = records(s, sector);
+		time_t t = s->first_time[sector];
+		bool time_known = true;
+		for (int i = 0; i < RECORDS_PER_SECTOR && r[i].type != STORE_ERASED; i++) {
+			if (!record_valid(&r[i])) {
+				// The time of later records is unknown
+				// until the next absolute time.
+				time_known = false;
+				continue;
+			}
+			if (r[i].type == STORE_TIME) {
+				t = (uint32_t)r[i].value;
+				time_known = true;
+				continue;
+			}
+			t += r[i].delta;
+			if (!time_known || t < since) {
+				continue;
+			}
+			store_event_t e = {
+				.time = t,
+				.type = r[i].type,
+				.value = r[i].value,
+				.duration = r[i].duration,
+			};
+			count++;
+			if (fn(&e, arg) != 0) {
+				return count;
+			}
+		}
+		if (sector == s->current) {
+			return count;
+		}
+		sector = next_sector(s, sector);
+	}
+}
+
+time_t store_last_time(store_t *s) {
+	return s->current == -1 ? 0 : s->last_time;
+}
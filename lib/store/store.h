@@ -0,0 +1,84 @@
+#ifndef _STORE_H
+#define _STORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// An append-only log of pump history and glucose events in flash.
+//
+// The log is a ring of 4K sectors, used in order so that erases are
+// spread evenly. Each sector starts with a header giving its sequence
+// number, erase count, and the time of its first event, followed by
+// fixed-size event records. Each record holds the number of seconds
+// since the previous record, so a sector is decoded from the start;
+// the header times form an index for finding where to start a scan.
+//
+// The log is read through a memory mapping of the flash, without copying.
+
+#define STORE_SECTOR_SIZE	4096
+#define STORE_MAX_SECTORS	256
+
+// Event types below STORE_GLUCOSE are pump history record types.
+#define STORE_GLUCOSE		0xF0	// value = glucose (mg/dL)
+
+typedef struct {
+	time_t time;
+	uint8_t type;
+	int32_t value;		// insulin (milliUnits) or glucose
+	int32_t duration;	// seconds
+} store_event_t;
+
+// Flash access for a store. The whole log is mapped at map;
+// writes can only clear bits, and erases set a whole range to 0xFF.
+typedef struct {
+	const uint8_t *map;
+	size_t size;
+	int (*write)(void *ctx, size_t offset, const void *buf, size_t len);
+	int (*erase)(void *ctx, size_t offset, size_t len);
+	void *ctx;
+} store_flash_t;
+
+typedef struct {
+	store_flash_t flash;
+	int num_sectors;
+	int current;		// sector being appended to, or -1 if the log is empty
+	int next_slot;		// next free record in the current sector
+	uint32_t seq;		// sequence number of the current sector
+	time_t last_time;	// time of the last event appended
+	bool need_time;		// an absolute time must precede the next event
+	// Time index: the time of the first event in each sector,
+	// or 0 if the sector is not in use.
+	uint32_t first_time[STORE_MAX_SECTORS];
+} store_t;
+
+// Open the log in the given flash region, finding where the last
+// session left off. Return 0 on success, -1 on error.
+int store_open(store_t *s, const store_flash_t *flash);
+
+// Set up access to the data partition with the given label,
+// for use by this log or another flash-backed structure.
+// Return 0 on success, -1 on error.
+int store_partition_flash(const char *label, store_flash_t *flash);
+
+// Open the log in the data partition with the given label.
+int store_open_partition(store_t *s, const char *label);
+
+// Append an event. Events must be appended in time order;
+// return -1 if the event is older than the last one or cannot be written.
+// When the log is full, the oldest sector is erased.
+int store_append(store_t *s, const store_event_t *e);
+
+// Signature of function applied to events during a scan.
+// If it returns a non-zero value, the scan terminates.
+typedef int (*store_scan_fn_t)(const store_event_t *e, void *arg);
+
+// Apply fn to the events at or after the given time, oldest first.
+// Return the number of events scanned.
+int store_scan(store_t *s, time_t since, store_scan_fn_t fn, void *arg);
+
+// Return the time of the last event, or 0 if there is none.
+time_t store_last_time(store_t *s);
+
+#endif // _STORE_H
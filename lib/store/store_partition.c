@@ -0,0 +1,58 @@
+#define TAG		"store"
+
+#include <esp_log.h>
+#include <esp_partition.h>
+
+#include "store.h"
+
+// Custom data partition subtype (see mk/partitions.csv).
+#define STORE_PARTITION_SUBTYPE	0x40
+
+static int partition_write(void *ctx, size_t offset, const void *buf, size_t len) {
+	esp_err_t err = esp_partition_write(ctx, offset, buf, len);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "esp_partition_write: %s", esp_err_to_name(err));
+		return -1;
+	}
+	return 0;
+}
+
+static int partition_erase(void *ctx, size_t offset, size_t len) {
+	esp_err_t err = esp_partition_erase_range(ctx, offset, len);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "esp_partition_erase_range: %s", esp_err_to_name(err));
+		return -1;
+	}
+	return 0;
+}
+
+int store_partition_flash(const char *label, store_flash_t *flash) {
+	const esp_partition_t *p = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, STORE_PARTITION_SUBTYPE, label);
+	if (p == 0) {
+		ESP_LOGE(TAG, "partition %s not found", label);
+		return -1;
+	}
+	const void *map;
+	esp_partition_mmap_handle_t handle;
+	esp_err_t err = esp_partition_mmap(p, 0, p->size, ESP_PARTITION_MMAP_DATA, &map, &handle);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "esp_partition_mmap: %s", esp_err_to_name(err));
+		return -1;
+	}
+	*flash = (store_flash_t){
+		.map = map,
+		.size = p->size,
+		.write = partition_write,
+		.erase = partition_erase,
+		.ctx = (void *)p,
+	};
+	return 0;
+}
+
+int store_open_partition(store_t *s, const char *label) {
+	store_flash_t flash;
+	if (store_partition_flash(label, &flash) != 0) {
+		return -1;
+	}
+	return store_open(s, &flash);
+}
@@ -0,0 +1,93 @@
+// Measure append and scan speed of the event log,
+// using a file the size of the flash partition.
+//
+// Usage: store_bench [events]
+
+#include <unistd.h>
+
+#include "testing.h"
+#include "store_file.h"
+
+#define BENCH_FILE	"store_bench.data"
+#define BENCH_SIZE	(256 * 1024)
+#define QUERIES		10000
+
+static store_t store;
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static int64_t total;
+
+static int add_value(const store_event_t *e, void *arg) {
+	total += e->value;
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	int n = argc > 1 ? atoi(argv[1]) : 200000;
+	unlink(BENCH_FILE);
+	if (store_open_file(&store, BENCH_FILE, BENCH_SIZE) != 0) {
+		exit(1);
+	}
+	// Glucose every 5 minutes with a pump event in between.
+	time_t start = TEST_TIME_NOW;
+	double t0 = now();
+	for (int i = 0; i < n; i++) {
+		store_event_t e = {
+			.time = start + i * 150,
+			.type = i % 2 == 0 ? STORE_GLUCOSE : 0x33,
+			.value = 100 + i % 50,
+		};
+		if (store_append(&store, &e) != 0) {
+			fprintf(stderr, "store_append failed\n");
+			exit(1);
+		}
+	}
+	double elapsed = now() - t0;
+	printf("append: %.0f events/sec\n", n / elapsed);
+
+	t0 = now();
+	store_close_file(&store);
+	store_open_file(&store, BENCH_FILE, BENCH_SIZE);
+	printf("open: %.1f us\n", (now() - t0) * 1e6);
+
+	t0 = now();
+	int scanned = 0;
+	for (int i = 0; i < 100; i++) {
+		scanned += store_scan(&store, 0, add_value, 0);
+	}
+	elapsed = now() - t0;
+	printf("full scan: %d events, %.0f events/sec\n", scanned / 100, scanned / elapsed);
+
+	// Queries for the last 3 hours, as for an upload or IOB calculation.
+	time_t last = store_last_time(&store);
+	t0 = now();
+	scanned = 0;
+	for (int i = 0; i < QUERIES; i++) {
+		scanned += store_scan(&store, last - 3 * 3600, add_value, 0);
+	}
+	elapsed = now() - t0;
+	printf("3-hour query: %d events, %.1f us/query\n", scanned / QUERIES, elapsed / QUERIES * 1e6);
+
+	int min = -1, max = 0;
+	for (int i = 0; i < store.num_sectors; i++) {
+		const uint32_t *header = (const uint32_t *)(store.flash.map + i * STORE_SECTOR_SIZE);
+		int erases = header[2];
+		if (min == -1 || erases < min) {
+			min = erases;
+		}
+		if (erases > max) {
+			max = erases;
+		}
+	}
+	printf("erases per sector: %d to %d\n", min, max);
+	store_close_file(&store);
+	unlink(BENCH_FILE);
+	if (total == 0) {
+		printf("no events scanned\n");
+	}
+}
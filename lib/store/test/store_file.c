@@ -0,0 +1,92 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "store_file.h"
+
+typedef struct {
+	int fd;
+	uint8_t *map;
+	size_t size;
+} store_file_t;
+
+static int file_write(void *ctx, size_t offset, const void *buf, size_t len) {
+	store_file_t *f = ctx;
+	if (offset + len > f->size) {
+		return -1;
+	}
+	uint8_t data[len];
+	const uint8_t *b = buf;
+	for (size_t i = 0; i < len; i++) {
+		data[i] = f->map[offset + i] & b[i];
+	}
+	return pwrite(f->fd, data, len, offset) == len ? 0 : -1;
+}
+
+static int file_erase(void *ctx, size_t offset, size_t len) {
+	store_file_t *f = ctx;
+	if (offset + len > f->size) {
+		return -1;
+	}
+	uint8_t *ones = malloc(len);
+	memset(ones, 0xFF, len);
+	int n = pwrite(f->fd, ones, len, offset);
+	free(ones);
+	return n == len ? 0 : -1;
+}
+
+int store_file_flash(const char *filename, size_t size, store_flash_t *flash) {
+	int fd = open(filename, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		perror(filename);
+		return -1;
+	}
+	struct stat st;
+	fstat(fd, &st);
+	store_file_t *f = malloc(sizeof(store_file_t));
+	f->fd = fd;
+	f->size = size;
+	if (st.st_size != size) {
+		if (ftruncate(fd, size) != 0) {
+			perror(filename);
+			return -1;
+		}
+		file_erase(f, 0, size);
+	}
+	f->map = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (f->map == MAP_FAILED) {
+		perror(filename);
+		return -1;
+	}
+	*flash = (store_flash_t){
+		.map = f->map,
+		.size = size,
+		.write = file_write,
+		.erase = file_erase,
+		.ctx = f,
+	};
+	return 0;
+}
+
+void store_file_close(store_flash_t *flash) {
+	store_file_t *f = flash->ctx;
+	munmap(f->map, f->size);
+	close(f->fd);
+	free(f);
+}
+
+int store_open_file(store_t *s, const char *filename, size_t size) {
+	store_flash_t flash;
+	if (store_file_flash(filename, size, &flash) != 0) {
+		return -1;
+	}
+	return store_open(s, &flash);
+}
+
+void store_close_file(store_t *s) {
+	store_file_close(&s->flash);
+}
@@ -0,0 +1,18 @@
+#ifndef _STORE_FILE_H
+#define _STORE_FILE_H
+
+#include "store.h"
+
+// Open a log kept in an ordinary file of the given size,
+// which is created and erased if it does not exist.
+// Writes emulate NOR flash: they can only clear bits.
+int store_open_file(store_t *s, const char *filename, size_t size);
+
+void store_close_file(store_t *s);
+
+// Set up flash emulation in a file as above, for other flash-backed structures.
+int store_file_flash(const char *filename, size_t size, store_flash_t *flash);
+
+void store_file_close(store_flash_t *flash);
+
+#endif // _STORE_FILE_H
@@ -0,0 +1,234 @@
+#include <unistd.h>
+
+#include "testing.h"
+#include "store_file.h"
+
+#define TEST_FILE		"store_test.data"
+#define TEST_SECTORS		8
+#define TEST_SIZE		(TEST_SECTORS * STORE_SECTOR_SIZE)
+
+// (4096 - 16-byte header) / 12-byte records
+#define RECORDS_PER_SECTOR	340
+
+static store_t store;
+
+static void open_store(void) {
+	if (store_open_file(&store, TEST_FILE, TEST_SIZE) != 0) {
+		test_failed("cannot open %s", TEST_FILE);
+		exit_test();
+	}
+}
+
+static void reopen_store(void) {
+	store_close_file(&store);
+	open_store();
+}
+
+static void start(void) {
+	unlink(TEST_FILE);
+	open_store();
+}
+
+static store_event_t event(int i) {
+	return (store_event_t){
+		.time = TEST_TIME_NOW + i * 300,
+		.type = i % 2 == 0 ? STORE_GLUCOSE : 0x01,
+		.value = 1000 + i,
+		.duration = i % 7 == 0 ? 1800 : 0,
+	};
+}
+
+static void append(int from, int to) {
+	for (int i = from; i < to; i++) {
+		store_event_t e = event(i);
+		if (store_append(&store, &e) != 0) {
+			test_failed("store_append(%d) failed", i);
+			return;
+		}
+	}
+}
+
+// Events collected by a scan.
+#define MAX_EVENTS	10000
+static store_event_t scanned[MAX_EVENTS];
+static int num_scanned;
+static int scan_limit;
+
+static int collect(const store_event_t *e, void *arg) {
+	if (num_scanned < MAX_EVENTS) {
+		scanned[num_scanned] = *e;
+	}
+	num_scanned++;
+	return num_scanned == scan_limit;
+}
+
+static void scan(time_t since) {
+	num_scanned = 0;
+	int n = store_scan(&store, since, collect, 0);
+	if (n != num_scanned) {
+		test_failed("store_scan returned %d, but scanned %d events", n, num_scanned);
+	}
+}
+
+// Check that the scan found events from..to-1.
+static void check_events(const char *name, int from, int to) {
+	if (num_scanned != to - from) {
+		test_failed("[%s] scanned %d events, want %d", name, num_scanned, to - from);
+		return;
+	}
+	for (int i = from; i < to; i++) {
+		store_event_t *e = &scanned[i - from], want = event(i);
+		if (e->time != want.time || e->type != want.type ||
+		    e->value != want.value || e->duration != want.duration) {
+			test_failed("[%s] event %d: got %ld %02X %d %d, want %ld %02X %d %d", name, i,
+				    (long)e->time, e->type, e->value, e->duration,
+				    (long)want.time, want.type, want.value, want.duration);
+			return;
+		}
+	}
+}
+
+void test_append(void) {
+	start();
+	scan(0);
+	check_events("empty", 0, 0);
+	append(0, 1000);
+	scan(0);
+	check_events("append", 0, 1000);
+	if (store_last_time(&store) != event(999).time) {
+		test_failed("store_last_time = %ld", (long)store_last_time(&store));
+	}
+	reopen_store();
+	scan(0);
+	check_events("reopen", 0, 1000);
+	append(1000, 1500);
+	reopen_store();
+	scan(0);
+	check_events("append after reopen", 0, 1500);
+}
+
+void test_since(void) {
+	start();
+	append(0, 2000);
+	for (int i = 0; i < 2000; i += 37) {
+		scan(event(i).time);
+		check_events("since", i, 2000);
+		// Times between events.
+		scan(event(i).time - 1);
+		check_events("since", i, 2000);
+	}
+	scan_limit = 10;
+	scan(event(500).time);
+	check_events("limit", 500, 510);
+	scan_limit = 0;
+}
+
+void test_wrap(void) {
+	start();
+	int n = 10 * TEST_SECTORS * RECORDS_PER_SECTOR + 123;
+	append(0, n);
+	// The current sector is partly filled, and the rest are full.
+	int kept = (TEST_SECTORS - 1) * RECORDS_PER_SECTOR + 123;
+	scan(0);
+	check_events("wrap", n - kept, n);
+	reopen_store();
+	scan(0);
+	check_events("wrap after reopen", n - kept, n);
+	// Erases are spread evenly.
+	int min = -1, max = 0;
+	for (int i = 0; i < TEST_SECTORS; i++) {
+		const uint32_t *header = (const uint32_t *)(store.flash.map + i * STORE_SECTOR_SIZE);
+		int erases = header[2];
+		if (min == -1 || erases < min) {
+			min = erases;
+		}
+		if (erases > max) {
+			max = erases;
+		}
+	}
+	if (max - min > 1) {
+		test_failed("erase counts range from %d to %d", min, max);
+	}
+}
+
+void test_gap(void) {
+	start();
+	store_event_t e = event(0);
+	store_append(&store, &e);
+	e.time += 100000;
+	store_append(&store, &e);
+	e.time += 3 * 86400;
+	store_append(&store, &e);
+	scan(0);
+	if (num_scanned != 3 || scanned[1].time != e.time - 3 * 86400 || scanned[2].time != e.time) {
+		test_failed("events with long gaps not recovered");
+	}
+}
+
+void test_order(void) {
+	start();
+	append(0, 10);
+	store_event_t e = event(5);
+	if (store_append(&store, &e) == 0) {
+		test_failed("store_append accepted an out-of-order event");
+	}
+	// Events at the same time are allowed.
+	e = event(9);
+	if (store_append(&store, &e) != 0) {
+		test_failed("store_append rejected an event at the same time");
+	}
+}
+
+void test_same_time(void) {
+	start();
+	int n = RECORDS_PER_SECTOR - 10;
+	append(0, n);
+	// Events at the same time that run into the next sector.
+	store_event_t e = event(n);
+	for (int i = 0; i < 30; i++) {
+		e.value = i;
+		store_append(&store, &e);
+	}
+	scan(e.time);
+	if (num_scanned != 30 || scanned[0].value != 0 || scanned[29].value != 29) {
+		test_failed("scanned %d events at a sector boundary, want 30", num_scanned);
+	}
+}
+
+void test_zero_time(void) {
+	start();
+	store_event_t e = { .type = STORE_GLUCOSE, .value = 100 };
+	for (int i = 0; i < 2 * RECORDS_PER_SECTOR; i++) {
+		store_append(&store, &e);
+	}
+	scan(0);
+	if (num_scanned != 2 * RECORDS_PER_SECTOR) {
+		test_failed("scanned %d events at time 0, want %d", num_scanned, 2 * RECORDS_PER_SECTOR);
+	}
+}
+
+void test_torn_write(void) {
+	start();
+	append(0, 100);
+	// Simulate a power failure after writing part of the next record.
+	uint8_t partial[] = { 0x01, 0xFF, 0x34, 0x12 };
+	int offset = 16 + 100 * 12;
+	store.flash.write(store.flash.ctx, offset, partial, sizeof(partial));
+	reopen_store();
+	append(100, 200);
+	scan(0);
+	check_events("torn write", 0, 200);
+}
+
+int main(int argc, char **argv) {
+	test_append();
+	test_since();
+	test_wrap();
+	test_gap();
+	test_order();
+	test_same_time();
+	test_zero_time();
+	test_torn_write();
+	unlink(TEST_FILE);
+	exit_test();
+}
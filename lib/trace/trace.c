@@ -0,0 +1,172 @@
+#include <stdatomic.h>
+#include <string.h>
+
+#define TAG		"trace"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "trace.h"
+
+// Number of records per core; must be a power of 2.
+#define RING_SIZE	256
+
+typedef struct {
+	atomic_uint head;	// next index to be reserved by a writer
+	uint32_t tail;		// next index to be read by trace_dump
+	trace_record_t rec[RING_SIZE];
+} ring_t;
+
+static ring_t rings[portNUM_PROCESSORS];
+
+static volatile int dropped;
+
+void trace_record(int event, int32_t a0, int32_t a1, int32_t a2, int32_t a3) {
+	int core = xPortGetCoreID();
+	ring_t *r = &rings[core];
+	// Reserving the slot is the only shared operation, so a task that
+	// is preempted (or interrupted) in the middle of writing a record
+	// never blocks another writer.
+	uint32_t i = atomic_fetch_add_explicit(&r->head, 1, memory_order_relaxed);
+	trace_record_t *p = &r->rec[i % RING_SIZE];
+	// Mark the slot as uncommitted before any of its fields change.
+	atomic_store_explicit(&p->seq, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	p->time = esp_timer_get_time();
+	p->event = event;
+	p->core = core;
+	p->arg[0] = a0;
+	p->arg[1] = a1;
+	p->arg[2] = a2;
+	p->arg[3] = a3;
+	atomic_store_explicit(&p->seq, i + 1, memory_order_release);
+}
+
+#define FORMAT(e)	[TRACE_ID(e)] = { #e, TRACE_FORMAT(e) }
+
+static const struct {
+	const char *name;
+	const char *fmt;
+} formats[MAX_TRACE_EVENT + 1] = {
+	FORMAT(TRACE_SET_MODE),
+	FORMAT(TRACE_SET_MODE_TIMEOUT),
+	FORMAT(TRACE_TRANSMIT),
+	FORMAT(TRACE_TX_FIFO_WRITE),
+	FORMAT(TRACE_TX_DONE),
+	FORMAT(TRACE_RX_START),
+	FORMAT(TRACE_RX_PACKET_SEEN),
+	FORMAT(TRACE_RX_TIMEOUT),
+	FORMAT(TRACE_RX_FIFO_WAIT),
+	FORMAT(TRACE_RX_GLITCH),
+	FORMAT(TRACE_RX_WAIT),
+	FORMAT(TRACE_RX_WAIT_DONE),
+	FORMAT(TRACE_PUMP_RETRIES),
+	FORMAT(TRACE_PUMP_NAK),
+	FORMAT(TRACE_RFSPY_COMMAND),
+	FORMAT(TRACE_RFSPY_QUEUED),
+	FORMAT(TRACE_RFSPY_RX_TIMEOUT),
+	FORMAT(TRACE_GET_PACKET),
+	FORMAT(TRACE_SEND_PACKET),
+	FORMAT(TRACE_SEND_AND_LISTEN),
+	FORMAT(TRACE_LISTEN),
+};
+
+static void print_record(FILE *f, const trace_record_t *p) {
+	fprintf(f, "%4lu.%06lu [%d] ", (unsigned long)p->time / 1000000, (unsigned long)p->time % 1000000, p->core);
+	if (p->event <= MAX_TRACE_EVENT && formats[p->event].fmt) {
+		fprintf(f, "%s: ", formats[p->event].name);
+		fprintf(f, formats[p->event].fmt, p->arg[0], p->arg[1], p->arg[2], p->arg[3]);
+	} else {
+		fprintf(f, "event %d: %d %d %d %d", p->event, (int)p->arg[0], (int)p->arg[1], (int)p->arg[2], (int)p->arg[3]);
+	}
+	fprintf(f, "\n");
+}
+
+// Return the next committed record in ring r, skipping any that
+// have been overwritten, or 0 if the ring has been drained.
+static trace_record_t *next_record(ring_t *r, trace_record_t *copy) {
+	for (;;) {
+		uint32_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+		if (r->tail == head) {
+			return 0;
+		}
+		if (head - r->tail > RING_SIZE) {
+			dropped += head - r->tail - RING_SIZE;
+			r->tail = head - RING_SIZE;
+		}
+		trace_record_t *p = &r->rec[r->tail % RING_SIZE];
+		uint32_t seq = atomic_load_explicit(&p->seq, memory_order_acquire);
+		if (seq != r->tail + 1) {
+			if (seq == 0 || seq < r->tail + 1) {
+				// Reserved but not yet committed.
+				return 0;
+			}
+			// Overwritten by a newer record.
+			dropped++;
+			r->tail++;
+			continue;
+		}
+		copy->time = p->time;
+		copy->event = p->event;
+		copy->core = p->core;
+		memcpy(copy->arg, p->arg, sizeof(copy->arg));
+		atomic_init(&copy->seq, seq);
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&p->seq, memory_order_relaxed) != r->tail + 1) {
+			// Overwritten while being copied.
+			dropped++;
+			r->tail++;
+			continue;
+		}
+		return copy;
+	}
+}
+
+int trace_dump(FILE *f) {
+	trace_record_t copy[portNUM_PROCESSORS];
+	trace_record_t *next[portNUM_PROCESSORS];
+	for (int c = 0; c < portNUM_PROCESSORS; c++) {
+		next[c] = next_record(&rings[c], &copy[c]);
+	}
+	int count = 0;
+	for (;;) {
+		// Merge the per-core rings in timestamp order.
+		int c0 = -1;
+		for (int c = 0; c < portNUM_PROCESSORS; c++) {
+			if (next[c] && (c0 == -1 || (int32_t)(next[c]->time - next[c0]->time) < 0)) {
+				c0 = c;
+			}
+		}
+		if (c0 == -1) {
+			break;
+		}
+		print_record(f, next[c0]);
+		count++;
+		rings[c0].tail++;
+		next[c0] = next_record(&rings[c0], &copy[c0]);
+	}
+	return count;
+}
+
+int trace_dropped(void) {
+	return dropped;
+}
+
+static void trace_task(void *arg) {
+	int period_ms = (intptr_t)arg;
+	int last_dropped = 0;
+	for (;;) {
+		vTaskDelay(pdMS_TO_TICKS(period_ms));
+		trace_dump(stdout);
+		if (dropped != last_dropped) {
+			ESP_LOGE(TAG, "%d trace records dropped", dropped - last_dropped);
+			last_dropped = dropped;
+		}
+	}
+}
+
+void trace_start_task(int period_ms) {
+	xTaskCreate(trace_task, "trace", 3072, (void *)(intptr_t)period_ms, tskIDLE_PRIORITY + 1, 0);
+}
@@ -0,0 +1,94 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "module.h"
+
+// Trace events are fixed-size binary records (event id, timestamp,
+// and up to 4 integer arguments) that are stored in a per-core ring
+// without any formatting.  They are printed later by trace_dump(),
+// typically from a low-priority task, so the radio task does not pay
+// for printf formatting.
+//
+// Each event is defined as its identifier, the ESP_LOG level used
+// when tracing is disabled, and the format used to print it.
+// The formats are those of the messages the events replace, so builds
+// without tracing log exactly what they did before.
+// Arguments are recorded as 32-bit integers, so formats should use %d or %X.
+
+#define TRACE_SET_MODE		 1, D, "set_mode %d -> %d"
+#define TRACE_SET_MODE_TIMEOUT	 2, I, "set_mode(%d) timeout in mode %d"
+#define TRACE_TRANSMIT		 3, D, "transmit %d-byte packet"
+#define TRACE_TX_FIFO_WRITE	 4, D, "writing %d bytes to TX FIFO"
+#define TRACE_TX_DONE		 5, D, "transmit done; waits = %d"
+#define TRACE_RX_START		 6, D, "starting receive"
+#define TRACE_RX_PACKET_SEEN	 7, D, "incoming packet seen"
+#define TRACE_RX_TIMEOUT	 8, D, "receive timeout"
+#define TRACE_RX_FIFO_WAIT	 9, D, "max RX FIFO wait reached"
+#define TRACE_RX_GLITCH		10, D, "end-of-packet glitch %X with RSSI %d"
+#define TRACE_RX_WAIT		11, D, "waiting until interrupt"
+#define TRACE_RX_WAIT_DONE	12, D, "finished waiting"
+#define TRACE_PUMP_RETRIES	13, E, "command %02X required %d tries"
+#define TRACE_PUMP_NAK		14, I, "history page %d: received fragment %d after %d NAK(s)"
+#define TRACE_RFSPY_COMMAND	15, I, "rfspy command %02X, %d-byte request"
+#define TRACE_RFSPY_QUEUED	16, D, "rfspy_command 0x%x, queue length %d"
+#define TRACE_RFSPY_RX_TIMEOUT	17, D, "RX: timeout"
+#define TRACE_GET_PACKET	18, D, "get_packet: listen_channel %d timeout_ms %d"
+#define TRACE_SEND_PACKET	19, D, "send_packet: len %d send_channel %d repeat_count %d delay_ms %d"
+#define TRACE_SEND_AND_LISTEN	20, D, "send_and_listen: len %d send_channel %d repeat_count %d delay_ms %d"
+#define TRACE_LISTEN		21, D, "send_and_listen: listen_channel %d timeout_ms %d retry_count %d"
+
+#define MAX_TRACE_EVENT		21
+
+#define TRACE_ID(...)		_TRACE_ID(__VA_ARGS__)
+#define _TRACE_ID(id, level, fmt)	id
+#define TRACE_FORMAT(...)	_TRACE_FORMAT(__VA_ARGS__)
+#define _TRACE_FORMAT(id, level, fmt)	fmt
+
+// TRACE(event, args...) records an event when TRACE_ENABLE is defined
+// (see module.h) and falls back to ESP_LOG otherwise.
+#define TRACE(...)		_TRACE(__VA_ARGS__)
+
+// TRACE_ONLY(event, args...) records an event when TRACE_ENABLE is defined
+// and does nothing otherwise. LOG_UNLESS_TRACE(level, fmt, args...) is
+// the reverse: together they let a single trace event stand in for
+// several log messages, which builds without tracing keep.
+#define TRACE_ONLY(...)		_TRACE_ONLY(__VA_ARGS__)
+
+#ifdef TRACE_ENABLE
+#define _TRACE(id, level, fmt, ...)	_TRACE4(id, ##__VA_ARGS__, 0, 0, 0, 0)
+#define _TRACE4(id, a, b, c, d, ...)	trace_record(id, (int32_t)(a), (int32_t)(b), (int32_t)(c), (int32_t)(d))
+#define _TRACE_ONLY(...)		_TRACE(__VA_ARGS__)
+#define LOG_UNLESS_TRACE(level, fmt, ...)
+#else
+#define _TRACE(id, level, fmt, ...)	ESP_LOG##level(TAG, fmt, ##__VA_ARGS__)
+#define _TRACE_ONLY(...)
+#define LOG_UNLESS_TRACE(level, fmt, ...)	ESP_LOG##level(TAG, fmt, ##__VA_ARGS__)
+#endif
+
+typedef struct {
+	atomic_uint seq;	// ring index + 1, stored last with release order
+	uint32_t time;		// microseconds since boot (low 32 bits)
+	uint16_t event;
+	uint16_t core;
+	int32_t arg[4];
+} trace_record_t;
+
+// Record an event in the current core's ring.
+// Safe to call from any task or ISR; the oldest records are overwritten.
+void trace_record(int event, int32_t a0, int32_t a1, int32_t a2, int32_t a3);
+
+// Print the records logged since the previous call, merged in time order.
+// Return the number of records printed.
+int trace_dump(FILE *f);
+
+// Return the number of records that were overwritten before being dumped.
+int trace_dropped(void);
+
+// Start a low-priority task that calls trace_dump(stdout) periodically.
+void trace_start_task(int period_ms);
+
+#endif // _TRACE_H
@@ -14,6 +14,7 @@
 #include "commands.h"
 #include "display.h"
 #include "rfm95.h"
+#include "trace.h"
 
 #define MAX_PARAM_LEN (16)
 #define MAX_PACKET_LEN (107)
@@ -174,7 +175,7 @@ static void rx_common(int n, int rssi)
 {
 	if (n == 0)
 	{
-		ESP_LOGD(TAG, "RX: timeout");
+		TRACE(TRACE_RFSPY_RX_TIMEOUT);
 		send_code(RESPONSE_CODE_RX_TIMEOUT);
 		set_pump_disconnected();
 		return;
@@ -216,8 +217,7 @@ static void get_packet(const uint8_t *buf, int len)
 {
 	get_packet_cmd_t *p = (get_packet_cmd_t *)buf;
 	reverse_four_bytes(&p->timeout_ms);
-	ESP_LOGD(TAG, "get_packet: listen_channel %d timeout_ms %lu",
-			 p->listen_channel, p->timeout_ms);
+	TRACE(TRACE_GET_PACKET, p->listen_channel, (int)p->timeout_ms);
 	in_get_packet = 1;
 	int n = receive(rx_buf.packet, sizeof(rx_buf.packet), p->timeout_ms);
 	rx_common(n, read_rssi());
@@ -228,8 +228,7 @@ static void send_packet(const uint8_t *buf, int len)
 {
 	send_packet_cmd_t *p = (send_packet_cmd_t *)buf;
 	reverse_two_bytes(&p->delay_ms);
-	ESP_LOGD(TAG, "send_packet: len %d send_channel %d repeat_count %d delay_ms %d",
-			 len, p->send_channel, p->repeat_count, p->delay_ms);
+	TRACE(TRACE_SEND_PACKET, len, p->send_channel, p->repeat_count, p->delay_ms);
 	len -= (p->packet - (uint8_t *)p);
 	send(p->packet, len, p->repeat_count, p->delay_ms);
 	send_code(RESPONSE_CODE_SUCCESS);
@@ -241,10 +240,8 @@ static void send_and_listen(const uint8_t *buf, int len)
 	reverse_two_bytes(&p->delay_ms);
 	reverse_four_bytes(&p->timeout_ms);
 	reverse_two_bytes(&p->preamble_ms);
-	ESP_LOGD(TAG, "send_and_listen: len %d send_channel %d repeat_count %d delay_ms %d",
-			 len, p->send_channel, p->repeat_count, p->delay_ms);
-	ESP_LOGD(TAG, "send_and_listen: listen_channel %d timeout_ms %lu retry_count %d",
-			 p->listen_channel, p->timeout_ms, p->retry_count);
+	TRACE(TRACE_SEND_AND_LISTEN, len, p->send_channel, p->repeat_count, p->delay_ms);
+	TRACE(TRACE_LISTEN, p->listen_channel, (int)p->timeout_ms, p->retry_count);
 	len -= (p->packet - (uint8_t *)p);
 
 	int n = 0;
@@ -423,7 +420,7 @@ void rfspy_command(const uint8_t *buf, int count, int rssi)
 		statistics.rx_fifo_overflow += 1;
 		return;
 	}
-	ESP_LOGD(TAG, "rfspy_command 0x%x, queue length %d", cmd, uxQueueMessagesWaiting(request_queue));
+	TRACE(TRACE_RFSPY_QUEUED, cmd, uxQueueMessagesWaiting(request_queue));
 }
 
 static void gnarl_loop(void *unused)
@@ -433,51 +430,52 @@ static void gnarl_loop(void *unused)
 	{
 		rfspy_request_t req;
 		xQueueReceive(request_queue, &req, portMAX_DELAY);
+		TRACE_ONLY(TRACE_RFSPY_COMMAND, req.command, req.length);
 
 		switch (req.command)
 		{
 		case CmdGetState:
-			ESP_LOGI(TAG, "CmdGetState");
+			LOG_UNLESS_TRACE(I, "CmdGetState");
 			send_bytes((const uint8_t *)STATE_OK, strlen(STATE_OK));
 			break;
 		case CmdGetVersion:
-			ESP_LOGI(TAG, "CmdGetVersion");
+			LOG_UNLESS_TRACE(I, "CmdGetVersion");
 			send_bytes((const uint8_t *)SUBG_RFSPY_VERSION, strlen(SUBG_RFSPY_VERSION));
 			break;
 		case CmdGetPacket:
-			ESP_LOGI(TAG, "CmdGetPacket");
+			LOG_UNLESS_TRACE(I, "CmdGetPacket");
 			get_packet(req.data, req.length);
 			break;
 		case CmdSendPacket:
-			ESP_LOGI(TAG, "CmdSendPacket");
+			LOG_UNLESS_TRACE(I, "CmdSendPacket");
 			send_packet(req.data, req.length);
 			break;
 		case CmdSendAndListen:
-			ESP_LOGI(TAG, "CmdSendAndListen");
+			LOG_UNLESS_TRACE(I, "CmdSendAndListen");
 			send_and_listen(req.data, req.length);
 			break;
 		case CmdUpdateRegister:
-			ESP_LOGI(TAG, "CmdUpdateRegister");
+			LOG_UNLESS_TRACE(I, "CmdUpdateRegister");
 			update_register(req.data, req.length);
 			break;
 		case CmdLED:
-			ESP_LOGI(TAG, "CmdLED");
+			LOG_UNLESS_TRACE(I, "CmdLED");
 			led_mode(req.data, req.length);
 			break;
 		case CmdReadRegister:
-			ESP_LOGI(TAG, "CmdReadRegister");
+			LOG_UNLESS_TRACE(I, "CmdReadRegister");
 			read_register(req.data, req.length);
 			break;
 		case CmdSetSWEncoding:
-			ESP_LOGI(TAG, "CmdSetSWEncoding");
+			LOG_UNLESS_TRACE(I, "CmdSetSWEncoding");
 			set_sw_encoding(req.data, req.length);
 			break;
 		case CmdResetRadioConfig:
-			ESP_LOGI(TAG, "CmdResetRadioConfig");
+			LOG_UNLESS_TRACE(I, "CmdResetRadioConfig");
 			send_code(RESPONSE_CODE_SUCCESS);
 			break;
 		case CmdGetStatistics:
-			ESP_LOGI(TAG, "CmdGetStatistics");
+			LOG_UNLESS_TRACE(I, "CmdGetStatistics");
 			send_stats();
 			break;
 		default:
@@ -8,6 +8,7 @@
 #include "gnarl.h"
 #include "rfm95.h"
 #include "spi.h"
+#include "trace.h"
 #include "esp_wifi.h"
 
 /**
@@ -21,6 +22,8 @@
  * //(CONFIG_FREERTOS_IDLE_TIME_BEFORE_SLEEP 2
  */
 
+#define TRACE_DUMP_INTERVAL 1000 // milliseconds
+
 void app_main(void)
 {
 	esp_pm_config_t pm_config = {
@@ -43,4 +46,7 @@ void app_main(void)
 	adc_init();
 	display_init();
 	gnarl_init();
+#ifdef TRACE_ENABLE
+	trace_start_task(TRACE_DUMP_INTERVAL);
+#endif
 }
@@ -11,15 +11,18 @@
 int model;
 int rssi;
 
+uint8_t pump_arena[PUMP_SESSION_ARENA_SIZE];
+pump_session_t pump;
+
 int try_frequency(uint32_t frequency) {
 	set_frequency(frequency);
 	printf("frequency set to %lu Hz\n", read_frequency());
 	printf("waking pump %s\n", PUMP_ID);
-	if (model == 0 && !pump_wakeup()) {
+	if (model == 0 && !pump_wakeup(&pump)) {
 		printf("wakeup failed\n");
 		return -128;
 	}
-	model = pump_get_model();
+	model = pump_get_model(&pump);
 	printf("model %d\n", model);
 	rssi = read_rssi();
 	printf("rssi %d\n", rssi);
@@ -57,7 +60,7 @@ void app_main(void) {
 	oled_init();
 	splash();
 	usleep(2 * SECONDS);
-	pump_set_id(PUMP_ID);
+	pump_session_init(&pump, PUMP_ID, pump_arena, sizeof(pump_arena));
 
 	oled_clear();
 	oled_font_medium();
@@ -1,3 +1,4 @@
+#include <string.h>
 #include <time.h>
 
 #include "network.h"
@@ -9,15 +10,23 @@ void app_main(void) {
 	printf("IP address: %s\n", ip_address());
 	setenv("TZ", TZ, 1);
 	tzset();
+	nightscout_cursor_t cursor = {0};
+	nightscout_cursor_load(&cursor);
+	nightscout_cursor_t prev = cursor;
 	esp_http_client_handle_t ns = nightscout_client_handle();
-	char *response = http_get(ns, "/api/v1/entries");
+	int n = sync_nightscout_entries(ns, &cursor, print_nightscout_entry, 0);
+	if (n >= 0) {
+		printf("%d new entries\n", n);
+	}
 	if (http_server_time) {
 		printf("%s  server time\n", nightscout_time_string(http_server_time));
 	}
-	process_nightscout_entries(response, print_nightscout_entry);
-	time_t last = get_last_treatment_time(ns);
+	time_t last = sync_last_treatment_time(ns, &cursor);
 	if (last) {
 		printf("%s  last treatment\n", nightscout_time_string(last));
 	}
+	if (memcmp(&cursor, &prev, sizeof(cursor)) != 0) {
+		nightscout_cursor_save(&cursor);
+	}
 	nightscout_client_close(ns);
 }
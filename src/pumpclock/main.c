@@ -11,13 +11,16 @@
 
 time_t pump_time;
 
+uint8_t pump_arena[PUMP_SESSION_ARENA_SIZE];
+pump_session_t pump;
+
 void get_time(void) {
 	printf("waking pump %s\n", PUMP_ID);
-	if (!pump_wakeup()) {
+	if (!pump_wakeup(&pump)) {
 		printf("pump_wakeup() failed\n");
 		return;
 	}
-	pump_time = pump_get_clock();
+	pump_time = pump_get_clock(&pump);
 	if (pump_time == -1) {
 		printf("pump_get_clock() failed\n");
 		return;
@@ -55,7 +58,7 @@ void splash(void) {
 void app_main(void) {
 	oled_init();
 	splash();
-	pump_set_id(PUMP_ID);
+	pump_session_init(&pump, PUMP_ID, pump_arena, sizeof(pump_arena));
 	rfm95_init();
 	set_frequency(PUMP_FREQUENCY);
 	printf("frequency set to %lu Hz\n", read_frequency());
@@ -13,20 +13,30 @@ int reservoir_level;
 int battery_level;
 int model;
 
+uint8_t pump_arena[PUMP_SESSION_ARENA_SIZE];
+pump_session_t pump;
+
 void get_pump_info(void) {
 	printf("waking pump %s\n", PUMP_ID);
-	if (!pump_wakeup()) {
+	if (!pump_wakeup(&pump)) {
 		printf("wakeup failed\n");
 		model = -1;
 		return;
 	}
-	model = pump_get_model();
+	pump_snapshot_t snap;
+	if (pump_get_snapshot(&pump, SNAPSHOT_BATTERY | SNAPSHOT_RESERVOIR | SNAPSHOT_TEMP_BASAL, &snap) != 0) {
+		printf("unable to read pump status\n");
+	}
+	// The snapshot reads the model if neither the wakeup nor
+	// the state saved before deep sleep supplied it.
+	model = pump_cached_model(&pump);
+	battery_level = snap.battery;
+	reservoir_level = snap.reservoir;
+	basal_rate = snap.temp_basal;
+	basal_minutes = snap.temp_basal_minutes;
 	printf("model %d\n", model);
-	battery_level = pump_get_battery();
 	printf("battery %d\n", battery_level);
-	reservoir_level = pump_get_reservoir();
 	printf("reservoir %d\n", reservoir_level);
-	basal_rate = pump_get_temp_basal(&basal_minutes);
 	printf("temp basal %d for %d min\n", basal_rate, basal_minutes);
 }
 
@@ -69,7 +79,7 @@ void splash(void) {
 void app_main(void) {
 	oled_init();
 	splash();
-	pump_set_id(PUMP_ID);
+	pump_session_init(&pump, PUMP_ID, pump_arena, sizeof(pump_arena));
 	rfm95_init();
 	set_frequency(PUMP_FREQUENCY);
 	printf("frequency set to %lu Hz\n", read_frequency());
@@ -1,17 +1,24 @@
 #include <time.h>
+#include <unistd.h>
 
 #include "network.h"
 #include "nightscout.h"
+#include "sgv_cache.h"
 #include "timezone_config.h"
 
+static sgv_cache_t cache;
+
 void app_main(void) {
 	ESP_ERROR_CHECK(network_init());
 	printf("IP address: %s\n", ip_address());
 	setenv("TZ", TZ, 1);
 	tzset();
-	char *response = http_get(xdrip_client_handle(), "/sgv.json");
-	if (http_server_time) {
-		printf("%s  server time\n", nightscout_time_string(http_server_time));
+	esp_http_client_handle_t xdrip = xdrip_client_handle();
+	sgv_cache_init(&cache);
+	for (;;) {
+		xdrip_poll(xdrip, &cache, print_nightscout_entry, 0);
+		// Prefer the phone's clock, which the readings are timed by.
+		time_t now = http_server_time ? http_server_time : time(0);
+		sleep(xdrip_poll_delay(&cache, now));
 	}
-	process_nightscout_entries(response, print_nightscout_entry);
 }
@@ -0,0 +1,8 @@
+#ifndef _ESP_ATTR_H
+#define _ESP_ATTR_H
+
+// Dummy header file for compiling test programs.
+
+#define RTC_DATA_ATTR
+
+#endif // _ESP_ATTR_H
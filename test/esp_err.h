@@ -0,0 +1,13 @@
+#ifndef _ESP_ERR_H
+#define _ESP_ERR_H
+
+// Dummy header file for compiling test programs.
+
+typedef int esp_err_t;
+
+#define ESP_OK		0
+#define ESP_FAIL	-1
+
+const char *esp_err_to_name(esp_err_t err);
+
+#endif // _ESP_ERR_H
@@ -1,8 +1,66 @@
 #ifndef _ESP_HTTP_CLIENT_H
 #define _ESP_HTTP_CLIENT_H
 
-// Dummy header file for compiling test programs.
+// Header file for compiling test programs.
+// The subset of the ESP-IDF HTTP client used by lib/nightscout
+// is implemented over plain TCP sockets in lib/nightscout/test/http_client.c.
 
-typedef void *esp_http_client_handle_t;
+#include <stdbool.h>
+
+#include "esp_err.h"
+
+typedef struct esp_http_client *esp_http_client_handle_t;
+
+typedef enum {
+	HTTP_METHOD_GET,
+	HTTP_METHOD_POST,
+} esp_http_client_method_t;
+
+typedef enum {
+	HTTP_EVENT_ERROR,
+	HTTP_EVENT_ON_CONNECTED,
+	HTTP_EVENT_HEADER_SENT,
+	HTTP_EVENT_ON_HEADER,
+	HTTP_EVENT_ON_DATA,
+	HTTP_EVENT_ON_FINISH,
+	HTTP_EVENT_DISCONNECTED,
+} esp_http_client_event_id_t;
+
+typedef struct {
+	esp_http_client_event_id_t event_id;
+	esp_http_client_handle_t client;
+	void *data;
+	int data_len;
+	void *user_data;
+	char *header_key;
+	char *header_value;
+} esp_http_client_event_t;
+
+typedef esp_err_t (*http_event_handle_cb)(esp_http_client_event_t *e);
+
+typedef struct {
+	const char *url;
+	const char *cert_pem;	// ignored
+	int timeout_ms;
+	http_event_handle_cb event_handler;
+	void *user_data;
+	bool keep_alive_enable;
+} esp_http_client_config_t;
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config);
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char *url);
+esp_err_t esp_http_client_set_method(esp_http_client_handle_t client, esp_http_client_method_t method);
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value);
+esp_err_t esp_http_client_set_post_field(esp_http_client_handle_t client, const char *data, int len);
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len);
+int esp_http_client_write(esp_http_client_handle_t client, const char *buf, int len);
+int esp_http_client_fetch_headers(esp_http_client_handle_t client);
+bool esp_http_client_is_chunked_response(esp_http_client_handle_t client);
+int esp_http_client_get_status_code(esp_http_client_handle_t client);
+int esp_http_client_read(esp_http_client_handle_t client, char *buf, int len);
+bool esp_http_client_is_complete_data_received(esp_http_client_handle_t client);
+esp_err_t esp_http_client_perform(esp_http_client_handle_t client);
+esp_err_t esp_http_client_close(esp_http_client_handle_t client);
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client);
 
 #endif // _ESP_HTTP_CLIENT_H
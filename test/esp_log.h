@@ -10,5 +10,6 @@
 
 // Avoid compiler complaints about unused variables by leaving them in (unreachable) code.
 #define ESP_LOGI(tag, fmt, ...)	if (true) {} else fprintf(stderr, fmt "\n", ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...)	if (true) {} else fprintf(stderr, fmt "\n", ##__VA_ARGS__)
 
 #endif // _ESP_LOG_H